@@ -99,6 +99,18 @@ def load_predictor(config_path: Path) -> Tuple[TIGERPredictor, dict, dict]:
     return predictor, tiger_config, config
 
 
+@st.cache_resource(show_spinner=False)
+def load_offtarget_searcher(binary_path: Path, reference_path: Path, threads: Optional[int]) -> OffTargetSearcher:
+    """Keep one resident `offtarget_search serve` per reference across reruns."""
+    return OffTargetSearcher(
+        binary_path=binary_path,
+        reference_path=reference_path,
+        logger=None,
+        threads=threads,
+        persistent=True,
+    )
+
+
 def _read_fasta_payload(upload, pasted_text: str, use_sample: bool) -> Tuple[Optional[bytes], Optional[str]]:
     if use_sample and SAMPLE_FASTA.exists():
         return SAMPLE_FASTA.read_bytes(), SAMPLE_FASTA.name
@@ -503,11 +515,10 @@ if isinstance(guides_df_cached, pd.DataFrame) and not guides_df_cached.empty:
                             st.error(f"Off-target binary not found: {binary_path}")
                         else:
                             try:
-                                searcher = OffTargetSearcher(
-                                    binary_path=binary_path,
-                                    reference_path=reference_path,
-                                    logger=None,
-                                    threads=compute_cfg.get("threads"),
+                                searcher = load_offtarget_searcher(
+                                    binary_path,
+                                    reference_path,
+                                    compute_cfg.get("threads"),
                                 )
                             except FileNotFoundError as exc:
                                 st.error(str(exc))
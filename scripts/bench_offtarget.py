@@ -0,0 +1,326 @@
+#!/usr/bin/env python3
+"""
+Benchmark the off-target search engines and write the results as JSON.
+
+Each dataset (synthetic transcriptomes at several sizes, plus the bundled
+resources/reference/sample_reference.fa) is loaded once per configuration
+into `offtarget_search serve`, and the guides are searched --reps times.
+The timings come from the search milliseconds that serve reports, so they
+leave out the reference load (reported separately as load_ms).
+
+Configurations:
+  - every engine (packed, byte, index) with every SIMD kernel family the
+    CPU supports (TIGER_OFFTARGET_SIMD), at the highest thread count
+  - a thread-scaling curve for the packed engine with the best kernel on
+    the largest dataset
+
+Per run the JSON reports:
+  guides_per_sec     guides searched per second
+  positions_per_sec  guide x reference-position comparisons per second
+  scan_gb_per_sec    reference bytes read by the kernels per second: every
+                     group of GROUP_SIZE guides reads the whole reference
+                     (bases / 2 bytes of packed planes, one byte per base
+                     for the byte engine); null for the index engine,
+                     which only verifies seed hits
+
+Usage:
+    make bench                                   # writes bench/results.json
+    python3 scripts/bench_offtarget.py --sizes small --reps 5 --output bench.json
+    python3 scripts/bench_offtarget.py --engines packed --threads 1,2,4,8
+"""
+
+import argparse
+import json
+import os
+import platform
+import random
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+from datetime import datetime, timezone
+from pathlib import Path
+
+ROOT_DIR = Path(__file__).parent.parent
+SAMPLE_REFERENCE = ROOT_DIR / 'resources' / 'reference' / 'sample_reference.fa'
+
+ENGINES = ('packed', 'byte', 'index')
+SIMD_LEVELS = ('scalar', 'vec128', 'avx2', 'avx512')
+GROUP_SIZE = 4  # guides per kernel pass (GROUP_SIZE in search.c)
+GUIDE_LENGTH = 23
+
+# name -> (transcripts, mean transcript length, guides)
+SIZES = {
+    'small': (400, 1500, 256),
+    'medium': (3000, 2000, 512),
+    'large': (10000, 3000, 1024),
+}
+
+
+def write_transcriptome(path, transcripts, mean_length, rng):
+    """Random transcriptome with GENCODE-style headers; returns the sequences"""
+    sequences = []
+    with open(path, 'w') as out:
+        for t in range(transcripts):
+            length = max(GUIDE_LENGTH * 2, int(rng.gauss(mean_length, mean_length / 3)))
+            sequence = ''.join(rng.choices('ACGT', k=length))
+            gene = f"Gene{t // 3}"
+            out.write(f">ENSBENCH{t:08d}.1|ENSBENCHG{t // 3:07d}.1|-|-|{gene}-{201 + t % 3}|{gene}|"
+                      f"{length}|protein_coding|\n")
+            for start in range(0, length, 60):
+                out.write(sequence[start:start + 60] + '\n')
+            sequences.append(sequence)
+    return sequences
+
+
+def read_transcriptome(path):
+    sequences = []
+    current = []
+    with open(path) as handle:
+        for line in handle:
+            if line.startswith('>'):
+                if current:
+                    sequences.append(''.join(current).upper())
+                current = []
+            else:
+                current.append(line.strip())
+    if current:
+        sequences.append(''.join(current).upper())
+    return sequences
+
+
+def make_guides(sequences, count, rng):
+    """
+    Guides CSV text: windows of the reference carrying 0-3 substitutions, so
+    every MMk column sees hits, plus one random guide in eight
+    """
+    rows = ['Gene,Sequence']
+    usable = [s for s in sequences if len(s) >= GUIDE_LENGTH]
+    for i in range(count):
+        if i % 8 == 7 or not usable:
+            guide = ''.join(rng.choices('ACGT', k=GUIDE_LENGTH))
+        else:
+            source = rng.choice(usable)
+            start = rng.randrange(len(source) - GUIDE_LENGTH + 1)
+            guide = list(source[start:start + GUIDE_LENGTH])
+            for pos in rng.sample(range(GUIDE_LENGTH), rng.randrange(4)):
+                guide[pos] = rng.choice([b for b in 'ACGT' if b != guide[pos]])
+            guide = ''.join(guide)
+        rows.append(f"Bench{i},{guide}")
+    return '\n'.join(rows) + '\n'
+
+
+class Server:
+    """`offtarget_search serve` with one engine / kernel / thread setting"""
+
+    def __init__(self, binary, reference, engine, simd, threads):
+        env = os.environ.copy()
+        env['TIGER_OFFTARGET_THREADS'] = str(threads)
+        if simd:
+            env['TIGER_OFFTARGET_SIMD'] = simd
+        self._stderr = tempfile.TemporaryFile()
+        started = time.perf_counter()
+        self._process = subprocess.Popen(
+            [str(binary), 'serve', '--engine', engine, '--window-length', str(GUIDE_LENGTH), str(reference)],
+            stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=self._stderr, env=env,
+        )
+        greeting = self._process.stdout.readline()
+        self.load_ms = (time.perf_counter() - started) * 1000.0
+        self._stderr.seek(0)
+        self.log = self._stderr.read().decode('utf-8', 'replace')
+        if greeting != b'READY\n':
+            self.close()
+            raise RuntimeError(f"serve failed to load {reference}: {self.log.strip()}")
+
+    def search_ms(self, guides_csv):
+        payload = guides_csv.encode('utf-8')
+        self._process.stdin.write(b'SEARCH %d\n' % len(payload))
+        self._process.stdin.write(payload)
+        self._process.stdin.flush()
+        header = self._process.stdout.readline().decode('utf-8').split()
+        if len(header) != 3 or header[0] != 'OK':
+            raise RuntimeError(f"serve answered {' '.join(header) or 'nothing'}")
+        self._process.stdout.read(int(header[1]))
+        return float(header[2])
+
+    def close(self):
+        if self._process.poll() is None:
+            try:
+                self._process.stdin.write(b'QUIT\n')
+                self._process.stdin.close()
+            except BrokenPipeError:
+                pass
+            self._process.wait()
+        self._stderr.close()
+
+
+def measure(binary, dataset, engine, simd, threads, reps, budget):
+    """
+    One configuration; None when the CPU lacks the requested kernel.  Stops
+    repeating (after at least one search) once `budget` seconds are spent,
+    so slow kernels such as scalar byte compares do not dominate the run.
+    """
+    server = Server(binary, dataset['path'], engine, simd, threads)
+    try:
+        if simd and 'not supported by this CPU' in server.log:
+            return None
+        timings = []
+        while len(timings) < reps and (not timings or sum(timings) < budget * 1000.0):
+            timings.append(server.search_ms(dataset['guides_csv']))
+    finally:
+        server.close()
+
+    seconds = min(timings) / 1000.0
+    guides = dataset['guides']
+    bases = dataset['bases']
+    if engine == 'index':
+        scan_bytes = None
+    else:
+        bytes_per_pass = bases / 2 if engine == 'packed' else bases
+        scan_bytes = bytes_per_pass * -(-guides // GROUP_SIZE)
+    return {
+        'dataset': dataset['name'],
+        'engine': engine,
+        'simd': simd or 'auto',
+        'threads': threads,
+        'reps': len(timings),
+        'load_ms': round(server.load_ms, 3),
+        'search_ms_min': min(timings),
+        'search_ms_median': statistics.median(timings),
+        'guides_per_sec': guides / seconds if seconds else None,
+        'positions_per_sec': guides * bases / seconds if seconds else None,
+        'scan_gb_per_sec': scan_bytes / seconds / 1e9 if seconds and scan_bytes is not None else None,
+    }
+
+
+def build_datasets(sizes, include_sample, work_dir, seed):
+    datasets = []
+    for name in sizes:
+        transcripts, mean_length, guides = SIZES[name]
+        rng = random.Random(f"{seed}-{name}")
+        path = work_dir / f"{name}.fa"
+        sequences = write_transcriptome(path, transcripts, mean_length, rng)
+        datasets.append({'name': name, 'path': path, 'source': 'synthetic',
+                         'sequences': sequences, 'guides': guides, 'rng': rng})
+    if include_sample and SAMPLE_REFERENCE.exists():
+        datasets.append({'name': 'sample_reference', 'path': SAMPLE_REFERENCE,
+                         'source': str(SAMPLE_REFERENCE.relative_to(ROOT_DIR)),
+                         'sequences': read_transcriptome(SAMPLE_REFERENCE), 'guides': 256,
+                         'rng': random.Random(f"{seed}-sample")})
+    for dataset in datasets:
+        sequences = dataset.pop('sequences')
+        dataset['guides_csv'] = make_guides(sequences, dataset['guides'], dataset.pop('rng'))
+        dataset['transcripts'] = len(sequences)
+        dataset['bases'] = sum(len(s) for s in sequences)
+    return datasets
+
+
+def parse_list(text, allowed=None):
+    items = [item.strip() for item in text.split(',') if item.strip()]
+    if allowed is not None:
+        unknown = [item for item in items if item not in allowed]
+        if unknown:
+            raise argparse.ArgumentTypeError(f"unknown value(s) {', '.join(unknown)}; choose from {', '.join(allowed)}")
+    return items
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Benchmark offtarget_search engines and kernels",
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog=__doc__.split('Usage:')[1],
+    )
+    parser.add_argument('--binary', default=str(ROOT_DIR / 'bin' / 'offtarget_search'),
+                        help='offtarget_search binary (default: bin/offtarget_search)')
+    parser.add_argument('--sizes', type=lambda s: parse_list(s, SIZES), default=['small', 'medium'],
+                        help=f"synthetic datasets ({', '.join(SIZES)}; default small,medium)")
+    parser.add_argument('--no-sample', action='store_true',
+                        help='skip resources/reference/sample_reference.fa')
+    parser.add_argument('--engines', type=lambda s: parse_list(s, ENGINES), default=list(ENGINES),
+                        help='engines to time (default: all)')
+    parser.add_argument('--simd', type=lambda s: parse_list(s, SIMD_LEVELS), default=list(SIMD_LEVELS),
+                        help='kernel families to time; unsupported ones are skipped (default: all)')
+    parser.add_argument('--threads', type=lambda s: [int(t) for t in parse_list(s)], default=None,
+                        help='thread counts for the scaling curve (default: 1, 2, 4, ... up to the CPU count)')
+    parser.add_argument('--reps', type=int, default=3, help='searches per configuration (default: 3)')
+    parser.add_argument('--budget', type=float, default=10.0,
+                        help='seconds after which a configuration stops repeating (default: 10)')
+    parser.add_argument('--seed', default='tiger-bench', help='seed for the synthetic data')
+    parser.add_argument('--output', '-o', help='write the JSON here instead of stdout')
+    args = parser.parse_args()
+
+    binary = Path(args.binary)
+    if not binary.exists():
+        parser.error(f"binary not found: {binary} (run make first)")
+
+    cpus = os.cpu_count() or 1
+    thread_counts = args.threads
+    if not thread_counts:
+        thread_counts = []
+        t = 1
+        while t < cpus:
+            thread_counts.append(t)
+            t *= 2
+        thread_counts.append(cpus)
+
+    with tempfile.TemporaryDirectory(prefix='tiger-bench-') as tmp:
+        datasets = build_datasets(args.sizes, not args.no_sample, Path(tmp), args.seed)
+
+        runs = []
+        for dataset in datasets:
+            for engine in args.engines:
+                for simd in args.simd:
+                    result = measure(binary, dataset, engine, simd, max(thread_counts), args.reps, args.budget)
+                    if result is None:
+                        print(f"skip {dataset['name']} {engine} {simd}: not supported by this CPU", file=sys.stderr)
+                        continue
+                    runs.append(result)
+                    print(f"{dataset['name']:>16} {engine:>6} {simd:>6} x{result['threads']}: "
+                          f"{result['search_ms_min']:10.3f} ms  {result['guides_per_sec']:12.1f} guides/s",
+                          file=sys.stderr)
+
+        scaling = []
+        largest = max(datasets, key=lambda d: d['bases'] * d['guides'])
+        for threads in thread_counts:
+            result = measure(binary, largest, 'packed', None, threads, args.reps, args.budget)
+            scaling.append(result)
+            print(f"{largest['name']:>16} packed   auto x{threads}: {result['search_ms_min']:10.3f} ms",
+                  file=sys.stderr)
+        # Relative to the first (fewest threads) point of the curve
+        for result in scaling:
+            first = scaling[0]
+            speedup = first['search_ms_min'] / result['search_ms_min'] if result['search_ms_min'] else None
+            result['speedup'] = speedup
+            result['efficiency'] = speedup * first['threads'] / result['threads'] if speedup else None
+
+    report = {
+        'schema': 1,
+        'timestamp': datetime.now(timezone.utc).isoformat(timespec='seconds'),
+        'host': {
+            'hostname': platform.node(),
+            'machine': platform.machine(),
+            'cpus': cpus,
+        },
+        'binary': str(binary),
+        'guide_length': GUIDE_LENGTH,
+        'datasets': [
+            {key: dataset[key] for key in ('name', 'source', 'transcripts', 'bases', 'guides')}
+            for dataset in datasets
+        ],
+        'runs': runs,
+        'thread_scaling': scaling,
+    }
+    text = json.dumps(report, indent=2) + '\n'
+    if args.output:
+        output = Path(args.output)
+        output.parent.mkdir(parents=True, exist_ok=True)
+        output.write_text(text)
+        print(f"Wrote {output}", file=sys.stderr)
+    else:
+        sys.stdout.write(text)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+"""
+Screen non-targeting guide candidates in bulk
+Generates (or reads) candidates and keeps those with no transcriptome window
+within K mismatches, using `offtarget_search screen`
+"""
+import argparse
+import sys
+from pathlib import Path
+
+# Add package to path
+ROOT_DIR = Path(__file__).parent.parent.parent  # Go up to TIGER root
+PACKAGE_SRC = ROOT_DIR / 'tiger_guides_pkg' / 'src'
+if PACKAGE_SRC.exists():
+    sys.path.insert(0, str(PACKAGE_SRC))
+
+from tiger_guides.offtarget.search import OffTargetSearcher
+from tiger_guides.logging import setup_logger
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip())
+    parser.add_argument("count", type=int, nargs="?", default=30,
+                        help="Surviving candidates to generate (default 30)")
+    parser.add_argument("--candidates", type=Path,
+                        help="Screen these sequences (one per line) instead of generating")
+    parser.add_argument("--reference", type=Path,
+                        default=ROOT_DIR / "resources/reference/gencode.vM37.transcripts.uc.joined")
+    parser.add_argument("--max-mismatches", type=int, default=2,
+                        help="Reject candidates with a window this close (default 2: MM0=MM1=MM2=0)")
+    parser.add_argument("--seed", type=int, default=42)
+    parser.add_argument("--output", type=Path, help="Write survivors here instead of stdout")
+    args = parser.parse_args()
+
+    logger = setup_logger(verbose=True)
+    searcher = OffTargetSearcher(
+        binary_path=ROOT_DIR / "bin/offtarget_search",
+        reference_path=args.reference,
+        logger=logger,
+        engine="index",
+    )
+
+    if args.candidates:
+        with open(args.candidates, 'r') as f:
+            sequences = [line.split()[0] for line in f if line.strip() and not line.startswith('#')]
+        survivors = searcher.screen(sequences=sequences, max_mismatches=args.max_mismatches)
+        logger.info(f"{len(survivors)} of {len(sequences)} candidates have no hit within "
+                    f"{args.max_mismatches} mismatches")
+    else:
+        survivors = searcher.screen(generate=args.count, seed=args.seed, max_mismatches=args.max_mismatches)
+
+    text = "".join(f"{seq}\n" for seq in survivors)
+    if args.output:
+        args.output.write_text(text)
+        logger.info(f"Saved {len(survivors)} non-targeting candidates to {args.output}")
+    else:
+        sys.stdout.write(text)
+
+
+if __name__ == '__main__':
+    main()
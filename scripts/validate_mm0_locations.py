@@ -12,6 +12,9 @@ Usage:
     python3 scripts/validate_mm0_locations.py runs/my_run/final_guides.csv \
         --reference resources/reference/gencode.vM37.transcripts.uc.joined \
         --output runs/my_run/mm0_analysis.csv
+
+When the run wrote offtarget/hits.csv (offtarget_search --hits-out), the
+matches are read from it instead of rescanning the transcriptome.
 """
 
 import sys
@@ -44,6 +47,10 @@ Examples:
   python3 scripts/validate_mm0_locations.py runs/human/final_guides.csv \\
       --reference resources/reference/gencode.v47.transcripts.fa
 
+  # Reuse hit details from the off-target search (no transcriptome rescan)
+  python3 scripts/validate_mm0_locations.py runs/my_run/final_guides.csv \\
+      --hits runs/my_run/offtarget/hits.csv
+
 Output:
   Creates a CSV file with detailed transcript-level analysis showing:
   - Which transcripts each guide matches
@@ -74,6 +81,18 @@ See docs/GUIDE_SELECTION_AND_VALIDATION.md for detailed interpretation guide.
         help='Output CSV file path (default: <guides_dir>/mm0_location_analysis.csv)'
     )
 
+    parser.add_argument(
+        '--hits',
+        type=str,
+        help='Hit details from offtarget_search --hits-out (default: <guides_dir>/offtarget/hits.csv if present)'
+    )
+
+    parser.add_argument(
+        '--rescan',
+        action='store_true',
+        help='Ignore hit details and rescan the transcriptome in Python'
+    )
+
     args = parser.parse_args()
 
     # Resolve paths
@@ -86,9 +105,21 @@ See docs/GUIDE_SELECTION_AND_VALIDATION.md for detailed interpretation guide.
     if not reference_path.is_absolute():
         reference_path = ROOT_DIR / reference_path
 
+    hits_path = None
+    if not args.rescan:
+        hits_path = Path(args.hits) if args.hits else guides_csv.parent / "offtarget" / "hits.csv"
+        if not hits_path.exists():
+            if args.hits:
+                print(f"Error: Hits file not found: {hits_path}")
+                sys.exit(1)
+            hits_path = None
+
     if not reference_path.exists():
-        print(f"Error: Reference file not found: {reference_path}")
-        sys.exit(1)
+        if hits_path is None:
+            print(f"Error: Reference file not found: {reference_path}")
+            sys.exit(1)
+        # Hit details carry everything but transcript names
+        reference_path = None
 
     # Determine output path
     if args.output:
@@ -101,6 +132,7 @@ See docs/GUIDE_SELECTION_AND_VALIDATION.md for detailed interpretation guide.
     print("=" * 70)
     print(f"Guides:     {guides_csv}")
     print(f"Reference:  {reference_path}")
+    print(f"Hits:       {hits_path or '(rescan transcriptome)'}")
     print(f"Output:     {output_path}")
     print("=" * 70)
     print()
@@ -109,8 +141,9 @@ See docs/GUIDE_SELECTION_AND_VALIDATION.md for detailed interpretation guide.
     try:
         results_df, stats = validate_final_guides(
             guides_csv=str(guides_csv),
-            transcriptome_file=str(reference_path),
-            output_file=str(output_path)
+            transcriptome_file=str(reference_path) if reference_path else None,
+            output_file=str(output_path),
+            hits_file=str(hits_path) if hits_path else None
         )
 
         print("\n" + "=" * 70)
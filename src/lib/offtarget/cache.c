@@ -0,0 +1,626 @@
+/*
+ * Result cache (--cache-dir DIR).  Results are kept per distinct guide
+ * sequence in DIR/<key>.otcache, where the key digests the reference
+ * content (its 2-bit planes), its transcript table and every option that
+ * changes a result, so a changed reference or option opens another file
+ * instead of reading stale hits.  A file is a CacheHeader followed by an
+ * append-only log of CacheRecords, each followed by its sequence (NUL
+ * padded to 8 bytes), MM0 transcript indices and hit-detail records.
+ * Runs read it and append what they had to search under an exclusive
+ * flock, so concurrent jobs can share a directory; a record torn by a
+ * crash is dropped by the next append.
+ */
+#include "search_internal.h"
+
+#define CACHE_MAGIC "TGROTCCH"
+#define CACHE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t content_digest;
+    uint64_t reference_digest;
+    uint64_t options_digest;
+    uint64_t reserved;
+} CacheHeader;
+
+typedef struct CacheRecord {
+    uint64_t counts[MAX_MISMATCHES + 1];
+    uint64_t disqualified_pos;
+    uint64_t mm0_count;
+    uint64_t detail_count;
+    int32_t disqualified_mm;        /* -1 = kept */
+    uint32_t length;                /* sequence length */
+} CacheRecord;
+
+_Static_assert(sizeof(CacheRecord) % 8 == 0, "cache records must keep 8-byte alignment");
+
+static size_t cache_sequence_bytes(uint32_t length) {
+    return ((size_t)length + 8) & ~(size_t)7;
+}
+
+/* End of the last complete record in `data`; with `cache`, indexes the records. */
+static size_t cache_scan(ResultCache *cache, char *data, size_t size) {
+    size_t offset = 0;
+    while (size - offset >= sizeof(CacheRecord)) {
+        const CacheRecord *record = (const CacheRecord *)(data + offset);
+        size_t left = size - offset - sizeof(CacheRecord);
+        if (record->length == 0 || record->length > MAX_GUIDE_LEN
+            || cache_sequence_bytes(record->length) > left) {
+            break;
+        }
+        left -= cache_sequence_bytes(record->length);
+        if (record->mm0_count > left / sizeof(uint64_t)
+            || record->detail_count > left / sizeof(uint64_t) - record->mm0_count) {
+            break;
+        }
+        if (cache) {
+            size_t before = cache->sequences.count;
+            size_t index = string_table_intern(&cache->sequences, (char *)(record + 1));
+            if (cache->sequences.count > before) {
+                cache->records = (const CacheRecord **)realloc(cache->records,
+                                                                cache->sequences.count * sizeof(CacheRecord *));
+                if (!cache->records) {
+                    fprintf(stderr, "Error: realloc failed while indexing the result cache\n");
+                    exit(EXIT_FAILURE);
+                }
+                cache->records[index] = record;
+            }
+        }
+        offset += sizeof(CacheRecord) + cache_sequence_bytes(record->length)
+            + (size_t)(record->mm0_count + record->detail_count) * sizeof(uint64_t);
+    }
+    return offset;
+}
+
+/* FNV-1a over the reference's lo, hi and N-mask words, packing the byte engine's sequence on the fly. */
+static uint64_t reference_content_digest(const SearchContext *ctx) {
+    bool packed = ctx->packed.lo != NULL;
+    size_t length = packed ? ctx->packed.length : ctx->reference.length;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t word = 0; word < (length + 63) / 64; ++word) {
+        uint64_t planes[3];
+        if (packed) {
+            planes[0] = ctx->packed.lo[word];
+            planes[1] = ctx->packed.hi[word];
+            planes[2] = ctx->packed.nmask[word];
+        } else {
+            pack_word(ctx->reference.data, length, word, planes);
+        }
+        h = fnv1a_bytes(h, planes, sizeof(planes));
+    }
+    return h;
+}
+
+/* Everything besides the reference that changes a guide's result.  Capped counts also depend on the engine's scan order. */
+uint64_t cache_options_digest(const SearchContext *ctx) {
+    const SearchOptions *options = &ctx->options;
+    uint64_t fields[6 + MAX_MISMATCHES + 1] = {
+        (uint64_t)options->max_mismatches,
+        (uint64_t)(int64_t)options->detail_mismatches,
+        options->caps.active,
+        options->caps.active ? (uint64_t)options->engine : 0,
+        ctx->shard_begin,
+        ctx->shard_end,
+    };
+    if (options->caps.active) {
+        memcpy(&fields[6], options->caps.max, sizeof(options->caps.max));
+    }
+    return fnv1a_bytes(1469598103934665603ULL, fields, sizeof(fields));
+}
+
+/*
+ * Opens (with `create`, creating if needed) the cache file for `ctx`; -1
+ * leaves the search uncached.  Without `create` it is opened read-only.
+ */
+static int result_cache_open(ResultCache *cache, const char *dir, const SearchContext *ctx, bool create) {
+    memset(cache, 0, sizeof(*cache));
+    cache->fd = -1;
+
+    CacheHeader expected;
+    memset(&expected, 0, sizeof(expected));
+    memcpy(expected.magic, CACHE_MAGIC, sizeof(expected.magic));
+    expected.version = CACHE_VERSION;
+    expected.byte_order = INDEX_BYTE_ORDER;
+    expected.content_digest = reference_content_digest(ctx);
+    expected.reference_digest = reference_digest(ctx->transcripts, ctx->transcript_count);
+    expected.options_digest = cache_options_digest(ctx);
+    uint64_t key = fnv1a_bytes(1469598103934665603ULL, &expected, sizeof(expected));
+
+    if (create && mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Warning: result cache disabled: unable to create '%s': %s\n", dir, strerror(errno));
+        return -1;
+    }
+    size_t path_size = strlen(dir) + 32;
+    cache->path = (char *)xmalloc(path_size);
+    snprintf(cache->path, path_size, "%s/%016llx.otcache", dir, (unsigned long long)key);
+
+    cache->fd = create ? open(cache->path, O_RDWR | O_CREAT, 0644) : open(cache->path, O_RDONLY);
+    if (cache->fd < 0 || flock(cache->fd, create ? LOCK_EX : LOCK_SH) != 0) {
+        fprintf(stderr, "Warning: result cache disabled: unable to open '%s': %s\n", cache->path, strerror(errno));
+        goto fail;
+    }
+
+    struct stat st;
+    if (fstat(cache->fd, &st) != 0) {
+        fprintf(stderr, "Warning: result cache disabled: unable to stat '%s': %s\n", cache->path, strerror(errno));
+        goto fail;
+    }
+    size_t file_size = (size_t)st.st_size;
+    if (file_size < sizeof(CacheHeader)) {
+        if (!create) {
+            fprintf(stderr, "Warning: result cache '%s' is empty\n", cache->path);
+            goto fail;
+        }
+        if (ftruncate(cache->fd, 0) != 0 || !pwrite_all(cache->fd, &expected, sizeof(expected), 0)) {
+            fprintf(stderr, "Warning: result cache disabled: unable to write '%s': %s\n", cache->path, strerror(errno));
+            goto fail;
+        }
+        file_size = sizeof(CacheHeader);
+    }
+
+    cache->mapping = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, cache->fd, 0);
+    if (cache->mapping == MAP_FAILED) {
+        cache->mapping = NULL;
+        fprintf(stderr, "Warning: result cache disabled: unable to map '%s': %s\n", cache->path, strerror(errno));
+        goto fail;
+    }
+    cache->mapping_size = file_size;
+    if (memcmp(cache->mapping, &expected, sizeof(expected)) != 0) {
+        fprintf(stderr, "Warning: result cache disabled: '%s' was written for another reference or options\n",
+                cache->path);
+        goto fail;
+    }
+
+    string_table_init(&cache->sequences);
+    char *records = (char *)cache->mapping + sizeof(CacheHeader);
+    cache->size = sizeof(CacheHeader) + cache_scan(cache, records, file_size - sizeof(CacheHeader));
+    flock(cache->fd, LOCK_UN);
+    buffer_init(&cache->pending, 4096);
+    return 0;
+
+fail:
+    if (cache->mapping) {
+        munmap(cache->mapping, cache->mapping_size);
+    }
+    if (cache->fd >= 0) {
+        close(cache->fd);
+    }
+    free(cache->path);
+    memset(cache, 0, sizeof(*cache));
+    cache->fd = -1;
+    return -1;
+}
+
+/* Fills `res` from the cache; false if `sequence` is not cached. */
+static bool result_cache_lookup(ResultCache *cache, const char *sequence, GuideResult *res) {
+    size_t index = string_table_find(&cache->sequences, sequence);
+    if (index == SIZE_MAX) {
+        return false;
+    }
+    const CacheRecord *record = cache->records[index];
+    const uint64_t *lists = (const uint64_t *)((const char *)(record + 1) + cache_sequence_bytes(record->length));
+
+    memcpy(res->counts, record->counts, sizeof(res->counts));
+    res->disqualified = record->disqualified_mm >= 0;
+    res->disqualified_mm = record->disqualified_mm;
+    res->disqualified_pos = (size_t)record->disqualified_pos;
+    res->mm0_count = (size_t)record->mm0_count;
+    res->mm0_transcripts = NULL;
+    if (res->mm0_count) {
+        res->mm0_transcripts = (size_t *)xmalloc(res->mm0_count * sizeof(size_t));
+        for (size_t i = 0; i < res->mm0_count; ++i) {
+            res->mm0_transcripts[i] = (size_t)lists[i];
+        }
+    }
+    res->detail_count = (size_t)record->detail_count;
+    res->details = NULL;
+    if (res->detail_count) {
+        res->details = (uint64_t *)xmalloc(res->detail_count * sizeof(uint64_t));
+        memcpy(res->details, lists + res->mm0_count, res->detail_count * sizeof(uint64_t));
+    }
+    ++cache->hits;
+    return true;
+}
+
+static void result_cache_add(ResultCache *cache, const Guide *guide, const GuideResult *res) {
+    CacheRecord record;
+    memset(&record, 0, sizeof(record));
+    memcpy(record.counts, res->counts, sizeof(record.counts));
+    record.disqualified_mm = res->disqualified ? res->disqualified_mm : -1;
+    record.disqualified_pos = res->disqualified ? res->disqualified_pos : 0;
+    record.mm0_count = res->mm0_count;
+    record.detail_count = res->detail_count;
+    record.length = (uint32_t)guide->length;
+
+    size_t sequence_bytes = cache_sequence_bytes(record.length);
+    buffer_reserve(&cache->pending, sizeof(record) + sequence_bytes
+                   + (res->mm0_count + res->detail_count) * sizeof(uint64_t));
+    char *out = cache->pending.data + cache->pending.length;
+    memcpy(out, &record, sizeof(record));
+    memset(out + sizeof(record), 0, sequence_bytes);
+    memcpy(out + sizeof(record), guide->sequence, (size_t)guide->length);
+    uint64_t *lists = (uint64_t *)(out + sizeof(record) + sequence_bytes);
+    for (size_t i = 0; i < res->mm0_count; ++i) {
+        lists[i] = res->mm0_transcripts[i];
+    }
+    if (res->detail_count) {
+        memcpy(lists + res->mm0_count, res->details, res->detail_count * sizeof(uint64_t));
+    }
+    cache->pending.length += sizeof(record) + sequence_bytes
+        + (res->mm0_count + res->detail_count) * sizeof(uint64_t);
+}
+
+/* Appends the pending records after whatever other runs have added, then releases the cache. */
+static void result_cache_close(ResultCache *cache) {
+    if (cache->fd < 0) {
+        return;
+    }
+    if (cache->pending.length && flock(cache->fd, LOCK_EX) == 0) {
+        struct stat st;
+        size_t end = cache->size;
+        if (fstat(cache->fd, &st) == 0 && (size_t)st.st_size > end) {
+            size_t added = (size_t)st.st_size - end;
+            char *tail = (char *)xmalloc(added);
+            if (pread(cache->fd, tail, added, (off_t)end) == (ssize_t)added) {
+                end += cache_scan(NULL, tail, added);
+            }
+            free(tail);
+            if (end < (size_t)st.st_size) {
+                fprintf(stderr, "Warning: dropping an incomplete record at the end of '%s'\n", cache->path);
+            }
+        }
+        if (ftruncate(cache->fd, (off_t)end) != 0
+            || !pwrite_all(cache->fd, cache->pending.data, cache->pending.length, end)) {
+            fprintf(stderr, "Warning: unable to update result cache '%s': %s\n", cache->path, strerror(errno));
+        }
+        flock(cache->fd, LOCK_UN);
+    }
+    munmap(cache->mapping, cache->mapping_size);
+    close(cache->fd);
+    string_table_free(&cache->sequences);
+    free(cache->records);
+    free(cache->pending.data);
+    free(cache->path);
+    cache->fd = -1;
+}
+
+/*
+ * --cache-from OLD: results cached against an earlier release of the
+ * reference carry over to this one.  Transcripts are matched by ID and a
+ * digest of their bases.  Windows never cross transcripts, so a guide's
+ * counts are sums of per-transcript parts: an old result becomes the new
+ * one by subtracting what the removed and changed transcripts contributed
+ * (scanning only those in the old reference) and adding what the added and
+ * changed ones contribute (scanning only those in the new one), and its
+ * MM0 transcript list is renumbered into the new reference.
+ */
+typedef struct CacheDelta {
+    SearchContext previous;         /* the old reference, loaded with the same options */
+    ResultCache cache;              /* its cache file, read-only */
+    size_t *renumber;               /* old transcript -> new index, SIZE_MAX if removed or changed */
+    TranscriptInfo *removed;        /* old transcripts removed or changed, by start */
+    size_t removed_count;
+    TranscriptInfo *added;          /* new transcripts added or changed, by start */
+    size_t added_count;
+} CacheDelta;
+
+/* FNV-1a over transcript `t`'s bases as 2-bit codes (4 = N), from whichever form the engine keeps. */
+static uint64_t transcript_content_digest(const SearchContext *ctx, size_t t) {
+    static const unsigned char codes[4] = {'A', 'C', 'G', 'T'};
+    const TranscriptInfo *info = &ctx->transcripts[t];
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t pos = info->start; pos < info->start + info->length; ++pos) {
+        unsigned char code;
+        if (ctx->packed.lo) {
+            bool is_n;
+            code = (unsigned char)packed_base(&ctx->packed, pos, &is_n);
+            code = is_n ? 'N' : codes[code];
+        } else {
+            code = (unsigned char)ctx->reference.data[pos];
+        }
+        h = fnv1a_bytes(h, &code, 1);
+    }
+    return h;
+}
+
+static uint64_t *transcript_content_digests(const SearchContext *ctx) {
+    uint64_t *digests = (uint64_t *)xmalloc((ctx->transcript_count + 1) * sizeof(uint64_t));
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t t = 0; t < ctx->transcript_count; ++t) {
+        digests[t] = transcript_content_digest(ctx, t);
+    }
+    return digests;
+}
+
+/* Transcript IDs of `ctx` in a table whose indices are transcript indices; false if an ID repeats. */
+static bool index_transcript_ids(const SearchContext *ctx, StringTable *ids) {
+    string_table_init(ids);
+    for (size_t t = 0; t < ctx->transcript_count; ++t) {
+        if (string_table_intern(ids, ctx->transcripts[t].transcript_id) != t) {
+            string_table_free(ids);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void cache_delta_close(CacheDelta *delta) {
+    if (delta->cache.fd >= 0) {
+        result_cache_close(&delta->cache);
+    }
+    free_search_context(&delta->previous);
+    free(delta->renumber);
+    free(delta->removed);
+    free(delta->added);
+    memset(delta, 0, sizeof(*delta));
+}
+
+/*
+ * Loads `previous_file` like `ctx` was loaded, opens its cache in `dir`
+ * and diffs the two transcript tables.  -1 (after a warning) leaves the
+ * current cache to start from nothing.
+ */
+static int cache_delta_open(CacheDelta *delta, const char *dir, const char *previous_file,
+                            const SearchContext *ctx, int window_len) {
+    memset(delta, 0, sizeof(*delta));
+    delta->cache.fd = -1;
+    delta->previous.options = ctx->options;
+    if (load_search_context(&delta->previous, previous_file, window_len) != 0) {
+        fprintf(stderr, "Warning: --cache-from ignored: unable to load '%s'\n", previous_file);
+        cache_delta_close(delta);
+        return -1;
+    }
+    if (ctx->options.engine == ENGINE_INDEX && ctx->kmers.k > 0
+        && prepare_seed_index(&delta->previous, ctx->kmers.k) != 0) {
+        cache_delta_close(delta);
+        return -1;
+    }
+    if (result_cache_open(&delta->cache, dir, &delta->previous, false) != 0) {
+        fprintf(stderr, "Warning: --cache-from ignored: no usable cache for '%s' in '%s'\n", previous_file, dir);
+        cache_delta_close(delta);
+        return -1;
+    }
+
+    StringTable previous_ids;
+    StringTable current_ids;
+    if (!index_transcript_ids(&delta->previous, &previous_ids)) {
+        fprintf(stderr, "Warning: --cache-from ignored: '%s' repeats transcript IDs\n", previous_file);
+        cache_delta_close(delta);
+        return -1;
+    }
+    if (!index_transcript_ids(ctx, &current_ids)) {
+        fprintf(stderr, "Warning: --cache-from ignored: the reference repeats transcript IDs\n");
+        string_table_free(&previous_ids);
+        cache_delta_close(delta);
+        return -1;
+    }
+    string_table_free(&previous_ids);
+
+    uint64_t *previous_digests = transcript_content_digests(&delta->previous);
+    uint64_t *current_digests = transcript_content_digests(ctx);
+    bool *kept = (bool *)xmalloc(ctx->transcript_count + 1);
+    memset(kept, 0, ctx->transcript_count + 1);
+    delta->renumber = (size_t *)xmalloc((delta->previous.transcript_count + 1) * sizeof(size_t));
+    delta->removed = (TranscriptInfo *)xmalloc((delta->previous.transcript_count + 1) * sizeof(TranscriptInfo));
+    delta->added = (TranscriptInfo *)xmalloc((ctx->transcript_count + 1) * sizeof(TranscriptInfo));
+    size_t changed = 0;
+    for (size_t t = 0; t < delta->previous.transcript_count; ++t) {
+        size_t n = string_table_find(&current_ids, delta->previous.transcripts[t].transcript_id);
+        if (n != SIZE_MAX && previous_digests[t] == current_digests[n]) {
+            delta->renumber[t] = n;
+            kept[n] = true;
+            continue;
+        }
+        changed += n != SIZE_MAX;
+        delta->renumber[t] = SIZE_MAX;
+        delta->removed[delta->removed_count++] = delta->previous.transcripts[t];
+    }
+    for (size_t n = 0; n < ctx->transcript_count; ++n) {
+        if (!kept[n]) {
+            delta->added[delta->added_count++] = ctx->transcripts[n];
+        }
+    }
+    fprintf(stderr, "Reference delta from '%s': %zu transcripts kept, %zu changed, %zu removed, %zu added\n",
+            previous_file, ctx->transcript_count - delta->added_count, changed,
+            delta->removed_count - changed, delta->added_count - changed);
+
+    free(kept);
+    free(previous_digests);
+    free(current_digests);
+    string_table_free(&current_ids);
+    return 0;
+}
+
+/* Scans `guides` in only the `count` transcripts of `scan` (a subset of `ctx`'s); `results` is zeroed first. */
+static void search_transcripts(const SearchContext *ctx, const TranscriptInfo *scan, size_t count,
+                               const Guide *guides, int n_guides, GuideResult *results) {
+    memset(results, 0, (size_t)n_guides * sizeof(GuideResult));
+    if (count == 0) {
+        return;
+    }
+    SearchContext subset = *ctx;
+    subset.selected = scan;
+    subset.selected_count = count;
+    run_search(&subset, guides, n_guides, results, NULL);
+}
+
+/*
+ * Turns `results[rows[k]]`, filled from the previous reference's cache,
+ * into results for `ctx`'s reference.
+ */
+static void cache_delta_apply(const CacheDelta *delta, const SearchContext *ctx, const Guide *guides,
+                              const size_t *rows, size_t count, GuideResult *results) {
+    Guide *updated = (Guide *)xmalloc((count + 1) * sizeof(Guide));
+    GuideResult *lost = (GuideResult *)xmalloc((count + 1) * sizeof(GuideResult));
+    GuideResult *gained = (GuideResult *)xmalloc((count + 1) * sizeof(GuideResult));
+    for (size_t k = 0; k < count; ++k) {
+        updated[k] = guides[rows[k]];
+    }
+    search_transcripts(&delta->previous, delta->removed, delta->removed_count, updated, (int)count, lost);
+    search_transcripts(ctx, delta->added, delta->added_count, updated, (int)count, gained);
+
+    for (size_t k = 0; k < count; ++k) {
+        GuideResult *res = &results[rows[k]];
+        for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
+            res->counts[mm] = res->counts[mm] - lost[k].counts[mm] + gained[k].counts[mm];
+        }
+        size_t mm0_count = 0;
+        for (size_t h = 0; h < res->mm0_count; ++h) {
+            size_t transcript = delta->renumber[res->mm0_transcripts[h]];
+            if (transcript != SIZE_MAX) {
+                res->mm0_transcripts[mm0_count++] = transcript;
+            }
+        }
+        if (gained[k].mm0_count) {
+            res->mm0_transcripts = (size_t *)realloc(res->mm0_transcripts,
+                                                     (mm0_count + gained[k].mm0_count) * sizeof(size_t));
+            if (!res->mm0_transcripts) {
+                fprintf(stderr, "Error: out of memory while updating cached results\n");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(res->mm0_transcripts + mm0_count, gained[k].mm0_transcripts,
+                   gained[k].mm0_count * sizeof(size_t));
+            mm0_count += gained[k].mm0_count;
+            qsort(res->mm0_transcripts, mm0_count, sizeof(size_t), compare_size);
+        }
+        res->mm0_count = mm0_count;
+    }
+
+    free_results(lost, count);
+    free_results(gained, count);
+    free(updated);
+}
+
+/* The --cache-dir cache of a run, seeded from --cache-from's reference when given; NULL = uncached. */
+ResultCache *open_run_cache(ResultCache *cache, const char *dir, const char *previous_file,
+                            const SearchContext *ctx, int window_len) {
+    if (!dir || result_cache_open(cache, dir, ctx, true) != 0) {
+        return NULL;
+    }
+    if (previous_file) {
+        CacheDelta *delta = (CacheDelta *)xmalloc(sizeof(CacheDelta));
+        if (cache_delta_open(delta, dir, previous_file, ctx, window_len) == 0) {
+            cache->delta = delta;
+        } else {
+            free(delta);
+        }
+    }
+    return cache;
+}
+
+void close_run_cache(ResultCache *cache) {
+    if (cache->delta) {
+        cache_delta_close(cache->delta);
+        free(cache->delta);
+        cache->delta = NULL;
+    }
+    result_cache_close(cache);
+}
+
+static void copy_guide_result(GuideResult *dst, const GuideResult *src) {
+    *dst = *src;
+    dst->mm0_transcripts = NULL;
+    dst->details = NULL;
+    dst->mismatch_positions = NULL;
+    if (src->mismatch_positions) {
+        dst->mismatch_positions = (uint64_t *)xmalloc((size_t)src->profile_length * sizeof(uint64_t));
+        memcpy(dst->mismatch_positions, src->mismatch_positions, (size_t)src->profile_length * sizeof(uint64_t));
+    }
+    if (src->mm0_count) {
+        dst->mm0_transcripts = (size_t *)xmalloc(src->mm0_count * sizeof(size_t));
+        memcpy(dst->mm0_transcripts, src->mm0_transcripts, src->mm0_count * sizeof(size_t));
+    }
+    if (src->detail_count) {
+        dst->details = (uint64_t *)xmalloc(src->detail_count * sizeof(uint64_t));
+        memcpy(dst->details, src->details, src->detail_count * sizeof(uint64_t));
+    }
+}
+
+/*
+ * Searches each distinct sequence once: repeats copy the first
+ * occurrence's result and, with a cache (NULL for none), cached sequences
+ * are not searched and new ones are added to it.  Sequences only cached
+ * for the --cache-from reference are updated to this one and added too.
+ * Returns false without
+ * searching when that saves nothing (every sequence distinct, no cache),
+ * leaving the caller to stream the search instead.  `*searched` receives
+ * the number of guides actually scanned.
+ */
+bool search_distinct(const SearchContext *ctx, ResultCache *cache, const Guide *guides, int n_guides,
+                     GuideResult *results, size_t *searched) {
+    StringTable seen;
+    string_table_init(&seen);
+    size_t *first = (size_t *)xmalloc(((size_t)n_guides + 1) * sizeof(size_t));
+    size_t *source = (size_t *)xmalloc(((size_t)n_guides + 1) * sizeof(size_t));
+    for (int i = 0; i < n_guides; ++i) {
+        size_t before = seen.count;
+        size_t index = string_table_intern(&seen, (char *)guides[i].sequence);
+        if (seen.count > before) {
+            first[index] = (size_t)i;
+        }
+        source[i] = first[index];
+    }
+    size_t distinct = seen.count;
+    string_table_free(&seen);
+    if (distinct == (size_t)n_guides && !cache) {
+        free(first);
+        free(source);
+        *searched = (size_t)n_guides;
+        return false;
+    }
+
+    /* first[] now lists the rows to resolve; compact the uncached ones in place. */
+    size_t misses = 0;
+    size_t updates = 0;
+    size_t *updated = cache && cache->delta ? (size_t *)xmalloc((distinct + 1) * sizeof(size_t)) : NULL;
+    for (size_t k = 0; k < distinct; ++k) {
+        const char *sequence = guides[first[k]].sequence;
+        if (cache && result_cache_lookup(cache, sequence, &results[first[k]])) {
+            continue;
+        }
+        if (updated && result_cache_lookup(&cache->delta->cache, sequence, &results[first[k]])) {
+            updated[updates++] = first[k];
+            continue;
+        }
+        first[misses++] = first[k];
+    }
+
+    if (updates) {
+        cache_delta_apply(cache->delta, ctx, guides, updated, updates, results);
+        for (size_t k = 0; k < updates; ++k) {
+            result_cache_add(cache, &guides[updated[k]], &results[updated[k]]);
+        }
+        cache->updated += updates;
+    }
+    free(updated);
+
+    if (misses) {
+        Guide *miss_guides = (Guide *)xmalloc(misses * sizeof(Guide));
+        GuideResult *miss_results = (GuideResult *)xmalloc(misses * sizeof(GuideResult));
+        memset(miss_results, 0, misses * sizeof(GuideResult));
+        for (size_t k = 0; k < misses; ++k) {
+            miss_guides[k] = guides[first[k]];
+        }
+        run_search(ctx, miss_guides, (int)misses, miss_results, NULL);
+        for (size_t k = 0; k < misses; ++k) {
+            results[first[k]] = miss_results[k];
+            if (cache) {
+                result_cache_add(cache, &miss_guides[k], &miss_results[k]);
+            }
+        }
+        free(miss_guides);
+        free(miss_results);
+    }
+    for (int i = 0; i < n_guides; ++i) {
+        if (source[i] != (size_t)i) {
+            copy_guide_result(&results[i], &results[source[i]]);
+        }
+    }
+
+    free(first);
+    free(source);
+    *searched = misses;
+    return true;
+}
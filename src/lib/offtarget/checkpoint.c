@@ -0,0 +1,235 @@
+/*
+ * --checkpoint PATH: guides are searched in groups of --checkpoint-group
+ * rows, and each finished group is appended to PATH as a CheckpointBlock,
+ * its guides' PartialGuide records (as in partials) and the block's end
+ * marker, then flushed to disk.  The header's key hashes the guides (genes,
+ * sequences, row range), the reference layout and the options that change
+ * results, so a rerun of the same job reads the complete blocks back and
+ * only searches the groups missing from them; a block cut short by the kill
+ * is dropped.  A file with another key is started over.
+ */
+#include "search_internal.h"
+
+#define CHECKPOINT_MAGIC "TGROTCKP"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_BLOCK_END 0x4b434f4c42444e45ULL    /* "ENDBLOCK" */
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t key;
+    uint64_t guide_count;
+    uint64_t group_size;
+} CheckpointHeader;
+
+typedef struct {
+    uint64_t first;                 /* row of the group's first guide */
+    uint64_t count;
+} CheckpointBlock;
+
+static uint64_t checkpoint_key(const SearchContext *ctx, const StringPool *genes, const Guide *guides, int n_guides,
+                               size_t first_row, size_t group_size) {
+    uint64_t fields[4] = {
+        reference_digest(ctx->transcripts, ctx->transcript_count),
+        cache_options_digest(ctx),
+        first_row,
+        group_size,
+    };
+    uint64_t h = fnv1a_bytes(1469598103934665603ULL, fields, sizeof(fields));
+    for (int i = 0; i < n_guides; ++i) {
+        const char *gene = string_pool_get(genes, guides[i].gene);
+        h = fnv1a_bytes(h, gene, strlen(gene) + 1);
+        h = fnv1a_bytes(h, guides[i].sequence, (size_t)guides[i].length + 1);
+    }
+    return h;
+}
+
+/* Reads one checkpointed guide into `res`; fails unless it is `guide` of `gene`. */
+static int read_checkpoint_guide(FILE *fp, const SearchContext *ctx, const char *gene, const Guide *guide,
+                                 GuideResult *res) {
+    PartialGuide record;
+    char name[256];
+    char sequence[MAX_GUIDE_LEN + 1];
+    if (read_exact(fp, &record, sizeof(record)) != 0 || record.gene_length != strlen(gene)
+        || record.gene_length >= sizeof(name) || record.sequence_length != (uint32_t)guide->length
+        || record.mm0_count > ctx->transcript_count
+        || read_exact(fp, name, record.gene_length) != 0
+        || read_exact(fp, sequence, record.sequence_length) != 0
+        || memcmp(name, gene, record.gene_length) != 0
+        || memcmp(sequence, guide->sequence, record.sequence_length) != 0) {
+        return -1;
+    }
+    memset(res, 0, sizeof(*res));
+    memcpy(res->counts, record.counts, sizeof(res->counts));
+    res->disqualified = record.disqualified_mm >= 0;
+    res->disqualified_mm = record.disqualified_mm;
+    res->disqualified_pos = (size_t)record.disqualified_pos;
+    if (record.mm0_count > 0) {
+        res->mm0_transcripts = (size_t *)xmalloc((size_t)record.mm0_count * sizeof(size_t));
+        for (uint64_t k = 0; k < record.mm0_count; ++k) {
+            uint64_t transcript;
+            if (read_exact(fp, &transcript, sizeof(transcript)) != 0) {
+                return -1;
+            }
+            res->mm0_transcripts[res->mm0_count++] = (size_t)transcript;
+        }
+    }
+    if (record.detail_count > 0) {
+        if (record.detail_count > SIZE_MAX / sizeof(uint64_t)) {
+            return -1;
+        }
+        res->details = (uint64_t *)malloc((size_t)record.detail_count * sizeof(uint64_t));
+        if (!res->details || read_exact(fp, res->details, (size_t)record.detail_count * sizeof(uint64_t)) != 0) {
+            return -1;
+        }
+        res->detail_count = (size_t)record.detail_count;
+    }
+    return 0;
+}
+
+/*
+ * Reads the complete blocks of an open checkpoint into `results`, marking
+ * their groups in `done`; returns how many groups it restored and leaves
+ * the file positioned (and truncated) after the last of them.
+ */
+static size_t checkpoint_restore(FILE *fp, const char *path, const SearchContext *ctx, const StringPool *genes,
+                                 const Guide *guides, int n_guides, size_t group_size, GuideResult *results,
+                                 bool *done) {
+    size_t restored = 0;
+    long good = (long)sizeof(CheckpointHeader);
+    for (;;) {
+        CheckpointBlock block;
+        if (read_exact(fp, &block, sizeof(block)) != 0 || block.first % group_size != 0
+            || block.first >= (uint64_t)n_guides || done[block.first / group_size]
+            || block.count != ((uint64_t)n_guides - block.first < group_size
+                               ? (uint64_t)n_guides - block.first : group_size)) {
+            break;
+        }
+        size_t first = (size_t)block.first;
+        size_t read = 0;
+        while (read < block.count
+               && read_checkpoint_guide(fp, ctx, string_pool_get(genes, guides[first + read].gene),
+                                        &guides[first + read], &results[first + read]) == 0) {
+            ++read;
+        }
+        uint64_t end = 0;
+        if (read < block.count || read_exact(fp, &end, sizeof(end)) != 0 || end != CHECKPOINT_BLOCK_END) {
+            for (size_t i = first; i <= first + read && i < first + block.count; ++i) {
+                free(results[i].mm0_transcripts);
+                free(results[i].details);
+                memset(&results[i], 0, sizeof(results[i]));
+            }
+            break;
+        }
+        done[first / group_size] = true;
+        ++restored;
+        good = ftell(fp);
+    }
+    if (fseek(fp, good, SEEK_SET) != 0 || ftruncate(fileno(fp), (off_t)good) != 0) {
+        fprintf(stderr, "Warning: unable to trim checkpoint '%s': %s\n", path, strerror(errno));
+    }
+    return restored;
+}
+
+static FILE *checkpoint_open(const char *path, const CheckpointHeader *expected) {
+    FILE *fp = fopen(path, "r+b");
+    if (fp) {
+        CheckpointHeader header;
+        if (read_exact(fp, &header, sizeof(header)) == 0 && memcmp(&header, expected, sizeof(header)) == 0) {
+            return fp;
+        }
+        fprintf(stderr, "Checkpoint '%s' was written for other guides, reference or options; starting over\n",
+                path);
+        fclose(fp);
+    }
+    fp = fopen(path, "w+b");
+    if (!fp) {
+        fprintf(stderr, "Error: unable to open checkpoint '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fwrite(expected, sizeof(*expected), 1, fp) != 1 || fflush(fp) != 0) {
+        fprintf(stderr, "Error: failed to write checkpoint '%s'\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+/*
+ * search_distinct group by group, restoring the groups already in the
+ * checkpoint at `path` and appending each one searched; `restored` counts
+ * the guides read back.  Progress (groups done, ETA from this run's rate)
+ * goes to stderr.
+ */
+int search_checkpointed(const SearchContext *ctx, ResultCache *cache, const char *path, size_t group_size,
+                        const StringPool *genes, const Guide *guides, int n_guides, size_t first_row,
+                        GuideResult *results, size_t *searched, size_t *restored_guides) {
+    CheckpointHeader expected;
+    memset(&expected, 0, sizeof(expected));
+    memcpy(expected.magic, CHECKPOINT_MAGIC, sizeof(expected.magic));
+    expected.version = CHECKPOINT_VERSION;
+    expected.byte_order = INDEX_BYTE_ORDER;
+    expected.key = checkpoint_key(ctx, genes, guides, n_guides, first_row, group_size);
+    expected.guide_count = (uint64_t)n_guides;
+    expected.group_size = group_size;
+    FILE *fp = checkpoint_open(path, &expected);
+    if (!fp) {
+        return -1;
+    }
+
+    size_t groups = ((size_t)n_guides + group_size - 1) / group_size;
+    bool *done = (bool *)xmalloc(groups + 1);
+    memset(done, 0, groups + 1);
+    size_t restored = checkpoint_restore(fp, path, ctx, genes, guides, n_guides, group_size, results, done);
+    if (restored > 0) {
+        fprintf(stderr, "Checkpoint '%s': resumed %zu of %zu groups\n", path, restored, groups);
+    }
+
+    *searched = 0;
+    *restored_guides = 0;
+    for (size_t g = 0; g < groups; ++g) {
+        if (done[g]) {
+            *restored_guides += (size_t)n_guides - g * group_size < group_size
+                ? (size_t)n_guides - g * group_size : group_size;
+        }
+    }
+    int status = 0;
+    size_t finished = restored;
+    double started = omp_get_wtime();
+    for (size_t g = 0; g < groups && status == 0; ++g) {
+        if (done[g]) {
+            continue;
+        }
+        size_t first = g * group_size;
+        size_t count = (size_t)n_guides - first < group_size ? (size_t)n_guides - first : group_size;
+        size_t group_searched = 0;
+        if (!search_distinct(ctx, cache, guides + first, (int)count, results + first, &group_searched)) {
+            run_search(ctx, guides + first, (int)count, results + first, NULL);
+        }
+        *searched += group_searched;
+
+        CheckpointBlock block = {first, count};
+        uint64_t end = CHECKPOINT_BLOCK_END;
+        fwrite(&block, sizeof(block), 1, fp);
+        for (size_t i = first; i < first + count; ++i) {
+            write_partial_guide(fp, string_pool_get(genes, guides[i].gene), &guides[i], &results[i]);
+        }
+        fwrite(&end, sizeof(end), 1, fp);
+        if (fflush(fp) != 0 || ferror(fp) || fsync(fileno(fp)) != 0) {
+            fprintf(stderr, "Error: failed to append to checkpoint '%s'\n", path);
+            status = -1;
+        }
+
+        ++finished;
+        double elapsed = omp_get_wtime() - started;
+        double eta = elapsed / (double)(finished - restored) * (double)(groups - finished);
+        fprintf(stderr, "Checkpoint: %zu/%zu groups done, %.0f s elapsed, ETA %.0f s\n",
+                finished, groups, elapsed, eta);
+    }
+    if (fclose(fp) != 0) {
+        status = -1;
+    }
+    free(done);
+    return status;
+}
@@ -0,0 +1,352 @@
+/*
+ * CUDA / HIP implementation of gpu.h.  The same source builds with nvcc
+ * (make GPU=cuda) and hipcc (make GPU=hip); GPU_API maps runtime calls.
+ *
+ * One thread owns one reference word, i.e. the 64 window starts it holds,
+ * and runs the bit-sliced mismatch counter of scan_group_packed over a
+ * batch of GPU_GUIDES_PER_BLOCK guides (blockIdx.y picks the batch).  A
+ * window leaves the loop once it is past MM5, and a thread stops early when
+ * all of its windows have.  Counts are added to per-guide device totals
+ * (non-zero words are rare, so plain atomics suffice) and windows within
+ * the hit level are appended to a hit buffer, which is grown and the
+ * launch repeated if it overflowed.
+ */
+#include "gpu.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__HIPCC__)
+#include <hip/hip_runtime.h>
+#define GPU_API(name) hip##name
+typedef hipError_t GpuError;
+#else
+#include <cuda_runtime.h>
+#define GPU_API(name) cuda##name
+typedef cudaError_t GpuError;
+#endif
+
+#define GPU_THREADS_PER_BLOCK 128
+#define GPU_GUIDES_PER_BLOCK 16
+#define GPU_MAX_BATCHES 65535       /* gridDim.y limit */
+#define GPU_MIN_HIT_CAPACITY (1u << 20)
+
+struct OtGpuReference {
+    int device;
+    size_t words;
+    uint64_t *lo;
+    uint64_t *hi;
+    uint64_t *nmask;
+    pthread_mutex_t lock;           /* guards the stored bitmap cache */
+    const uint64_t *stored_host;
+    uint64_t *stored;
+};
+
+static bool gpu_check(GpuError status, const char *what, char *error, size_t error_size) {
+    if (status == GPU_API(Success)) {
+        return true;
+    }
+    snprintf(error, error_size, "%s: %s", what, GPU_API(GetErrorString)(status));
+    return false;
+}
+
+static bool gpu_upload(uint64_t **dst, const uint64_t *src, size_t words, char *error, size_t error_size) {
+    *dst = NULL;
+    return gpu_check(GPU_API(Malloc)((void **)dst, words * sizeof(uint64_t)), "device allocation", error, error_size)
+        && gpu_check(GPU_API(Memcpy)(*dst, src, words * sizeof(uint64_t), GPU_API(MemcpyHostToDevice)),
+                     "reference upload", error, error_size);
+}
+
+extern "C" int ot_gpu_open(int device, const uint64_t *lo, const uint64_t *hi, const uint64_t *nmask, size_t words,
+                           OtGpuReference **out, char *error, size_t error_size) {
+    *out = NULL;
+    int devices = 0;
+    if (!gpu_check(GPU_API(GetDeviceCount)(&devices), "device query", error, error_size)) {
+        return -1;
+    }
+    if (device < 0 || device >= devices) {
+        snprintf(error, error_size, "device %d requested but %d available", device, devices);
+        return -1;
+    }
+    if (!gpu_check(GPU_API(SetDevice)(device), "device selection", error, error_size)) {
+        return -1;
+    }
+
+    OtGpuReference *ref = (OtGpuReference *)calloc(1, sizeof(OtGpuReference));
+    if (!ref) {
+        snprintf(error, error_size, "out of memory");
+        return -1;
+    }
+    ref->device = device;
+    ref->words = words;
+    pthread_mutex_init(&ref->lock, NULL);
+    if (!gpu_upload(&ref->lo, lo, words, error, error_size) || !gpu_upload(&ref->hi, hi, words, error, error_size)
+        || !gpu_upload(&ref->nmask, nmask, words, error, error_size)) {
+        ot_gpu_close(ref);
+        return -1;
+    }
+    *out = ref;
+    return 0;
+}
+
+extern "C" void ot_gpu_close(OtGpuReference *ref) {
+    if (!ref) {
+        return;
+    }
+    GPU_API(SetDevice)(ref->device);
+    GPU_API(Free)(ref->lo);
+    GPU_API(Free)(ref->hi);
+    GPU_API(Free)(ref->nmask);
+    GPU_API(Free)(ref->stored);
+    pthread_mutex_destroy(&ref->lock);
+    free(ref);
+}
+
+/* Window of `k`-shifted bases starting in word `w` (k < 64), as plane_window in search.c. */
+__device__ static inline uint64_t window_plane(uint64_t cur, uint64_t next, int k) {
+    return k == 0 ? cur : (cur >> k) | (next << (64 - k));
+}
+
+/* Bit i set where the 3-bit counter (c2 c1 c0) of window i equals `value`. */
+__device__ static inline uint64_t counter_equals(uint64_t c0, uint64_t c1, uint64_t c2, int value) {
+    return ((value & 1) ? c0 : ~c0) & ((value & 2) ? c1 : ~c1) & ((value & 4) ? c2 : ~c2);
+}
+
+__device__ static inline uint64_t counter_over_limit(uint64_t c0, uint64_t c1, uint64_t c2, uint64_t dead,
+                                                    int max_mismatches) {
+    uint64_t over = dead;
+    for (int value = max_mismatches + 1; value < 8; ++value) {
+        over |= counter_equals(c0, c1, c2, value);
+    }
+    return over;
+}
+
+__global__ void scan_kernel(const uint64_t *lo, const uint64_t *hi, const uint64_t *nmask,
+                            const uint64_t *const *valid_len, const uint64_t *any_valid, size_t data_words,
+                            const OtGpuGuide *guides, size_t n_guides, size_t guide_base, int max_mismatches,
+                            int hit_level,
+                            unsigned long long *counts, OtGpuHit *hits, unsigned long long *hit_count,
+                            unsigned long long hit_capacity) {
+    size_t word = (size_t)blockIdx.x * blockDim.x + threadIdx.x;
+    if (word >= data_words || !any_valid[word]) {
+        return;
+    }
+    uint64_t lo0 = lo[word], lo1 = lo[word + 1];
+    uint64_t hi0 = hi[word], hi1 = hi[word + 1];
+    uint64_t n0 = nmask[word], n1 = nmask[word + 1];
+
+    size_t first = guide_base + (size_t)blockIdx.y * GPU_GUIDES_PER_BLOCK;
+    size_t last = first + GPU_GUIDES_PER_BLOCK < n_guides ? first + GPU_GUIDES_PER_BLOCK : n_guides;
+    for (size_t g = first; g < last; ++g) {
+        OtGpuGuide guide = guides[g];
+        uint64_t valid = valid_len[guide.length][word];
+        if (!valid) {
+            continue;
+        }
+        uint64_t c0 = 0, c1 = 0, c2 = 0, dead = 0;
+        for (int k = 0; k < guide.length; ++k) {
+            uint64_t wlo = window_plane(lo0, lo1, k);
+            uint64_t whi = window_plane(hi0, hi1, k);
+            uint64_t wn = window_plane(n0, n1, k);
+            uint64_t glo = 0 - (uint64_t)((guide.lo >> k) & 1);
+            uint64_t ghi = 0 - (uint64_t)((guide.hi >> k) & 1);
+            uint64_t gn = 0 - (uint64_t)((guide.n >> k) & 1);
+            uint64_t diff = ((wlo ^ glo) | (whi ^ ghi) | wn) & ~gn;
+            uint64_t carry = diff | (~wn & gn);
+            uint64_t next = c0 & carry;
+            c0 ^= carry;
+            carry = next;
+            next = c1 & carry;
+            c1 ^= carry;
+            carry = next;
+            next = c2 & carry;
+            c2 ^= carry;
+            dead |= next;
+            if ((valid & ~counter_over_limit(c0, c1, c2, dead, max_mismatches)) == 0) {
+                break;
+            }
+        }
+
+        uint64_t live = valid & ~counter_over_limit(c0, c1, c2, dead, max_mismatches);
+        if (!live) {
+            continue;
+        }
+        uint64_t wanted = 0;
+        for (int mm = 0; mm < OT_GPU_LEVELS; ++mm) {
+            uint64_t level = live & counter_equals(c0, c1, c2, mm);
+            if (level) {
+                atomicAdd(&counts[g * OT_GPU_LEVELS + (size_t)mm], (unsigned long long)__popcll(level));
+                if (mm <= hit_level) {
+                    wanted |= level;
+                }
+            }
+        }
+        while (wanted) {
+            int bit = __ffsll((long long)wanted) - 1;
+            wanted &= wanted - 1;
+            unsigned long long slot = atomicAdd(hit_count, 1ULL);
+            if (slot < hit_capacity) {
+                OtGpuHit hit;
+                hit.position = (uint64_t)word * 64 + (uint64_t)bit;
+                hit.guide = (uint32_t)g;
+                hit.mismatches = (uint32_t)(((c0 >> bit) & 1) | (((c1 >> bit) & 1) << 1) | (((c2 >> bit) & 1) << 2));
+                hits[slot] = hit;
+            }
+        }
+    }
+}
+
+static int compare_hits(const void *a, const void *b) {
+    const OtGpuHit *x = (const OtGpuHit *)a;
+    const OtGpuHit *y = (const OtGpuHit *)b;
+    if (x->guide != y->guide) {
+        return x->guide < y->guide ? -1 : 1;
+    }
+    return x->position < y->position ? -1 : (x->position > y->position ? 1 : 0);
+}
+
+/* Device copy of the stored bitmap, uploaded on first use. */
+static uint64_t *stored_bitmap(OtGpuReference *ref, const uint64_t *host, char *error, size_t error_size) {
+    pthread_mutex_lock(&ref->lock);
+    if (ref->stored_host != host) {
+        GPU_API(Free)(ref->stored);
+        ref->stored = NULL;
+        ref->stored_host = NULL;
+        if (gpu_upload(&ref->stored, host, ref->words, error, error_size)) {
+            ref->stored_host = host;
+        }
+    }
+    uint64_t *stored = ref->stored;
+    pthread_mutex_unlock(&ref->lock);
+    return stored;
+}
+
+extern "C" int ot_gpu_search(OtGpuReference *ref, const uint64_t *const valid_len[OT_GPU_MAX_GUIDE_LEN + 1],
+                             const uint64_t *any_valid, const uint64_t *stored_valid, size_t data_words,
+                             const OtGpuGuide *guides, size_t n_guides, int max_mismatches, int hit_level,
+                             uint64_t *counts,
+                             OtGpuHit **hits, size_t *hit_count, char *error, size_t error_size) {
+    *hits = NULL;
+    *hit_count = 0;
+    if (n_guides == 0) {
+        return 0;
+    }
+    if (!gpu_check(GPU_API(SetDevice)(ref->device), "device selection", error, error_size)) {
+        return -1;
+    }
+
+    /* Device bitmaps for every distinct host bitmap of this search. */
+    const uint64_t *host_maps[OT_GPU_MAX_GUIDE_LEN + 2];
+    uint64_t *device_maps[OT_GPU_MAX_GUIDE_LEN + 2];
+    bool owned[OT_GPU_MAX_GUIDE_LEN + 2];
+    int map_count = 0;
+    uint64_t *table_host[OT_GPU_MAX_GUIDE_LEN + 1];
+    uint64_t *any_device = NULL;
+    bool ok = true;
+    for (int len = 0; len <= OT_GPU_MAX_GUIDE_LEN + 1 && ok; ++len) {
+        const uint64_t *host = len <= OT_GPU_MAX_GUIDE_LEN ? valid_len[len] : any_valid;
+        uint64_t *device = NULL;
+        for (int m = 0; m < map_count; ++m) {
+            if (host_maps[m] == host) {
+                device = device_maps[m];
+            }
+        }
+        if (host && !device) {
+            bool stored = host == stored_valid;
+            device = stored ? stored_bitmap(ref, host, error, error_size) : NULL;
+            if (!stored) {
+                ok = gpu_upload(&device, host, ref->words, error, error_size);
+            }
+            ok = ok && device;
+            host_maps[map_count] = host;
+            device_maps[map_count] = device;
+            owned[map_count++] = !stored;
+        }
+        if (len <= OT_GPU_MAX_GUIDE_LEN) {
+            table_host[len] = device;
+        } else {
+            any_device = device;
+        }
+    }
+
+    uint64_t **table = NULL;
+    OtGpuGuide *guides_device = NULL;
+    unsigned long long *counts_device = NULL;
+    unsigned long long *count_device = NULL;
+    OtGpuHit *hits_device = NULL;
+    size_t counts_bytes = n_guides * OT_GPU_LEVELS * sizeof(unsigned long long);
+    unsigned long long capacity = GPU_MIN_HIT_CAPACITY > n_guides * 16 ? GPU_MIN_HIT_CAPACITY : n_guides * 16;
+    unsigned long long found = 0;
+    ok = ok && any_device
+        && gpu_check(GPU_API(Malloc)((void **)&table, sizeof(table_host)), "device allocation", error, error_size)
+        && gpu_check(GPU_API(Memcpy)(table, table_host, sizeof(table_host), GPU_API(MemcpyHostToDevice)),
+                     "bitmap table upload", error, error_size)
+        && gpu_check(GPU_API(Malloc)((void **)&guides_device, n_guides * sizeof(OtGpuGuide)), "device allocation",
+                     error, error_size)
+        && gpu_check(GPU_API(Memcpy)(guides_device, guides, n_guides * sizeof(OtGpuGuide),
+                                     GPU_API(MemcpyHostToDevice)), "guide upload", error, error_size)
+        && gpu_check(GPU_API(Malloc)((void **)&counts_device, counts_bytes), "device allocation", error, error_size)
+        && gpu_check(GPU_API(Malloc)((void **)&count_device, sizeof(*count_device)), "device allocation",
+                     error, error_size);
+
+    /* Launch until the hit buffer was large enough (normally once). */
+    while (ok) {
+        ok = gpu_check(GPU_API(Malloc)((void **)&hits_device, capacity * sizeof(OtGpuHit)), "device allocation",
+                       error, error_size)
+            && gpu_check(GPU_API(Memset)(counts_device, 0, counts_bytes), "device memset", error, error_size)
+            && gpu_check(GPU_API(Memset)(count_device, 0, sizeof(*count_device)), "device memset", error, error_size);
+        size_t batches = (n_guides + GPU_GUIDES_PER_BLOCK - 1) / GPU_GUIDES_PER_BLOCK;
+        for (size_t batch = 0; batch < batches && ok; batch += GPU_MAX_BATCHES) {
+            size_t launch_batches = batches - batch < GPU_MAX_BATCHES ? batches - batch : GPU_MAX_BATCHES;
+            dim3 grid((unsigned)((data_words + GPU_THREADS_PER_BLOCK - 1) / GPU_THREADS_PER_BLOCK),
+                      (unsigned)launch_batches);
+            scan_kernel<<<grid, GPU_THREADS_PER_BLOCK>>>(ref->lo, ref->hi, ref->nmask, table, any_device,
+                                                         data_words, guides_device, n_guides,
+                                                         batch * GPU_GUIDES_PER_BLOCK, max_mismatches, hit_level,
+                                                         counts_device,
+                                                         hits_device, count_device, capacity);
+            ok = gpu_check(GPU_API(GetLastError)(), "kernel launch", error, error_size);
+        }
+        ok = ok && gpu_check(GPU_API(Memcpy)(&found, count_device, sizeof(found), GPU_API(MemcpyDeviceToHost)),
+                             "scan", error, error_size);
+        if (!ok || found <= capacity) {
+            break;
+        }
+        GPU_API(Free)(hits_device);
+        hits_device = NULL;
+        capacity = found;
+    }
+
+    if (ok) {
+        *hits = (OtGpuHit *)malloc(found ? found * sizeof(OtGpuHit) : 1);
+        ok = *hits != NULL;
+        if (!ok) {
+            snprintf(error, error_size, "out of memory");
+        }
+    }
+    ok = ok && gpu_check(GPU_API(Memcpy)(counts, counts_device, counts_bytes, GPU_API(MemcpyDeviceToHost)),
+                         "count download", error, error_size)
+        && gpu_check(GPU_API(Memcpy)(*hits, hits_device, found * sizeof(OtGpuHit), GPU_API(MemcpyDeviceToHost)),
+                     "hit download", error, error_size);
+    if (ok) {
+        qsort(*hits, (size_t)found, sizeof(OtGpuHit), compare_hits);
+        *hit_count = (size_t)found;
+    } else {
+        free(*hits);
+        *hits = NULL;
+    }
+
+    GPU_API(Free)(hits_device);
+    GPU_API(Free)(count_device);
+    GPU_API(Free)(counts_device);
+    GPU_API(Free)(guides_device);
+    GPU_API(Free)(table);
+    for (int m = 0; m < map_count; ++m) {
+        if (owned[m]) {
+            GPU_API(Free)(device_maps[m]);
+        }
+    }
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,70 @@
+/*
+ * GPU scan backend for search.c's "--engine gpu" (make GPU=cuda or GPU=hip).
+ *
+ * The device keeps one copy of the packed reference planes for the life of
+ * a context.  A search uploads its guides (and any validity bitmap not
+ * cached yet), counts windows per mismatch level on the device and returns
+ * the windows the host needs listed (MM0 transcripts, --hits-out details)
+ * as hit records in (guide, position) order.  Semantics match the packed
+ * CPU scan exactly: same N handling, same validity bitmaps, same counts.
+ */
+#ifndef OFFTARGET_GPU_H
+#define OFFTARGET_GPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OT_GPU_MAX_GUIDE_LEN 64
+#define OT_GPU_LEVELS 6             /* MM0..MM5, as MAX_MISMATCHES in search.c */
+
+/* A guide as bit-planes: bit k describes base k (A=00 C=01 G=10 T=11, n marks N). */
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t n;
+    int32_t length;
+} OtGpuGuide;
+
+/* A window within the requested hit level: `guide` indexes the search's guides. */
+typedef struct {
+    uint64_t position;
+    uint32_t guide;
+    uint32_t mismatches;
+} OtGpuHit;
+
+typedef struct OtGpuReference OtGpuReference;
+
+/*
+ * Uploads `words` words of each plane to device `device`.  Returns 0, or
+ * -1 with a message in `error`.
+ */
+int ot_gpu_open(int device, const uint64_t *lo, const uint64_t *hi, const uint64_t *nmask, size_t words,
+                OtGpuReference **out, char *error, size_t error_size);
+
+/*
+ * Scans words [0, data_words) for `n_guides` guides.  valid_len[len] is the
+ * window-start bitmap for guides of that length and `any_valid` a superset
+ * of all of them; bitmaps equal to `stored_valid` are uploaded once per
+ * reference, the others per call.  counts receives n_guides x
+ * OT_GPU_LEVELS totals, of which levels above `max_mismatches` stay zero
+ * (windows past it are abandoned early).  Every window with at most
+ * `hit_level` mismatches
+ * is returned in *hits (malloc'd, sorted by guide then position, freed by
+ * the caller).  Safe to call from several threads at once.
+ */
+int ot_gpu_search(OtGpuReference *ref, const uint64_t *const valid_len[OT_GPU_MAX_GUIDE_LEN + 1],
+                  const uint64_t *any_valid, const uint64_t *stored_valid, size_t data_words,
+                  const OtGpuGuide *guides, size_t n_guides, int max_mismatches, int hit_level, uint64_t *counts,
+                  OtGpuHit **hits, size_t *hit_count, char *error, size_t error_size);
+
+void ot_gpu_close(OtGpuReference *ref);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OFFTARGET_GPU_H */
@@ -0,0 +1,131 @@
+/*
+ * libofftarget: in-process API for the off-target search engine
+ *
+ * Build with `make lib` (bin/libofftarget.so).  A reference is opened once
+ * and may then be searched any number of times, from any number of threads;
+ * it is only read after loading.  Functions report failures by returning
+ * NULL or -1 and print the reason to stderr, like the command-line tool.
+ *
+ * Guides are passed as one contiguous buffer: guide i occupies
+ * sequences[i * stride .. i * stride + lengths[i]) (e.g. a numpy "S64"
+ * array).  Results are written to caller-provided arrays in guide order.
+ */
+#ifndef OFFTARGET_H
+#define OFFTARGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OT_API_VERSION 2
+#define OT_MAX_MISMATCHES 5
+#define OT_MAX_GUIDE_LENGTH 64
+#define OT_NO_CAP UINT64_MAX
+
+enum {
+    OT_ENGINE_PACKED = 0,
+    OT_ENGINE_BYTE = 1,
+    OT_ENGINE_INDEX = 2,
+    OT_ENGINE_GPU = 3                           /* experimental, make GPU=cuda|hip; else packed */
+};
+
+typedef struct {
+    int engine;                                 /* OT_ENGINE_* */
+    int max_mismatches;                         /* highest MMk computed, 0..OT_MAX_MISMATCHES */
+    int window_length;                          /* guide length validity is precomputed for */
+    int threads;                                /* OpenMP threads, 0 = default */
+    uint64_t max_hits[OT_MAX_MISMATCHES + 1];   /* per-level caps (--max-mmK), OT_NO_CAP = none */
+} ot_options;
+
+/* MM0 hits of a search: guide i hit transcripts[offsets[i] .. offsets[i + 1]). */
+typedef struct {
+    uint64_t *offsets;
+    uint64_t *transcripts;
+} ot_hits;
+
+typedef struct ot_reference ot_reference;
+
+int ot_api_version(void);
+
+/* Defaults: packed engine, 5 mismatches, window 23, no caps. */
+void ot_options_init(ot_options *options);
+
+/* Opens a FASTA file or index image; NULL on failure. */
+ot_reference *ot_reference_open(const char *path, const ot_options *options);
+void ot_reference_close(ot_reference *ref);
+
+size_t ot_reference_transcript_count(const ot_reference *ref);
+const char *ot_reference_transcript_id(const ot_reference *ref, size_t index);
+const char *ot_reference_gene_symbol(const ot_reference *ref, size_t index);
+
+/* Maps a disqualification position to its transcript and offset within it. */
+int ot_reference_locate(const ot_reference *ref, uint64_t position, size_t *transcript, uint64_t *offset);
+
+/*
+ * Searches n_guides guides.  `counts` receives n_guides rows of
+ * OT_MAX_MISMATCHES + 1 values (levels above max_mismatches are 0).
+ * `hits` (optional) receives MM0 transcript indices allocated by the
+ * library; release them with ot_hits_free.  `disqualified_mm` and
+ * `disqualified_pos` (optional, used with caps) receive the level that
+ * retired each guide (-1 if none) and the reference position of the window
+ * that did.  Returns 0 on success, -1 on invalid input.
+ */
+int ot_search(const ot_reference *ref,
+              const char *sequences, size_t stride, const int32_t *lengths, size_t n_guides,
+              uint64_t *counts, ot_hits *hits,
+              int32_t *disqualified_mm, uint64_t *disqualified_pos);
+
+void ot_hits_free(ot_hits *hits);
+
+/*
+ * Guide tables: the candidate guides of a target FASTA, enumerated as TIGER
+ * does.  Each window of context_5p + guide_length + context_3p bases of a
+ * record is one guide; its target is the guide_length bases after the 5'
+ * context (what the off-target search looks for) and its spacer the
+ * reverse complement of those.  A record with a non-ACGT base at a target
+ * position is skipped (TIGER cannot complement it); one shorter than a
+ * window has none.  Windows are numbered record by record.
+ */
+typedef struct ot_guides ot_guides;
+
+/* NULL on failure.  guide_length 1..OT_MAX_GUIDE_LENGTH, contexts 0..OT_MAX_GUIDE_LENGTH. */
+ot_guides *ot_guides_open(const char *fasta_path, int guide_length, int context_5p, int context_3p);
+void ot_guides_close(ot_guides *guides);
+
+size_t ot_guides_count(const ot_guides *guides);
+size_t ot_guides_record_count(const ot_guides *guides);
+/* The record's header up to the first '|'. */
+const char *ot_guides_record_id(const ot_guides *guides, size_t record);
+/* ot_guides_record_count + 1 entries: record r owns windows [offsets[r], offsets[r + 1]). */
+const uint64_t *ot_guides_record_offsets(const ot_guides *guides);
+int ot_guides_record_skipped(const ot_guides *guides, size_t record);
+
+/*
+ * Model inputs of windows [first, first + count), as TIGER's process_data
+ * builds them: per window, 2 * window length rows of 4 floats, the one-hot
+ * window (A, C, G, T; other bases all zero) and then the one-hot complement
+ * of its target with all-zero rows in place of the contexts.  Returns -1 if
+ * the range is out of bounds.
+ */
+int ot_guides_encode(const ot_guides *guides, size_t first, size_t count, float *inputs);
+
+/* Writes the targets and/or spacers (either may be NULL) of a range, `stride` bytes each, NUL padded. */
+int ot_guides_sequences(const ot_guides *guides, size_t first, size_t count,
+                        char *targets, char *spacers, size_t stride);
+
+/* ot_search over the targets of the given windows of `guides`, without copying them out. */
+int ot_search_windows(const ot_reference *ref, const ot_guides *guides, const uint64_t *windows, size_t n_windows,
+                      uint64_t *counts, ot_hits *hits,
+                      int32_t *disqualified_mm, uint64_t *disqualified_pos);
+
+/* Writes an index image like `offtarget_search index build`; kmer_length 0 stores no seeds. */
+int ot_index_build(const char *reference_path, const char *index_path, int window_length, int kmer_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OFFTARGET_H */
@@ -0,0 +1,337 @@
+/*
+ * 'screen' looks for sequences with no window within K mismatches anywhere
+ * in the reference, e.g. non-targeting controls.  A candidate is rejected
+ * at its first such window: the index engine stops its seed lookups there
+ * (screen_candidates in search.c), and the packed engine retires it through
+ * --max-mm0..K caps of 0.  Candidates are screened in batches of
+ * SCREEN_BATCH and the survivors written, in input order, after each.
+ */
+#include "search_internal.h"
+
+#define SCREEN_BATCH 65536
+
+typedef struct {
+    int count;                      /* survivors to generate; 0 = read candidates */
+    uint64_t state;                 /* splitmix64 state, from --seed */
+    int gc_min;                     /* percent */
+    int gc_max;
+    int max_homopolymer;            /* longest run of one base */
+    int max_dinucleotide;           /* most consecutive copies of one base pair */
+} CandidateGenerator;
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* The constraints of scripts/nt_guides/generate_nt_candidates.py. */
+static bool candidate_acceptable(const CandidateGenerator *gen, const char *sequence, int length) {
+    int gc = 0;
+    int run = 1;
+    for (int i = 0; i < length; ++i) {
+        gc += sequence[i] == 'C' || sequence[i] == 'G';
+        run = i > 0 && sequence[i] == sequence[i - 1] ? run + 1 : 1;
+        if (run > gen->max_homopolymer) {
+            return false;
+        }
+    }
+    if (gc * 100 < gen->gc_min * length || gc * 100 > gen->gc_max * length) {
+        return false;
+    }
+    for (int i = 0; i + 2 * (gen->max_dinucleotide + 1) <= length; ++i) {
+        int copies = 1;
+        while (copies <= gen->max_dinucleotide && sequence[i + 2 * copies] == sequence[i]
+               && sequence[i + 2 * copies + 1] == sequence[i + 1]) {
+            copies++;
+        }
+        if (copies > gen->max_dinucleotide) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Draws sequences until one meets the constraints; false if none does in 10000 draws. */
+static bool generate_candidate(CandidateGenerator *gen, int length, Guide *guide) {
+    static const char bases[4] = {'A', 'C', 'G', 'T'};
+    for (int attempt = 0; attempt < 10000; ++attempt) {
+        uint64_t bits = 0;
+        for (int i = 0; i < length; ++i) {
+            if (i % 32 == 0) {
+                bits = splitmix64(&gen->state);
+            }
+            guide->sequence[i] = bases[bits & 3];
+            bits >>= 2;
+        }
+        if (candidate_acceptable(gen, guide->sequence, length)) {
+            guide->sequence[length] = '\0';
+            guide->length = length;
+            guide->gene = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Generated survivors already written, so a repeat draw is not written twice. */
+typedef struct {
+    uint64_t *keys;                 /* lo, hi bit-plane pairs; lo = hi = ~0 marks an empty slot */
+    size_t capacity;
+    size_t count;
+} SurvivorSet;
+
+static size_t survivor_slot(const SurvivorSet *set, uint64_t lo, uint64_t hi) {
+    size_t slot = (size_t)((lo * 0x9E3779B97F4A7C15ULL) ^ (hi * 0xC2B2AE3D27D4EB4FULL)) >> 7;
+    for (slot &= set->capacity - 1; ; slot = (slot + 1) & (set->capacity - 1)) {
+        uint64_t *key = &set->keys[2 * slot];
+        if ((key[0] == lo && key[1] == hi) || (key[0] == ~0ULL && key[1] == ~0ULL)) {
+            return slot;
+        }
+    }
+}
+
+/* Adds `guide`; false if it was already there. */
+static bool survivor_set_add(SurvivorSet *set, const Guide *guide) {
+    if (2 * (set->count + 1) > set->capacity) {
+        SurvivorSet grown = {NULL, set->capacity ? set->capacity * 2 : 1024, set->count};
+        grown.keys = (uint64_t *)xmalloc(2 * grown.capacity * sizeof(uint64_t));
+        memset(grown.keys, 0xff, 2 * grown.capacity * sizeof(uint64_t));
+        for (size_t slot = 0; slot < set->capacity; ++slot) {
+            const uint64_t *key = &set->keys[2 * slot];
+            if (key[0] != ~0ULL || key[1] != ~0ULL) {
+                memcpy(&grown.keys[2 * survivor_slot(&grown, key[0], key[1])], key, 2 * sizeof(uint64_t));
+            }
+        }
+        free(set->keys);
+        *set = grown;
+    }
+    GuideBits bits;
+    guide_bits(guide, &bits);
+    uint64_t *key = &set->keys[2 * survivor_slot(set, bits.lo, bits.hi)];
+    if (key[0] == bits.lo && key[1] == bits.hi) {
+        return false;
+    }
+    key[0] = bits.lo;
+    key[1] = bits.hi;
+    set->count++;
+    return true;
+}
+
+/*
+ * Reads up to `max` candidates of `length` bases from `in`: the first
+ * field of each line (so generate_nt_candidates.py output works as is),
+ * skipping blank lines and '#' comments.  Other lengths or bases are
+ * counted in `skipped`.  Returns the number read; *eof is set at the end.
+ */
+static int read_candidates(FILE *in, int length, Guide *guides, int max, size_t *skipped, bool *eof) {
+    char *line = NULL;
+    size_t capacity = 0;
+    int n = 0;
+    while (n < max) {
+        if (getline(&line, &capacity, in) < 0) {
+            *eof = true;
+            break;
+        }
+        char *token = line + strspn(line, " \t");
+        size_t token_len = strcspn(token, " \t,\r\n");
+        if (token_len == 0 || token[0] == '#') {
+            continue;
+        }
+        bool usable = token_len == (size_t)length;
+        for (size_t i = 0; i < token_len && usable; ++i) {
+            char base = (char)toupper((unsigned char)token[i]);
+            usable = base == 'A' || base == 'C' || base == 'G' || base == 'T' || base == 'U';
+            guides[n].sequence[i] = base == 'U' ? 'T' : base;
+        }
+        if (!usable) {
+            (*skipped)++;
+            continue;
+        }
+        guides[n].sequence[length] = '\0';
+        guides[n].length = length;
+        guides[n].gene = 0;
+        n++;
+    }
+    free(line);
+    return n;
+}
+
+/* Sets hit[i] when guides[i] has a window within the mismatch limit. */
+int screen_main(int argc, char *argv[], const char *prog) {
+    SearchContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    search_options_init(&ctx.options);
+    ctx.options.engine = ENGINE_INDEX;
+    ctx.options.max_mismatches = 2;
+    const char *candidates_file = "-";
+    const char *output_file = "-";
+    CandidateGenerator gen = {0, 42, 40, 60, 3, 3};
+    int seed = 42;
+    int limit = 0;
+
+    static const struct option long_options[] = {
+        SEARCH_LONG_OPTIONS,
+        {"candidates", required_argument, NULL, 'i'},
+        {"output", required_argument, NULL, 'o'},
+        {"generate", required_argument, NULL, 'n'},
+        {"seed", required_argument, NULL, 's'},
+        {"gc-min", required_argument, NULL, 'l'},
+        {"gc-max", required_argument, NULL, 'u'},
+        {"max-homopolymer", required_argument, NULL, 'r'},
+        {"max-dinucleotide", required_argument, NULL, 'd'},
+        {"limit", required_argument, NULL, 'L'},
+        {NULL, 0, NULL, 0}
+    };
+
+    optind = 1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        int parsed = 0;
+        if (opt == 'i') {
+            candidates_file = optarg;
+        } else if (opt == 'o') {
+            output_file = optarg;
+        } else if (opt == 'n') {
+            parsed = parse_int_option("--generate", optarg, 1, INT_MAX, &gen.count);
+        } else if (opt == 's') {
+            parsed = parse_int_option("--seed", optarg, 0, INT_MAX, &seed);
+        } else if (opt == 'l') {
+            parsed = parse_int_option("--gc-min", optarg, 0, 100, &gen.gc_min);
+        } else if (opt == 'u') {
+            parsed = parse_int_option("--gc-max", optarg, 0, 100, &gen.gc_max);
+        } else if (opt == 'r') {
+            parsed = parse_int_option("--max-homopolymer", optarg, 1, MAX_GUIDE_LEN, &gen.max_homopolymer);
+        } else if (opt == 'd') {
+            parsed = parse_int_option("--max-dinucleotide", optarg, 1, MAX_GUIDE_LEN, &gen.max_dinucleotide);
+        } else if (opt == 'L') {
+            parsed = parse_int_option("--limit", optarg, 1, INT_MAX, &limit);
+        } else {
+            int handled = parse_search_option(opt, optarg, &ctx.options);
+            if (handled <= 0) {
+                if (handled == 0) {
+                    print_usage(prog);
+                }
+                return EXIT_FAILURE;
+            }
+        }
+        if (parsed != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind < 1) {
+        print_usage(prog);
+        return EXIT_FAILURE;
+    }
+    if (validate_search_options(&ctx.options) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (ctx.options.engine == ENGINE_BYTE || ctx.options.engine == ENGINE_GPU || ctx.options.caps.active
+        || ctx.options.mismatch_profile || ctx.options.collapse_isoforms) {
+        fprintf(stderr, "Error: screen takes --engine index or packed and --max-mismatches only\n");
+        return EXIT_FAILURE;
+    }
+    if (gen.gc_min > gen.gc_max) {
+        fprintf(stderr, "Error: --gc-min must not exceed --gc-max\n");
+        return EXIT_FAILURE;
+    }
+    int length = ctx.options.guide_length > 0 ? ctx.options.guide_length : DEFAULT_INDEX_WINDOW;
+    if (gen.count > 0) {
+        gen.state = (uint64_t)seed;
+        if (limit == 0) {
+            limit = gen.count > INT_MAX / 100 ? INT_MAX : gen.count * 100;
+        }
+    }
+
+    FILE *in = NULL;
+    if (gen.count == 0) {
+        in = strcmp(candidates_file, "-") == 0 ? stdin : fopen(candidates_file, "r");
+        if (!in) {
+            fprintf(stderr, "Error: cannot open %s: %s\n", candidates_file, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+    FILE *out = strcmp(output_file, "-") == 0 ? stdout : fopen(output_file, "w");
+    if (!out) {
+        fprintf(stderr, "Error: cannot open %s: %s\n", output_file, strerror(errno));
+        if (in && in != stdin) {
+            fclose(in);
+        }
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_FAILURE;
+    if (load_search_context(&ctx, argv[optind], length) == 0
+        && (ctx.options.engine != ENGINE_INDEX || prepare_seed_index_for_window(&ctx, length) == 0)) {
+        Guide *guides = (Guide *)xmalloc(SCREEN_BATCH * sizeof(Guide));
+        bool *hit = (bool *)xmalloc(SCREEN_BATCH * sizeof(bool));
+        size_t screened = 0;
+        size_t skipped = 0;
+        size_t survivors = 0;
+        bool eof = false;
+        SurvivorSet seen = {NULL, 0, 0};
+        double started = omp_get_wtime();
+        status = EXIT_SUCCESS;
+        while (!eof && (gen.count == 0 || survivors < (size_t)gen.count)
+               && (limit == 0 || screened < (size_t)limit)) {
+            int batch = SCREEN_BATCH;
+            /* Small requests draw about twice the survivors still needed; most candidates survive. */
+            size_t wanted = gen.count > 0 ? 2 * ((size_t)gen.count - survivors) : (size_t)batch;
+            if (wanted < (size_t)batch) {
+                batch = (int)wanted;
+            }
+            if (limit > 0 && (size_t)limit - screened < (size_t)batch) {
+                batch = (int)((size_t)limit - screened);
+            }
+            int n = 0;
+            if (gen.count > 0) {
+                for (; n < batch; ++n) {
+                    if (!generate_candidate(&gen, length, &guides[n])) {
+                        fprintf(stderr, "Error: no %d-base sequence met the GC and repeat constraints "
+                                "in 10000 draws\n", length);
+                        status = EXIT_FAILURE;
+                        break;
+                    }
+                }
+            } else {
+                n = read_candidates(in, length, guides, batch, &skipped, &eof);
+            }
+            if (n == 0 || status != EXIT_SUCCESS) {
+                break;
+            }
+            screen_candidates(&ctx, guides, n, hit);
+            screened += (size_t)n;
+            for (int i = 0; i < n && (gen.count == 0 || survivors < (size_t)gen.count); ++i) {
+                if (!hit[i] && (gen.count == 0 || survivor_set_add(&seen, &guides[i]))) {
+                    fprintf(out, "%s\n", guides[i].sequence);
+                    survivors++;
+                }
+            }
+            if (fflush(out) != 0) {
+                fprintf(stderr, "Error: writing %s failed: %s\n", output_file, strerror(errno));
+                status = EXIT_FAILURE;
+                break;
+            }
+        }
+        double elapsed = omp_get_wtime() - started;
+        fprintf(stderr, "Screened %zu candidates within %d mismatches in %.2f s (%.0f per second): "
+                "%zu survivors, %zu skipped\n", screened, ctx.options.max_mismatches, elapsed,
+                elapsed > 0.0 ? (double)screened / elapsed : 0.0, survivors, skipped);
+        if (gen.count > 0 && survivors < (size_t)gen.count) {
+            fprintf(stderr, "Warning: only %zu of %d survivors within --limit %d candidates\n",
+                    survivors, gen.count, limit);
+        }
+        free(seen.keys);
+        free(guides);
+        free(hit);
+    }
+    if (in && in != stdin) {
+        fclose(in);
+    }
+    if (out != stdout && fclose(out) != 0) {
+        status = EXIT_FAILURE;
+    }
+    free_search_context(&ctx);
+    return status;
+}
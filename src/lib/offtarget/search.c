@@ -1,56 +1,121 @@
 /*
- * High-performance off-target search using AVX2 + OpenMP
+ * High-performance off-target search using runtime-selected SIMD
+ * (AVX-512, AVX2, 128-bit NEON/SSE2 or scalar) + OpenMP
  *
- * Usage: offtarget_search guides.csv reference.fasta output.csv
+ * Usage: offtarget_search [--engine packed|byte|index|gpu] [--max-mismatches K]
+ *                         [--guide-length N] [--max-mm0..--max-mm5 N]
+ *                         [--hits-out PATH [--hits-max-mm K]]
+ *                         guides.csv reference.fasta output.csv
+ *        offtarget_search serve [search options] [--window-length N] [--socket PATH]
+ *                         reference
+ *        offtarget_search index build [--window-length N] [--kmer K]
+ *                         reference.fasta reference.otidx
+ *        offtarget_search merge [--hits-out PATH] [--output-format csv|columnar]
+ *                         reference output partial...
+ *        offtarget_search screen [--max-mismatches K] [--candidates PATH | --generate N]
+ *                         reference
+ *
+ * The reference argument of a search may also be an index image produced by
+ * "index build"; it is memory-mapped instead of re-parsing the FASTA.
+ *
+ * A FASTA reference may be gzip-compressed; BGZF files (bgzip) are
+ * decompressed block-parallel.
+ *
+ * TIGER_OFFTARGET_SIMD=scalar|vec128|avx2|avx512 caps the kernel family
+ * picked at startup (default: the best the CPU supports).
+ * TIGER_OFFTARGET_NUMA=interleave|replicate places the reference across the
+ * NUMA nodes of a multi-socket host and pins threads to them (Linux).
+ *
+ * Built with -DOFFTARGET_GPU (make GPU=cuda|hip) --engine gpu runs the packed
+ * scan on a device through gpu.h.  The backend is experimental: CI only
+ * compiles gpu.cu, so any build without it, and any device that fails to
+ * open, warns and scans on the CPU with the packed engine instead.
+ *
+ * Built with -DOFFTARGET_LIBRARY the command-line front end is left out and
+ * the file becomes libofftarget.so, exposing the API in offtarget.h.  The
+ * binary adds the subcommands and run modes in cache.c, checkpoint.c,
+ * serve.c, stream.c and screen.c, which share search_internal.h with it.
  *
  * The guides.csv file must contain a header row with at least the columns:
  *   Gene,Sequence
  *
  * Results are written in the same order as input with columns:
  *   Gene,Sequence,MM0,MM1,MM2,MM3,MM4,MM5,MM0_Transcripts,MM0_Genes
+ * plus a Status column when any --max-mmK cap is given.  --hits-out writes
+ * the individual windows behind the MM0..MMK counts (K = --hits-max-mm,
+ * default 0) with their transcript and offset.  --reference-shard and
+ * --guide-shard restrict a run to one slice of the reference or the guides;
+ * with --partial it writes a binary partial that 'merge' combines.
+ * --output-format columnar replaces the CSV with a memory-mappable column
+ * file.  Results are written by a separate thread as guides finish.
+ * A guides file of "-" streams rows from stdin and searches them in
+ * batches as they arrive (--window-length sizes the reference up front).
+ * Repeated sequences are searched once, and --cache-dir keeps results per
+ * sequence across runs so only sequences never seen before are scanned;
+ * --cache-from OLD updates results cached against an earlier reference
+ * release by scanning only the transcripts that differ.
+ * --stats PATH records per-phase timings and work counters as JSON.
+ * Guides may be up to MAX_GUIDE_LEN (64) bases; --guide-length N rejects
+ * guides of any other length and sizes the reference for N.
+ * --position-weights adds Mismatch_Positions and OffTarget_Score columns,
+ * built from the mismatch bitmaps of the windows the scan kernels accept.
+ * --collapse-isoforms scans a gene's windows shared between isoforms once.
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <ctype.h>
-#include <stdint.h>
-#include <stdbool.h>
-#include <errno.h>
+#include "search_internal.h"
+
+#ifdef OFFTARGET_ZLIB
+#include <zlib.h>
+#endif
+
+#include "offtarget.h"
+
+/*
+ * SIMD kernels are compiled for their own instruction sets with target
+ * attributes, so one portable build (make's default flags) carries the
+ * scalar, 128-bit, AVX2 and AVX-512 paths; the kernel is picked at startup
+ * from what the CPU supports (see detect_simd_level).
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define OT_X86 1
 #include <immintrin.h>
-#include <sys/types.h>
+#define OT_TARGET_AVX2 __attribute__((target("avx2,bmi,bmi2,popcnt")))
+#define OT_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx2,bmi,bmi2,popcnt")))
+#else
+#define OT_X86 0
+#endif
 
-#ifdef _OPENMP
-#include <omp.h>
+/* Library builds use -fvisibility=hidden; only the offtarget.h API is exported. */
+#if defined(__GNUC__)
+#define OT_EXPORT __attribute__((visibility("default")))
 #else
-static inline void omp_set_num_threads(int n) { (void)n; }
-static inline int omp_get_max_threads(void) { return 1; }
+#define OT_EXPORT
 #endif
 
 #define PAD_WIDTH 32
-#define MAX_GUIDE_LEN 30
-#define MAX_MISMATCHES 5
+#define FIXED_GUIDE_LEN 23       /* guide length with its own kernel variants (tiger.guide_length) */
 #define GROUP_SIZE 4
 #define SENTINEL_CHAR 'X'
+#define PACKED_PAD_WORDS 8
+#define TILE_WORDS 16384         /* 1 Mi bases; four planes = 512 KiB per tile */
+#define MAX_GUIDE_BLOCK 256
+#define SLICE_MIN_WORDS 64       /* smallest reference slice a scan task covers (4096 bases) */
 
-typedef struct {
-    char gene[256];
-    char sequence[MAX_GUIDE_LEN + 1];
-    int length;
-} Guide;
-
-typedef struct {
-    uint64_t counts[MAX_MISMATCHES + 1];
-    size_t *mm0_transcripts;
-    size_t mm0_count;
-} GuideResult;
+_Static_assert(MAX_MISMATCHES < 8, "packed kernels use three-bit mismatch counters");
+_Static_assert(MAX_GUIDE_LEN <= 2 * PAD_WIDTH && MAX_GUIDE_LEN <= 64,
+               "byte kernels compare at most two vectors and guide masks are one word");
+_Static_assert(GROUP_SIZE % 2 == 0, "the AVX-512 byte kernel pairs guides");
 
+/*
+ * Mismatch-position profile of one guide (--position-weights): over its
+ * windows with 1..K mismatches, how many mismatch each guide position, and
+ * the sum of every window's activity, the product of the weights of its
+ * mismatched positions.
+ */
 typedef struct {
-    size_t start;
-    size_t length;
-    char *transcript_id;
-    char *gene_symbol;
-} TranscriptInfo;
+    uint64_t positions[MAX_GUIDE_LEN];
+    double score;
+} MismatchProfile;
 
 typedef struct {
     size_t *data;
@@ -58,13 +123,35 @@ typedef struct {
     size_t capacity;
 } HitList;
 
+/*
+ * Hit-detail records (--hits-out): every window with at most the requested
+ * number of mismatches, in reference order, encoded as
+ * position << DETAIL_MM_BITS | mismatches.
+ */
+#define DETAIL_MM_BITS 3
+
 typedef struct {
-    char *data;
-    size_t length;
+    uint64_t *data;
+    size_t count;
     size_t capacity;
-} Buffer;
+} DetailList;
+
+typedef uint64_t v2u64 __attribute__((vector_size(16)));
+typedef uint8_t v16u8 __attribute__((vector_size(16)));
+
+static inline v2u64 load_v2u64(const void *p) {
+    v2u64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
 
-static void *xmalloc(size_t size) {
+static inline v16u8 load_v16u8(const void *p) {
+    v16u8 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void *xmalloc(size_t size) {
     void *ptr = malloc(size);
     if (!ptr) {
         fprintf(stderr, "Error: out of memory (requested %zu bytes)\n", size);
@@ -73,13 +160,14 @@ static void *xmalloc(size_t size) {
     return ptr;
 }
 
-static void buffer_init(Buffer *buf, size_t initial_capacity) {
+void buffer_init(Buffer *buf, size_t initial_capacity) {
     buf->data = (char *)xmalloc(initial_capacity);
     buf->length = 0;
     buf->capacity = initial_capacity;
 }
 
-static void buffer_reserve(Buffer *buf, size_t additional) {
+#ifndef OFFTARGET_LIBRARY
+void buffer_reserve(Buffer *buf, size_t additional) {
     size_t required = buf->length + additional;
     if (required > buf->capacity) {
         size_t new_capacity = buf->capacity * 2;
@@ -97,19 +185,7 @@ static void buffer_reserve(Buffer *buf, size_t additional) {
     }
 }
 
-static void buffer_append_char(Buffer *buf, char c) {
-    buffer_reserve(buf, 1);
-    buf->data[buf->length++] = c;
-}
-
-static void append_sentinel(Buffer *buf) {
-    buffer_reserve(buf, PAD_WIDTH);
-    for (int i = 0; i < PAD_WIDTH; ++i) {
-        buf->data[buf->length++] = SENTINEL_CHAR;
-    }
-}
-
-static char *xstrdup(const char *s) {
+char *xstrdup(const char *s) {
     if (!s) {
         return NULL;
     }
@@ -118,57 +194,147 @@ static char *xstrdup(const char *s) {
     memcpy(copy, s, len + 1);
     return copy;
 }
+#endif /* !OFFTARGET_LIBRARY */
 
-static char *trim_whitespace_inplace(char *s) {
-    if (!s) {
-        return s;
+static uint64_t hash_string(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    for (; *s; ++s) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
     }
-    while (*s && isspace((unsigned char)*s)) {
-        ++s;
-    }
-    char *end = s + strlen(s);
-    while (end > s && isspace((unsigned char)*(end - 1))) {
-        --end;
+    return h;
+}
+
+void string_table_init(StringTable *table) {
+    table->strings = NULL;
+    table->count = 0;
+    table->capacity = 0;
+    table->slot_count = 1024;
+    table->slots = (size_t *)xmalloc(table->slot_count * sizeof(size_t));
+    memset(table->slots, 0, table->slot_count * sizeof(size_t));
+}
+
+void string_table_free(StringTable *table) {
+    free(table->strings);
+    free(table->slots);
+    table->strings = NULL;
+    table->slots = NULL;
+    table->count = table->capacity = table->slot_count = 0;
+}
+
+static void string_table_grow(StringTable *table) {
+    size_t slot_count = table->slot_count * 2;
+    size_t *slots = (size_t *)xmalloc(slot_count * sizeof(size_t));
+    memset(slots, 0, slot_count * sizeof(size_t));
+    for (size_t i = 0; i < table->count; ++i) {
+        size_t slot = hash_string(table->strings[i]) & (slot_count - 1);
+        while (slots[slot]) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = i + 1;
     }
-    *end = '\0';
-    return s;
+    free(table->slots);
+    table->slots = slots;
+    table->slot_count = slot_count;
 }
 
-static void parse_fasta_header(const char *line, char **transcript_id_out, char **gene_symbol_out) {
-    char *buffer = xstrdup(line[0] == '>' ? line + 1 : line);
-    size_t len = strlen(buffer);
-    while (len > 0 && (buffer[len - 1] == '\n' || buffer[len - 1] == '\r')) {
-        buffer[--len] = '\0';
+/* Slot holding `s`, or the empty slot where it would go. */
+static size_t string_table_slot(const StringTable *table, const char *s) {
+    size_t slot = hash_string(s) & (table->slot_count - 1);
+    while (table->slots[slot]) {
+        if (strcmp(table->strings[table->slots[slot] - 1], s) == 0) {
+            break;
+        }
+        slot = (slot + 1) & (table->slot_count - 1);
     }
+    return slot;
+}
 
-    char *saveptr = NULL;
-    char *token = strtok_r(buffer, "|", &saveptr);
-    char *transcript_id = NULL;
-    char *gene_symbol = NULL;
-    int index = 0;
+/* Returns the index of `s`, or SIZE_MAX if it is not in the table. */
+size_t string_table_find(const StringTable *table, const char *s) {
+    size_t slot = string_table_slot(table, s);
+    return table->slots[slot] ? table->slots[slot] - 1 : SIZE_MAX;
+}
 
-    while (token) {
-        char *clean = trim_whitespace_inplace(token);
-        if (index == 0 && !transcript_id) {
-            transcript_id = xstrdup(clean);
-        } else if (index == 5 && !gene_symbol) {
-            gene_symbol = xstrdup(clean);
+/* Returns the index of `s`, adding it if unseen.  Strings are borrowed, not copied. */
+size_t string_table_intern(StringTable *table, char *s) {
+    size_t slot = string_table_slot(table, s);
+    if (table->slots[slot]) {
+        return table->slots[slot] - 1;
+    }
+
+    if (table->count == table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 256;
+        char **strings = (char **)realloc(table->strings, capacity * sizeof(char *));
+        if (!strings) {
+            fprintf(stderr, "Error: realloc failed while growing string table\n");
+            exit(EXIT_FAILURE);
         }
-        token = strtok_r(NULL, "|", &saveptr);
-        ++index;
+        table->strings = strings;
+        table->capacity = capacity;
+    }
+    table->strings[table->count] = s;
+    table->slots[slot] = ++table->count;
+
+    if (table->count * 2 > table->slot_count) {
+        string_table_grow(table);
     }
+    return table->count - 1;
+}
+
+/*
+ * Interned names: `interned` maps each distinct string to a stable index,
+ * and every string stored through the pool (interned or merely copied)
+ * lives in fixed arena blocks, so its pointer never moves.  Gene symbols
+ * are interned, transcript IDs only copied.
+ */
+#define STRING_BLOCK_SIZE (64 * 1024)
+
+void string_pool_init(StringPool *pool) {
+    string_table_init(&pool->interned);
+    pool->blocks = NULL;
+    pool->block_count = 0;
+    pool->block_used = STRING_BLOCK_SIZE;
+}
 
-    if (!transcript_id) {
-        transcript_id = xstrdup("UNKNOWN");
+void string_pool_free(StringPool *pool) {
+    for (size_t b = 0; b < pool->block_count; ++b) {
+        free(pool->blocks[b]);
     }
-    if (!gene_symbol) {
-        gene_symbol = xstrdup("Unknown");
+    free(pool->blocks);
+    string_table_free(&pool->interned);
+    memset(pool, 0, sizeof(*pool));
+}
+
+static char *string_pool_copy(StringPool *pool, const char *s) {
+    size_t len = strlen(s) + 1;
+    if (pool->block_used + len > STRING_BLOCK_SIZE || pool->block_count == 0) {
+        char **blocks = (char **)realloc(pool->blocks, (pool->block_count + 1) * sizeof(char *));
+        if (!blocks) {
+            fprintf(stderr, "Error: realloc failed while growing string pool\n");
+            exit(EXIT_FAILURE);
+        }
+        pool->blocks = blocks;
+        pool->blocks[pool->block_count++] = (char *)xmalloc(len > STRING_BLOCK_SIZE ? len : STRING_BLOCK_SIZE);
+        pool->block_used = 0;
     }
+    char *copy = pool->blocks[pool->block_count - 1] + pool->block_used;
+    memcpy(copy, s, len);
+    pool->block_used += len;
+    return copy;
+}
 
-    *transcript_id_out = transcript_id;
-    *gene_symbol_out = gene_symbol;
+/* Index of `s` in the pool, copying it in if unseen. */
+static uint32_t string_pool_intern(StringPool *pool, const char *s) {
+    size_t idx = string_table_find(&pool->interned, s);
+    if (idx == SIZE_MAX) {
+        idx = string_table_intern(&pool->interned, string_pool_copy(pool, s));
+    }
+    return (uint32_t)idx;
+}
 
-    free(buffer);
+const char *string_pool_get(const StringPool *pool, uint32_t idx) {
+    return pool->interned.strings[idx];
 }
 
 static void hitlist_init(HitList *list) {
@@ -184,11 +350,21 @@ static void hitlist_free(HitList *list) {
     list->capacity = 0;
 }
 
+/*
+ * Adds an MM0 transcript.  Every engine reports a guide's hits in reference
+ * order, so a repeat of the same transcript is the previous entry; only an
+ * out-of-order value pays for a scan.
+ */
 static void hitlist_add(HitList *list, size_t value) {
-    for (size_t i = 0; i < list->count; ++i) {
-        if (list->data[i] == value) {
+    if (list->count > 0 && list->data[list->count - 1] >= value) {
+        if (list->data[list->count - 1] == value) {
             return;
         }
+        for (size_t i = 0; i + 1 < list->count; ++i) {
+            if (list->data[i] == value) {
+                return;
+            }
+        }
     }
 
     if (list->count == list->capacity) {
@@ -206,18 +382,29 @@ static void hitlist_add(HitList *list, size_t value) {
     list->data[list->count++] = value;
 }
 
-static void free_transcript_info(TranscriptInfo *transcripts, size_t count) {
-    if (!transcripts) {
-        return;
-    }
-    for (size_t i = 0; i < count; ++i) {
-        free(transcripts[i].transcript_id);
-        free(transcripts[i].gene_symbol);
+static void detail_list_init(DetailList *list) {
+    list->data = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+static void detail_list_add(DetailList *list, size_t pos, int mismatches) {
+    if (list->count == list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 16;
+        uint64_t *new_data = (uint64_t *)realloc(list->data, new_capacity * sizeof(uint64_t));
+        if (!new_data) {
+            fprintf(stderr, "Error: realloc failed while growing hit details\n");
+            free(list->data);
+            exit(EXIT_FAILURE);
+        }
+        list->data = new_data;
+        list->capacity = new_capacity;
     }
-    free(transcripts);
+
+    list->data[list->count++] = ((uint64_t)pos << DETAIL_MM_BITS) | (uint64_t)mismatches;
 }
 
-static void free_results(GuideResult *results, size_t count) {
+void free_results(GuideResult *results, size_t count) {
     if (!results) {
         return;
     }
@@ -225,10 +412,37 @@ static void free_results(GuideResult *results, size_t count) {
         free(results[i].mm0_transcripts);
         results[i].mm0_transcripts = NULL;
         results[i].mm0_count = 0;
+        free(results[i].details);
+        results[i].details = NULL;
+        results[i].detail_count = 0;
+        free(results[i].mismatch_positions);
+        results[i].mismatch_positions = NULL;
     }
     free(results);
 }
 
+static void result_stream_complete(ResultStream *stream, size_t start, size_t count) {
+    if (!stream) {
+        return;
+    }
+    pthread_mutex_lock(&stream->lock);
+    for (size_t i = 0; i < count; ++i) {
+        stream->done[start + i] = true;
+    }
+    pthread_cond_signal(&stream->ready);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+static inline void search_counters_busy(SearchCounters *counters, double since) {
+    if (!counters) {
+        return;
+    }
+    int thread = omp_get_thread_num();
+    if (thread < counters->threads) {
+        counters->busy[thread] += omp_get_wtime() - since;
+    }
+}
+
 static inline char normalize_base(char c) {
     switch (c) {
         case 'A': case 'a': return 'A';
@@ -256,28 +470,326 @@ static int parse_thread_override(void) {
     return (int)value;
 }
 
-static unsigned char *compute_valid_positions(const char *sequence, size_t length, int max_length) {
-    unsigned char *valid = (unsigned char *)xmalloc(length);
-    int consecutive = 0;
-    for (ssize_t idx = (ssize_t)length - 1; idx >= 0; --idx) {
-        if (sequence[idx] == SENTINEL_CHAR) {
-            consecutive = 0;
-            valid[idx] = 0;
-        } else {
-            consecutive++;
-            valid[idx] = (unsigned char)(consecutive >= max_length);
+static const char *const simd_level_names[] = {"scalar", "vec128", "avx2", "avx512"};
+
+/* Best kernel family this CPU runs. */
+static SimdLevel detect_simd_level(void) {
+#if OT_X86 && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("popcnt")) {
+        return SIMD_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return SIMD_AVX2;
+    }
+    return SIMD_VEC128;
+#elif defined(__aarch64__) || defined(__SSE2__)
+    return SIMD_VEC128;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+/*
+ * The detected level, optionally lowered with TIGER_OFFTARGET_SIMD
+ * (scalar, vec128, avx2 or avx512) for benchmarking and testing.  Levels
+ * above what the CPU supports are refused.
+ */
+static SimdLevel select_simd_level(void) {
+    SimdLevel best = detect_simd_level();
+    const char *env = getenv("TIGER_OFFTARGET_SIMD");
+    if (!env || !*env) {
+        return best;
+    }
+    for (int level = SIMD_SCALAR; level <= SIMD_AVX512; ++level) {
+        if (strcmp(env, simd_level_names[level]) == 0) {
+            if (level > (int)best) {
+                fprintf(stderr, "Warning: TIGER_OFFTARGET_SIMD=%s is not supported by this CPU; using %s\n",
+                        env, simd_level_names[best]);
+                return best;
+            }
+            return (SimdLevel)level;
+        }
+    }
+    fprintf(stderr, "Warning: ignoring invalid TIGER_OFFTARGET_SIMD value '%s'\n", env);
+    return best;
+}
+
+/*
+ * Packed reference layout: each base is a 2-bit code (A=00, C=01, G=10,
+ * T=11) split across two bit-planes, so bit i of `lo`/`hi` describes
+ * reference position i.  `nmask` flags N bases and sentinel padding, which
+ * never match a guide base, and `valid` flags the start positions whose
+ * window of `window_len` bases lies inside one transcript.  One 64-bit word
+ * therefore covers 64 consecutive window offsets.
+ *
+ * A search sees one validity bitmap per guide length in `valid_len`, so a
+ * guide's windows do not depend on the other guides in its batch; `valid`
+ * then holds the bitmap of the shortest length, a superset of the others,
+ * which the kernels use to skip words no guide can start in.
+ */
+static void set_bit_range(uint64_t *bits, size_t first, size_t last) {
+    for (size_t pos = first; pos <= last; ) {
+        size_t word = pos / 64;
+        unsigned offset = (unsigned)(pos % 64);
+        size_t span = 64 - offset;
+        if (span > last - pos + 1) {
+            span = last - pos + 1;
+        }
+        uint64_t mask = (span == 64) ? ~0ULL : (((1ULL << span) - 1) << offset);
+        bits[word] |= mask;
+        pos += span;
+    }
+}
+
+static size_t find_transcript(const TranscriptInfo *transcripts, size_t transcript_count, size_t pos);
+
+/*
+ * Threads fill blocks of VALID_BLOCK_WORDS words, each from the transcripts
+ * overlapping it, so no word is written by two threads.
+ */
+#define VALID_BLOCK_WORDS 4096
+
+static uint64_t *compute_valid_bitmap(
+    size_t words,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    int window_len
+) {
+    uint64_t *valid = (uint64_t *)xmalloc(words * sizeof(uint64_t));
+    size_t blocks = (words + VALID_BLOCK_WORDS - 1) / VALID_BLOCK_WORDS;
+    #pragma omp parallel for schedule(dynamic, 4)
+    for (size_t block = 0; block < blocks; ++block) {
+        size_t first_word = block * VALID_BLOCK_WORDS;
+        size_t end_word = first_word + VALID_BLOCK_WORDS < words ? first_word + VALID_BLOCK_WORDS : words;
+        memset(valid + first_word, 0, (end_word - first_word) * sizeof(uint64_t));
+        if (transcript_count == 0) {
+            continue;
+        }
+        size_t block_first = first_word * 64;
+        size_t block_last = end_word * 64 - 1;
+        for (size_t t = find_transcript(transcripts, transcript_count, block_first);
+             t < transcript_count && transcripts[t].start <= block_last; ++t) {
+            if (transcripts[t].length < (size_t)window_len) {
+                continue;
+            }
+            size_t first = transcripts[t].start;
+            size_t last = transcripts[t].start + transcripts[t].length - (size_t)window_len;
+            if (last < block_first) {
+                continue;
+            }
+            set_bit_range(valid, first > block_first ? first : block_first, last < block_last ? last : block_last);
         }
     }
     return valid;
 }
 
-static int load_guides(const char *filename, Guide **guides_out, int *max_len_out) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "Error: unable to open guides file '%s': %s\n", filename, strerror(errno));
+static inline bool bit_is_set(const uint64_t *bits, size_t pos) {
+    return (bits[pos / 64] >> (pos % 64)) & 1;
+}
+
+/*
+ * Transcript containing `pos`.  Only hits pay for it, so it is kept out of
+ * line: inlined, it crowds the registers of the scan loops that call it.
+ */
+__attribute__((noinline)) static size_t find_transcript(const TranscriptInfo *transcripts, size_t transcript_count, size_t pos) {
+    size_t lo = 0;
+    size_t hi = transcript_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (transcripts[mid].start <= pos) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Packs bases [64 * word, 64 * word + 64) of `sequence` into its lo, hi and N-mask words. */
+void pack_word(const char *sequence, size_t length, size_t word, uint64_t planes[3]) {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+    uint64_t nmask = 0;
+    size_t base = word * 64;
+    for (unsigned bit = 0; bit < 64; ++bit) {
+        size_t pos = base + bit;
+        char c = pos < length ? sequence[pos] : SENTINEL_CHAR;
+        switch (c) {
+            case 'A': break;
+            case 'C': lo |= 1ULL << bit; break;
+            case 'G': hi |= 1ULL << bit; break;
+            case 'T': lo |= 1ULL << bit; hi |= 1ULL << bit; break;
+            default: nmask |= 1ULL << bit; break;
+        }
+    }
+    planes[0] = lo;
+    planes[1] = hi;
+    planes[2] = nmask;
+}
+
+#if OT_X86
+/*
+ * Packs the 64 normalised bases at `bases` (no sentinel among them): one
+ * byte compare per base and plane instead of pack_word's switch.
+ */
+OT_TARGET_AVX2 static void pack_word_avx2(const char *bases, uint64_t planes[3]) {
+    uint64_t masks[4] = {0, 0, 0, 0};
+    static const char codes[4] = {'A', 'C', 'G', 'T'};
+    for (int half = 0; half < 2; ++half) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(bases + 32 * half));
+        for (int code = 0; code < 4; ++code) {
+            uint32_t hit = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(codes[code])));
+            masks[code] |= (uint64_t)hit << (32 * half);
+        }
+    }
+    planes[0] = masks[1] | masks[3];
+    planes[1] = masks[2] | masks[3];
+    planes[2] = ~(masks[0] | masks[1] | masks[2] | masks[3]);
+}
+
+OT_TARGET_AVX512 static void pack_word_avx512(const char *bases, uint64_t planes[3]) {
+    __m512i c = _mm512_loadu_si512((const void *)bases);
+    uint64_t a = _mm512_cmpeq_epi8_mask(c, _mm512_set1_epi8('A'));
+    uint64_t cc = _mm512_cmpeq_epi8_mask(c, _mm512_set1_epi8('C'));
+    uint64_t g = _mm512_cmpeq_epi8_mask(c, _mm512_set1_epi8('G'));
+    uint64_t t = _mm512_cmpeq_epi8_mask(c, _mm512_set1_epi8('T'));
+    planes[0] = cc | t;
+    planes[1] = g | t;
+    planes[2] = ~(a | cc | g | t);
+}
+#endif
+
+/* pack_word through the widest kernel `simd` allows; words reaching past `length` take the scalar path. */
+static void pack_word_simd(SimdLevel simd, const char *sequence, size_t length, size_t word, uint64_t planes[3]) {
+#if OT_X86
+    if (word < length / 64) {
+        switch (simd) {
+            case SIMD_AVX512:
+                pack_word_avx512(sequence + word * 64, planes);
+                return;
+            case SIMD_AVX2:
+                pack_word_avx2(sequence + word * 64, planes);
+                return;
+            default:
+                break;
+        }
+    }
+#else
+    (void)simd;
+#endif
+    pack_word(sequence, length, word, planes);
+}
+
+static PackedReference pack_reference(
+    const char *sequence,
+    size_t length,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    int window_len,
+    SimdLevel simd
+) {
+    PackedReference packed;
+    memset(&packed, 0, sizeof(packed));
+    packed.length = length;
+    packed.data_words = (length + 63) / 64;
+    packed.words = packed.data_words + PACKED_PAD_WORDS;
+
+    size_t bytes = packed.words * sizeof(uint64_t);
+    packed.lo = (uint64_t *)xmalloc(bytes);
+    packed.hi = (uint64_t *)xmalloc(bytes);
+    packed.nmask = (uint64_t *)xmalloc(bytes);
+
+    #pragma omp parallel for schedule(static)
+    for (size_t word = 0; word < packed.words; ++word) {
+        uint64_t planes[3];
+        pack_word_simd(simd, sequence, length, word, planes);
+        packed.lo[word] = planes[0];
+        packed.hi[word] = planes[1];
+        packed.nmask[word] = planes[2];
+    }
+
+    packed.valid = compute_valid_bitmap(packed.words, transcripts, transcript_count, window_len);
+    return packed;
+}
+
+static void free_packed_reference(PackedReference *packed) {
+    if (!packed->valid_mapped) {
+        free(packed->valid);
+    }
+    if (packed->mapping) {
+        munmap(packed->mapping, packed->mapping_size);
+    } else {
+        free(packed->lo);
+        free(packed->hi);
+        free(packed->nmask);
+    }
+    memset(packed, 0, sizeof(*packed));
+}
+
+#ifndef OFFTARGET_LIBRARY
+/*
+ * Parses one `Gene,Sequence,...` row (modified in place) into `guide`.
+ * Returns 1 for a guide, 0 for a row without one, -1 for an unusable guide
+ * (including one that is not `required_length` long, when that is set).
+ */
+int parse_guide_line(char *line, StringPool *genes, int required_length, Guide *guide) {
+    char *cursor = line;
+    char *gene = strsep(&cursor, ",");
+    char *sequence = strsep(&cursor, ",");
+
+    if (!gene || !sequence) {
+        return 0;
+    }
+
+    while (*gene && isspace((unsigned char)*gene)) {
+        gene++;
+    }
+    while (*sequence && isspace((unsigned char)*sequence)) {
+        sequence++;
+    }
+
+    char *gene_end = gene + strlen(gene);
+    while (gene_end > gene && isspace((unsigned char)gene_end[-1])) {
+        --gene_end;
+    }
+    *gene_end = '\0';
+
+    char *seq_end = sequence + strcspn(sequence, ",\r\n");
+    *seq_end = '\0';
+
+    int len = (int)strlen(sequence);
+    if (len <= 0) {
+        return 0;
+    }
+    if (len > MAX_GUIDE_LEN) {
+        fprintf(stderr, "Error: guide '%s' exceeds supported length (%d > %d)\n",
+                gene, len, MAX_GUIDE_LEN);
         return -1;
     }
+    if (required_length > 0 && len != required_length) {
+        fprintf(stderr, "Error: guide '%s' has length %d but --guide-length is %d\n",
+                gene, len, required_length);
+        return -1;
+    }
+
+    guide->gene = string_pool_intern(genes, gene);
+    for (int i = 0; i < len; ++i) {
+        guide->sequence[i] = normalize_base(sequence[i]);
+    }
+    guide->sequence[len] = '\0';
+    guide->length = len;
+    return 1;
+}
 
+/*
+ * Parses a guides CSV from `fp` (left open); `filename` only labels errors.
+ * Gene names are interned into `genes`, which the caller initialises.
+ * `required_length` is as for parse_guide_line.
+ */
+int read_guides(FILE *fp, const char *filename, StringPool *genes, int required_length,
+                Guide **guides_out, int *max_len_out) {
     size_t capacity = 1024;
     Guide *guides = (Guide *)xmalloc(capacity * sizeof(Guide));
     int max_len = 0;
@@ -291,7 +803,6 @@ static int load_guides(const char *filename, Guide **guides_out, int *max_len_ou
         fprintf(stderr, "Error: guides file '%s' is empty\n", filename);
         free(line);
         free(guides);
-        fclose(fp);
         return -1;
     }
 
@@ -300,44 +811,6 @@ static int load_guides(const char *filename, Guide **guides_out, int *max_len_ou
             continue;
         }
 
-        // Tokenize: expect Gene,Sequence,...
-        char *cursor = line;
-        char *gene = strsep(&cursor, ",");
-        char *sequence = strsep(&cursor, ",");
-
-        if (!gene || !sequence) {
-            continue;
-        }
-
-        while (*gene && isspace((unsigned char)*gene)) {
-            gene++;
-        }
-        while (*sequence && isspace((unsigned char)*sequence)) {
-            sequence++;
-        }
-
-        char *gene_end = gene + strlen(gene);
-        while (gene_end > gene && isspace((unsigned char)gene_end[-1])) {
-            --gene_end;
-        }
-        *gene_end = '\0';
-
-        char *seq_end = sequence + strcspn(sequence, ",\r\n");
-        *seq_end = '\0';
-
-        int len = (int)strlen(sequence);
-        if (len <= 0) {
-            continue;
-        }
-        if (len > MAX_GUIDE_LEN) {
-            fprintf(stderr, "Error: guide '%s' exceeds supported length (%d > %d)\n",
-                    gene, len, MAX_GUIDE_LEN);
-            free(line);
-            free(guides);
-            fclose(fp);
-            return -1;
-        }
-
         if (count == (int)capacity) {
             capacity *= 2;
             Guide *tmp = (Guide *)realloc(guides, capacity * sizeof(Guide));
@@ -345,28 +818,27 @@ static int load_guides(const char *filename, Guide **guides_out, int *max_len_ou
                 fprintf(stderr, "Error: failed to grow guide buffer\n");
                 free(line);
                 free(guides);
-                fclose(fp);
                 return -1;
             }
             guides = tmp;
         }
 
-        Guide *g = &guides[count];
-        strncpy(g->gene, gene, sizeof(g->gene) - 1);
-        g->gene[sizeof(g->gene) - 1] = '\0';
-        for (int i = 0; i < len; ++i) {
-            g->sequence[i] = normalize_base(sequence[i]);
+        int parsed = parse_guide_line(line, genes, required_length, &guides[count]);
+        if (parsed < 0) {
+            free(line);
+            free(guides);
+            return -1;
+        }
+        if (parsed == 0) {
+            continue;
         }
-        g->sequence[len] = '\0';
-        g->length = len;
-        if (len > max_len) {
-            max_len = len;
+        if (guides[count].length > max_len) {
+            max_len = guides[count].length;
         }
         count++;
     }
 
     free(line);
-    fclose(fp);
 
     if (count == 0) {
         fprintf(stderr, "Error: no guides found in '%s'\n", filename);
@@ -379,426 +851,6801 @@ static int load_guides(const char *filename, Guide **guides_out, int *max_len_ou
     return count;
 }
 
-static Buffer load_reference_sequence(const char *filename, TranscriptInfo **transcripts_out, size_t *transcript_count_out) {
+static int load_guides(const char *filename, StringPool *genes, int required_length, Guide **guides_out,
+                       int *max_len_out) {
     FILE *fp = fopen(filename, "r");
     if (!fp) {
-        fprintf(stderr, "Error: unable to open reference file '%s': %s\n", filename, strerror(errno));
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "Error: unable to open guides file '%s': %s\n", filename, strerror(errno));
+        return -1;
     }
+    int count = read_guides(fp, filename, genes, required_length, guides_out, max_len_out);
+    fclose(fp);
+    return count;
+}
+#endif /* !OFFTARGET_LIBRARY */
 
-    Buffer buffer;
-    buffer_init(&buffer, 1024 * 1024);
-
-    size_t capacity = 1024;
-    TranscriptInfo *transcripts = (TranscriptInfo *)xmalloc(capacity * sizeof(TranscriptInfo));
-    size_t transcript_count = 0;
-    TranscriptInfo *current = NULL;
-
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    bool first_sequence = true;
+/*
+ * Reference FASTA loading.  The file is mapped (or read whole when it
+ * cannot be, e.g. a pipe), decompressed when it is gzip, and parsed in parallel: threads find the record
+ * headers in equal slices of the text, cut the record bodies into pieces of
+ * at most LOAD_PIECE_BYTES, count the bases of each piece and, after a
+ * prefix sum over the pieces, normalise every piece straight into its final
+ * place in a buffer sized up front.  Only copying the names into the pool
+ * is serial, so gene indices follow the record order.
+ */
+#define LOAD_PIECE_BYTES (1u << 20)
 
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        if (linelen <= 1) {
-            continue;
-        }
+/*
+ * One record of the text: the '>' at `header`, the header line ending at
+ * `header_end`, and the body [body, end).  The transcript ID and gene
+ * symbol are GENCODE fields 1 and 6 of the header ('|'-separated, empty
+ * fields skipped), as spans of the text; a length of SIZE_MAX marks a
+ * missing field.
+ */
+typedef struct {
+    size_t header;
+    size_t header_end;
+    size_t body;
+    size_t end;
+    size_t id_begin;
+    size_t id_length;
+    size_t gene_begin;
+    size_t gene_length;
+    size_t first_piece;
+} FastaRecord;
 
-        if (line[0] == '>') {
-            if (!first_sequence && current) {
-                current->length = buffer.length - current->start;
-                append_sentinel(&buffer);
-            }
-            first_sequence = false;
+typedef struct {
+    size_t begin;
+    size_t end;
+    size_t bases;
+    size_t out;
+} FastaPiece;
 
-            if (transcript_count == capacity) {
-                capacity *= 2;
-                TranscriptInfo *tmp = (TranscriptInfo *)realloc(transcripts, capacity * sizeof(TranscriptInfo));
-                if (!tmp) {
-                    fprintf(stderr, "Error: realloc failed while growing transcript metadata\n");
-                    free(transcripts);
-                    exit(EXIT_FAILURE);
-                }
-                transcripts = tmp;
-            }
+typedef struct {
+    const char *data;
+    size_t size;
+    void *mapping;
+    size_t mapping_size;
+} FastaText;
 
-            char *transcript_id = NULL;
-            char *gene_symbol = NULL;
-            parse_fasta_header(line, &transcript_id, &gene_symbol);
+static void inflate_fasta_text(const char *filename, FastaText *text);
 
-            current = &transcripts[transcript_count++];
-            current->start = buffer.length;
-            current->length = 0;
-            current->transcript_id = transcript_id;
-            current->gene_symbol = gene_symbol;
-            continue;
+/*
+ * Maps `filename`, or reads it into memory when it is not a regular file,
+ * and inflates gzip input in memory.  Exits on failure.
+ */
+static FastaText open_fasta_text(const char *filename) {
+    FastaText text;
+    memset(&text, 0, sizeof(text));
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: unable to open reference file '%s': %s\n", filename, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, (size_t)st.st_size, MADV_WILLNEED);
+            close(fd);
+            text.data = (const char *)mapping;
+            text.size = (size_t)st.st_size;
+            text.mapping = mapping;
+            text.mapping_size = text.size;
+            inflate_fasta_text(filename, &text);
+            return text;
         }
+    }
+
+    size_t capacity = 1 << 20;
+    char *data = (char *)xmalloc(capacity);
+    for (;;) {
+        if (text.size == capacity) {
+            capacity *= 2;
+            char *grown = (char *)realloc(data, capacity);
+            if (!grown) {
+                fprintf(stderr, "Error: realloc failed while reading reference file '%s'\n", filename);
+                exit(EXIT_FAILURE);
+            }
+            data = grown;
+        }
+        ssize_t got = read(fd, data + text.size, capacity - text.size);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            fprintf(stderr, "Error: failed to read reference file '%s': %s\n", filename, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (got == 0) {
+            break;
+        }
+        text.size += (size_t)got;
+    }
+    close(fd);
+    text.data = data;
+    inflate_fasta_text(filename, &text);
+    return text;
+}
+
+static void close_fasta_text(FastaText *text) {
+    if (text->mapping) {
+        munmap(text->mapping, text->mapping_size);
+    } else {
+        free((char *)text->data);
+    }
+    memset(text, 0, sizeof(*text));
+}
+
+static inline bool is_gzip(const unsigned char *data, size_t size) {
+    return size >= 2 && data[0] == 0x1f && data[1] == 0x8b;
+}
+
+#ifdef OFFTARGET_ZLIB
+/*
+ * gzip input.  BGZF (bgzip, samtools) is a series of gzip members of at
+ * most 64 KiB, each naming its compressed size in a "BC" extra field and
+ * its inflated size in its trailer, so every block's place in the output is
+ * known before any is inflated and threads inflate blocks straight into
+ * it.  Any other gzip file is inflated serially, member after member.
+ */
+typedef struct {
+    size_t offset;          /* of the deflate data within the file */
+    size_t length;
+    size_t out;
+    uint32_t out_length;
+    uint32_t crc;
+} BgzfBlock;
+
+static inline uint32_t read_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Size of the BGZF member at `p`, or 0 when it is not one. */
+static size_t bgzf_block_size(const unsigned char *p, size_t available, size_t *header_size) {
+    if (available < 18 || !is_gzip(p, available) || p[2] != 8 || !(p[3] & 0x04)) {
+        return 0;
+    }
+    size_t extra_length = (size_t)p[10] | (size_t)p[11] << 8;
+    if (12 + extra_length > available) {
+        return 0;
+    }
+    for (size_t field = 12; field + 4 <= 12 + extra_length; ) {
+        size_t field_length = (size_t)p[field + 2] | (size_t)p[field + 3] << 8;
+        if (p[field] == 'B' && p[field + 1] == 'C' && field_length == 2 && field + 6 <= 12 + extra_length) {
+            size_t size = ((size_t)p[field + 4] | (size_t)p[field + 5] << 8) + 1;
+            if (size < 12 + extra_length + 8 || size > available) {
+                return 0;
+            }
+            *header_size = 12 + extra_length;
+            return size;
+        }
+        field += 4 + field_length;
+    }
+    return 0;
+}
+
+/* Lists the blocks of a BGZF file; returns 0 (and lists nothing) for any other input. */
+static size_t list_bgzf_blocks(const unsigned char *data, size_t size, BgzfBlock **blocks_out) {
+    size_t count = 0;
+    size_t capacity = 1024;
+    BgzfBlock *blocks = (BgzfBlock *)xmalloc(capacity * sizeof(BgzfBlock));
+    size_t out = 0;
+    for (size_t pos = 0; pos < size; ) {
+        size_t header_size = 0;
+        size_t block_size = bgzf_block_size(data + pos, size - pos, &header_size);
+        if (block_size == 0) {
+            free(blocks);
+            return 0;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            BgzfBlock *grown = (BgzfBlock *)realloc(blocks, capacity * sizeof(BgzfBlock));
+            if (!grown) {
+                fprintf(stderr, "Error: realloc failed while indexing BGZF blocks\n");
+                exit(EXIT_FAILURE);
+            }
+            blocks = grown;
+        }
+        BgzfBlock *block = &blocks[count++];
+        block->offset = pos + header_size;
+        block->length = block_size - header_size - 8;
+        block->crc = read_le32(data + pos + block_size - 8);
+        block->out_length = read_le32(data + pos + block_size - 4);
+        block->out = out;
+        out += block->out_length;
+        pos += block_size;
+    }
+    *blocks_out = blocks;
+    return count;
+}
+
+static char *inflate_bgzf(const char *filename, const unsigned char *data, const BgzfBlock *blocks,
+                          size_t block_count, size_t *size_out) {
+    size_t size = blocks[block_count - 1].out + blocks[block_count - 1].out_length;
+    char *out = (char *)xmalloc(size ? size : 1);
+    size_t failed = SIZE_MAX;
+    #pragma omp parallel
+    {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        bool ready = inflateInit2(&stream, -15) == Z_OK;
+        #pragma omp for schedule(dynamic, 16)
+        for (size_t b = 0; b < block_count; ++b) {
+            const BgzfBlock *block = &blocks[b];
+            bool ok = ready && inflateReset(&stream) == Z_OK;
+            if (ok) {
+                stream.next_in = (Bytef *)(data + block->offset);
+                stream.avail_in = (uInt)block->length;
+                stream.next_out = (Bytef *)(out + block->out);
+                stream.avail_out = block->out_length;
+                ok = inflate(&stream, Z_FINISH) == Z_STREAM_END && stream.avail_out == 0
+                     && crc32(0, (const Bytef *)(out + block->out), block->out_length) == block->crc;
+            }
+            if (!ok) {
+                #pragma omp critical(bgzf_failure)
+                if (b < failed) {
+                    failed = b;
+                }
+            }
+        }
+        if (ready) {
+            inflateEnd(&stream);
+        }
+    }
+    if (failed != SIZE_MAX) {
+        fprintf(stderr, "Error: reference '%s' has a corrupt BGZF block at offset %zu\n", filename,
+                blocks[failed].offset);
+        exit(EXIT_FAILURE);
+    }
+    *size_out = size;
+    return out;
+}
+
+static char *inflate_gzip(const char *filename, const unsigned char *data, size_t size, size_t *size_out) {
+    size_t capacity = size * 4 + 4096;
+    char *out = (char *)xmalloc(capacity);
+    size_t length = 0;
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 16 + 15) != Z_OK) {
+        fprintf(stderr, "Error: failed to initialise zlib for reference '%s'\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    size_t consumed = 0;
+    for (;;) {
+        if (length == capacity) {
+            capacity *= 2;
+            char *grown = (char *)realloc(out, capacity);
+            if (!grown) {
+                fprintf(stderr, "Error: realloc failed while inflating reference '%s'\n", filename);
+                exit(EXIT_FAILURE);
+            }
+            out = grown;
+        }
+        size_t in_chunk = size - consumed < (size_t)UINT_MAX ? size - consumed : (size_t)UINT_MAX;
+        size_t out_chunk = capacity - length < (size_t)UINT_MAX ? capacity - length : (size_t)UINT_MAX;
+        stream.next_in = (Bytef *)(data + consumed);
+        stream.avail_in = (uInt)in_chunk;
+        stream.next_out = (Bytef *)(out + length);
+        stream.avail_out = (uInt)out_chunk;
+        int status = inflate(&stream, Z_NO_FLUSH);
+        consumed += in_chunk - stream.avail_in;
+        length += out_chunk - stream.avail_out;
+        if (status == Z_STREAM_END) {
+            /* Concatenated members continue the file; anything else after one ends it. */
+            if (!is_gzip(data + consumed, size - consumed)) {
+                break;
+            }
+            inflateReset(&stream);
+        } else if (status != Z_OK && !(status == Z_BUF_ERROR && stream.avail_out == 0)) {
+            fprintf(stderr, "Error: reference '%s' is not valid gzip data (%s)\n", filename,
+                    stream.msg ? stream.msg : "truncated");
+            exit(EXIT_FAILURE);
+        } else if (consumed == size && stream.avail_out != 0) {
+            fprintf(stderr, "Error: reference '%s' is not valid gzip data (truncated)\n", filename);
+            exit(EXIT_FAILURE);
+        }
+    }
+    inflateEnd(&stream);
+    *size_out = length;
+    return out;
+}
+#endif
+
+/* Replaces gzip input in `text` by its inflated contents; other input is left alone. */
+static void inflate_fasta_text(const char *filename, FastaText *text) {
+    const unsigned char *data = (const unsigned char *)text->data;
+    if (!is_gzip(data, text->size)) {
+        return;
+    }
+#ifdef OFFTARGET_ZLIB
+    size_t size = 0;
+    char *inflated;
+    BgzfBlock *blocks = NULL;
+    size_t block_count = list_bgzf_blocks(data, text->size, &blocks);
+    if (block_count > 0) {
+        inflated = inflate_bgzf(filename, data, blocks, block_count, &size);
+        free(blocks);
+    } else {
+        inflated = inflate_gzip(filename, data, text->size, &size);
+    }
+    close_fasta_text(text);
+    text->data = inflated;
+    text->size = size;
+#else
+    fprintf(stderr, "Error: reference '%s' is gzip-compressed; this build has no zlib (rebuild with 'make ZLIB=1')\n",
+            filename);
+    exit(EXIT_FAILURE);
+#endif
+}
+
+/* Offsets of the '>' that start a line, in text order. */
+static size_t find_fasta_headers(const char *data, size_t size, size_t **headers_out) {
+    int max_threads = omp_get_max_threads();
+    size_t **found = (size_t **)xmalloc((size_t)max_threads * sizeof(size_t *));
+    size_t *found_count = (size_t *)xmalloc((size_t)max_threads * sizeof(size_t));
+    int used = 1;
+    #pragma omp parallel
+    {
+        int thread = omp_get_thread_num();
+        int threads = omp_get_num_threads();
+        #pragma omp single
+        used = threads;
+        size_t begin = size / (size_t)threads * (size_t)thread;
+        size_t end = thread == threads - 1 ? size : size / (size_t)threads * (size_t)(thread + 1);
+        size_t count = 0;
+        size_t capacity = 256;
+        size_t *list = (size_t *)xmalloc(capacity * sizeof(size_t));
+        for (size_t pos = begin; pos < end; ) {
+            const char *next = (const char *)memchr(data + pos, '>', end - pos);
+            if (!next) {
+                break;
+            }
+            pos = (size_t)(next - data);
+            if (pos == 0 || data[pos - 1] == '\n') {
+                if (count == capacity) {
+                    capacity *= 2;
+                    size_t *grown = (size_t *)realloc(list, capacity * sizeof(size_t));
+                    if (!grown) {
+                        fprintf(stderr, "Error: realloc failed while indexing FASTA headers\n");
+                        exit(EXIT_FAILURE);
+                    }
+                    list = grown;
+                }
+                list[count++] = pos;
+            }
+            ++pos;
+        }
+        found[thread] = list;
+        found_count[thread] = count;
+    }
+
+    size_t total = 0;
+    for (int t = 0; t < used; ++t) {
+        total += found_count[t];
+    }
+    size_t *headers = (size_t *)xmalloc((total ? total : 1) * sizeof(size_t));
+    size_t filled = 0;
+    for (int t = 0; t < used; ++t) {
+        memcpy(headers + filled, found[t], found_count[t] * sizeof(size_t));
+        filled += found_count[t];
+        free(found[t]);
+    }
+    free(found);
+    free(found_count);
+    *headers_out = headers;
+    return total;
+}
+
+/* Locates the header line and the ID / gene fields of `rec`, whose `header` and `end` are set. */
+static void parse_fasta_record(const char *data, FastaRecord *rec) {
+    const char *line = data + rec->header + 1;
+    const char *newline = (const char *)memchr(line, '\n', rec->end - rec->header - 1);
+    const char *stop = newline ? newline : data + rec->end;
+    rec->header_end = (size_t)(stop - data);
+    rec->body = newline ? rec->header_end + 1 : rec->end;
+
+    const char *nul = (const char *)memchr(line, '\0', (size_t)(stop - line));
+    if (nul) {
+        stop = nul;
+    }
+    while (stop > line && stop[-1] == '\r') {
+        --stop;
+    }
+
+    rec->id_length = SIZE_MAX;
+    rec->gene_length = SIZE_MAX;
+    int index = 0;
+    for (const char *p = line; p < stop && index <= 5; ) {
+        const char *bar = (const char *)memchr(p, '|', (size_t)(stop - p));
+        const char *field_end = bar ? bar : stop;
+        if (field_end > p) {
+            const char *b = p;
+            const char *e = field_end;
+            while (b < e && isspace((unsigned char)*b)) {
+                ++b;
+            }
+            while (e > b && isspace((unsigned char)e[-1])) {
+                --e;
+            }
+            if (index == 0) {
+                rec->id_begin = (size_t)(b - data);
+                rec->id_length = (size_t)(e - b);
+            } else if (index == 5) {
+                rec->gene_begin = (size_t)(b - data);
+                rec->gene_length = (size_t)(e - b);
+            }
+            ++index;
+        }
+        p = bar ? bar + 1 : stop;
+    }
+}
+
+static inline bool is_line_break(char c) {
+    return c == '\n' || c == '\r';
+}
+
+static size_t count_bases(const char *src, size_t len) {
+    size_t breaks = 0;
+    for (size_t i = 0; i < len; ++i) {
+        breaks += is_line_break(src[i]);
+    }
+    return len - breaks;
+}
+
+/*
+ * Normalisers: copy `src` to `dst` (room for exactly the `dst_len` bases
+ * of `src`) through normalize_base, dropping line breaks.  The vector
+ * versions map a whole vector at a time and, at a line break, store the
+ * vector anyway and advance past the break; a store only happens with a
+ * full vector of room left, so no piece writes into its neighbour's part of
+ * the buffer, and the tail is finished by the scalar loop.
+ */
+static void normalize_bases_scalar(const char *src, size_t len, char *dst) {
+    for (size_t i = 0; i < len; ++i) {
+        if (!is_line_break(src[i])) {
+            *dst++ = normalize_base(src[i]);
+        }
+    }
+}
+
+static void normalize_bases_vec128(const char *src, size_t len, char *dst, size_t dst_len) {
+    size_t in = 0;
+    size_t out = 0;
+    while (in + 16 <= len && out + 16 <= dst_len) {
+        v16u8 c = load_v16u8(src + in);
+        v16u8 folded = c | 0x20;
+        v16u8 base = (v16u8)((folded == 'a') & ('A' ^ 'N')) ^ (v16u8)((folded == 'c') & ('C' ^ 'N'))
+                     ^ (v16u8)((folded == 'g') & ('G' ^ 'N'))
+                     ^ (v16u8)(((folded == 't') | (folded == 'u')) & ('T' ^ 'N')) ^ 'N';
+        memcpy(dst + out, &base, sizeof(base));
+        v2u64 breaks = (v2u64)((c == '\n') | (c == '\r'));
+        if (!(breaks[0] | breaks[1])) {
+            in += 16;
+            out += 16;
+            continue;
+        }
+        size_t first = breaks[0] ? (size_t)__builtin_ctzll(breaks[0]) / 8
+                                 : 8 + (size_t)__builtin_ctzll(breaks[1]) / 8;
+        in += first + 1;
+        out += first;
+    }
+    normalize_bases_scalar(src + in, len - in, dst + out);
+}
+
+#if OT_X86
+/*
+ * pshufb lookup: after folding to lower case, a-g sit at 0x61-0x67 and t/u
+ * at 0x74/0x75, so the low nibble indexes one 16-entry table per high
+ * nibble and every other byte becomes 'N'.
+ */
+OT_TARGET_AVX2 static void normalize_bases_avx2(const char *src, size_t len, char *dst, size_t dst_len) {
+    const __m256i table6 = _mm256_broadcastsi128_si256(
+        _mm_setr_epi8('N', 'A', 'N', 'C', 'N', 'N', 'N', 'G', 'N', 'N', 'N', 'N', 'N', 'N', 'N', 'N'));
+    const __m256i table7 = _mm256_broadcastsi128_si256(
+        _mm_setr_epi8('N', 'N', 'N', 'N', 'T', 'T', 'N', 'N', 'N', 'N', 'N', 'N', 'N', 'N', 'N', 'N'));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i unknown = _mm256_set1_epi8('N');
+    size_t in = 0;
+    size_t out = 0;
+    while (in + 32 <= len && out + 32 <= dst_len) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(src + in));
+        __m256i folded = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+        __m256i low = _mm256_and_si256(folded, nibble);
+        __m256i high = _mm256_and_si256(_mm256_srli_epi16(folded, 4), nibble);
+        __m256i base = _mm256_blendv_epi8(unknown, _mm256_shuffle_epi8(table6, low),
+                                          _mm256_cmpeq_epi8(high, _mm256_set1_epi8(6)));
+        base = _mm256_blendv_epi8(base, _mm256_shuffle_epi8(table7, low),
+                                  _mm256_cmpeq_epi8(high, _mm256_set1_epi8(7)));
+        _mm256_storeu_si256((__m256i *)(dst + out), base);
+        uint32_t breaks = (uint32_t)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')),
+                            _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\r'))));
+        if (!breaks) {
+            in += 32;
+            out += 32;
+            continue;
+        }
+        size_t first = (size_t)__builtin_ctz(breaks);
+        in += first + 1;
+        out += first;
+    }
+    normalize_bases_scalar(src + in, len - in, dst + out);
+}
+#endif
+
+static void normalize_bases(SimdLevel simd, const char *src, size_t len, char *dst, size_t dst_len) {
+    switch (simd) {
+#if OT_X86
+        case SIMD_AVX512:
+        case SIMD_AVX2:
+            normalize_bases_avx2(src, len, dst, dst_len);
+            break;
+#endif
+        case SIMD_VEC128:
+            normalize_bases_vec128(src, len, dst, dst_len);
+            break;
+        default:
+            normalize_bases_scalar(src, len, dst);
+            break;
+    }
+}
+
+/* Copies the field at [begin, begin + length) of the text into `scratch` as a C string. */
+static const char *fasta_field(const char *data, size_t begin, size_t length, const char *missing,
+                               char **scratch, size_t *scratch_size) {
+    if (length == SIZE_MAX) {
+        return missing;
+    }
+    if (length + 1 > *scratch_size) {
+        free(*scratch);
+        *scratch_size = length + 1;
+        *scratch = (char *)xmalloc(*scratch_size);
+    }
+    memcpy(*scratch, data + begin, length);
+    (*scratch)[length] = '\0';
+    return *scratch;
+}
+
+/*
+ * A parsed reference text: its pieces in record order, each with the
+ * position `out` of its first base in the loaded sequence.
+ */
+typedef struct {
+    FastaText text;
+    FastaPiece *pieces;
+    size_t piece_count;
+} FastaLayout;
+
+/*
+ * Parses the records of `filename` and lays them out as a load would (each
+ * followed by PAD_WIDTH sentinels), storing transcript IDs and gene symbols
+ * in `names`, which the caller initialises.  The text stays open in `layout`
+ * for fill_reference_range; returns the sequence length.
+ */
+static size_t layout_reference(const char *filename, StringPool *names, FastaLayout *layout,
+                               TranscriptInfo **transcripts_out, size_t *transcript_count_out) {
+    FastaText text = open_fasta_text(filename);
+    const char *data = text.data;
+    size_t size = text.size;
+    /* A final one-character line without a newline is not read (the line reader skipped it too). */
+    if (size > 0 && data[size - 1] != '\n' && (size == 1 || data[size - 2] == '\n')) {
+        --size;
+    }
+
+    size_t *headers = NULL;
+    size_t transcript_count = find_fasta_headers(data, size, &headers);
+    FastaRecord *records = (FastaRecord *)xmalloc((transcript_count ? transcript_count : 1) * sizeof(FastaRecord));
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (size_t t = 0; t < transcript_count; ++t) {
+        records[t].header = headers[t];
+        records[t].end = t + 1 < transcript_count ? headers[t + 1] : size;
+        parse_fasta_record(data, &records[t]);
+    }
+    free(headers);
+
+    if (transcript_count == 0) {
+        fprintf(stderr, "Error: reference '%s' contains no sequence records\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t piece_count = 0;
+    for (size_t t = 0; t < transcript_count; ++t) {
+        records[t].first_piece = piece_count;
+        piece_count += (records[t].end - records[t].body + LOAD_PIECE_BYTES - 1) / LOAD_PIECE_BYTES;
+    }
+    FastaPiece *pieces = (FastaPiece *)xmalloc((piece_count ? piece_count : 1) * sizeof(FastaPiece));
+    for (size_t t = 0; t < transcript_count; ++t) {
+        size_t p = records[t].first_piece;
+        for (size_t begin = records[t].body; begin < records[t].end; begin += LOAD_PIECE_BYTES, ++p) {
+            pieces[p].begin = begin;
+            pieces[p].end = begin + LOAD_PIECE_BYTES < records[t].end ? begin + LOAD_PIECE_BYTES : records[t].end;
+        }
+    }
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (size_t p = 0; p < piece_count; ++p) {
+        pieces[p].bases = count_bases(data + pieces[p].begin, pieces[p].end - pieces[p].begin);
+    }
+
+    TranscriptInfo *transcripts = (TranscriptInfo *)xmalloc(transcript_count * sizeof(TranscriptInfo));
+    size_t length = 0;
+    for (size_t t = 0; t < transcript_count; ++t) {
+        size_t piece_end = t + 1 < transcript_count ? records[t + 1].first_piece : piece_count;
+        transcripts[t].start = length;
+        for (size_t p = records[t].first_piece; p < piece_end; ++p) {
+            pieces[p].out = length;
+            length += pieces[p].bases;
+        }
+        transcripts[t].length = length - transcripts[t].start;
+        length += PAD_WIDTH;    /* sentinel padding, also after the last record for vector loads */
+    }
+    if (length == PAD_WIDTH) {
+        fprintf(stderr, "Error: reference '%s' contains no sequence data\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    char *scratch = NULL;
+    size_t scratch_size = 0;
+    for (size_t t = 0; t < transcript_count; ++t) {
+        const FastaRecord *rec = &records[t];
+        transcripts[t].transcript_id = string_pool_copy(
+            names, fasta_field(data, rec->id_begin, rec->id_length, "UNKNOWN", &scratch, &scratch_size));
+        transcripts[t].gene = string_pool_intern(
+            names, fasta_field(data, rec->gene_begin, rec->gene_length, "Unknown", &scratch, &scratch_size));
+        transcripts[t].gene_symbol = (char *)string_pool_get(names, transcripts[t].gene);
+    }
+    free(scratch);
+    free(records);
+
+    layout->text = text;
+    layout->pieces = pieces;
+    layout->piece_count = piece_count;
+    *transcripts_out = transcripts;
+    *transcript_count_out = transcript_count;
+    return length;
+}
+
+static void close_fasta_layout(FastaLayout *layout) {
+    free(layout->pieces);
+    close_fasta_text(&layout->text);
+    memset(layout, 0, sizeof(*layout));
+}
+
+/*
+ * Normalises positions [begin, end) of the laid-out sequence into `dst`;
+ * padding between records becomes sentinels.  Serial, so a prefetch thread
+ * can run it beside a scan.
+ */
+static void fill_reference_range(const FastaLayout *layout, SimdLevel simd, size_t begin, size_t end, char *dst) {
+    memset(dst, SENTINEL_CHAR, end - begin);
+    size_t lo = 0;
+    size_t hi = layout->piece_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (layout->pieces[mid].out + layout->pieces[mid].bases <= begin) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    char *scratch = NULL;
+    for (size_t p = lo; p < layout->piece_count && layout->pieces[p].out < end; ++p) {
+        const FastaPiece *piece = &layout->pieces[p];
+        const char *src = layout->text.data + piece->begin;
+        size_t piece_end = piece->out + piece->bases;
+        if (piece->out >= begin && piece_end <= end) {
+            normalize_bases(simd, src, piece->end - piece->begin, dst + (piece->out - begin), piece->bases);
+            continue;
+        }
+        /* A piece cut by the range is normalised whole and the overlap copied. */
+        if (!scratch) {
+            scratch = (char *)xmalloc(LOAD_PIECE_BYTES);
+        }
+        normalize_bases(simd, src, piece->end - piece->begin, scratch, piece->bases);
+        size_t from = piece->out > begin ? piece->out : begin;
+        size_t to = piece_end < end ? piece_end : end;
+        memcpy(dst + (from - begin), scratch + (from - piece->out), to - from);
+    }
+    free(scratch);
+}
+
+/*
+ * Transcript IDs and gene symbols are stored in `names`, which the caller
+ * initialises.  Without `keep_sequence` only the layout is read: transcripts
+ * get the offsets a full load would give them and the returned buffer holds
+ * no data, only the length.  `simd` picks the normaliser.
+ */
+static Buffer load_reference_sequence(const char *filename, StringPool *names, bool keep_sequence, SimdLevel simd,
+                                      TranscriptInfo **transcripts_out, size_t *transcript_count_out) {
+    FastaLayout layout;
+    TranscriptInfo *transcripts = NULL;
+    size_t transcript_count = 0;
+    size_t length = layout_reference(filename, names, &layout, &transcripts, &transcript_count);
+
+    Buffer buffer = {0};
+    buffer.length = length;
+    if (keep_sequence) {
+        /* PAD_WIDTH bytes of slack past the end for the second vector of wide byte kernels. */
+        buffer.data = (char *)xmalloc(length + PAD_WIDTH);
+        buffer.capacity = length + PAD_WIDTH;
+        memset(buffer.data + length, SENTINEL_CHAR, PAD_WIDTH);
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (size_t p = 0; p < layout.piece_count; ++p) {
+            const FastaPiece *piece = &layout.pieces[p];
+            normalize_bases(simd, layout.text.data + piece->begin, piece->end - piece->begin,
+                            buffer.data + piece->out, piece->bases);
+        }
+        for (size_t t = 0; t < transcript_count; ++t) {
+            memset(buffer.data + transcripts[t].start + transcripts[t].length, SENTINEL_CHAR, PAD_WIDTH);
+        }
+    }
+    close_fasta_layout(&layout);
+
+    *transcripts_out = transcripts;
+    *transcript_count_out = transcript_count;
+    return buffer;
+}
+
+/*
+ * k-mer position index for the seed-and-verify engine.  `offsets` has
+ * 4^k + 1 entries; positions of k-mer `code` (2-bit codes, first base in the
+ * most significant bits) are positions[offsets[code] .. offsets[code + 1]),
+ * in ascending order.  k-mers that touch an N or sentinel are not indexed.
+ */
+#define MAX_KMER_LEN 12
+
+static int build_kmer_index(const PackedReference *ref, int k, KmerIndex *index) {
+    memset(index, 0, sizeof(*index));
+    if (k < 1 || k > MAX_KMER_LEN) {
+        fprintf(stderr, "Error: k-mer length must be between 1 and %d\n", MAX_KMER_LEN);
+        return -1;
+    }
+    if (ref->length > UINT32_MAX) {
+        fprintf(stderr, "Error: k-mer index supports references up to %u bases\n", UINT32_MAX);
+        return -1;
+    }
+
+    size_t buckets = (size_t)1 << (2 * k);
+    uint32_t mask = (uint32_t)(buckets - 1);
+    uint32_t *offsets = (uint32_t *)xmalloc((buckets + 1) * sizeof(uint32_t));
+    memset(offsets, 0, (buckets + 1) * sizeof(uint32_t));
+
+    // Pass 1: count k-mers ending at each position.
+    uint32_t code = 0;
+    int run = 0;
+    uint64_t total = 0;
+    for (size_t pos = 0; pos < ref->length; ++pos) {
+        bool is_n;
+        unsigned base = packed_base(ref, pos, &is_n);
+        if (is_n) {
+            run = 0;
+            continue;
+        }
+        code = ((code << 2) | base) & mask;
+        if (++run >= k) {
+            offsets[code + 1]++;
+            total++;
+        }
+    }
+    for (size_t b = 0; b < buckets; ++b) {
+        offsets[b + 1] += offsets[b];
+    }
+
+    // Pass 2: fill positions in ascending order using a moving cursor per bucket.
+    uint32_t *positions = (uint32_t *)xmalloc((total ? total : 1) * sizeof(uint32_t));
+    uint32_t *cursor = (uint32_t *)xmalloc(buckets * sizeof(uint32_t));
+    memcpy(cursor, offsets, buckets * sizeof(uint32_t));
+    code = 0;
+    run = 0;
+    for (size_t pos = 0; pos < ref->length; ++pos) {
+        bool is_n;
+        unsigned base = packed_base(ref, pos, &is_n);
+        if (is_n) {
+            run = 0;
+            continue;
+        }
+        code = ((code << 2) | base) & mask;
+        if (++run >= k) {
+            positions[cursor[code]++] = (uint32_t)(pos + 1 - (size_t)k);
+        }
+    }
+    free(cursor);
+
+    index->k = k;
+    index->offsets = offsets;
+    index->positions = positions;
+    index->position_count = total;
+    return 0;
+}
+
+static void free_kmer_index(KmerIndex *index) {
+    if (!index->mapped) {
+        free(index->offsets);
+        free(index->positions);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+/*
+ * NUMA placement, chosen with TIGER_OFFTARGET_NUMA (Linux).  The loading
+ * thread first-touches the whole reference, so on a multi-socket node it
+ * all lands on one node and threads on the other sockets scan it across
+ * the interconnect.  "interleave" spreads the pages of the reference
+ * arrays round-robin over the nodes; "replicate" gives every node its own
+ * copy of them (bit-planes, stored validity bitmap, byte sequence, k-mer
+ * index) and each scan block reads the copy of the node it runs on.  Both
+ * pin every worker thread to the CPUs of one node, alternating nodes.
+ * Index images are mapped from the shared page cache, so interleave only
+ * moves their derived arrays; replicate copies them like the rest.  With a
+ * single node either mode is a no-op.
+ */
+static const char *const numa_mode_names[] = {"off", "interleave", "replicate"};
+
+#ifdef __linux__
+/* Parses a sysfs CPU list ("0-3,8-11") into `set`, restricted to `allowed`. */
+static void parse_cpu_list(const char *list, const cpu_set_t *allowed, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *cursor = list;
+    while (*cursor && *cursor != '\n') {
+        char *end = NULL;
+        long first = strtol(cursor, &end, 10);
+        if (end == cursor) {
+            return;
+        }
+        long last = first;
+        cursor = end;
+        if (*cursor == '-') {
+            last = strtol(cursor + 1, &end, 10);
+            cursor = end;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            if (cpu >= 0 && CPU_ISSET((int)cpu, allowed)) {
+                CPU_SET((int)cpu, set);
+            }
+        }
+        if (*cursor == ',') {
+            ++cursor;
+        }
+    }
+}
+
+static bool read_sysfs_line(const char *path, char *line, size_t size) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        return false;
+    }
+    bool ok = fgets(line, (int)size, in) != NULL;
+    fclose(in);
+    return ok;
+}
+
+/* Fills the node table from /sys/devices/system/node; returns the node count. */
+static int numa_discover(NumaLayout *numa) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return 0;
+    }
+    char line[4096];
+    for (int node = 0; node < MAX_NUMA_NODES; ++node) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (!read_sysfs_line(path, line, sizeof(line))) {
+            continue;
+        }
+        cpu_set_t cpus;
+        parse_cpu_list(line, &allowed, &cpus);
+        if (CPU_COUNT(&cpus) == 0) {
+            continue;
+        }
+        numa->cpus[numa->node_count] = cpus;
+        numa->node_ids[numa->node_count++] = node;
+    }
+
+    numa->cpu_limit = CPU_SETSIZE;
+    numa->cpu_node = (short *)xmalloc((size_t)numa->cpu_limit * sizeof(short));
+    for (int cpu = 0; cpu < numa->cpu_limit; ++cpu) {
+        numa->cpu_node[cpu] = -1;
+        for (int n = 0; n < numa->node_count; ++n) {
+            if (CPU_ISSET(cpu, &numa->cpus[n])) {
+                numa->cpu_node[cpu] = (short)n;
+            }
+        }
+    }
+    return numa->node_count;
+}
+
+static long numa_mbind(void *addr, size_t size, int mode, const unsigned long *mask, unsigned flags) {
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(page - 1);
+    uintptr_t end = ((uintptr_t)addr + size + page - 1) & ~(page - 1);
+    return syscall(SYS_mbind, (void *)start, end - start, mode, mask, (unsigned long)MAX_NUMA_NODES + 1, flags);
+}
+
+/* Moves the pages of [addr, addr + size) to an interleave over every node. */
+static bool numa_interleave(const NumaLayout *numa, const void *addr, size_t size) {
+    if (!addr || size == 0) {
+        return true;
+    }
+    unsigned long mask = 0;
+    for (int n = 0; n < numa->node_count; ++n) {
+        mask |= 1UL << numa->node_ids[n];
+    }
+    return numa_mbind((void *)addr, size, MPOL_INTERLEAVE, &mask, MPOL_MF_MOVE) == 0;
+}
+
+/* Anonymous mapping whose pages are allocated on node index `n` when first written. */
+static void *numa_alloc_on_node(const NumaLayout *numa, int n, size_t size) {
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    unsigned long mask = 1UL << numa->node_ids[n];
+    if (numa_mbind(mapping, size, MPOL_BIND, &mask, 0) != 0) {
+        munmap(mapping, size);
+        return NULL;
+    }
+    return mapping;
+}
+#endif
+
+/* Copies `size` bytes of `src` to `*cursor` (advanced 64-byte aligned); NULL when there is nothing to copy. */
+static void *numa_copy(char **cursor, const void *src, size_t size) {
+    if (!src || size == 0) {
+        return NULL;
+    }
+    void *dst = *cursor;
+    memcpy(dst, src, size);
+    *cursor += (size + 63) & ~(size_t)63;
+    return dst;
+}
+
+static void numa_free_kmer_replicas(NumaLayout *numa) {
+    for (int n = 0; numa->replicas && n < numa->node_count; ++n) {
+        NumaReplica *replica = &numa->replicas[n];
+        if (replica->kmer_mapping) {
+            munmap(replica->kmer_mapping, replica->kmer_mapping_size);
+        }
+        replica->kmer_mapping = NULL;
+        replica->kmer_offsets = NULL;
+        replica->kmer_positions = NULL;
+    }
+}
+
+static void numa_free(NumaLayout *numa) {
+    numa_free_kmer_replicas(numa);
+    for (int n = 0; numa->replicas && n < numa->node_count; ++n) {
+        if (numa->replicas[n].mapping) {
+            munmap(numa->replicas[n].mapping, numa->replicas[n].mapping_size);
+        }
+    }
+    free(numa->replicas);
+    free(numa->cpu_node);
+    memset(numa, 0, sizeof(*numa));
+}
+
+/*
+ * Reads TIGER_OFFTARGET_NUMA and the node topology.  Returns the mode in
+ * effect: off unless a mode was asked for and more than one node is usable.
+ */
+static NumaMode numa_init(NumaLayout *numa) {
+    memset(numa, 0, sizeof(*numa));
+    const char *env = getenv("TIGER_OFFTARGET_NUMA");
+    if (!env || !*env || strcmp(env, "off") == 0) {
+        return NUMA_OFF;
+    }
+    NumaMode mode = NUMA_OFF;
+    for (int m = NUMA_INTERLEAVE; m <= NUMA_REPLICATE; ++m) {
+        if (strcmp(env, numa_mode_names[m]) == 0) {
+            mode = (NumaMode)m;
+        }
+    }
+    if (mode == NUMA_OFF) {
+        fprintf(stderr, "Warning: ignoring invalid TIGER_OFFTARGET_NUMA value '%s'\n", env);
+        return NUMA_OFF;
+    }
+#ifdef __linux__
+    if (numa_discover(numa) > 1) {
+        numa->mode = mode;
+        return mode;
+    }
+#else
+    fprintf(stderr, "Warning: TIGER_OFFTARGET_NUMA is only supported on Linux; ignored\n");
+#endif
+    numa_free(numa);
+    return NUMA_OFF;
+}
+
+/*
+ * Applies the NUMA mode to the reference arrays of `packed` and the byte
+ * sequence `bytes` (either may be empty).  Falls back to the shared copy
+ * with a warning when the kernel refuses the placement.
+ */
+static void numa_place_reference(NumaLayout *numa, const PackedReference *packed, const char *bytes,
+                                 size_t byte_count) {
+#ifdef __linux__
+    size_t plane_bytes = packed->lo ? packed->words * sizeof(uint64_t) : 0;
+    size_t valid_bytes = packed->valid ? packed->words * sizeof(uint64_t) : 0;
+    if (numa->mode == NUMA_INTERLEAVE) {
+        bool placed = (packed->mapping || (numa_interleave(numa, packed->lo, plane_bytes)
+                                           && numa_interleave(numa, packed->hi, plane_bytes)
+                                           && numa_interleave(numa, packed->nmask, plane_bytes)))
+            && (packed->valid_mapped || numa_interleave(numa, packed->valid, valid_bytes))
+            && numa_interleave(numa, bytes, byte_count);
+        if (!placed) {
+            fprintf(stderr, "Warning: could not interleave the reference over NUMA nodes: %s\n", strerror(errno));
+        }
+        return;
+    }
+    if (numa->mode != NUMA_REPLICATE) {
+        return;
+    }
+
+    size_t size = 3 * ((plane_bytes + 63) & ~(size_t)63) + ((valid_bytes + 63) & ~(size_t)63) + byte_count + 64;
+    numa->replicas = (NumaReplica *)xmalloc((size_t)numa->node_count * sizeof(NumaReplica));
+    memset(numa->replicas, 0, (size_t)numa->node_count * sizeof(NumaReplica));
+    for (int n = 0; n < numa->node_count; ++n) {
+        NumaReplica *replica = &numa->replicas[n];
+        replica->mapping = numa_alloc_on_node(numa, n, size);
+        if (!replica->mapping) {
+            fprintf(stderr, "Warning: could not replicate the reference on NUMA node %d (%s); "
+                    "using one shared copy\n", numa->node_ids[n], strerror(errno));
+            for (int k = 0; k < n; ++k) {
+                munmap(numa->replicas[k].mapping, numa->replicas[k].mapping_size);
+            }
+            free(numa->replicas);
+            numa->replicas = NULL;
+            return;
+        }
+        replica->mapping_size = size;
+        char *cursor = (char *)replica->mapping;
+        replica->lo = (const uint64_t *)numa_copy(&cursor, packed->lo, plane_bytes);
+        replica->hi = (const uint64_t *)numa_copy(&cursor, packed->hi, plane_bytes);
+        replica->nmask = (const uint64_t *)numa_copy(&cursor, packed->nmask, plane_bytes);
+        replica->valid = (const uint64_t *)numa_copy(&cursor, packed->valid, valid_bytes);
+        replica->bytes = (const char *)numa_copy(&cursor, bytes, byte_count);
+    }
+#else
+    (void)numa;
+    (void)packed;
+    (void)bytes;
+    (void)byte_count;
+#endif
+}
+
+/* Interleaves or replicates a freshly built or loaded k-mer index like the reference. */
+static void numa_place_kmers(NumaLayout *numa, const KmerIndex *kmers) {
+#ifdef __linux__
+    if (numa->mode == NUMA_OFF || kmers->offsets == numa->placed_kmers) {
+        return;
+    }
+    numa->placed_kmers = kmers->offsets;
+    size_t offset_bytes = kmers->k ? (((size_t)1 << (2 * kmers->k)) + 1) * sizeof(uint32_t) : 0;
+    size_t position_bytes = (size_t)kmers->position_count * sizeof(uint32_t);
+    if (numa->mode == NUMA_INTERLEAVE && !kmers->mapped) {
+        if (!numa_interleave(numa, kmers->offsets, offset_bytes)
+            || !numa_interleave(numa, kmers->positions, position_bytes)) {
+            fprintf(stderr, "Warning: could not interleave the k-mer index over NUMA nodes: %s\n",
+                    strerror(errno));
+        }
+        return;
+    }
+    if (!numa->replicas) {
+        return;
+    }
+    numa_free_kmer_replicas(numa);
+    if (offset_bytes == 0) {
+        return;
+    }
+    size_t size = ((offset_bytes + 63) & ~(size_t)63) + position_bytes + 64;
+    for (int n = 0; n < numa->node_count; ++n) {
+        NumaReplica *replica = &numa->replicas[n];
+        replica->kmer_mapping = numa_alloc_on_node(numa, n, size);
+        if (!replica->kmer_mapping) {
+            fprintf(stderr, "Warning: could not replicate the k-mer index on NUMA node %d (%s); "
+                    "using one shared copy\n", numa->node_ids[n], strerror(errno));
+            numa_free_kmer_replicas(numa);
+            return;
+        }
+        replica->kmer_mapping_size = size;
+        char *cursor = (char *)replica->kmer_mapping;
+        replica->kmer_offsets = (const uint32_t *)numa_copy(&cursor, kmers->offsets, offset_bytes);
+        replica->kmer_positions = (const uint32_t *)numa_copy(&cursor, kmers->positions, position_bytes);
+    }
+#else
+    (void)numa;
+    (void)kmers;
+#endif
+}
+
+/*
+ * Called by a worker before each scan block: pins the calling thread to
+ * the next node in turn on first use (so the threads of every team, serve
+ * connections included, spread evenly) and returns the index of the node it runs on,
+ * whose replica the block should read (0 when NUMA placement is off).
+ */
+static inline int numa_enter(const NumaLayout *numa) {
+#ifdef __linux__
+    static __thread bool pinned;
+    static int next_thread;
+    if (numa->mode == NUMA_OFF) {
+        return 0;
+    }
+    if (!pinned) {
+        int n = __atomic_fetch_add(&next_thread, 1, __ATOMIC_RELAXED) % numa->node_count;
+        sched_setaffinity(0, sizeof(cpu_set_t), &numa->cpus[n]);
+        pinned = true;
+    }
+    int cpu = sched_getcpu();
+    return cpu >= 0 && cpu < numa->cpu_limit && numa->cpu_node[cpu] >= 0 ? numa->cpu_node[cpu] : 0;
+#else
+    (void)numa;
+    return 0;
+#endif
+}
+
+/*
+ * Per-node views of a search's reference: `batch` (the context's packed
+ * reference with this batch's validity bitmaps) with every array that has
+ * a replica swapped for it.  Returns NULL without replicas.
+ */
+static PackedReference *numa_packed_views(const NumaLayout *numa, const PackedReference *batch,
+                                          const uint64_t *stored_valid) {
+    if (!numa->replicas) {
+        return NULL;
+    }
+    PackedReference *views = (PackedReference *)xmalloc((size_t)numa->node_count * sizeof(PackedReference));
+    for (int n = 0; n < numa->node_count; ++n) {
+        const NumaReplica *replica = &numa->replicas[n];
+        views[n] = *batch;
+        if (replica->lo) {
+            views[n].lo = (uint64_t *)replica->lo;
+            views[n].hi = (uint64_t *)replica->hi;
+            views[n].nmask = (uint64_t *)replica->nmask;
+        }
+        if (replica->valid) {
+            if (views[n].valid == stored_valid) {
+                views[n].valid = (uint64_t *)replica->valid;
+            }
+            for (int len = 0; len <= MAX_GUIDE_LEN; ++len) {
+                if (views[n].valid_len[len] == stored_valid) {
+                    views[n].valid_len[len] = replica->valid;
+                }
+            }
+        }
+    }
+    return views;
+}
+
+/* Per-node views of the k-mer index, or NULL without replicas of it. */
+static KmerIndex *numa_kmer_views(const NumaLayout *numa, const KmerIndex *kmers) {
+    if (!numa->replicas || !numa->replicas[0].kmer_offsets) {
+        return NULL;
+    }
+    KmerIndex *views = (KmerIndex *)xmalloc((size_t)numa->node_count * sizeof(KmerIndex));
+    for (int n = 0; n < numa->node_count; ++n) {
+        views[n] = *kmers;
+        views[n].offsets = (uint32_t *)numa->replicas[n].kmer_offsets;
+        views[n].positions = (uint32_t *)numa->replicas[n].kmer_positions;
+    }
+    return views;
+}
+
+/* The per-node views one search hands its workers (see numa_enter). */
+typedef struct {
+    const NumaLayout *numa;
+    const PackedReference *packed;  /* per node, or NULL for the shared reference */
+    const KmerIndex *kmers;         /* per node, or NULL */
+} NumaViews;
+
+static inline const PackedReference *numa_local_packed(const NumaViews *views, int node,
+                                                       const PackedReference *shared) {
+    return views && views->packed ? &views->packed[node] : shared;
+}
+
+/*
+ * Reference index image ("offtarget_search index build").  The image holds
+ * the packed bit-planes, a window-start bitmap for one guide length, the
+ * transcript offset table and a string heap with transcript IDs and interned
+ * gene symbols, optionally followed by a k-mer position index for the seed
+ * engine.  Every section is 64-byte aligned so a search can mmap the
+ * file read-only and point straight into it; concurrent jobs on a node then
+ * share one copy through the page cache.
+ */
+#define INDEX_MAGIC "TGROTIDX"
+#define INDEX_VERSION 2
+#define INDEX_ALIGN 64
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t window_len;
+    uint32_t reserved;
+    uint64_t length;
+    uint64_t data_words;
+    uint64_t words;
+    uint64_t transcript_count;
+    uint64_t gene_count;
+    uint64_t lo_offset;
+    uint64_t hi_offset;
+    uint64_t nmask_offset;
+    uint64_t valid_offset;
+    uint64_t transcripts_offset;
+    uint64_t genes_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t kmer_k;
+    uint64_t kmer_offsets_offset;
+    uint64_t kmer_positions_offset;
+    uint64_t kmer_position_count;
+    uint64_t file_size;
+} IndexHeader;
+
+typedef struct {
+    uint64_t start;
+    uint64_t length;
+    uint64_t id_offset;
+    uint32_t gene_index;
+    uint32_t reserved;
+} IndexTranscript;
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + INDEX_ALIGN - 1) & ~(uint64_t)(INDEX_ALIGN - 1);
+}
+
+static int write_section(FILE *fp, const void *data, size_t bytes, uint64_t *offset) {
+    static const char zeros[INDEX_ALIGN] = {0};
+    uint64_t aligned = align_offset(*offset);
+    if (aligned > *offset && fwrite(zeros, 1, (size_t)(aligned - *offset), fp) != aligned - *offset) {
+        return -1;
+    }
+    if (bytes > 0 && fwrite(data, 1, bytes, fp) != bytes) {
+        return -1;
+    }
+    *offset = aligned + bytes;
+    return 0;
+}
+
+static int is_index_image(const char *filename) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return 0;
+    }
+    char magic[8];
+    size_t got = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    return got == sizeof(magic) && memcmp(magic, INDEX_MAGIC, sizeof(magic)) == 0;
+}
+
+static int build_index_image(const char *reference_file, const char *index_file, int window_len, int kmer_len) {
+    int threads = parse_thread_override();
+    if (threads > 0) {
+        omp_set_num_threads(threads);
+    }
+    TranscriptInfo *transcripts = NULL;
+    size_t transcript_count = 0;
+    StringPool names;
+    string_pool_init(&names);
+    SimdLevel simd = select_simd_level();
+    Buffer reference = load_reference_sequence(reference_file, &names, true, simd,
+                                               &transcripts, &transcript_count);
+    PackedReference packed = pack_reference(reference.data, reference.length,
+                                            transcripts, transcript_count, window_len, simd);
+    free(reference.data);
+
+    KmerIndex kmers;
+    memset(&kmers, 0, sizeof(kmers));
+    if (kmer_len > 0 && build_kmer_index(&packed, kmer_len, &kmers) != 0) {
+        free_packed_reference(&packed);
+        free(transcripts);
+        string_pool_free(&names);
+        return -1;
+    }
+    uint64_t kmer_offset_bytes = kmer_len > 0 ? (((uint64_t)1 << (2 * kmer_len)) + 1) * sizeof(uint32_t) : 0;
+    uint64_t kmer_position_bytes = kmers.position_count * sizeof(uint32_t);
+
+    const StringTable *genes = &names.interned;
+    IndexTranscript *records = (IndexTranscript *)xmalloc(transcript_count * sizeof(IndexTranscript));
+    uint64_t strings_size = 0;
+    for (size_t t = 0; t < transcript_count; ++t) {
+        records[t].start = transcripts[t].start;
+        records[t].length = transcripts[t].length;
+        records[t].id_offset = strings_size;
+        records[t].gene_index = transcripts[t].gene;
+        records[t].reserved = 0;
+        strings_size += strlen(transcripts[t].transcript_id) + 1;
+    }
+    uint64_t *gene_offsets = (uint64_t *)xmalloc((genes->count ? genes->count : 1) * sizeof(uint64_t));
+    for (size_t g = 0; g < genes->count; ++g) {
+        gene_offsets[g] = strings_size;
+        strings_size += strlen(genes->strings[g]) + 1;
+    }
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.byte_order = INDEX_BYTE_ORDER;
+    header.window_len = (uint32_t)window_len;
+    header.length = packed.length;
+    header.data_words = packed.data_words;
+    header.words = packed.words;
+    header.transcript_count = transcript_count;
+    header.gene_count = genes->count;
+    header.strings_size = strings_size;
+
+    uint64_t plane_bytes = packed.words * sizeof(uint64_t);
+    uint64_t offset = sizeof(header);
+    header.lo_offset = align_offset(offset);
+    header.hi_offset = align_offset(header.lo_offset + plane_bytes);
+    header.nmask_offset = align_offset(header.hi_offset + plane_bytes);
+    header.valid_offset = align_offset(header.nmask_offset + plane_bytes);
+    header.transcripts_offset = align_offset(header.valid_offset + plane_bytes);
+    header.genes_offset = align_offset(header.transcripts_offset + transcript_count * sizeof(IndexTranscript));
+    header.strings_offset = align_offset(header.genes_offset + genes->count * sizeof(uint64_t));
+    header.file_size = header.strings_offset + strings_size;
+    if (kmer_len > 0) {
+        header.kmer_k = (uint64_t)kmer_len;
+        header.kmer_position_count = kmers.position_count;
+        header.kmer_offsets_offset = align_offset(header.file_size);
+        header.kmer_positions_offset = align_offset(header.kmer_offsets_offset + kmer_offset_bytes);
+        header.file_size = header.kmer_positions_offset + kmer_position_bytes;
+    }
+
+    size_t tmp_len = strlen(index_file) + 16;
+    char *tmp_file = (char *)xmalloc(tmp_len);
+    snprintf(tmp_file, tmp_len, "%s.tmp.%ld", index_file, (long)getpid());
+
+    int status = -1;
+    FILE *fp = fopen(tmp_file, "wb");
+    if (!fp) {
+        fprintf(stderr, "Error: unable to create index file '%s': %s\n", tmp_file, strerror(errno));
+    } else {
+        offset = 0;
+        bool ok = write_section(fp, &header, sizeof(header), &offset) == 0
+            && write_section(fp, packed.lo, plane_bytes, &offset) == 0
+            && write_section(fp, packed.hi, plane_bytes, &offset) == 0
+            && write_section(fp, packed.nmask, plane_bytes, &offset) == 0
+            && write_section(fp, packed.valid, plane_bytes, &offset) == 0
+            && write_section(fp, records, transcript_count * sizeof(IndexTranscript), &offset) == 0
+            && write_section(fp, gene_offsets, genes->count * sizeof(uint64_t), &offset) == 0;
+        uint64_t aligned = align_offset(offset);
+        ok = ok && write_section(fp, NULL, 0, &offset) == 0 && aligned == header.strings_offset;
+        for (size_t t = 0; ok && t < transcript_count; ++t) {
+            ok = fputs(transcripts[t].transcript_id, fp) >= 0 && fputc('\0', fp) != EOF;
+        }
+        for (size_t g = 0; ok && g < genes->count; ++g) {
+            ok = fputs(genes->strings[g], fp) >= 0 && fputc('\0', fp) != EOF;
+        }
+        if (ok && kmer_len > 0) {
+            offset = header.strings_offset + strings_size;
+            ok = write_section(fp, kmers.offsets, kmer_offset_bytes, &offset) == 0
+                && write_section(fp, kmers.positions, kmer_position_bytes, &offset) == 0;
+        }
+        if (fclose(fp) != 0) {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "Error: failed writing index file '%s': %s\n", tmp_file, strerror(errno));
+            unlink(tmp_file);
+        } else if (rename(tmp_file, index_file) != 0) {
+            fprintf(stderr, "Error: unable to move index into place at '%s': %s\n", index_file, strerror(errno));
+            unlink(tmp_file);
+        } else {
+            fprintf(stderr, "Built index '%s': %zu transcripts, %zu genes, %llu bases (window %d",
+                    index_file, transcript_count, genes->count,
+                    (unsigned long long)packed.length, window_len);
+            if (kmer_len > 0) {
+                fprintf(stderr, ", %d-mer seeds", kmer_len);
+            }
+            fprintf(stderr, ")\n");
+            status = 0;
+        }
+    }
+
+    free(tmp_file);
+    free_kmer_index(&kmers);
+    free(gene_offsets);
+    free(records);
+    free_packed_reference(&packed);
+    free(transcripts);
+    string_pool_free(&names);
+    return status;
+}
+
+static bool index_section_fits(const IndexHeader *header, uint64_t offset, uint64_t bytes) {
+    return offset % INDEX_ALIGN == 0 && offset <= header->file_size && bytes <= header->file_size - offset;
+}
+
+/*
+ * Maps an index image.  The plane pointers in `packed_out` and the name
+ * pointers in the returned transcript table point into the mapping; the
+ * transcript array itself and a non-matching validity bitmap are heap
+ * allocated.  The mapping is released by free_packed_reference.  When the
+ * image carries a k-mer section and `kmers_out` is non-NULL, it is mapped
+ * too (k == 0 otherwise).
+ */
+static int load_index_image(
+    const char *filename,
+    int window_len,
+    PackedReference *packed_out,
+    TranscriptInfo **transcripts_out,
+    size_t *transcript_count_out,
+    KmerIndex *kmers_out
+) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: unable to open index '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        fprintf(stderr, "Error: index '%s' is truncated\n", filename);
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    void *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Error: unable to mmap index '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    const IndexHeader *header = (const IndexHeader *)base;
+    uint64_t plane_bytes = header->words * sizeof(uint64_t);
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0
+        || header->version != INDEX_VERSION
+        || header->byte_order != INDEX_BYTE_ORDER
+        || header->file_size != size
+        || header->words < header->data_words + PACKED_PAD_WORDS
+        || header->transcript_count == 0
+        || !index_section_fits(header, header->lo_offset, plane_bytes)
+        || !index_section_fits(header, header->hi_offset, plane_bytes)
+        || !index_section_fits(header, header->nmask_offset, plane_bytes)
+        || !index_section_fits(header, header->valid_offset, plane_bytes)
+        || !index_section_fits(header, header->transcripts_offset,
+                               header->transcript_count * sizeof(IndexTranscript))
+        || !index_section_fits(header, header->genes_offset, header->gene_count * sizeof(uint64_t))
+        || header->strings_size == 0
+        || header->strings_offset + header->strings_size > header->file_size
+        || header->kmer_k > MAX_KMER_LEN
+        || (header->kmer_k > 0
+            && (!index_section_fits(header, header->kmer_offsets_offset,
+                                    (((uint64_t)1 << (2 * header->kmer_k)) + 1) * sizeof(uint32_t))
+                || !index_section_fits(header, header->kmer_positions_offset,
+                                       header->kmer_position_count * sizeof(uint32_t))))) {
+        fprintf(stderr, "Error: '%s' is not a compatible index image (version %u); rebuild it with "
+                "'offtarget_search index build'\n", filename, header->version);
+        munmap(base, size);
+        return -1;
+    }
+
+    const char *bytes = (const char *)base;
+    const char *strings = bytes + header->strings_offset;
+    if (strings[header->strings_size - 1] != '\0') {
+        fprintf(stderr, "Error: index '%s' has a corrupt string table\n", filename);
+        munmap(base, size);
+        return -1;
+    }
+    const IndexTranscript *records = (const IndexTranscript *)(bytes + header->transcripts_offset);
+    const uint64_t *gene_offsets = (const uint64_t *)(bytes + header->genes_offset);
+
+    TranscriptInfo *transcripts = (TranscriptInfo *)xmalloc(header->transcript_count * sizeof(TranscriptInfo));
+    for (size_t t = 0; t < header->transcript_count; ++t) {
+        if (records[t].gene_index >= header->gene_count
+            || records[t].id_offset >= header->strings_size
+            || gene_offsets[records[t].gene_index] >= header->strings_size
+            || records[t].start + records[t].length > header->length) {
+            fprintf(stderr, "Error: index '%s' has a corrupt transcript table\n", filename);
+            free(transcripts);
+            munmap(base, size);
+            return -1;
+        }
+        transcripts[t].start = records[t].start;
+        transcripts[t].length = records[t].length;
+        transcripts[t].transcript_id = (char *)(strings + records[t].id_offset);
+        transcripts[t].gene_symbol = (char *)(strings + gene_offsets[records[t].gene_index]);
+        transcripts[t].gene = records[t].gene_index;
+    }
+
+    PackedReference packed;
+    memset(&packed, 0, sizeof(packed));
+    packed.lo = (uint64_t *)(bytes + header->lo_offset);
+    packed.hi = (uint64_t *)(bytes + header->hi_offset);
+    packed.nmask = (uint64_t *)(bytes + header->nmask_offset);
+    packed.length = header->length;
+    packed.data_words = header->data_words;
+    packed.words = header->words;
+    packed.mapping = base;
+    packed.mapping_size = size;
+    if ((int)header->window_len == window_len) {
+        packed.valid = (uint64_t *)(bytes + header->valid_offset);
+        packed.valid_mapped = true;
+    } else {
+        packed.valid = compute_valid_bitmap(packed.words, transcripts, header->transcript_count, window_len);
+    }
+
+    if (kmers_out) {
+        memset(kmers_out, 0, sizeof(*kmers_out));
+        if (header->kmer_k > 0) {
+            const uint32_t *offsets = (const uint32_t *)(bytes + header->kmer_offsets_offset);
+            if (offsets[(size_t)1 << (2 * header->kmer_k)] != header->kmer_position_count) {
+                fprintf(stderr, "Error: index '%s' has a corrupt k-mer table\n", filename);
+                free(transcripts);
+                if (!packed.valid_mapped) {
+                    free(packed.valid);
+                }
+                munmap(base, size);
+                return -1;
+            }
+            kmers_out->k = (int)header->kmer_k;
+            kmers_out->offsets = (uint32_t *)offsets;
+            kmers_out->positions = (uint32_t *)(bytes + header->kmer_positions_offset);
+            kmers_out->position_count = header->kmer_position_count;
+            kmers_out->mapped = true;
+        }
+    }
+
+    *packed_out = packed;
+    *transcripts_out = transcripts;
+    *transcript_count_out = header->transcript_count;
+    return 0;
+}
+
+/* Rebuilds the ASCII reference (with sentinels) from packed planes for the byte engine. */
+static Buffer unpack_reference(const PackedReference *packed, const TranscriptInfo *transcripts,
+                               size_t transcript_count) {
+    static const char bases[4] = {'A', 'C', 'G', 'T'};
+    Buffer buffer;
+    buffer_init(&buffer, packed->length + PAD_WIDTH);
+    memset(buffer.data, SENTINEL_CHAR, packed->length + PAD_WIDTH);
+    buffer.length = packed->length;
+    for (size_t t = 0; t < transcript_count; ++t) {
+        for (size_t pos = transcripts[t].start; pos < transcripts[t].start + transcripts[t].length; ++pos) {
+            size_t word = pos / 64;
+            unsigned bit = (unsigned)(pos % 64);
+            if ((packed->nmask[word] >> bit) & 1) {
+                buffer.data[pos] = 'N';
+            } else {
+                unsigned code = (unsigned)(((packed->lo[word] >> bit) & 1) | (((packed->hi[word] >> bit) & 1) << 1));
+                buffer.data[pos] = bases[code];
+            }
+        }
+    }
+    return buffer;
+}
+
+/* Releases `mm0_hits` and takes over `details` (which may be NULL). */
+static void store_guide_result(GuideResult *res, const uint64_t *counts, HitList *mm0_hits, DetailList *details) {
+    for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
+        res->counts[mm] = counts[mm];
+    }
+
+    if (mm0_hits->count > 0) {
+        res->mm0_transcripts = (size_t *)xmalloc(mm0_hits->count * sizeof(size_t));
+        memcpy(res->mm0_transcripts, mm0_hits->data, mm0_hits->count * sizeof(size_t));
+        res->mm0_count = mm0_hits->count;
+    } else {
+        res->mm0_transcripts = NULL;
+        res->mm0_count = 0;
+    }
+
+    hitlist_free(mm0_hits);
+
+    if (details) {
+        res->details = details->data;
+        res->detail_count = details->count;
+        detail_list_init(details);
+    } else {
+        res->details = NULL;
+        res->detail_count = 0;
+    }
+}
+
+/* Adds one window with mismatch bitmap `diff` (bit k = guide position k) to `profile`. */
+static inline void mismatch_profile_add(MismatchProfile *profile, uint64_t diff, const double *weights) {
+    double activity = 1.0;
+    for (; diff; diff &= diff - 1) {
+        int k = __builtin_ctzll(diff);
+        profile->positions[k]++;
+        activity *= weights[k];
+    }
+    profile->score += activity;
+}
+
+/* Copies the first `length` positions of `profile` into `res`. */
+static void store_guide_profile(GuideResult *res, const MismatchProfile *profile, int length) {
+    res->mismatch_positions = (uint64_t *)xmalloc((size_t)length * sizeof(uint64_t));
+    memcpy(res->mismatch_positions, profile->positions, (size_t)length * sizeof(uint64_t));
+    res->profile_length = length;
+    res->offtarget_score = profile->score;
+}
+
+/* Returns the first level whose count exceeds its cap, or -1. */
+static int caps_exceeded(const CountCaps *caps, const uint64_t *counts) {
+    if (!caps || !caps->active) {
+        return -1;
+    }
+    for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
+        if (counts[mm] > caps->max[mm]) {
+            return mm;
+        }
+    }
+    return -1;
+}
+
+static void store_group_results(
+    GuideResult *results,
+    size_t group_start,
+    size_t group_size,
+    uint64_t local_counts[GROUP_SIZE][MAX_MISMATCHES + 1],
+    HitList *mm0_hits,
+    DetailList *details,
+    const MismatchProfile *profiles,
+    const Guide *guides
+) {
+    for (size_t j = 0; j < group_size; ++j) {
+        store_guide_result(&results[group_start + j], local_counts[j], &mm0_hits[j], &details[j]);
+        if (profiles) {
+            store_guide_profile(&results[group_start + j], &profiles[j], guides[group_start + j].length);
+        }
+    }
+}
+
+/*
+ * Kernel specialisation.  Scan kernels are written once as always-inline
+ * bodies taking the mismatch limit `max_mm` (--max-mismatches) and a guide
+ * length `fixed_len` (0 = each lane's own length).  KERNEL_VARIANTS
+ * instantiates a body for every limit, for any length and for
+ * FIXED_GUIDE_LEN, and KERNEL_TABLE lists the instances as
+ * [fixed length?][max_mm]; a group whose guides all have FIXED_GUIDE_LEN
+ * bases runs with constant masks and loop bounds.
+ */
+#define OT_INLINE inline __attribute__((always_inline))
+
+_Static_assert(MAX_MISMATCHES == 5 && FIXED_GUIDE_LEN == 23, "KERNEL_VARIANTS spells out the limits and length");
+
+#define KERNEL_VARIANTS_FOR(X, body, attr, len) \
+    X(body, attr, 0, len) X(body, attr, 1, len) X(body, attr, 2, len) \
+    X(body, attr, 3, len) X(body, attr, 4, len) X(body, attr, 5, len)
+#define KERNEL_VARIANTS(X, body, attr) \
+    KERNEL_VARIANTS_FOR(X, body, attr, 0) KERNEL_VARIANTS_FOR(X, body, attr, 23)
+#define KERNEL_TABLE_ROW(body, len) \
+    { body##_k0_l##len, body##_k1_l##len, body##_k2_l##len, body##_k3_l##len, body##_k4_l##len, body##_k5_l##len }
+#define KERNEL_TABLE(body) { KERNEL_TABLE_ROW(body, 0), KERNEL_TABLE_ROW(body, 23) }
+
+/* Row of KERNEL_TABLE for a group whose guides share `length` bases (0 if they differ). */
+static inline int kernel_variant(int length) {
+    return length == FIXED_GUIDE_LEN;
+}
+
+static inline uint64_t mask_for_length(int length) {
+    if (length >= 64) {
+        return ~0ULL;
+    }
+    return (1ULL << length) - 1ULL;
+}
+
+/* Mismatch bitmap (bit k = guide position k) of a byte-engine window. */
+static inline uint64_t byte_window_diff(const char *window, const char *guide, int length) {
+    uint64_t diff = 0;
+    for (int k = 0; k < length; ++k) {
+        diff |= (uint64_t)(window[k] != guide[k]) << k;
+    }
+    return diff;
+}
+
+/*
+ * Records a window of a byte-engine lane that is within the mismatch
+ * limit; `diff` is its mismatch bitmap, only used for profiles (weights).
+ */
+static inline void record_byte_hit(
+    uint64_t *counts,
+    HitList *mm0_hits,
+    DetailList *details,
+    int mismatches,
+    size_t pos,
+    int detail_level,
+    uint64_t diff,
+    MismatchProfile *profile,
+    const double *weights,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count
+) {
+    if (weights && mismatches > 0) {
+        mismatch_profile_add(profile, diff, weights);
+    }
+    counts[mismatches]++;
+    if (mismatches == 0) {
+        hitlist_add(mm0_hits, find_transcript(transcripts, transcript_count, pos));
+    }
+    if (mismatches <= detail_level) {
+        detail_list_add(details, pos, mismatches);
+    }
+}
+
+/*
+ * Byte-engine kernels for guides of up to 2 * PAD_WIDTH bases, over the
+ * windows starting in words [word_begin, word_end): a window is
+ * compared as one PAD_WIDTH-byte vector, or as two when the group holds a
+ * guide longer than PAD_WIDTH ("wide").  Each is an always-inline body over
+ * (max_mm, fixed_len); see KERNEL_VARIANTS.
+ */
+#if OT_X86
+OT_TARGET_AVX2 static OT_INLINE void process_group_avx2(
+    const char *ref_seq,
+    const PackedReference *ref,
+    size_t word_begin,
+    size_t word_end,
+    const Guide *guides,
+    size_t group_start,
+    size_t group_size,
+    GuideResult *results,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    int detail_level,
+    const double *weights,
+    const int max_mm,
+    const int fixed_len
+) {
+    __m256i query_vec[GROUP_SIZE][2];
+    uint64_t query_masks[GROUP_SIZE];
+    int query_lengths[GROUP_SIZE];
+    int max_len = 0;
+
+    char padded[GROUP_SIZE][2 * PAD_WIDTH];
+    memset(padded, SENTINEL_CHAR, sizeof(padded));
+
+    for (size_t j = 0; j < group_size; ++j) {
+        const Guide *g = &guides[group_start + j];
+        memcpy(padded[j], g->sequence, (size_t)g->length);
+        query_vec[j][0] = _mm256_loadu_si256((const __m256i *)padded[j]);
+        query_vec[j][1] = _mm256_loadu_si256((const __m256i *)(padded[j] + PAD_WIDTH));
+        query_masks[j] = mask_for_length(g->length);
+        query_lengths[j] = g->length;
+        if (g->length > max_len) {
+            max_len = g->length;
+        }
+    }
+    const bool wide = (fixed_len ? fixed_len : max_len) > PAD_WIDTH;
+
+    uint64_t local_counts[GROUP_SIZE][MAX_MISMATCHES + 1] = {{0}};
+    HitList mm0_hits[GROUP_SIZE];
+    DetailList details[GROUP_SIZE];
+    for (size_t j = 0; j < group_size; ++j) {
+        hitlist_init(&mm0_hits[j]);
+        detail_list_init(&details[j]);
+    }
+    MismatchProfile profiles[GROUP_SIZE];
+    if (weights) {
+        memset(profiles, 0, sizeof(profiles));
+    }
+
+    const uint64_t *lane_valid[GROUP_SIZE];
+    for (size_t j = 0; j < group_size; ++j) {
+        lane_valid[j] = ref->valid_len[guides[group_start + j].length];
+    }
+
+    for (size_t word = word_begin; word < word_end; ++word) {
+        uint64_t open = ref->valid[word];
+        if (!open) {
+            continue;
+        }
+        uint64_t lane_open[GROUP_SIZE];
+        for (size_t j = 0; j < group_size; ++j) {
+            lane_open[j] = lane_valid[j][word];
+        }
+
+        for (; open; open &= open - 1) {
+            unsigned bit = (unsigned)__builtin_ctzll(open);
+            size_t pos = word * 64 + bit;
+
+            __m256i ref_lo = _mm256_loadu_si256((const __m256i *)(ref_seq + pos));
+            __m256i ref_hi = wide ? _mm256_loadu_si256((const __m256i *)(ref_seq + pos + PAD_WIDTH))
+                                  : _mm256_setzero_si256();
+
+            for (size_t j = 0; j < group_size; ++j) {
+                uint64_t eq_mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(ref_lo, query_vec[j][0]));
+                if (wide) {
+                    eq_mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                        _mm256_cmpeq_epi8(ref_hi, query_vec[j][1])) << 32;
+                }
+                const uint64_t lane_mask = fixed_len ? mask_for_length(fixed_len) : query_masks[j];
+                eq_mask &= lane_mask;
+
+                int matches = __builtin_popcountll(eq_mask);
+                int mismatches = (fixed_len ? fixed_len : query_lengths[j]) - matches;
+
+                if (mismatches <= max_mm && ((lane_open[j] >> bit) & 1)) {
+                    record_byte_hit(local_counts[j], &mm0_hits[j], &details[j], mismatches, pos,
+                                    detail_level, ~eq_mask & lane_mask, &profiles[j], weights,
+                                    transcripts, transcript_count);
+                }
+            }
+        }
+    }
+
+    store_group_results(results, group_start, group_size, local_counts, mm0_hits, details,
+                        weights ? profiles : NULL, guides);
+}
+
+/*
+ * AVX-512BW variant of process_group_avx2: guides of up to PAD_WIDTH bases
+ * are paired into one 64-byte query, the 32 reference bytes are broadcast
+ * to both halves, and a single compare yields a 64-bit mask register
+ * holding both guides.  A wide group compares each guide as a whole
+ * 64-byte query instead.
+ */
+OT_TARGET_AVX512 static OT_INLINE void process_group_avx512(
+    const char *ref_seq,
+    const PackedReference *ref,
+    size_t word_begin,
+    size_t word_end,
+    const Guide *guides,
+    size_t group_start,
+    size_t group_size,
+    GuideResult *results,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    int detail_level,
+    const double *weights,
+    const int max_mm,
+    const int fixed_len
+) {
+    enum { PAIRS = GROUP_SIZE / 2 };
+    __m512i query_vec[GROUP_SIZE];
+    uint64_t query_masks[GROUP_SIZE];
+    int query_lengths[GROUP_SIZE] = {0};
+    int max_len = 0;
+
+    char padded[GROUP_SIZE][2 * PAD_WIDTH];
+    memset(padded, SENTINEL_CHAR, sizeof(padded));
+
+    for (size_t j = 0; j < group_size; ++j) {
+        const Guide *g = &guides[group_start + j];
+        memcpy(padded[j], g->sequence, (size_t)g->length);
+        query_lengths[j] = g->length;
+        if (g->length > max_len) {
+            max_len = g->length;
+        }
+    }
+    const bool wide = (fixed_len ? fixed_len : max_len) > PAD_WIDTH;
+    if (wide) {
+        for (size_t j = 0; j < group_size; ++j) {
+            query_vec[j] = _mm512_loadu_si512((const void *)padded[j]);
+            query_masks[j] = mask_for_length(query_lengths[j]);
+        }
+    } else {
+        for (size_t p = 0; p < PAIRS; ++p) {
+            query_vec[p] = _mm512_inserti64x4(
+                _mm512_castsi256_si512(_mm256_loadu_si256((const __m256i *)padded[2 * p])),
+                _mm256_loadu_si256((const __m256i *)padded[2 * p + 1]), 1);
+            query_masks[p] = mask_for_length(fixed_len ? fixed_len : query_lengths[2 * p])
+                           | (mask_for_length(fixed_len ? fixed_len : query_lengths[2 * p + 1]) << 32);
+        }
+    }
+
+    uint64_t local_counts[GROUP_SIZE][MAX_MISMATCHES + 1] = {{0}};
+    HitList mm0_hits[GROUP_SIZE];
+    DetailList details[GROUP_SIZE];
+    for (size_t j = 0; j < group_size; ++j) {
+        hitlist_init(&mm0_hits[j]);
+        detail_list_init(&details[j]);
+    }
+    MismatchProfile profiles[GROUP_SIZE];
+    if (weights) {
+        memset(profiles, 0, sizeof(profiles));
+    }
+
+    const uint64_t *lane_valid[GROUP_SIZE];
+    for (size_t j = 0; j < group_size; ++j) {
+        lane_valid[j] = ref->valid_len[guides[group_start + j].length];
+    }
+
+    for (size_t word = word_begin; word < word_end; ++word) {
+        uint64_t open = ref->valid[word];
+        if (!open) {
+            continue;
+        }
+        uint64_t lane_open[GROUP_SIZE];
+        for (size_t j = 0; j < group_size; ++j) {
+            lane_open[j] = lane_valid[j][word];
+        }
+
+        for (; open; open &= open - 1) {
+            unsigned bit = (unsigned)__builtin_ctzll(open);
+            size_t pos = word * 64 + bit;
+
+            if (wide) {
+                __m512i ref_vec = _mm512_loadu_si512((const void *)(ref_seq + pos));
+                for (size_t j = 0; j < group_size; ++j) {
+                    uint64_t eq_mask = (uint64_t)_mm512_cmpeq_epi8_mask(ref_vec, query_vec[j]) & query_masks[j];
+                    int mismatches = (fixed_len ? fixed_len : query_lengths[j]) - __builtin_popcountll(eq_mask);
+                    if (mismatches <= max_mm && ((lane_open[j] >> bit) & 1)) {
+                        record_byte_hit(local_counts[j], &mm0_hits[j], &details[j], mismatches, pos,
+                                        detail_level, ~eq_mask & query_masks[j], &profiles[j], weights,
+                                        transcripts, transcript_count);
+                    }
+                }
+                continue;
+            }
+
+            __m512i ref_vec = _mm512_broadcast_i64x4(_mm256_loadu_si256((const __m256i *)(ref_seq + pos)));
+
+            for (size_t p = 0; p * 2 < group_size; ++p) {
+                uint64_t eq_mask = (uint64_t)_mm512_cmpeq_epi8_mask(ref_vec, query_vec[p]) & query_masks[p];
+
+                for (size_t half = 0; half < 2 && p * 2 + half < group_size; ++half) {
+                    size_t j = p * 2 + half;
+                    uint64_t lane_eq = half ? eq_mask >> 32 : eq_mask & 0xFFFFFFFFu;
+                    int length = fixed_len ? fixed_len : query_lengths[j];
+                    int mismatches = length - __builtin_popcountll(lane_eq);
+
+                    if (mismatches <= max_mm && ((lane_open[j] >> bit) & 1)) {
+                        record_byte_hit(local_counts[j], &mm0_hits[j], &details[j], mismatches, pos,
+                                        detail_level, ~lane_eq & mask_for_length(length), &profiles[j], weights,
+                                        transcripts, transcript_count);
+                    }
+                }
+            }
+        }
+    }
+
+    store_group_results(results, group_start, group_size, local_counts, mm0_hits, details,
+                        weights ? profiles : NULL, guides);
+}
+#endif /* OT_X86 */
+
+/*
+ * 128-bit variant of process_group_avx2 (NEON on aarch64): the window is
+ * compared as two 16-byte quarters (four for a wide group), and matching
+ * bytes (0xFF) are counted with popcount / 8 after masking to the guide
+ * length.
+ */
+static OT_INLINE void process_group_vec128(
+    const char *ref_seq,
+    const PackedReference *ref,
+    size_t word_begin,
+    size_t word_end,
+    const Guide *guides,
+    size_t group_start,
+    size_t group_size,
+    GuideResult *results,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    int detail_level,
+    const double *weights,
+    const int max_mm,
+    const int fixed_len
+) {
+    enum { QUARTERS = 2 * PAD_WIDTH / 16 };
+    v16u8 query_vec[GROUP_SIZE][QUARTERS];
+    v2u64 query_masks[GROUP_SIZE][QUARTERS];
+    int query_lengths[GROUP_SIZE];
+    int max_len = 0;
+
+    char padded[GROUP_SIZE][2 * PAD_WIDTH];
+    unsigned char length_mask[2 * PAD_WIDTH];
+    memset(padded, SENTINEL_CHAR, sizeof(padded));
+
+    for (size_t j = 0; j < group_size; ++j) {
+        const Guide *g = &guides[group_start + j];
+        memcpy(padded[j], g->sequence, (size_t)g->length);
+        memset(length_mask, 0, sizeof(length_mask));
+        memset(length_mask, 0xFF, (size_t)g->length);
+        for (int q = 0; q < QUARTERS; ++q) {
+            query_vec[j][q] = load_v16u8(padded[j] + 16 * q);
+            query_masks[j][q] = load_v2u64(length_mask + 16 * q);
+        }
+        query_lengths[j] = g->length;
+        if (g->length > max_len) {
+            max_len = g->length;
+        }
+    }
+    const int quarters = (fixed_len ? fixed_len : max_len) > PAD_WIDTH ? QUARTERS : PAD_WIDTH / 16;
+
+    uint64_t local_counts[GROUP_SIZE][MAX_MISMATCHES + 1] = {{0}};
+    HitList mm0_hits[GROUP_SIZE];
+    DetailList details[GROUP_SIZE];
+    for (size_t j = 0; j < group_size; ++j) {
+        hitlist_init(&mm0_hits[j]);
+        detail_list_init(&details[j]);
+    }
+    MismatchProfile profiles[GROUP_SIZE];
+    if (weights) {
+        memset(profiles, 0, sizeof(profiles));
+    }
+
+    const uint64_t *lane_valid[GROUP_SIZE];
+    for (size_t j = 0; j < group_size; ++j) {
+        lane_valid[j] = ref->valid_len[guides[group_start + j].length];
+    }
+
+    for (size_t word = word_begin; word < word_end; ++word) {
+        uint64_t open = ref->valid[word];
+        if (!open) {
+            continue;
+        }
+        uint64_t lane_open[GROUP_SIZE];
+        for (size_t j = 0; j < group_size; ++j) {
+            lane_open[j] = lane_valid[j][word];
+        }
+
+        for (; open; open &= open - 1) {
+            unsigned bit = (unsigned)__builtin_ctzll(open);
+            size_t pos = word * 64 + bit;
+
+            v16u8 ref_vec[QUARTERS];
+            for (int q = 0; q < quarters; ++q) {
+                ref_vec[q] = load_v16u8(ref_seq + pos + 16 * q);
+            }
+
+            for (size_t j = 0; j < group_size; ++j) {
+                int bits = 0;
+                for (int q = 0; q < quarters; ++q) {
+                    v2u64 eq = (v2u64)(ref_vec[q] == query_vec[j][q]) & query_masks[j][q];
+                    bits += __builtin_popcountll(eq[0]) + __builtin_popcountll(eq[1]);
+                }
+                const int length = fixed_len ? fixed_len : query_lengths[j];
+                int mismatches = length - bits / 8;
+
+                if (mismatches <= max_mm && ((lane_open[j] >> bit) & 1)) {
+                    uint64_t diff = weights ? byte_window_diff(ref_seq + pos, padded[j], length) : 0;
+                    record_byte_hit(local_counts[j], &mm0_hits[j], &details[j], mismatches, pos,
+                                    detail_level, diff, &profiles[j], weights, transcripts, transcript_count);
+                }
+            }
+        }
+    }
+
+    store_group_results(results, group_start, group_size, local_counts, mm0_hits, details,
+                        weights ? profiles : NULL, guides);
+}
+
+static OT_INLINE void process_group_scalar(
+    const char *ref_seq,
+    const PackedReference *ref,
+    size_t word_begin,
+    size_t word_end,
+    const Guide *guides,
+    size_t group_start,
+    size_t group_size,
+    GuideResult *results,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    int detail_level,
+    const double *weights,
+    const int max_mm,
+    const int fixed_len
+) {
+    uint64_t local_counts[GROUP_SIZE][MAX_MISMATCHES + 1] = {{0}};
+    HitList mm0_hits[GROUP_SIZE];
+    DetailList details[GROUP_SIZE];
+    for (size_t j = 0; j < group_size; ++j) {
+        hitlist_init(&mm0_hits[j]);
+        detail_list_init(&details[j]);
+    }
+    MismatchProfile profiles[GROUP_SIZE];
+    if (weights) {
+        memset(profiles, 0, sizeof(profiles));
+    }
+
+    const uint64_t *lane_valid[GROUP_SIZE];
+    for (size_t j = 0; j < group_size; ++j) {
+        lane_valid[j] = ref->valid_len[guides[group_start + j].length];
+    }
+
+    for (size_t word = word_begin; word < word_end; ++word) {
+        uint64_t open = ref->valid[word];
+        if (!open) {
+            continue;
+        }
+        uint64_t lane_open[GROUP_SIZE];
+        for (size_t j = 0; j < group_size; ++j) {
+            lane_open[j] = lane_valid[j][word];
+        }
+
+        for (; open; open &= open - 1) {
+            unsigned bit = (unsigned)__builtin_ctzll(open);
+            size_t pos = word * 64 + bit;
+
+            for (size_t j = 0; j < group_size; ++j) {
+                const Guide *g = &guides[group_start + j];
+                if (!((lane_open[j] >> bit) & 1)) {
+                    continue;
+                }
+
+                const int length = fixed_len ? fixed_len : g->length;
+                int mismatches = 0;
+                uint64_t diff = 0;
+                for (int k = 0; k < length; ++k) {
+                    if (ref_seq[pos + k] != g->sequence[k]) {
+                        diff |= 1ULL << k;
+                        mismatches++;
+                        if (mismatches > max_mm) {
+                            break;
+                        }
+                    }
+                }
+                if (mismatches <= max_mm) {
+                    record_byte_hit(local_counts[j], &mm0_hits[j], &details[j], mismatches, pos,
+                                    detail_level, diff, &profiles[j], weights, transcripts, transcript_count);
+                }
+            }
+        }
+    }
+
+    store_group_results(results, group_start, group_size, local_counts, mm0_hits, details,
+                        weights ? profiles : NULL, guides);
+}
+
+#define BYTE_KERNEL_PARAMS \
+    const char *ref_seq, const PackedReference *ref, size_t word_begin, size_t word_end, const Guide *guides, \
+    size_t group_start, size_t group_size, GuideResult *results, const TranscriptInfo *transcripts, \
+    size_t transcript_count, int detail_level, const double *weights
+#define BYTE_KERNEL_ARGS \
+    ref_seq, ref, word_begin, word_end, guides, group_start, group_size, results, transcripts, \
+    transcript_count, detail_level, weights
+
+typedef void (*ByteKernel)(BYTE_KERNEL_PARAMS);
+
+#define DEFINE_BYTE_KERNEL(body, attr, k, len) \
+    attr static void body##_k##k##_l##len(BYTE_KERNEL_PARAMS) { body(BYTE_KERNEL_ARGS, k, len); }
+
+#if OT_X86
+KERNEL_VARIANTS(DEFINE_BYTE_KERNEL, process_group_avx512, OT_TARGET_AVX512)
+KERNEL_VARIANTS(DEFINE_BYTE_KERNEL, process_group_avx2, OT_TARGET_AVX2)
+static const ByteKernel byte_kernels_avx512[2][MAX_MISMATCHES + 1] = KERNEL_TABLE(process_group_avx512);
+static const ByteKernel byte_kernels_avx2[2][MAX_MISMATCHES + 1] = KERNEL_TABLE(process_group_avx2);
+#endif
+KERNEL_VARIANTS(DEFINE_BYTE_KERNEL, process_group_vec128, )
+KERNEL_VARIANTS(DEFINE_BYTE_KERNEL, process_group_scalar, )
+static const ByteKernel byte_kernels_vec128[2][MAX_MISMATCHES + 1] = KERNEL_TABLE(process_group_vec128);
+static const ByteKernel byte_kernels_scalar[2][MAX_MISMATCHES + 1] = KERNEL_TABLE(process_group_scalar);
+
+void guide_bits(const Guide *guide, GuideBits *bits) {
+    memset(bits, 0, sizeof(*bits));
+    for (int k = 0; k < guide->length; ++k) {
+        uint64_t bit = 1ULL << k;
+        switch (guide->sequence[k]) {
+            case 'A': break;
+            case 'C': bits->lo |= bit; break;
+            case 'G': bits->hi |= bit; break;
+            case 'T': bits->lo |= bit; bits->hi |= bit; break;
+            default: bits->n |= bit; break;
+        }
+    }
+    bits->length_mask = (guide->length >= 64) ? ~0ULL : ((1ULL << guide->length) - 1);
+}
+
+static inline uint64_t plane_window(const uint64_t *plane, size_t word, int shift) {
+    if (shift == 0) {
+        return plane[word];
+    }
+    return (plane[word] >> shift) | (plane[word + 1] << (64 - shift));
+}
+
+/* Mismatch bitmap (bit k = guide position k) of the window starting at `pos`. */
+static inline uint64_t packed_window_diff(const PackedReference *ref, size_t pos, const GuideBits *g) {
+    size_t word = pos / 64;
+    int shift = (int)(pos % 64);
+    uint64_t lo = plane_window(ref->lo, word, shift);
+    uint64_t hi = plane_window(ref->hi, word, shift);
+    uint64_t nmask = plane_window(ref->nmask, word, shift);
+    uint64_t diff = ((lo ^ g->lo) | (hi ^ g->hi) | nmask) & ~g->n;
+    return (diff | (~nmask & g->n)) & g->length_mask;
+}
+
+/*
+ * Guide bases broadcast to full-width masks so the packed kernels can XOR a
+ * whole reference word against one guide position.  `n` is set where the
+ * guide itself carries an N, which (as in the byte engine) only matches an N
+ * in the reference.
+ */
+typedef struct {
+    uint64_t lo[MAX_GUIDE_LEN];
+    uint64_t hi[MAX_GUIDE_LEN];
+    uint64_t n[MAX_GUIDE_LEN];
+    int length;
+    GuideBits bits;
+} PackedGuide;
+
+static void pack_guide(const Guide *guide, PackedGuide *packed) {
+    memset(packed, 0, sizeof(*packed));
+    packed->length = guide->length;
+    guide_bits(guide, &packed->bits);
+    for (int k = 0; k < guide->length; ++k) {
+        switch (guide->sequence[k]) {
+            case 'A': break;
+            case 'C': packed->lo[k] = ~0ULL; break;
+            case 'G': packed->hi[k] = ~0ULL; break;
+            case 'T': packed->lo[k] = ~0ULL; packed->hi[k] = ~0ULL; break;
+            default: packed->n[k] = ~0ULL; break;
+        }
+    }
+}
+
+/*
+ * Bit-sliced mismatch counters: bit i of (c2,c1,c0) holds the running
+ * mismatch count of the window starting at offset i, and `dead` latches
+ * windows whose count overflowed the counter.  Scans only carry as many
+ * counter planes as the mismatch limit needs (counter_bits); the planes
+ * they leave out stay zero.
+ */
+static inline int counter_bits(int max_mm) {
+    return max_mm == 0 ? 1 : (max_mm <= 2 ? 2 : 3);
+}
+
+static inline uint64_t bitsliced_equals(uint64_t c0, uint64_t c1, uint64_t c2, int value) {
+    return ((value & 1) ? c0 : ~c0) & ((value & 2) ? c1 : ~c1) & ((value & 4) ? c2 : ~c2);
+}
+
+static inline uint64_t bitsliced_over_limit(uint64_t c0, uint64_t c1, uint64_t c2, uint64_t dead, int max_mm) {
+    uint64_t over = dead;
+    for (int value = max_mm + 1; value < 8; ++value) {
+        over |= bitsliced_equals(c0, c1, c2, value);
+    }
+    return over;
+}
+
+static inline void accumulate_packed_word(
+    size_t word,
+    uint64_t valid,
+    uint64_t c0,
+    uint64_t c1,
+    uint64_t c2,
+    uint64_t dead,
+    int max_mm,
+    uint64_t *counts,
+    HitList *mm0_hits,
+    int detail_level,
+    DetailList *details,
+    const PackedReference *ref,
+    const GuideBits *bits,
+    MismatchProfile *profile,
+    const double *weights,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count
+) {
+    uint64_t live = valid & ~bitsliced_over_limit(c0, c1, c2, dead, max_mm);
+    if (!live) {
+        return;
+    }
+    for (int mm = 0; mm <= max_mm; ++mm) {
+        counts[mm] += (uint64_t)__builtin_popcountll(live & bitsliced_equals(c0, c1, c2, mm));
+    }
+
+    uint64_t exact = live & bitsliced_equals(c0, c1, c2, 0);
+    while (exact) {
+        size_t pos = word * 64 + (size_t)__builtin_ctzll(exact);
+        hitlist_add(mm0_hits, find_transcript(transcripts, transcript_count, pos));
+        exact &= exact - 1;
+    }
+
+    if (detail_level >= 0) {
+        uint64_t wanted = 0;
+        for (int mm = 0; mm <= detail_level; ++mm) {
+            wanted |= bitsliced_equals(c0, c1, c2, mm);
+        }
+        wanted &= live;
+        while (wanted) {
+            int bit = __builtin_ctzll(wanted);
+            wanted &= wanted - 1;
+            int mm = (int)(((c0 >> bit) & 1) | (((c1 >> bit) & 1) << 1) | (((c2 >> bit) & 1) << 2));
+            detail_list_add(details, word * 64 + (size_t)bit, mm);
+        }
+    }
+
+    if (weights) {
+        for (uint64_t off = live & ~bitsliced_equals(c0, c1, c2, 0); off; off &= off - 1) {
+            size_t pos = word * 64 + (size_t)__builtin_ctzll(off);
+            mismatch_profile_add(profile, packed_window_diff(ref, pos, bits), weights);
+        }
+    }
+}
+
+/*
+ * Per-group scan state.  Counters and hit lists persist across calls so a
+ * group can be scanned one reference tile at a time.  Lanes are addressed
+ * by guide index because pruning moves guides between groups; tile_counts
+ * tile_hits and tile_details snapshot each lane at the start of the current
+ * tile.  Hit details are only recorded when detail_level >= 0, and
+ * mismatch profiles when `weights` is set.  `length` is the lanes' common
+ * guide length (0 when they differ) and picks the kernel variant.
+ */
+typedef struct {
+    PackedGuide packed[GROUP_SIZE];
+    int max_len;
+    int length;
+    size_t size;
+    int detail_level;
+    int max_mismatches;
+    size_t index[GROUP_SIZE];
+    uint64_t counts[GROUP_SIZE][MAX_MISMATCHES + 1];
+    HitList mm0_hits[GROUP_SIZE];
+    DetailList details[GROUP_SIZE];
+    uint64_t tile_counts[GROUP_SIZE][MAX_MISMATCHES + 1];
+    size_t tile_hits[GROUP_SIZE];
+    size_t tile_details[GROUP_SIZE];
+    const double *weights;
+    MismatchProfile profiles[GROUP_SIZE];
+} PackedGroup;
+
+static void packed_group_update_max_len(PackedGroup *group) {
+    group->max_len = 0;
+    group->length = group->size > 0 ? group->packed[0].length : 0;
+    for (size_t j = 0; j < group->size; ++j) {
+        if (group->packed[j].length > group->max_len) {
+            group->max_len = group->packed[j].length;
+        }
+        if (group->packed[j].length != group->length) {
+            group->length = 0;
+        }
+    }
+}
+
+static void packed_group_init(PackedGroup *group, const Guide *guides, size_t group_start, size_t group_size,
+                              int detail_level, int max_mismatches, const double *weights) {
+    memset(group->counts, 0, sizeof(group->counts));
+    memset(group->tile_counts, 0, sizeof(group->tile_counts));
+    group->weights = weights;
+    if (weights) {
+        memset(group->profiles, 0, sizeof(group->profiles));
+    }
+    group->size = group_size;
+    group->detail_level = detail_level;
+    group->max_mismatches = max_mismatches;
+    for (size_t j = 0; j < group_size; ++j) {
+        group->index[j] = group_start + j;
+        pack_guide(&guides[group_start + j], &group->packed[j]);
+        hitlist_init(&group->mm0_hits[j]);
+        detail_list_init(&group->details[j]);
+        group->tile_hits[j] = 0;
+        group->tile_details[j] = 0;
+    }
+    packed_group_update_max_len(group);
+}
+
+/* Moves lane `sj` of `src` into lane `dj` of `dst`; the hit lists change owner. */
+static void packed_group_move_lane(PackedGroup *dst, size_t dj, const PackedGroup *src, size_t sj) {
+    dst->packed[dj] = src->packed[sj];
+    dst->index[dj] = src->index[sj];
+    memcpy(dst->counts[dj], src->counts[sj], sizeof(dst->counts[dj]));
+    memcpy(dst->tile_counts[dj], src->tile_counts[sj], sizeof(dst->tile_counts[dj]));
+    dst->mm0_hits[dj] = src->mm0_hits[sj];
+    dst->details[dj] = src->details[sj];
+    dst->tile_hits[dj] = src->tile_hits[sj];
+    dst->tile_details[dj] = src->tile_details[sj];
+    dst->profiles[dj] = src->profiles[sj];
+}
+
+static void packed_group_store(PackedGroup *group, GuideResult *results) {
+    for (size_t j = 0; j < group->size; ++j) {
+        store_guide_result(&results[group->index[j]], group->counts[j], &group->mm0_hits[j],
+                           &group->details[j]);
+        if (group->weights) {
+            store_guide_profile(&results[group->index[j]], &group->profiles[j], group->packed[j].length);
+        }
+    }
+}
+
+/*
+ * Scans reference words [word_begin, word_end) for one group.  Kernel body
+ * over (max_mm, fixed_len), see KERNEL_VARIANTS.
+ */
+static OT_INLINE void scan_group_packed(
+    const PackedReference *ref,
+    PackedGroup *group,
+    size_t word_begin,
+    size_t word_end,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    const int max_mm,
+    const int fixed_len
+) {
+    const size_t group_size = group->size;
+    const int max_len = fixed_len ? fixed_len : group->max_len;
+    const int bits = counter_bits(max_mm);
+
+    for (size_t word = word_begin; word < word_end; ++word) {
+        uint64_t valid = ref->valid[word];
+        if (!valid) {
+            continue;
+        }
+
+        uint64_t c0[GROUP_SIZE] = {0};
+        uint64_t c1[GROUP_SIZE] = {0};
+        uint64_t c2[GROUP_SIZE] = {0};
+        uint64_t dead[GROUP_SIZE] = {0};
+
+        for (int k = 0; k < max_len; ++k) {
+            uint64_t lo = plane_window(ref->lo, word, k);
+            uint64_t hi = plane_window(ref->hi, word, k);
+            uint64_t nmask = plane_window(ref->nmask, word, k);
+            uint64_t finished = ~0ULL;
+
+            for (size_t j = 0; j < group_size; ++j) {
+                const PackedGuide *g = &group->packed[j];
+                if (!fixed_len && k >= g->length) {
+                    continue;
+                }
+                uint64_t diff = ((lo ^ g->lo[k]) | (hi ^ g->hi[k]) | nmask) & ~g->n[k];
+                uint64_t carry = diff | (~nmask & g->n[k]);
+                uint64_t next = c0[j] & carry;
+                c0[j] ^= carry;
+                carry = next;
+                if (bits > 1) {
+                    next = c1[j] & carry;
+                    c1[j] ^= carry;
+                    carry = next;
+                }
+                if (bits > 2) {
+                    next = c2[j] & carry;
+                    c2[j] ^= carry;
+                    carry = next;
+                }
+                dead[j] |= carry;
+                finished &= bitsliced_over_limit(c0[j], c1[j], c2[j], dead[j], max_mm);
+            }
+
+            if ((valid & ~finished) == 0) {
+                break;
+            }
+        }
+
+        for (size_t j = 0; j < group_size; ++j) {
+            accumulate_packed_word(word, ref->valid_len[fixed_len ? fixed_len : group->packed[j].length][word],
+                                   c0[j], c1[j], c2[j], dead[j], max_mm,
+                                   group->counts[j], &group->mm0_hits[j],
+                                   group->detail_level, &group->details[j],
+                                   ref, &group->packed[j].bits, &group->profiles[j], group->weights,
+                                   transcripts, transcript_count);
+        }
+    }
+}
+
+/*
+ * 128-bit variant of scan_group_packed using GCC vector extensions, two
+ * reference words per iteration.  It compiles to NEON on aarch64 (where it
+ * is the default kernel) and to SSE2 on x86.  C shifts by 64 are undefined,
+ * so k == 0 is special-cased as in plane_window.  `word_begin` must be even.
+ */
+static inline v2u64 plane_window_vec128(const uint64_t *plane, size_t word, int shift) {
+    v2u64 cur = load_v2u64(plane + word);
+    if (shift == 0) {
+        return cur;
+    }
+    return (cur >> shift) | (load_v2u64(plane + word + 1) << (64 - shift));
+}
+
+static OT_INLINE void scan_group_packed_vec128(
+    const PackedReference *ref,
+    PackedGroup *group,
+    size_t word_begin,
+    size_t word_end,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    const int max_mm,
+    const int fixed_len
+) {
+    const size_t group_size = group->size;
+    const int max_len = fixed_len ? fixed_len : group->max_len;
+    const int bits = counter_bits(max_mm);
+
+    for (size_t word = word_begin; word < word_end; word += 2) {
+        v2u64 valid = load_v2u64(ref->valid + word);
+        if (!(valid[0] | valid[1])) {
+            continue;
+        }
+
+        v2u64 c0[GROUP_SIZE];
+        v2u64 c1[GROUP_SIZE];
+        v2u64 c2[GROUP_SIZE];
+        v2u64 dead[GROUP_SIZE];
+        for (size_t j = 0; j < GROUP_SIZE; ++j) {
+            c0[j] = c1[j] = c2[j] = dead[j] = (v2u64){0, 0};
+        }
+
+        for (int k = 0; k < max_len; ++k) {
+            v2u64 lo = plane_window_vec128(ref->lo, word, k);
+            v2u64 hi = plane_window_vec128(ref->hi, word, k);
+            v2u64 nmask = plane_window_vec128(ref->nmask, word, k);
+            v2u64 finished = ~(v2u64){0, 0};
+
+            for (size_t j = 0; j < group_size; ++j) {
+                const PackedGuide *g = &group->packed[j];
+                if (!fixed_len && k >= g->length) {
+                    continue;
+                }
+                v2u64 diff = ((lo ^ g->lo[k]) | (hi ^ g->hi[k]) | nmask) & ~g->n[k];
+                v2u64 carry = diff | (~nmask & g->n[k]);
+                v2u64 next = c0[j] & carry;
+                c0[j] ^= carry;
+                carry = next;
+                if (bits > 1) {
+                    next = c1[j] & carry;
+                    c1[j] ^= carry;
+                    carry = next;
+                }
+                if (bits > 2) {
+                    next = c2[j] & carry;
+                    c2[j] ^= carry;
+                    carry = next;
+                }
+                dead[j] |= carry;
+                v2u64 over = dead[j];
+                for (int value = max_mm + 1; value < (1 << bits); ++value) {
+                    over |= ((value & 1) ? c0[j] : ~c0[j]) & ((value & 2) ? c1[j] : ~c1[j])
+                          & ((value & 4) ? c2[j] : ~c2[j]);
+                }
+                finished &= over;
+            }
+
+            v2u64 open = valid & ~finished;
+            if (!(open[0] | open[1])) {
+                break;
+            }
+        }
+
+        for (size_t j = 0; j < group_size; ++j) {
+            const uint64_t *lane_valid = ref->valid_len[fixed_len ? fixed_len : group->packed[j].length];
+            for (size_t lane = 0; lane < 2; ++lane) {
+                accumulate_packed_word(word + lane, lane_valid[word + lane],
+                                       c0[j][lane], c1[j][lane], c2[j][lane], dead[j][lane], max_mm,
+                                       group->counts[j], &group->mm0_hits[j],
+                                       group->detail_level, &group->details[j],
+                                       ref, &group->packed[j].bits, &group->profiles[j], group->weights,
+                                       transcripts, transcript_count);
+            }
+        }
+    }
+}
+
+#if OT_X86
+OT_TARGET_AVX2 static inline __m256i plane_window_avx2(const uint64_t *plane, size_t word, __m128i shift, __m128i back) {
+    __m256i cur = _mm256_loadu_si256((const __m256i *)(plane + word));
+    __m256i next = _mm256_loadu_si256((const __m256i *)(plane + word + 1));
+    return _mm256_or_si256(_mm256_srl_epi64(cur, shift), _mm256_sll_epi64(next, back));
+}
+
+OT_TARGET_AVX2 static OT_INLINE __m256i bitsliced_over_limit_avx2(__m256i c0, __m256i c1, __m256i c2, __m256i dead,
+                                                                 const int max_mm, const int bits) {
+    __m256i over = dead;
+    for (int value = max_mm + 1; value < (1 << bits); ++value) {
+        __m256i eq = _mm256_and_si256(
+            _mm256_and_si256((value & 1) ? c0 : _mm256_xor_si256(c0, _mm256_set1_epi8(-1)),
+                             (value & 2) ? c1 : _mm256_xor_si256(c1, _mm256_set1_epi8(-1))),
+            (value & 4) ? c2 : _mm256_xor_si256(c2, _mm256_set1_epi8(-1)));
+        over = _mm256_or_si256(over, eq);
+    }
+    return over;
+}
+
+/*
+ * Same bit-sliced scan as scan_group_packed, four reference words (256
+ * window offsets) per iteration.  Shift counts of 64 yield zero for AVX2
+ * shifts, so the k == 0 window needs no special case.  `word_begin` must be
+ * a multiple of four; the final partial step reads into the plane padding,
+ * whose validity bits are zero.
+ */
+OT_TARGET_AVX2 static OT_INLINE void scan_group_packed_avx2(
+    const PackedReference *ref,
+    PackedGroup *group,
+    size_t word_begin,
+    size_t word_end,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    const int max_mm,
+    const int fixed_len
+) {
+    const size_t group_size = group->size;
+    const int max_len = fixed_len ? fixed_len : group->max_len;
+    const int bits = counter_bits(max_mm);
+    const PackedGuide *packed = group->packed;
+    const __m256i ones = _mm256_set1_epi8(-1);
+
+    for (size_t word = word_begin; word < word_end; word += 4) {
+        __m256i valid = _mm256_loadu_si256((const __m256i *)(ref->valid + word));
+        if (_mm256_testz_si256(valid, valid)) {
+            continue;
+        }
+
+        __m256i c0[GROUP_SIZE];
+        __m256i c1[GROUP_SIZE];
+        __m256i c2[GROUP_SIZE];
+        __m256i dead[GROUP_SIZE];
+        for (size_t j = 0; j < GROUP_SIZE; ++j) {
+            c0[j] = c1[j] = c2[j] = dead[j] = _mm256_setzero_si256();
+        }
+
+        for (int k = 0; k < max_len; ++k) {
+            __m128i shift = _mm_cvtsi32_si128(k);
+            __m128i back = _mm_cvtsi32_si128(64 - k);
+            __m256i lo = plane_window_avx2(ref->lo, word, shift, back);
+            __m256i hi = plane_window_avx2(ref->hi, word, shift, back);
+            __m256i nmask = plane_window_avx2(ref->nmask, word, shift, back);
+            __m256i finished = ones;
+
+            for (size_t j = 0; j < group_size; ++j) {
+                const PackedGuide *g = &packed[j];
+                if (!fixed_len && k >= g->length) {
+                    continue;
+                }
+                __m256i glo = _mm256_set1_epi64x((long long)g->lo[k]);
+                __m256i ghi = _mm256_set1_epi64x((long long)g->hi[k]);
+                __m256i gn = _mm256_set1_epi64x((long long)g->n[k]);
+                __m256i diff = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_xor_si256(lo, glo), _mm256_xor_si256(hi, ghi)), nmask);
+                __m256i carry = _mm256_or_si256(_mm256_andnot_si256(gn, diff),
+                                                _mm256_andnot_si256(nmask, gn));
+                __m256i next = _mm256_and_si256(c0[j], carry);
+                c0[j] = _mm256_xor_si256(c0[j], carry);
+                carry = next;
+                if (bits > 1) {
+                    next = _mm256_and_si256(c1[j], carry);
+                    c1[j] = _mm256_xor_si256(c1[j], carry);
+                    carry = next;
+                }
+                if (bits > 2) {
+                    next = _mm256_and_si256(c2[j], carry);
+                    c2[j] = _mm256_xor_si256(c2[j], carry);
+                    carry = next;
+                }
+                dead[j] = _mm256_or_si256(dead[j], carry);
+                finished = _mm256_and_si256(finished, bitsliced_over_limit_avx2(c0[j], c1[j], c2[j], dead[j],
+                                                                                max_mm, bits));
+            }
+
+            if (_mm256_testc_si256(finished, valid)) {
+                break;
+            }
+        }
+
+        for (size_t j = 0; j < group_size; ++j) {
+            const uint64_t *lane_valid = ref->valid_len[fixed_len ? fixed_len : group->packed[j].length];
+            uint64_t w0[4], w1[4], w2[4], wd[4];
+            _mm256_storeu_si256((__m256i *)w0, c0[j]);
+            _mm256_storeu_si256((__m256i *)w1, c1[j]);
+            _mm256_storeu_si256((__m256i *)w2, c2[j]);
+            _mm256_storeu_si256((__m256i *)wd, dead[j]);
+            for (size_t lane = 0; lane < 4; ++lane) {
+                accumulate_packed_word(word + lane, lane_valid[word + lane],
+                                       w0[lane], w1[lane], w2[lane], wd[lane], max_mm,
+                                       group->counts[j], &group->mm0_hits[j],
+                                       group->detail_level, &group->details[j],
+                                       ref, &group->packed[j].bits, &group->profiles[j], group->weights,
+                                       transcripts, transcript_count);
+            }
+        }
+    }
+}
+
+/*
+ * Truth table for _mm512_ternarylogic_epi64(c0, c1, c2, imm) selecting
+ * windows whose three-bit count equals `v`, and the union over every count
+ * above `k`.  The immediate must be a constant, hence one case per limit.
+ */
+#define TERNARY_EQ(v) (1u << ((((v) & 1) << 2) | ((v) & 2) | (((v) >> 2) & 1)))
+#define TERNARY_ABOVE(k, v) ((k) < (v) ? TERNARY_EQ(v) : 0u)
+#define TERNARY_OVER_LIMIT(k) (TERNARY_ABOVE(k, 1) | TERNARY_ABOVE(k, 2) | TERNARY_ABOVE(k, 3) \
+                               | TERNARY_ABOVE(k, 4) | TERNARY_ABOVE(k, 5) | TERNARY_ABOVE(k, 6) \
+                               | TERNARY_ABOVE(k, 7))
+
+OT_TARGET_AVX512 static OT_INLINE __m512i bitsliced_over_limit_avx512(__m512i c0, __m512i c1, __m512i c2,
+                                                                     const int max_mm) {
+    switch (max_mm) {
+        case 0: return _mm512_ternarylogic_epi64(c0, c1, c2, TERNARY_OVER_LIMIT(0));
+        case 1: return _mm512_ternarylogic_epi64(c0, c1, c2, TERNARY_OVER_LIMIT(1));
+        case 2: return _mm512_ternarylogic_epi64(c0, c1, c2, TERNARY_OVER_LIMIT(2));
+        case 3: return _mm512_ternarylogic_epi64(c0, c1, c2, TERNARY_OVER_LIMIT(3));
+        case 4: return _mm512_ternarylogic_epi64(c0, c1, c2, TERNARY_OVER_LIMIT(4));
+        default: return _mm512_ternarylogic_epi64(c0, c1, c2, TERNARY_OVER_LIMIT(5));
+    }
+}
+
+OT_TARGET_AVX512 static inline __m512i plane_window_avx512(const uint64_t *plane, size_t word,
+                                                           __m128i shift, __m128i back) {
+    __m512i cur = _mm512_loadu_si512((const void *)(plane + word));
+    __m512i next = _mm512_loadu_si512((const void *)(plane + word + 1));
+    return _mm512_or_si512(_mm512_srl_epi64(cur, shift), _mm512_sll_epi64(next, back));
+}
+
+/*
+ * AVX-512 variant of scan_group_packed_avx2: eight reference words (512
+ * window offsets) per iteration, one ternary-logic op for the over-limit
+ * test and mask registers for the early exits.  `word_begin` must be a
+ * multiple of eight; the final partial step reads into the plane padding.
+ */
+OT_TARGET_AVX512 static OT_INLINE void scan_group_packed_avx512(
+    const PackedReference *ref,
+    PackedGroup *group,
+    size_t word_begin,
+    size_t word_end,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    const int max_mm,
+    const int fixed_len
+) {
+    const size_t group_size = group->size;
+    const int max_len = fixed_len ? fixed_len : group->max_len;
+    const int bits = counter_bits(max_mm);
+    const PackedGuide *packed = group->packed;
+    const __m512i ones = _mm512_set1_epi64(-1);
+
+    for (size_t word = word_begin; word < word_end; word += 8) {
+        __m512i valid = _mm512_loadu_si512((const void *)(ref->valid + word));
+        __mmask8 live_words = _mm512_test_epi64_mask(valid, valid);
+        if (!live_words) {
+            continue;
+        }
+
+        __m512i c0[GROUP_SIZE];
+        __m512i c1[GROUP_SIZE];
+        __m512i c2[GROUP_SIZE];
+        __m512i dead[GROUP_SIZE];
+        for (size_t j = 0; j < GROUP_SIZE; ++j) {
+            c0[j] = c1[j] = c2[j] = dead[j] = _mm512_setzero_si512();
+        }
+
+        for (int k = 0; k < max_len; ++k) {
+            __m128i shift = _mm_cvtsi32_si128(k);
+            __m128i back = _mm_cvtsi32_si128(64 - k);
+            __m512i lo = plane_window_avx512(ref->lo, word, shift, back);
+            __m512i hi = plane_window_avx512(ref->hi, word, shift, back);
+            __m512i nmask = plane_window_avx512(ref->nmask, word, shift, back);
+            __m512i finished = ones;
+
+            for (size_t j = 0; j < group_size; ++j) {
+                const PackedGuide *g = &packed[j];
+                if (!fixed_len && k >= g->length) {
+                    continue;
+                }
+                __m512i glo = _mm512_set1_epi64((long long)g->lo[k]);
+                __m512i ghi = _mm512_set1_epi64((long long)g->hi[k]);
+                __m512i gn = _mm512_set1_epi64((long long)g->n[k]);
+                __m512i diff = _mm512_or_si512(
+                    _mm512_or_si512(_mm512_xor_si512(lo, glo), _mm512_xor_si512(hi, ghi)), nmask);
+                __m512i carry = _mm512_or_si512(_mm512_andnot_si512(gn, diff),
+                                                _mm512_andnot_si512(nmask, gn));
+                __m512i next = _mm512_and_si512(c0[j], carry);
+                c0[j] = _mm512_xor_si512(c0[j], carry);
+                carry = next;
+                if (bits > 1) {
+                    next = _mm512_and_si512(c1[j], carry);
+                    c1[j] = _mm512_xor_si512(c1[j], carry);
+                    carry = next;
+                }
+                if (bits > 2) {
+                    next = _mm512_and_si512(c2[j], carry);
+                    c2[j] = _mm512_xor_si512(c2[j], carry);
+                    carry = next;
+                }
+                dead[j] = _mm512_or_si512(dead[j], carry);
+                __m512i over = _mm512_or_si512(dead[j], bitsliced_over_limit_avx512(c0[j], c1[j], c2[j], max_mm));
+                finished = _mm512_and_si512(finished, over);
+            }
+
+            if (!_mm512_test_epi64_mask(valid, _mm512_andnot_si512(finished, ones))) {
+                break;
+            }
+        }
+
+        for (size_t j = 0; j < group_size; ++j) {
+            const uint64_t *lane_valid = ref->valid_len[fixed_len ? fixed_len : group->packed[j].length];
+            uint64_t w0[8], w1[8], w2[8], wd[8];
+            _mm512_storeu_si512((void *)w0, c0[j]);
+            _mm512_storeu_si512((void *)w1, c1[j]);
+            _mm512_storeu_si512((void *)w2, c2[j]);
+            _mm512_storeu_si512((void *)wd, dead[j]);
+            for (unsigned lanes = live_words; lanes; lanes &= lanes - 1) {
+                size_t lane = (size_t)__builtin_ctz(lanes);
+                accumulate_packed_word(word + lane, lane_valid[word + lane],
+                                       w0[lane], w1[lane], w2[lane], wd[lane], max_mm,
+                                       group->counts[j], &group->mm0_hits[j],
+                                       group->detail_level, &group->details[j],
+                                       ref, &group->packed[j].bits, &group->profiles[j], group->weights,
+                                       transcripts, transcript_count);
+            }
+        }
+    }
+}
+#endif /* OT_X86 */
+
+#define PACKED_KERNEL_PARAMS \
+    const PackedReference *ref, PackedGroup *group, size_t word_begin, size_t word_end, \
+    const TranscriptInfo *transcripts, size_t transcript_count
+#define PACKED_KERNEL_ARGS ref, group, word_begin, word_end, transcripts, transcript_count
+
+typedef void (*PackedKernel)(PACKED_KERNEL_PARAMS);
+
+#define DEFINE_PACKED_KERNEL(body, attr, k, len) \
+    attr static void body##_k##k##_l##len(PACKED_KERNEL_PARAMS) { body(PACKED_KERNEL_ARGS, k, len); }
+
+#if OT_X86
+KERNEL_VARIANTS(DEFINE_PACKED_KERNEL, scan_group_packed_avx512, OT_TARGET_AVX512)
+KERNEL_VARIANTS(DEFINE_PACKED_KERNEL, scan_group_packed_avx2, OT_TARGET_AVX2)
+static const PackedKernel packed_kernels_avx512[2][MAX_MISMATCHES + 1] = KERNEL_TABLE(scan_group_packed_avx512);
+static const PackedKernel packed_kernels_avx2[2][MAX_MISMATCHES + 1] = KERNEL_TABLE(scan_group_packed_avx2);
+#endif
+KERNEL_VARIANTS(DEFINE_PACKED_KERNEL, scan_group_packed_vec128, )
+KERNEL_VARIANTS(DEFINE_PACKED_KERNEL, scan_group_packed, )
+static const PackedKernel packed_kernels_vec128[2][MAX_MISMATCHES + 1] = KERNEL_TABLE(scan_group_packed_vec128);
+static const PackedKernel packed_kernels_scalar[2][MAX_MISMATCHES + 1] = KERNEL_TABLE(scan_group_packed);
+
+/* Packed scan kernel for `group` at the selected SIMD level. */
+static PackedKernel packed_kernel(SimdLevel simd, const PackedGroup *group) {
+    int variant = kernel_variant(group->length);
+    switch (simd) {
+#if OT_X86
+        case SIMD_AVX512:
+            return packed_kernels_avx512[variant][group->max_mismatches];
+        case SIMD_AVX2:
+            return packed_kernels_avx2[variant][group->max_mismatches];
+#endif
+        case SIMD_VEC128:
+            return packed_kernels_vec128[variant][group->max_mismatches];
+        default:
+            return packed_kernels_scalar[variant][group->max_mismatches];
+    }
+}
+
+/*
+ * Replays words [word_begin, word_end) for one lane window by window, in
+ * reference order, and returns the position of the window whose hit first
+ * pushes a count past its cap (SIZE_MAX if none does).  The lane's counts
+ * MM0 hits and hit details must have been rewound to the start of word_begin.
+ */
+static size_t replay_lane_to_cap(
+    const PackedReference *ref,
+    PackedGroup *group,
+    size_t lane,
+    size_t word_begin,
+    size_t word_end,
+    const CountCaps *caps,
+    int *level_out,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count
+) {
+    const PackedGuide *g = &group->packed[lane];
+    const uint64_t *lane_valid = ref->valid_len[g->length];
+    uint64_t *counts = group->counts[lane];
+
+    for (size_t word = word_begin; word < word_end; ++word) {
+        uint64_t valid = lane_valid[word];
+        if (!valid) {
+            continue;
+        }
+        uint64_t c0 = 0, c1 = 0, c2 = 0, dead = 0;
+        for (int k = 0; k < g->length; ++k) {
+            uint64_t lo = plane_window(ref->lo, word, k);
+            uint64_t hi = plane_window(ref->hi, word, k);
+            uint64_t nmask = plane_window(ref->nmask, word, k);
+            uint64_t diff = ((lo ^ g->lo[k]) | (hi ^ g->hi[k]) | nmask) & ~g->n[k];
+            uint64_t carry = diff | (~nmask & g->n[k]);
+            uint64_t next = c0 & carry;
+            c0 ^= carry;
+            carry = next;
+            next = c1 & carry;
+            c1 ^= carry;
+            carry = next;
+            next = c2 & carry;
+            c2 ^= carry;
+            dead |= next;
+        }
+
+        uint64_t live = valid & ~bitsliced_over_limit(c0, c1, c2, dead, group->max_mismatches);
+        while (live) {
+            int bit = __builtin_ctzll(live);
+            live &= live - 1;
+            int mm = (int)(((c0 >> bit) & 1) | (((c1 >> bit) & 1) << 1) | (((c2 >> bit) & 1) << 2));
+            size_t pos = word * 64 + (size_t)bit;
+            counts[mm]++;
+            if (mm == 0) {
+                hitlist_add(&group->mm0_hits[lane], find_transcript(transcripts, transcript_count, pos));
+            }
+            if (mm <= group->detail_level) {
+                detail_list_add(&group->details[lane], pos, mm);
+            }
+            if (counts[mm] > caps->max[mm]) {
+                *level_out = mm;
+                return pos;
+            }
+        }
+    }
+    return SIZE_MAX;
+}
+
+/*
+ * Retires every lane whose counts went over a cap during the tile just
+ * scanned, storing its result, then compacts the surviving lanes so all
+ * groups but the last are full.  Returns the new group count.
+ */
+static size_t retire_capped_lanes(
+    const PackedReference *ref,
+    PackedGroup *groups,
+    size_t group_count,
+    size_t tile,
+    size_t tile_end,
+    const CountCaps *caps,
+    GuideResult *results,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count
+) {
+    size_t out_group = 0;
+    size_t out_lane = 0;
+    for (size_t g = 0; g < group_count; ++g) {
+        PackedGroup *group = &groups[g];
+        for (size_t j = 0; j < group->size; ++j) {
+            if (caps_exceeded(caps, group->counts[j]) >= 0) {
+                memcpy(group->counts[j], group->tile_counts[j], sizeof(group->counts[j]));
+                group->mm0_hits[j].count = group->tile_hits[j];
+                group->details[j].count = group->tile_details[j];
+                int level = -1;
+                size_t pos = replay_lane_to_cap(ref, group, j, tile, tile_end, caps, &level,
+                                                transcripts, transcript_count);
+                GuideResult *res = &results[group->index[j]];
+                store_guide_result(res, group->counts[j], &group->mm0_hits[j], &group->details[j]);
+                res->disqualified = true;
+                res->disqualified_mm = level;
+                res->disqualified_pos = pos;
+                continue;
+            }
+
+            memcpy(group->tile_counts[j], group->counts[j], sizeof(group->tile_counts[j]));
+            group->tile_hits[j] = group->mm0_hits[j].count;
+            group->tile_details[j] = group->details[j].count;
+            if (out_group != g || out_lane != j) {
+                packed_group_move_lane(&groups[out_group], out_lane, group, j);
+            }
+            if (++out_lane == GROUP_SIZE) {
+                groups[out_group++].size = GROUP_SIZE;
+                out_lane = 0;
+            }
+        }
+    }
+    if (out_lane > 0) {
+        groups[out_group++].size = out_lane;
+    }
+    for (size_t g = 0; g < out_group; ++g) {
+        packed_group_update_max_len(&groups[g]);
+    }
+    return out_group;
+}
+
+/*
+ * Cache-blocked packed search for one block of guides over reference words
+ * [word_begin, word_end).  The range is walked in TILE_WORDS tiles (all
+ * four planes of a tile fit in L2), and
+ * every group of the block scans the tile before moving on, so a block of
+ * guides streams the reference from memory once instead of once per group.
+ * With caps, guides are checked after every tile and disqualified ones stop
+ * being scanned.
+ */
+static void process_block_packed(
+    const PackedReference *ref,
+    const Guide *guides,
+    size_t block_start,
+    size_t block_size,
+    GuideResult *results,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    const CountCaps *caps,
+    int detail_level,
+    int max_mismatches,
+    const double *weights,
+    SimdLevel simd,
+    size_t word_begin,
+    size_t word_end
+) {
+    size_t group_count = (block_size + GROUP_SIZE - 1) / GROUP_SIZE;
+    PackedGroup *groups = (PackedGroup *)xmalloc(group_count * sizeof(PackedGroup));
+    for (size_t g = 0; g < group_count; ++g) {
+        size_t start = block_start + g * GROUP_SIZE;
+        size_t remaining = block_start + block_size - start;
+        packed_group_init(&groups[g], guides, start, remaining < GROUP_SIZE ? remaining : GROUP_SIZE,
+                          detail_level, max_mismatches, weights);
+    }
+
+    for (size_t tile = word_begin; tile < word_end && group_count > 0; tile += TILE_WORDS) {
+        size_t tile_end = tile + TILE_WORDS < word_end ? tile + TILE_WORDS : word_end;
+        for (size_t g = 0; g < group_count; ++g) {
+            packed_kernel(simd, &groups[g])(ref, &groups[g], tile, tile_end, transcripts, transcript_count);
+        }
+        if (caps && caps->active) {
+            group_count = retire_capped_lanes(ref, groups, group_count, tile, tile_end, caps,
+                                              results, transcripts, transcript_count);
+        }
+    }
+
+    for (size_t g = 0; g < group_count; ++g) {
+        packed_group_store(&groups[g], results);
+    }
+    free(groups);
+}
+
+/*
+ * Guides per cache-blocked task: as large as possible (up to
+ * MAX_GUIDE_BLOCK) while still leaving a few blocks per thread so dynamic
+ * scheduling can balance the load.
+ */
+static size_t packed_block_size(size_t n_guides, int threads) {
+    size_t tasks = (size_t)(threads > 0 ? threads : 1) * 4;
+    size_t block = (n_guides + tasks - 1) / tasks;
+    block = (block + GROUP_SIZE - 1) / GROUP_SIZE * GROUP_SIZE;
+    if (block < GROUP_SIZE) {
+        block = GROUP_SIZE;
+    }
+    if (block > MAX_GUIDE_BLOCK) {
+        block = MAX_GUIDE_BLOCK;
+    }
+    return block;
+}
+
+/*
+ * Seed-and-verify engine.  By the pigeonhole principle, a window with at
+ * most K mismatches against a guide split into K + 1 segments matches at
+ * least one segment exactly, so looking up the leading k-mer of every
+ * segment finds every such window.  Candidates are verified with an
+ * XOR/popcount over the packed planes.  A window whose seeds match for
+ * several segments is only counted from the first of them, which keeps MM0
+ * hits in reference order (they all come from segment 0).  Windows with
+ * more than K mismatches are not enumerated, so only MM0..MMK are reported.
+ * Seeds do not visit windows in reference order, so under caps the hits are
+ * collected and replayed sorted to find the disqualifying window.
+ */
+
+/*
+ * Seed length that lets every guide be cut into max_mismatches + 1
+ * segments of at least k bases, or 0 when some guide is too short.
+ */
+static int seed_length_for(const Guide *guides, int n_guides, int max_mismatches) {
+    int min_len = MAX_GUIDE_LEN;
+    for (int i = 0; i < n_guides; ++i) {
+        if (guides[i].length < min_len) {
+            min_len = guides[i].length;
+        }
+    }
+    int k = min_len / (max_mismatches + 1);
+    return k > MAX_KMER_LEN ? MAX_KMER_LEN : k;
+}
+
+static bool guide_has_n(const Guide *guide) {
+    for (int k = 0; k < guide->length; ++k) {
+        if (guide->sequence[k] == 'N') {
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct {
+    size_t window;
+    int mismatches;
+} SeedHit;
+
+static int compare_seed_hits(const void *a, const void *b) {
+    size_t wa = ((const SeedHit *)a)->window;
+    size_t wb = ((const SeedHit *)b)->window;
+    return (wa > wb) - (wa < wb);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t va = *(const uint64_t *)a;
+    uint64_t vb = *(const uint64_t *)b;
+    return (va > vb) - (va < vb);
+}
+
+int compare_size(const void *a, const void *b) {
+    size_t va = *(const size_t *)a;
+    size_t vb = *(const size_t *)b;
+    return (va > vb) - (va < vb);
+}
+
+/* Seed-list entries search_guide_seeded verifies for `guide` (--stats). */
+static uint64_t seed_candidates(const KmerIndex *kmers, const Guide *guide, int max_mismatches) {
+    GuideBits bits;
+    guide_bits(guide, &bits);
+    int parts = max_mismatches + 1;
+    uint64_t total = 0;
+    for (int s = 0; s < parts; ++s) {
+        int start = s * guide->length / parts;
+        uint32_t code = 0;
+        for (int k = 0; k < kmers->k; ++k) {
+            code = (code << 2) | (uint32_t)(((bits.lo >> (start + k)) & 1) | (((bits.hi >> (start + k)) & 1) << 1));
+        }
+        total += kmers->offsets[code + 1] - kmers->offsets[code];
+    }
+    return total;
+}
+
+static void search_guide_seeded(
+    const PackedReference *ref,
+    const KmerIndex *kmers,
+    const Guide *guide,
+    int max_mismatches,
+    const CountCaps *caps,
+    int detail_level,
+    const double *weights,
+    GuideResult *result,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count
+) {
+    GuideBits bits;
+    guide_bits(guide, &bits);
+    MismatchProfile profile;
+    if (weights) {
+        memset(&profile, 0, sizeof(profile));
+    }
+
+    int parts = max_mismatches + 1;
+    int starts[MAX_MISMATCHES + 2];
+    uint64_t segment_masks[MAX_MISMATCHES + 1];
+    for (int s = 0; s <= parts; ++s) {
+        starts[s] = s * guide->length / parts;
+    }
+    for (int s = 0; s < parts; ++s) {
+        segment_masks[s] = ((1ULL << kmers->k) - 1) << starts[s];
+    }
+
+    uint64_t counts[MAX_MISMATCHES + 1] = {0};
+    HitList mm0_hits;
+    hitlist_init(&mm0_hits);
+    DetailList details;
+    detail_list_init(&details);
+    bool collect = caps && caps->active;
+    SeedHit *hits = NULL;
+    size_t hit_count = 0;
+    size_t hit_capacity = 0;
+
+    for (int s = 0; s < parts; ++s) {
+        uint32_t code = 0;
+        for (int k = 0; k < kmers->k; ++k) {
+            code = (code << 2) | (uint32_t)(((bits.lo >> (starts[s] + k)) & 1)
+                                            | (((bits.hi >> (starts[s] + k)) & 1) << 1));
+        }
+
+        const uint32_t *pos = kmers->positions + kmers->offsets[code];
+        const uint32_t *end = kmers->positions + kmers->offsets[code + 1];
+        for (; pos < end; ++pos) {
+            if (*pos < (uint32_t)starts[s]) {
+                continue;
+            }
+            size_t window = (size_t)*pos - (size_t)starts[s];
+            if (window >= ref->length || !bit_is_set(ref->valid_len[guide->length], window)) {
+                continue;
+            }
+
+            uint64_t diff = packed_window_diff(ref, window, &bits);
+            int mismatches = __builtin_popcountll(diff);
+            if (mismatches > max_mismatches) {
+                continue;
+            }
+            bool seen_earlier = false;
+            for (int prev = 0; prev < s; ++prev) {
+                if (!(diff & segment_masks[prev])) {
+                    seen_earlier = true;
+                    break;
+                }
+            }
+            if (seen_earlier) {
+                continue;
+            }
+
+            if (collect) {
+                if (hit_count == hit_capacity) {
+                    hit_capacity = hit_capacity ? hit_capacity * 2 : 64;
+                    SeedHit *grown = (SeedHit *)realloc(hits, hit_capacity * sizeof(SeedHit));
+                    if (!grown) {
+                        fprintf(stderr, "Error: realloc failed while collecting seed hits\n");
+                        exit(EXIT_FAILURE);
+                    }
+                    hits = grown;
+                }
+                hits[hit_count].window = window;
+                hits[hit_count].mismatches = mismatches;
+                hit_count++;
+                continue;
+            }
+
+            counts[mismatches]++;
+            if (mismatches == 0) {
+                hitlist_add(&mm0_hits, find_transcript(transcripts, transcript_count, window));
+            } else if (weights) {
+                mismatch_profile_add(&profile, diff, weights);
+            }
+            if (mismatches <= detail_level) {
+                detail_list_add(&details, window, mismatches);
+            }
+        }
+    }
+
+    int level = -1;
+    size_t disqualified_pos = 0;
+    if (collect) {
+        qsort(hits, hit_count, sizeof(SeedHit), compare_seed_hits);
+        for (size_t h = 0; h < hit_count && level < 0; ++h) {
+            int mm = hits[h].mismatches;
+            counts[mm]++;
+            if (mm == 0) {
+                hitlist_add(&mm0_hits, find_transcript(transcripts, transcript_count, hits[h].window));
+            }
+            if (mm <= detail_level) {
+                detail_list_add(&details, hits[h].window, mm);
+            }
+            if (counts[mm] > caps->max[mm]) {
+                level = mm;
+                disqualified_pos = hits[h].window;
+            }
+        }
+        free(hits);
+    } else if (details.count > 1) {
+        qsort(details.data, details.count, sizeof(uint64_t), compare_u64);
+    }
+
+    store_guide_result(result, counts, &mm0_hits, &details);
+    if (weights) {
+        store_guide_profile(result, &profile, guide->length);
+    }
+    if (level >= 0) {
+        result->disqualified = true;
+        result->disqualified_mm = level;
+        result->disqualified_pos = disqualified_pos;
+    }
+}
+
+/*
+ * Runs guides the seed engine cannot handle (N bases) through the packed
+ * scan, packing them into a contiguous array first.
+ */
+static void search_fallback_packed(
+    const PackedReference *ref,
+    const Guide *guides,
+    const int *indices,
+    size_t count,
+    GuideResult *results,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    const CountCaps *caps,
+    int detail_level,
+    int max_mismatches,
+    const double *weights,
+    SimdLevel simd,
+    const NumaViews *views,
+    SearchCounters *counters
+) {
+    if (count == 0) {
+        return;
+    }
+    Guide *subset = (Guide *)xmalloc(count * sizeof(Guide));
+    GuideResult *subset_results = (GuideResult *)xmalloc(count * sizeof(GuideResult));
+    memset(subset_results, 0, count * sizeof(GuideResult));
+    for (size_t i = 0; i < count; ++i) {
+        subset[i] = guides[indices[i]];
+    }
+
+    size_t block_size = packed_block_size(count, omp_get_max_threads());
+    size_t total_blocks = (count + block_size - 1) / block_size;
+#pragma omp parallel for schedule(dynamic)
+    for (size_t block_idx = 0; block_idx < total_blocks; ++block_idx) {
+        double started = counters ? omp_get_wtime() : 0.0;
+        int node = numa_enter(views->numa);
+        size_t start = block_idx * block_size;
+        size_t remaining = count - start;
+        process_block_packed(numa_local_packed(views, node, ref), subset, start,
+                             remaining < block_size ? remaining : block_size,
+                             subset_results, transcripts, transcript_count, caps, detail_level,
+                             max_mismatches, weights, simd, 0, ref->data_words);
+        search_counters_busy(counters, started);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        results[indices[i]] = subset_results[i];
+    }
+    free(subset_results);
+    free(subset);
+}
+
+static void search_seeded(
+    const PackedReference *ref,
+    const KmerIndex *kmers,
+    const Guide *guides,
+    int n_guides,
+    int max_mismatches,
+    const CountCaps *caps,
+    int detail_level,
+    const double *weights,
+    GuideResult *results,
+    const TranscriptInfo *transcripts,
+    size_t transcript_count,
+    SimdLevel simd,
+    ResultStream *stream,
+    const NumaViews *views,
+    SearchCounters *counters
+) {
+    int *fallback = (int *)xmalloc((size_t)n_guides * sizeof(int));
+    size_t fallback_count = 0;
+    for (int i = 0; i < n_guides; ++i) {
+        if (guide_has_n(&guides[i])) {
+            fallback[fallback_count++] = i;
+        }
+    }
+
+#pragma omp parallel for schedule(dynamic, 16)
+    for (int i = 0; i < n_guides; ++i) {
+        if (!guide_has_n(&guides[i])) {
+            double started = counters ? omp_get_wtime() : 0.0;
+            int node = numa_enter(views->numa);
+            search_guide_seeded(numa_local_packed(views, node, ref), views->kmers ? &views->kmers[node] : kmers,
+                                &guides[i], max_mismatches, caps, detail_level, weights, &results[i],
+                                transcripts, transcript_count);
+            result_stream_complete(stream, (size_t)i, 1);
+            search_counters_busy(counters, started);
+        }
+    }
+
+    search_fallback_packed(ref, guides, fallback, fallback_count, results,
+                           transcripts, transcript_count, caps, detail_level, max_mismatches, weights,
+                           simd, views, counters);
+    for (size_t f = 0; f < fallback_count; ++f) {
+        result_stream_complete(stream, (size_t)fallback[f], 1);
+    }
+    free(fallback);
+}
+
+/* Index-backed transcript names point into the mapping; only the array is owned. */
+/* Weights mismatch profiles are built with, or NULL when profiles are off. */
+static const double *profile_weights(const SearchOptions *options) {
+    return options->mismatch_profile ? options->position_weights : NULL;
+}
+
+void search_options_init(SearchOptions *options) {
+    options->engine = ENGINE_PACKED;
+    options->max_mismatches = MAX_MISMATCHES;
+    options->guide_length = 0;
+    options->detail_mismatches = -1;
+    options->mismatch_profile = false;
+    options->collapse_isoforms = false;
+    for (int k = 0; k < MAX_GUIDE_LEN; ++k) {
+        options->position_weights[k] = 1.0;
+    }
+    options->caps.active = false;
+    for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
+        options->caps.max[mm] = UINT64_MAX;
+    }
+}
+
+int validate_search_options(const SearchOptions *options) {
+    for (int mm = options->max_mismatches + 1; mm <= MAX_MISMATCHES; ++mm) {
+        if (options->caps.max[mm] != UINT64_MAX) {
+            fprintf(stderr, "Error: --max-mm%d requires --max-mismatches >= %d\n", mm, mm);
+            return -1;
+        }
+    }
+    if (options->detail_mismatches > options->max_mismatches) {
+        fprintf(stderr, "Error: --hits-max-mm %d requires --max-mismatches >= %d\n",
+                options->detail_mismatches, options->detail_mismatches);
+        return -1;
+    }
+    if (options->caps.active && (options->engine == ENGINE_BYTE || options->engine == ENGINE_GPU)) {
+        fprintf(stderr, "Error: --max-mmK is not supported by --engine %s\n",
+                options->engine == ENGINE_BYTE ? "byte" : "gpu");
+        return -1;
+    }
+    if (options->mismatch_profile && (options->caps.active || options->engine == ENGINE_GPU)) {
+        fprintf(stderr, "Error: --position-weights cannot be combined with %s\n",
+                options->caps.active ? "--max-mmK" : "--engine gpu");
+        return -1;
+    }
+    if (options->collapse_isoforms
+        && (options->caps.active || options->mismatch_profile || options->engine == ENGINE_GPU)) {
+        fprintf(stderr, "Error: --collapse-isoforms cannot be combined with %s\n",
+                options->caps.active ? "--max-mmK"
+                : options->mismatch_profile ? "--position-weights" : "--engine gpu");
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef OFFTARGET_GPU
+_Static_assert(OT_GPU_LEVELS == MAX_MISMATCHES + 1 && OT_GPU_MAX_GUIDE_LEN == MAX_GUIDE_LEN,
+               "gpu.h must match the engine's limits");
+
+/* Uploads the packed planes to TIGER_OFFTARGET_GPU_DEVICE (default 0). */
+static int open_gpu_reference(SearchContext *ctx) {
+    const char *env = getenv("TIGER_OFFTARGET_GPU_DEVICE");
+    int device = env && *env ? atoi(env) : 0;
+    char error[256];
+    if (ot_gpu_open(device, ctx->packed.lo, ctx->packed.hi, ctx->packed.nmask, ctx->packed.words,
+                    &ctx->gpu, error, sizeof(error)) != 0) {
+        fprintf(stderr, "Warning: unable to initialise the GPU backend (%s); using the packed engine\n", error);
+        ctx->options.engine = ENGINE_PACKED;
+        ctx->gpu = NULL;
+    }
+    return 0;
+}
+#endif
+
+/*
+ * Turns the normalised sequence in ctx->reference (laid out for
+ * ctx->transcripts) into what the engine scans: packed planes, or for the
+ * byte engine the sequence itself plus its validity bitmap.
+ */
+static void prepare_loaded_reference(SearchContext *ctx, int window_len) {
+    if (ctx->options.engine != ENGINE_BYTE) {
+        ctx->packed = pack_reference(ctx->reference.data, ctx->reference.length,
+                                     ctx->transcripts, ctx->transcript_count, window_len, ctx->simd);
+        free(ctx->reference.data);
+        ctx->reference.data = NULL;
+        return;
+    }
+    ctx->packed.length = ctx->reference.length;
+    ctx->packed.data_words = (ctx->reference.length + 63) / 64;
+    ctx->packed.words = ctx->packed.data_words + PACKED_PAD_WORDS;
+    ctx->packed.valid = compute_valid_bitmap(ctx->packed.words, ctx->transcripts, ctx->transcript_count, window_len);
+}
+
+int load_search_context(SearchContext *ctx, const char *reference_file, int window_len) {
+    ctx->window_len = window_len;
+    ctx->threads = parse_thread_override();
+    if (ctx->threads > 0) {
+        omp_set_num_threads(ctx->threads);
+    }
+    ctx->simd = select_simd_level();
+
+    ctx->from_index = is_index_image(reference_file);
+    if (ctx->from_index) {
+        if (load_index_image(reference_file, window_len, &ctx->packed, &ctx->transcripts,
+                             &ctx->transcript_count, &ctx->kmers) != 0) {
+            return -1;
+        }
+        if (ctx->options.engine == ENGINE_BYTE) {
+            ctx->reference = unpack_reference(&ctx->packed, ctx->transcripts, ctx->transcript_count);
+        }
+    } else {
+        string_pool_init(&ctx->names);
+        ctx->reference = load_reference_sequence(reference_file, &ctx->names, true, ctx->simd,
+                                                 &ctx->transcripts, &ctx->transcript_count);
+        prepare_loaded_reference(ctx, window_len);
+    }
+
+    ctx->shard_begin = 0;
+    ctx->shard_end = ctx->transcript_count;
+    for (size_t t = 0; t < ctx->transcript_count; ++t) {
+        if (ctx->transcripts[t].gene >= ctx->gene_count) {
+            ctx->gene_count = (size_t)ctx->transcripts[t].gene + 1;
+        }
+    }
+
+    if (numa_init(&ctx->numa) != NUMA_OFF) {
+        numa_place_reference(&ctx->numa, &ctx->packed, ctx->reference.data,
+                             ctx->reference.data ? ctx->reference.length + PAD_WIDTH : 0);
+    }
+#ifdef OFFTARGET_GPU
+    if (ctx->options.engine == ENGINE_GPU && open_gpu_reference(ctx) != 0) {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/*
+ * Makes sure the seed engine has a k-mer index usable for seeds of
+ * `seed_len` bases: a stored one with k <= seed_len, else a fresh one.
+ */
+int prepare_seed_index(SearchContext *ctx, int seed_len) {
+    if (ctx->kmers.k == 0 || ctx->kmers.k > seed_len) {
+        free_kmer_index(&ctx->kmers);
+        if (build_kmer_index(&ctx->packed, seed_len, &ctx->kmers) != 0) {
+            return -1;
+        }
+    }
+    numa_place_kmers(&ctx->numa, &ctx->kmers);
+    return 0;
+}
+
+static void free_collapsed_reference(struct CollapsedReference *collapsed);
+static void free_streamed_reference(struct StreamedReference *streamed);
+
+void free_search_context(SearchContext *ctx) {
+    if (ctx->collapsed) {
+        free_collapsed_reference(ctx->collapsed);
+    }
+    if (ctx->streamed) {
+        free_streamed_reference(ctx->streamed);
+    }
+    free(ctx->reference.data);
+    free(ctx->transcripts);
+    if (!ctx->from_index) {
+        string_pool_free(&ctx->names);
+    }
+    numa_free(&ctx->numa);
+#ifdef OFFTARGET_GPU
+    ot_gpu_close(ctx->gpu);
+#endif
+    free_kmer_index(&ctx->kmers);
+    free_packed_reference(&ctx->packed);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+/*
+ * Points ref->valid_len at a validity bitmap for every guide length in the
+ * batch, reusing the stored one for ctx->window_len, and ref->valid at the
+ * shortest length's.  Bitmaps it had to compute are returned in `owned`
+ * (indexed by length) for the caller to free.  A reference shard computes
+ * all of them over its own transcripts, which confines every engine to it.
+ */
+static void prepare_validity(const SearchContext *ctx, const Guide *guides, int n_guides,
+                             PackedReference *ref, uint64_t *owned[MAX_GUIDE_LEN + 1]) {
+    bool sharded = ctx->selected || ctx->shard_begin > 0 || ctx->shard_end < ctx->transcript_count;
+    const TranscriptInfo *scanned = ctx->selected ? ctx->selected : ctx->transcripts + ctx->shard_begin;
+    size_t scanned_count = ctx->selected ? ctx->selected_count : ctx->shard_end - ctx->shard_begin;
+    int min_len = MAX_GUIDE_LEN;
+    for (int i = 0; i < n_guides; ++i) {
+        int len = guides[i].length;
+        if (len < min_len) {
+            min_len = len;
+        }
+        if (ref->valid_len[len]) {
+            continue;
+        }
+        if (len == ctx->window_len && !sharded) {
+            ref->valid_len[len] = ctx->packed.valid;
+        } else {
+            owned[len] = compute_valid_bitmap(ref->words, scanned, scanned_count, len);
+            ref->valid_len[len] = owned[len];
+        }
+    }
+    if (n_guides > 0) {
+        ref->valid = (uint64_t *)ref->valid_len[min_len];
+    }
+}
+
+/*
+ * Byte-engine scan of one group of `sequence`, over windows starting in
+ * words [word_begin, word_end), with the widest kernel the CPU supports,
+ * specialised for the mismatch limit and, when the group's guides share
+ * it, the guide length.
+ */
+static void process_group_byte(const SearchContext *ctx, const PackedReference *packed, const char *sequence,
+                               const Guide *guides, size_t start, size_t group_size, GuideResult *results,
+                               size_t word_begin, size_t word_end) {
+    int length = guides[start].length;
+    for (size_t j = 1; j < group_size; ++j) {
+        if (guides[start + j].length != length) {
+            length = 0;
+        }
+    }
+    int variant = kernel_variant(length);
+    int max_mm = ctx->options.max_mismatches;
+    ByteKernel kernel;
+    switch (ctx->simd) {
+#if OT_X86
+        case SIMD_AVX512:
+            kernel = byte_kernels_avx512[variant][max_mm];
+            break;
+        case SIMD_AVX2:
+            kernel = byte_kernels_avx2[variant][max_mm];
+            break;
+#endif
+        case SIMD_VEC128:
+            kernel = byte_kernels_vec128[variant][max_mm];
+            break;
+        default:
+            kernel = byte_kernels_scalar[variant][max_mm];
+            break;
+    }
+    kernel(sequence, packed, word_begin, word_end, guides, start, group_size, results,
+           ctx->transcripts, ctx->transcript_count, ctx->options.detail_mismatches, profile_weights(&ctx->options));
+}
+
+/*
+ * Adds the work of a search to `counters`: the windows a scan compares
+ * each guide against (starts in the shard's transcripts that fit the
+ * guide), or the seed-list entries the index engine verifies.
+ */
+static void count_search_work(const SearchContext *ctx, SearchEngine engine, const Guide *guides, int n_guides,
+                              SearchCounters *counters) {
+    counters->guides += (uint64_t)n_guides;
+    if (engine == ENGINE_INDEX) {
+        for (int i = 0; i < n_guides; ++i) {
+            if (!guide_has_n(&guides[i])) {
+                counters->seed_candidates += seed_candidates(&ctx->kmers, &guides[i], ctx->options.max_mismatches);
+            }
+        }
+        return;
+    }
+
+    uint64_t per_length[MAX_GUIDE_LEN + 1] = {0};
+    for (int i = 0; i < n_guides; ++i) {
+        per_length[guides[i].length]++;
+    }
+    for (int len = 1; len <= MAX_GUIDE_LEN; ++len) {
+        if (!per_length[len]) {
+            continue;
+        }
+        uint64_t windows = 0;
+        const TranscriptInfo *scanned = ctx->selected ? ctx->selected : ctx->transcripts + ctx->shard_begin;
+        size_t scanned_count = ctx->selected ? ctx->selected_count : ctx->shard_end - ctx->shard_begin;
+        for (size_t t = 0; t < scanned_count; ++t) {
+            if (scanned[t].length >= (size_t)len) {
+                windows += scanned[t].length - (size_t)len + 1;
+            }
+        }
+        counters->windows += windows * per_length[len];
+    }
+}
+
+#ifdef OFFTARGET_GPU
+/*
+ * --engine gpu: one device scan of the whole batch (gpu.cu).  Its hit
+ * records, in reference order per guide, become MM0 transcript lists and
+ * hit details exactly as the packed scan builds them.  Returns -1 after a
+ * warning when the device fails, so the caller can scan on the CPU.
+ */
+static int search_gpu(const SearchContext *ctx, const PackedReference *packed, const Guide *guides, int n_guides,
+                      GuideResult *results) {
+    OtGpuGuide *device_guides = (OtGpuGuide *)xmalloc(((size_t)n_guides + 1) * sizeof(OtGpuGuide));
+    for (int i = 0; i < n_guides; ++i) {
+        GuideBits bits;
+        guide_bits(&guides[i], &bits);
+        device_guides[i].lo = bits.lo;
+        device_guides[i].hi = bits.hi;
+        device_guides[i].n = bits.n;
+        device_guides[i].length = guides[i].length;
+    }
+    uint64_t *counts = (uint64_t *)xmalloc(((size_t)n_guides + 1) * (MAX_MISMATCHES + 1) * sizeof(uint64_t));
+    int detail_level = ctx->options.detail_mismatches;
+    OtGpuHit *hits = NULL;
+    size_t hit_count = 0;
+    char error[256];
+    int status = ot_gpu_search(ctx->gpu, packed->valid_len, packed->valid, ctx->packed.valid, packed->data_words,
+                               device_guides, (size_t)n_guides, ctx->options.max_mismatches,
+                               detail_level > 0 ? detail_level : 0, counts,
+                               &hits, &hit_count, error, sizeof(error));
+    free(device_guides);
+    if (status != 0) {
+        fprintf(stderr, "Warning: GPU search failed (%s); using the packed engine\n", error);
+        free(counts);
+        return -1;
+    }
+
+    size_t h = 0;
+    for (int i = 0; i < n_guides; ++i) {
+        HitList mm0_hits;
+        DetailList details;
+        hitlist_init(&mm0_hits);
+        detail_list_init(&details);
+        for (; h < hit_count && hits[h].guide == (uint32_t)i; ++h) {
+            if (hits[h].mismatches == 0) {
+                hitlist_add(&mm0_hits, find_transcript(ctx->transcripts, ctx->transcript_count, hits[h].position));
+            }
+            if ((int)hits[h].mismatches <= detail_level) {
+                detail_list_add(&details, hits[h].position, (int)hits[h].mismatches);
+            }
+        }
+        store_guide_result(&results[i], counts + (size_t)i * (MAX_MISMATCHES + 1), &mm0_hits,
+                           detail_level >= 0 ? &details : NULL);
+    }
+    free(hits);
+    free(counts);
+    return 0;
+}
+#endif
+
+/*
+ * Searches `guides` against the context.  The seed engine falls back to the
+ * packed scan when the prepared k-mer index is too long for these guides.
+ * Finished guides are reported to `stream` (optional) as they complete.
+ */
+/*
+ * Words per reference slice of the packed and byte scans.  Runs with fewer
+ * guide blocks than a few per thread (a single gene, a smoke test) also
+ * split the reference, so every thread gets work and no long task is left
+ * running alone at the end; slices are multiples of SLICE_MIN_WORDS.
+ * Returns `words` (one slice) when the guide blocks alone keep the threads
+ * busy.
+ */
+static size_t reference_slice_words(size_t blocks, size_t words, int threads) {
+    size_t wanted = (size_t)(threads > 0 ? threads : 1) * 4;
+    if (blocks == 0 || blocks >= wanted || words <= SLICE_MIN_WORDS) {
+        return words;
+    }
+    size_t slices = (wanted + blocks - 1) / blocks;
+    size_t slice_words = (words + slices - 1) / slices;
+    slice_words = (slice_words + SLICE_MIN_WORDS - 1) / SLICE_MIN_WORDS * SLICE_MIN_WORDS;
+    return slice_words < words ? slice_words : words;
+}
+
+/*
+ * Folds the per-slice results of guides [start, start + count) into
+ * `results` in slice (reference) order: counts and profiles add up, MM0
+ * lists and hit details concatenate.  A transcript straddling a slice
+ * boundary is listed once.
+ */
+static void reduce_slices(GuideResult *partials, size_t slices, size_t n_guides, size_t start, size_t count,
+                          GuideResult *results) {
+    for (size_t i = start; i < start + count; ++i) {
+        GuideResult *res = &results[i];
+        *res = partials[i];
+        size_t mm0_total = res->mm0_count;
+        size_t detail_total = res->detail_count;
+        for (size_t slice = 1; slice < slices; ++slice) {
+            mm0_total += partials[slice * n_guides + i].mm0_count;
+            detail_total += partials[slice * n_guides + i].detail_count;
+        }
+        if (mm0_total > res->mm0_count) {
+            res->mm0_transcripts = (size_t *)realloc(res->mm0_transcripts, mm0_total * sizeof(size_t));
+        }
+        if (detail_total > res->detail_count) {
+            res->details = (uint64_t *)realloc(res->details, detail_total * sizeof(uint64_t));
+        }
+        if ((mm0_total && !res->mm0_transcripts) || (detail_total && !res->details)) {
+            fprintf(stderr, "Error: out of memory while combining reference slices\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t slice = 1; slice < slices; ++slice) {
+            GuideResult *part = &partials[slice * n_guides + i];
+            for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
+                res->counts[mm] += part->counts[mm];
+            }
+            for (size_t h = 0; h < part->mm0_count; ++h) {
+                if (res->mm0_count == 0 || res->mm0_transcripts[res->mm0_count - 1] != part->mm0_transcripts[h]) {
+                    res->mm0_transcripts[res->mm0_count++] = part->mm0_transcripts[h];
+                }
+            }
+            if (part->detail_count) {
+                memcpy(res->details + res->detail_count, part->details, part->detail_count * sizeof(uint64_t));
+                res->detail_count += part->detail_count;
+            }
+            if (part->mismatch_positions) {
+                for (int k = 0; k < res->profile_length; ++k) {
+                    res->mismatch_positions[k] += part->mismatch_positions[k];
+                }
+                res->offtarget_score += part->offtarget_score;
+            }
+            free(part->mm0_transcripts);
+            free(part->details);
+            free(part->mismatch_positions);
+        }
+    }
+}
+
+static void search_collapsed(const SearchContext *ctx, const Guide *guides, int n_guides, GuideResult *results);
+static void search_streamed(const SearchContext *ctx, const Guide *guides, int n_guides, GuideResult *results);
+
+void run_search(const SearchContext *ctx, const Guide *guides, int n_guides, GuideResult *results,
+                ResultStream *stream) {
+    if (ctx->collapsed && !ctx->selected && ctx->shard_begin == 0 && ctx->shard_end == ctx->transcript_count) {
+        bool window_guides = true;
+        for (int i = 0; i < n_guides && window_guides; ++i) {
+            window_guides = guides[i].length == ctx->window_len;
+        }
+        if (window_guides) {
+            search_collapsed(ctx, guides, n_guides, results);
+            result_stream_complete(stream, 0, (size_t)n_guides);
+            return;
+        }
+    }
+    if (ctx->streamed) {
+        search_streamed(ctx, guides, n_guides, results);
+        result_stream_complete(stream, 0, (size_t)n_guides);
+        return;
+    }
+
+    const SearchOptions *options = &ctx->options;
+    const TranscriptInfo *transcripts = ctx->transcripts;
+    size_t transcript_count = ctx->transcript_count;
+
+    PackedReference packed = ctx->packed;
+    uint64_t *owned[MAX_GUIDE_LEN + 1] = {0};
+    prepare_validity(ctx, guides, n_guides, &packed, owned);
+
+    SearchEngine engine = options->engine;
+    if (engine == ENGINE_INDEX) {
+        int seed_len = seed_length_for(guides, n_guides, options->max_mismatches);
+        if (seed_len == 0 || ctx->kmers.k == 0 || ctx->kmers.k > seed_len) {
+            engine = ENGINE_PACKED;
+        }
+    }
+
+#ifdef OFFTARGET_GPU
+    if (engine == ENGINE_GPU && search_gpu(ctx, &packed, guides, n_guides, results) != 0) {
+        engine = ENGINE_PACKED;
+    }
+#endif
+
+    SearchCounters *counters = ctx->counters;
+    if (counters) {
+        count_search_work(ctx, engine, guides, n_guides, counters);
+    }
+    NumaViews views = {
+        &ctx->numa,
+        numa_packed_views(&ctx->numa, &packed, ctx->packed.valid),
+        engine == ENGINE_INDEX ? numa_kmer_views(&ctx->numa, &ctx->kmers) : NULL,
+    };
+
+    if (engine == ENGINE_INDEX) {
+        search_seeded(&packed, &ctx->kmers, guides, n_guides, options->max_mismatches, &options->caps,
+                      options->detail_mismatches, profile_weights(options), results, transcripts, transcript_count,
+                      ctx->simd, stream,
+                      &views, counters);
+    } else if (engine == ENGINE_GPU) {
+        result_stream_complete(stream, 0, (size_t)n_guides);
+    } else {
+        /*
+         * Tasks are (guide block x reference slice) pairs, claimed in guide
+         * order from one dynamic loop; a block's last slice to finish folds
+         * the partial results into `results` and releases the block.
+         */
+        bool packed_engine = engine == ENGINE_PACKED;
+        size_t block_size = packed_engine ? packed_block_size((size_t)n_guides, omp_get_max_threads()) : GROUP_SIZE;
+        size_t total_blocks = ((size_t)n_guides + block_size - 1) / block_size;
+        /*
+         * Both engines scan every data word: byte buffers carry PAD_WIDTH
+         * bytes of slack past their data, so any window start the validity
+         * bitmaps admit can be loaded, up to the last base of a slice.
+         */
+        size_t words = packed.data_words;
+        size_t slice_words = options->caps.active
+            ? words : reference_slice_words(total_blocks, words, omp_get_max_threads());
+        size_t slices = slice_words < words ? (words + slice_words - 1) / slice_words : 1;
+        GuideResult *partials = NULL;
+        unsigned *finished = NULL;
+        if (slices > 1) {
+            partials = (GuideResult *)xmalloc(slices * (size_t)n_guides * sizeof(GuideResult));
+            memset(partials, 0, slices * (size_t)n_guides * sizeof(GuideResult));
+            finished = (unsigned *)xmalloc(total_blocks * sizeof(unsigned));
+            memset(finished, 0, total_blocks * sizeof(unsigned));
+        }
+
+#pragma omp parallel for schedule(dynamic)
+        for (size_t task = 0; task < total_blocks * slices; ++task) {
+            double started = counters ? omp_get_wtime() : 0.0;
+            int node = numa_enter(views.numa);
+            size_t block_idx = task / slices;
+            size_t slice = task % slices;
+            size_t start = block_idx * block_size;
+            size_t remaining = (size_t)n_guides - start;
+            size_t count = remaining < block_size ? remaining : block_size;
+            size_t word_begin = slice * slice_words;
+            size_t word_end = slices > 1 && word_begin + slice_words < words ? word_begin + slice_words : words;
+            GuideResult *out = partials ? partials + slice * (size_t)n_guides : results;
+            if (packed_engine) {
+                process_block_packed(numa_local_packed(&views, node, &packed), guides, start, count, out,
+                                     transcripts, transcript_count,
+                                     &options->caps, options->detail_mismatches, options->max_mismatches,
+                                     profile_weights(options), ctx->simd, word_begin, word_end);
+            } else {
+                const char *sequence = ctx->numa.replicas ? ctx->numa.replicas[node].bytes : ctx->reference.data;
+                process_group_byte(ctx, numa_local_packed(&views, node, &packed), sequence, guides, start, count,
+                                   out, word_begin, word_end);
+            }
+            if (!partials || __atomic_add_fetch(&finished[block_idx], 1, __ATOMIC_ACQ_REL) == slices) {
+                if (partials) {
+                    reduce_slices(partials, slices, (size_t)n_guides, start, count, results);
+                }
+                result_stream_complete(stream, start, count);
+            }
+            search_counters_busy(counters, started);
+        }
+        free(partials);
+        free(finished);
+    }
+
+    free((void *)views.packed);
+    free((void *)views.kmers);
+    for (int len = 0; len <= MAX_GUIDE_LEN; ++len) {
+        free(owned[len]);
+    }
+}
+
+/*
+ * --collapse-isoforms: isoforms of a gene repeat its exons, so most of the
+ * windows of a transcriptome occur several times within a gene.  The
+ * collapsed reference keeps each distinct window of a gene once: runs of
+ * windows not seen earlier in the gene are copied into "pieces" (laid out
+ * gene by gene, each gene starting on a word boundary), and every repeat
+ * is recorded as a further owner of the piece window it equals.  Searches
+ * of guides of the collapsed length scan the pieces, record every window
+ * within the mismatch limit, and expand each into its owners' original
+ * positions, so counts, MM0 transcripts and hit details come out as a scan
+ * of the full reference would report them.  Windows with an N are never
+ * merged.
+ */
+typedef struct CollapsedReference {
+    SearchContext scan;             /* the pieces as a reference; transcripts = pieces */
+    size_t *origins;                /* original position of each piece's first base */
+    size_t *owner_windows;          /* collapsed windows with further owners, sorted */
+    size_t *owner_positions;        /* ... the original position of each further owner */
+    size_t owner_count;
+    size_t windows;                 /* valid windows of the full reference */
+} CollapsedReference;
+
+static void free_collapsed_reference(CollapsedReference *collapsed) {
+    free_search_context(&collapsed->scan);
+    free(collapsed->origins);
+    free(collapsed->owner_windows);
+    free(collapsed->owner_positions);
+    free(collapsed);
+}
+
+#ifndef OFFTARGET_LIBRARY
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+    uint32_t window;                /* gene-local collapsed position + 1; 0 = empty slot */
+    uint32_t reserved;
+} CollapseSlot;
+
+typedef struct {
+    size_t origin;                  /* original position of the first window */
+    size_t start;                   /* gene-local collapsed position */
+    size_t windows;
+} CollapsePiece;
+
+typedef struct {
+    size_t window;                  /* gene-local, then global, collapsed position */
+    size_t owner;                   /* original position */
+} CollapseOwner;
+
+/* One gene's pieces and repeats, and the bases its pieces take. */
+typedef struct {
+    CollapsePiece *pieces;
+    size_t piece_count;
+    CollapseOwner *owners;
+    size_t owner_count;
+    size_t length;
+    size_t base;                    /* global collapsed position of the gene */
+} CollapseGene;
+
+static int compare_collapse_owners(const void *a, const void *b) {
+    const CollapseOwner *x = (const CollapseOwner *)a;
+    const CollapseOwner *y = (const CollapseOwner *)b;
+    if (x->window != y->window) {
+        return x->window < y->window ? -1 : 1;
+    }
+    return (x->owner > y->owner) - (x->owner < y->owner);
+}
+
+/* Finds the pieces and repeats of one gene's transcripts (ascending indices in `members`). */
+static void collapse_gene(const PackedReference *ref, const TranscriptInfo *transcripts, const size_t *members,
+                          size_t member_count, int window_len, CollapseGene *gene) {
+    uint64_t mask = window_len == 64 ? ~0ULL : (1ULL << window_len) - 1;
+    size_t windows = 0;
+    for (size_t m = 0; m < member_count; ++m) {
+        const TranscriptInfo *t = &transcripts[members[m]];
+        windows += t->length >= (size_t)window_len ? t->length - (size_t)window_len + 1 : 0;
+    }
+    size_t slot_count = 16;
+    while (slot_count < windows * 2) {
+        slot_count *= 2;
+    }
+    CollapseSlot *slots = (CollapseSlot *)xmalloc(slot_count * sizeof(CollapseSlot));
+    memset(slots, 0, slot_count * sizeof(CollapseSlot));
+    size_t piece_capacity = 16;
+    size_t owner_capacity = 16;
+    gene->pieces = (CollapsePiece *)xmalloc(piece_capacity * sizeof(CollapsePiece));
+    gene->owners = (CollapseOwner *)xmalloc(owner_capacity * sizeof(CollapseOwner));
+
+    for (size_t m = 0; m < member_count; ++m) {
+        const TranscriptInfo *t = &transcripts[members[m]];
+        if (t->length < (size_t)window_len) {
+            continue;
+        }
+        CollapsePiece *piece = NULL;
+        for (size_t pos = t->start; pos + (size_t)window_len <= t->start + t->length; ++pos) {
+            size_t word = pos / 64;
+            int shift = (int)(pos % 64);
+            uint64_t lo = plane_window(ref->lo, word, shift) & mask;
+            uint64_t hi = plane_window(ref->hi, word, shift) & mask;
+            CollapseSlot *slot = NULL;
+            if (!(plane_window(ref->nmask, word, shift) & mask)) {
+                size_t s = (size_t)((lo * 0x9E3779B97F4A7C15ULL) ^ (hi * 0xC2B2AE3D27D4EB4FULL)) >> 17;
+                for (s &= slot_count - 1; slots[s].window; s = (s + 1) & (slot_count - 1)) {
+                    if (slots[s].lo == lo && slots[s].hi == hi) {
+                        break;
+                    }
+                }
+                slot = &slots[s];
+                if (slot->window) {
+                    if (gene->owner_count == owner_capacity) {
+                        owner_capacity *= 2;
+                        gene->owners = (CollapseOwner *)realloc(gene->owners, owner_capacity * sizeof(CollapseOwner));
+                        if (!gene->owners) {
+                            fprintf(stderr, "Error: out of memory while collapsing isoforms\n");
+                            exit(EXIT_FAILURE);
+                        }
+                    }
+                    gene->owners[gene->owner_count].window = slot->window - 1;
+                    gene->owners[gene->owner_count].owner = pos;
+                    gene->owner_count++;
+                    piece = NULL;
+                    continue;
+                }
+            }
+            if (!piece) {
+                if (gene->piece_count == piece_capacity) {
+                    piece_capacity *= 2;
+                    gene->pieces = (CollapsePiece *)realloc(gene->pieces, piece_capacity * sizeof(CollapsePiece));
+                    if (!gene->pieces) {
+                        fprintf(stderr, "Error: out of memory while collapsing isoforms\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                piece = &gene->pieces[gene->piece_count++];
+                piece->origin = pos;
+                piece->start = gene->length;
+                piece->windows = 0;
+                gene->length += (size_t)window_len - 1;
+            }
+            if (slot) {
+                slot->lo = lo;
+                slot->hi = hi;
+                slot->window = (uint32_t)(piece->start + piece->windows + 1);
+            }
+            piece->windows++;
+            gene->length++;
+        }
+    }
+    free(slots);
+}
+
+/* Copies `count` bases of `src` from `src_pos` into the zeroed `dst` planes at `dst_pos`. */
+static void copy_plane_bits(const uint64_t *src, size_t src_pos, uint64_t *dst, size_t dst_pos, size_t count) {
+    while (count > 0) {
+        size_t chunk = count < 64 ? count : 64;
+        uint64_t bits = plane_window(src, src_pos / 64, (int)(src_pos % 64));
+        if (chunk < 64) {
+            bits &= (1ULL << chunk) - 1;
+        }
+        size_t word = dst_pos / 64;
+        int shift = (int)(dst_pos % 64);
+        dst[word] |= bits << shift;
+        if (shift && shift + chunk > 64) {
+            dst[word + 1] |= bits >> (64 - shift);
+        }
+        src_pos += chunk;
+        dst_pos += chunk;
+        count -= chunk;
+    }
+}
+
+/*
+ * Builds ctx->collapsed for guides of ctx->window_len bases.  The scan
+ * context shares ctx's options (with every hit recorded) and gets its own
+ * seed index when the index engine has one.
+ */
+int collapse_isoforms(SearchContext *ctx) {
+    int window_len = ctx->window_len;
+    PackedReference temporary;
+    memset(&temporary, 0, sizeof(temporary));
+    const PackedReference *ref = &ctx->packed;
+    if (!ref->lo) {
+        temporary = pack_reference(ctx->reference.data, ctx->reference.length, ctx->transcripts,
+                                   ctx->transcript_count, window_len, ctx->simd);
+        ref = &temporary;
+    }
+
+    size_t gene_count = ctx->gene_count;
+    size_t *member_offsets = (size_t *)xmalloc((gene_count + 1) * sizeof(size_t));
+    size_t *members = (size_t *)xmalloc((ctx->transcript_count + 1) * sizeof(size_t));
+    memset(member_offsets, 0, (gene_count + 1) * sizeof(size_t));
+    for (size_t t = 0; t < ctx->transcript_count; ++t) {
+        member_offsets[ctx->transcripts[t].gene + 1]++;
+    }
+    for (size_t g = 0; g < gene_count; ++g) {
+        member_offsets[g + 1] += member_offsets[g];
+    }
+    size_t *fill = (size_t *)xmalloc((gene_count + 1) * sizeof(size_t));
+    memcpy(fill, member_offsets, (gene_count + 1) * sizeof(size_t));
+    for (size_t t = 0; t < ctx->transcript_count; ++t) {
+        members[fill[ctx->transcripts[t].gene]++] = t;
+    }
+    free(fill);
+
+    CollapseGene *genes = (CollapseGene *)xmalloc((gene_count + 1) * sizeof(CollapseGene));
+    memset(genes, 0, (gene_count + 1) * sizeof(CollapseGene));
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (size_t g = 0; g < gene_count; ++g) {
+        collapse_gene(ref, ctx->transcripts, members + member_offsets[g], member_offsets[g + 1] - member_offsets[g],
+                      window_len, &genes[g]);
+    }
+    free(members);
+    free(member_offsets);
+
+    size_t length = 0;
+    size_t piece_count = 0;
+    size_t owner_count = 0;
+    for (size_t g = 0; g < gene_count; ++g) {
+        genes[g].base = length;
+        length += (genes[g].length + 63) / 64 * 64;
+        piece_count += genes[g].piece_count;
+        owner_count += genes[g].owner_count;
+    }
+
+    CollapsedReference *collapsed = (CollapsedReference *)xmalloc(sizeof(CollapsedReference));
+    memset(collapsed, 0, sizeof(*collapsed));
+    SearchContext *scan = &collapsed->scan;
+    scan->options = ctx->options;
+    scan->options.detail_mismatches = ctx->options.max_mismatches;
+    scan->window_len = window_len;
+    scan->threads = ctx->threads;
+    scan->simd = ctx->simd;
+    scan->gene_count = ctx->gene_count;
+    scan->transcript_count = piece_count;
+    scan->shard_end = piece_count;
+    scan->transcripts = (TranscriptInfo *)xmalloc((piece_count + 1) * sizeof(TranscriptInfo));
+    collapsed->origins = (size_t *)xmalloc((piece_count + 1) * sizeof(size_t));
+    collapsed->owner_windows = (size_t *)xmalloc((owner_count + 1) * sizeof(size_t));
+    collapsed->owner_positions = (size_t *)xmalloc((owner_count + 1) * sizeof(size_t));
+    collapsed->owner_count = owner_count;
+
+    PackedReference *packed = &scan->packed;
+    packed->length = length;
+    packed->data_words = length / 64;
+    packed->words = packed->data_words + PACKED_PAD_WORDS;
+    size_t plane_bytes = packed->words * sizeof(uint64_t);
+    packed->lo = (uint64_t *)xmalloc(plane_bytes);
+    packed->hi = (uint64_t *)xmalloc(plane_bytes);
+    packed->nmask = (uint64_t *)xmalloc(plane_bytes);
+    packed->valid = (uint64_t *)xmalloc(plane_bytes);
+    memset(packed->lo, 0, plane_bytes);
+    memset(packed->hi, 0, plane_bytes);
+    memset(packed->nmask, 0, plane_bytes);
+    memset(packed->valid, 0, plane_bytes);
+
+    size_t *piece_first = (size_t *)xmalloc((gene_count + 1) * sizeof(size_t));
+    size_t *owner_first = (size_t *)xmalloc((gene_count + 1) * sizeof(size_t));
+    for (size_t g = 0, p = 0, o = 0; g < gene_count; ++g) {
+        piece_first[g] = p;
+        owner_first[g] = o;
+        p += genes[g].piece_count;
+        o += genes[g].owner_count;
+    }
+    /* Genes start on word boundaries, so each thread writes its own words. */
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (size_t g = 0; g < gene_count; ++g) {
+        CollapseGene *gene = &genes[g];
+        for (size_t p = 0; p < gene->piece_count; ++p) {
+            const CollapsePiece *piece = &gene->pieces[p];
+            size_t start = gene->base + piece->start;
+            size_t bases = piece->windows + (size_t)window_len - 1;
+            copy_plane_bits(ref->lo, piece->origin, packed->lo, start, bases);
+            copy_plane_bits(ref->hi, piece->origin, packed->hi, start, bases);
+            copy_plane_bits(ref->nmask, piece->origin, packed->nmask, start, bases);
+            set_bit_range(packed->valid, start, start + piece->windows - 1);
+            TranscriptInfo *info = &scan->transcripts[piece_first[g] + p];
+            memset(info, 0, sizeof(*info));
+            info->start = start;
+            info->length = bases;
+            collapsed->origins[piece_first[g] + p] = piece->origin;
+        }
+        for (size_t o = 0; o < gene->owner_count; ++o) {
+            gene->owners[o].window += gene->base;
+        }
+        qsort(gene->owners, gene->owner_count, sizeof(CollapseOwner), compare_collapse_owners);
+        for (size_t o = 0; o < gene->owner_count; ++o) {
+            collapsed->owner_windows[owner_first[g] + o] = gene->owners[o].window;
+            collapsed->owner_positions[owner_first[g] + o] = gene->owners[o].owner;
+        }
+        free(gene->pieces);
+        free(gene->owners);
+    }
+    free(piece_first);
+    free(owner_first);
+    free(genes);
+    free_packed_reference(&temporary);
+
+    collapsed->windows = 0;
+    for (size_t t = 0; t < ctx->transcript_count; ++t) {
+        if (ctx->transcripts[t].length >= (size_t)window_len) {
+            collapsed->windows += ctx->transcripts[t].length - (size_t)window_len + 1;
+        }
+    }
+    size_t unique = collapsed->windows - owner_count;
+    fprintf(stderr, "Collapsed isoforms: %zu of %zu %d-base windows distinct within their gene (%.1f%%), "
+            "%zu pieces\n", unique, collapsed->windows, window_len,
+            collapsed->windows ? 100.0 * (double)unique / (double)collapsed->windows : 100.0, piece_count);
+
+    if (ctx->options.engine == ENGINE_BYTE) {
+        scan->reference = unpack_reference(packed, scan->transcripts, scan->transcript_count);
+    }
+    if (ctx->options.engine == ENGINE_INDEX && ctx->kmers.k > 0
+        && build_kmer_index(packed, ctx->kmers.k, &scan->kmers) != 0) {
+        free_collapsed_reference(collapsed);
+        return -1;
+    }
+    ctx->collapsed = collapsed;
+    return 0;
+}
+#endif /* !OFFTARGET_LIBRARY */
+
+/*
+ * Searches the collapsed reference and expands every recorded window into
+ * its owners.  Called by run_search for batches of ctx->window_len guides.
+ */
+static void search_collapsed(const SearchContext *ctx, const Guide *guides, int n_guides, GuideResult *results) {
+    const CollapsedReference *collapsed = ctx->collapsed;
+    SearchContext scan = collapsed->scan;
+    scan.counters = ctx->counters;
+    GuideResult *windows = (GuideResult *)xmalloc((size_t)n_guides * sizeof(GuideResult));
+    memset(windows, 0, (size_t)n_guides * sizeof(GuideResult));
+    run_search(&scan, guides, n_guides, windows, NULL);
+
+    int detail_level = ctx->options.detail_mismatches;
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int i = 0; i < n_guides; ++i) {
+        const GuideResult *found = &windows[i];
+        uint64_t counts[MAX_MISMATCHES + 1] = {0};
+        HitList mm0;
+        DetailList details;
+        hitlist_init(&mm0);
+        detail_list_init(&details);
+        for (size_t d = 0; d < found->detail_count; ++d) {
+            size_t window = (size_t)(found->details[d] >> DETAIL_MM_BITS);
+            int mm = (int)(found->details[d] & ((1u << DETAIL_MM_BITS) - 1));
+            size_t piece = find_transcript(scan.transcripts, scan.transcript_count, window);
+            size_t first = 0;
+            size_t last = collapsed->owner_count;
+            while (first < last) {
+                size_t mid = first + (last - first) / 2;
+                if (collapsed->owner_windows[mid] < window) {
+                    first = mid + 1;
+                } else {
+                    last = mid;
+                }
+            }
+            size_t owner = collapsed->origins[piece] + (window - scan.transcripts[piece].start);
+            for (size_t o = first; ; ++o) {
+                counts[mm]++;
+                if (mm == 0) {
+                    hitlist_add(&mm0, find_transcript(ctx->transcripts, ctx->transcript_count, owner));
+                }
+                if (mm <= detail_level) {
+                    detail_list_add(&details, owner, mm);
+                }
+                if (o >= collapsed->owner_count || collapsed->owner_windows[o] != window) {
+                    break;
+                }
+                owner = collapsed->owner_positions[o];
+            }
+        }
+        /* Owners arrive in collapsed order; restore reference order (hitlist_add dropped repeats). */
+        if (mm0.count > 1) {
+            qsort(mm0.data, mm0.count, sizeof(size_t), compare_size);
+        }
+        if (details.count > 1) {
+            qsort(details.data, details.count, sizeof(uint64_t), compare_u64);
+        }
+        store_guide_result(&results[i], counts, &mm0, &details);
+    }
+    free_results(windows, (size_t)n_guides);
+}
+
+/*
+ * --memory-budget: the reference is never loaded whole.  Its FASTA stays
+ * mapped and laid out (transcripts keep their full-load positions), and a
+ * search walks it in slices: slice s owns the windows starting in
+ * [begin_s, begin_s+1) and holds the bases up to guide length - 1 past that,
+ * so every window lies whole in the slice that owns it.  Each slice is
+ * normalised by a prefetch thread while the one before it is scanned, then
+ * packed (and k-mer indexed for --engine index) like a full reference and
+ * searched with `selected` transcripts clipped to its own windows.  Hits
+ * are shifted back to reference positions and transcript indices and folded
+ * in reference order, so results equal a whole-reference run.
+ */
+typedef struct StreamedReference {
+    FastaLayout layout;
+    size_t total_length;            /* of the laid-out sequence */
+    size_t budget_bytes;
+} StreamedReference;
+
+static void free_streamed_reference(StreamedReference *streamed) {
+    close_fasta_layout(&streamed->layout);
+    free(streamed);
+}
+
+/*
+ * Bases per slice for `budget_bytes`: two slices of text in flight (one
+ * being scanned, one prefetched), about a byte per base of packed planes
+ * and validity bitmaps, and for the index engine 4 bytes of k-mer
+ * positions per base plus the fixed 4^k offsets table.
+ */
+#define STREAM_MIN_SLICE_BASES ((size_t)1 << 12)
+
+static size_t streamed_slice_bases(size_t budget_bytes, SearchEngine engine, int seed_len) {
+    size_t per_base = 3;
+    size_t fixed = 0;
+    if (engine == ENGINE_INDEX && seed_len > 0) {
+        per_base += sizeof(uint32_t);
+        fixed = (((size_t)1 << (2 * seed_len)) + 1) * sizeof(uint32_t);
+    }
+    size_t bases = budget_bytes > fixed ? (budget_bytes - fixed) / per_base : 0;
+    return bases > STREAM_MIN_SLICE_BASES ? bases : STREAM_MIN_SLICE_BASES;
+}
+
+typedef struct {
+    const FastaLayout *layout;
+    SimdLevel simd;
+    size_t begin;
+    size_t end;
+    Buffer sequence;
+} SliceFill;
+
+static void *fill_slice(void *arg) {
+    SliceFill *fill = (SliceFill *)arg;
+    size_t length = fill->end - fill->begin;
+    fill->sequence.data = (char *)xmalloc(length + PAD_WIDTH);
+    fill->sequence.length = length;
+    fill->sequence.capacity = length + PAD_WIDTH;
+    fill_reference_range(fill->layout, fill->simd, fill->begin, fill->end, fill->sequence.data);
+    memset(fill->sequence.data + length, SENTINEL_CHAR, PAD_WIDTH);
+    return NULL;
+}
+
+/* Drops the mapped text of positions before `end` from the page tables; later slices never read it. */
+static void release_slice_text(const FastaLayout *layout, size_t end) {
+    if (!layout->text.mapping) {
+        return;
+    }
+    size_t text_end = 0;
+    for (size_t p = 0; p < layout->piece_count && layout->pieces[p].out + layout->pieces[p].bases <= end; ++p) {
+        text_end = layout->pieces[p].end;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    text_end -= text_end % page;
+    if (text_end > 0) {
+        madvise(layout->text.mapping, text_end, MADV_DONTNEED);
+    }
+}
+
+static int compare_guide_length(const void *a, const void *b) {
+    const Guide *x = *(const Guide *const *)a;
+    const Guide *y = *(const Guide *const *)b;
+    if (x->length != y->length) {
+        return x->length < y->length ? -1 : 1;
+    }
+    return (x > y) - (x < y);
+}
+
+static void search_streamed(const SearchContext *ctx, const Guide *guides, int n_guides, GuideResult *results) {
+    const StreamedReference *streamed = ctx->streamed;
+    memset(results, 0, (size_t)n_guides * sizeof(GuideResult));
+    if (n_guides == 0 || ctx->shard_begin >= ctx->shard_end) {
+        return;
+    }
+
+    /* Guides sorted by length: each length clips the slices' windows with its own overlap. */
+    const Guide **order = (const Guide **)xmalloc((size_t)n_guides * sizeof(Guide *));
+    for (int i = 0; i < n_guides; ++i) {
+        order[i] = &guides[i];
+    }
+    qsort(order, (size_t)n_guides, sizeof(Guide *), compare_guide_length);
+    Guide *sorted = (Guide *)xmalloc((size_t)n_guides * sizeof(Guide));
+    for (int i = 0; i < n_guides; ++i) {
+        sorted[i] = *order[i];
+    }
+    GuideResult *folded = (GuideResult *)xmalloc((size_t)n_guides * sizeof(GuideResult));
+    memset(folded, 0, (size_t)n_guides * sizeof(GuideResult));
+    GuideResult *partials = (GuideResult *)xmalloc(2 * (size_t)n_guides * sizeof(GuideResult));
+    int max_len = sorted[n_guides - 1].length;
+    int seed_len = ctx->options.engine == ENGINE_INDEX
+        ? seed_length_for(sorted, n_guides, ctx->options.max_mismatches) : 0;
+    size_t slice_bases = streamed_slice_bases(streamed->budget_bytes, ctx->options.engine, seed_len);
+
+    const TranscriptInfo *first = &ctx->transcripts[ctx->shard_begin];
+    const TranscriptInfo *last = &ctx->transcripts[ctx->shard_end - 1];
+    size_t range_begin = first->start;
+    size_t range_end = last->start + last->length;
+    size_t overlap = (size_t)max_len - 1;
+
+    SliceFill fill = {&streamed->layout, ctx->simd, range_begin, 0, {0}};
+    fill.end = range_begin + slice_bases + overlap < range_end ? range_begin + slice_bases + overlap : range_end;
+    fill_slice(&fill);
+    size_t slices = 0;
+    for (size_t begin = range_begin; begin < range_end; ++slices) {
+        size_t owned_end = begin + slice_bases < range_end ? begin + slice_bases : range_end;
+        size_t end = fill.end;
+        SearchContext slice;
+        memset(&slice, 0, sizeof(slice));
+        slice.options = ctx->options;
+        slice.threads = ctx->threads;
+        slice.simd = ctx->simd;
+        slice.window_len = max_len;
+        slice.counters = ctx->counters;
+        slice.reference = fill.sequence;
+
+        /* Prefetch the next slice while this one is packed and scanned. */
+        pthread_t prefetch;
+        bool prefetching = false;
+        if (owned_end < range_end) {
+            fill.begin = owned_end;
+            fill.end = owned_end + slice_bases + overlap < range_end ? owned_end + slice_bases + overlap : range_end;
+            fill.sequence.data = NULL;
+            prefetching = pthread_create(&prefetch, NULL, fill_slice, &fill) == 0;
+        }
+
+        /* The slice's transcripts, in slice positions; index k is transcript transcript_base + k. */
+        size_t transcript_base = find_transcript(ctx->transcripts, ctx->transcript_count, begin);
+        if (transcript_base < ctx->transcript_count
+            && ctx->transcripts[transcript_base].start + ctx->transcripts[transcript_base].length <= begin) {
+            ++transcript_base;
+        }
+        size_t count = 0;
+        while (transcript_base + count < ctx->shard_end && ctx->transcripts[transcript_base + count].start < end) {
+            ++count;
+        }
+        TranscriptInfo *local = (TranscriptInfo *)xmalloc((count ? count : 1) * sizeof(TranscriptInfo));
+        TranscriptInfo *owned = (TranscriptInfo *)xmalloc((count ? count : 1) * sizeof(TranscriptInfo));
+        for (size_t k = 0; k < count; ++k) {
+            const TranscriptInfo *t = &ctx->transcripts[transcript_base + k];
+            size_t from = t->start > begin ? t->start : begin;
+            size_t to = t->start + t->length < end ? t->start + t->length : end;
+            local[k] = *t;
+            local[k].start = from - begin;
+            local[k].length = to - from;
+        }
+        slice.transcripts = local;
+        slice.transcript_count = count;
+        slice.shard_end = count;
+        prepare_loaded_reference(&slice, max_len);
+        if (seed_len > 0 && prepare_seed_index(&slice, seed_len) != 0) {
+            fprintf(stderr, "Error: unable to index reference slice %zu\n", slices);
+            exit(EXIT_FAILURE);
+        }
+
+        for (int group = 0; group < n_guides;) {
+            int len = sorted[group].length;
+            int group_end = group;
+            while (group_end < n_guides && sorted[group_end].length == len) {
+                ++group_end;
+            }
+            size_t n = (size_t)(group_end - group);
+            for (size_t k = 0; k < count; ++k) {
+                const TranscriptInfo *t = &ctx->transcripts[transcript_base + k];
+                size_t to = owned_end + (size_t)len - 1;
+                if (t->start + t->length < to) {
+                    to = t->start + t->length;
+                }
+                owned[k] = local[k];
+                owned[k].length = to > begin + local[k].start ? to - (begin + local[k].start) : 0;
+            }
+            SearchContext scan = slice;
+            scan.selected = owned;
+            scan.selected_count = count;
+            GuideResult *part = partials + n;
+            memset(part, 0, n * sizeof(GuideResult));
+            run_search(&scan, sorted + group, (int)n, part, NULL);
+
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t h = 0; h < part[i].mm0_count; ++h) {
+                    part[i].mm0_transcripts[h] += transcript_base;
+                }
+                for (size_t d = 0; d < part[i].detail_count; ++d) {
+                    part[i].details[d] += (uint64_t)begin << DETAIL_MM_BITS;
+                }
+            }
+            if (slices == 0) {
+                memcpy(folded + group, part, n * sizeof(GuideResult));
+            } else {
+                memcpy(partials, folded + group, n * sizeof(GuideResult));
+                reduce_slices(partials, 2, n, 0, n, folded + group);
+            }
+            group = group_end;
+        }
+        free(owned);
+        free_search_context(&slice);
+
+        if (prefetching) {
+            pthread_join(prefetch, NULL);
+        } else if (owned_end < range_end) {
+            fill_slice(&fill);
+        }
+        release_slice_text(&streamed->layout, owned_end);
+        begin = owned_end;
+    }
+    if (ctx->counters) {
+        ctx->counters->reference_slices += slices;
+    }
+
+    for (int i = 0; i < n_guides; ++i) {
+        results[order[i] - guides] = folded[i];
+    }
+    free(partials);
+    free(folded);
+    free(sorted);
+    free(order);
+}
+
+#ifndef OFFTARGET_LIBRARY
+/* Lays out `reference_file` for a --memory-budget of `budget_bytes` instead of loading it. */
+static int open_streamed_reference(SearchContext *ctx, const char *reference_file, size_t budget_bytes) {
+    if (is_index_image(reference_file)) {
+        fprintf(stderr, "Error: --memory-budget streams a FASTA reference; index images are mapped whole\n");
+        return -1;
+    }
+    ctx->threads = parse_thread_override();
+    if (ctx->threads > 0) {
+        omp_set_num_threads(ctx->threads);
+    }
+    ctx->simd = select_simd_level();
+    StreamedReference *streamed = (StreamedReference *)xmalloc(sizeof(StreamedReference));
+    memset(streamed, 0, sizeof(*streamed));
+    string_pool_init(&ctx->names);
+    streamed->total_length = layout_reference(reference_file, &ctx->names, &streamed->layout,
+                                              &ctx->transcripts, &ctx->transcript_count);
+    streamed->budget_bytes = budget_bytes;
+    ctx->streamed = streamed;
+    if (!streamed->layout.text.mapping) {
+        fprintf(stderr, "Error: --memory-budget needs an uncompressed FASTA file it can map ('%s' is "
+                "compressed or not a regular file)\n", reference_file);
+        return -1;
+    }
+    ctx->reference.length = streamed->total_length;
+    ctx->shard_begin = 0;
+    ctx->shard_end = ctx->transcript_count;
+    for (size_t t = 0; t < ctx->transcript_count; ++t) {
+        if (ctx->transcripts[t].gene >= ctx->gene_count) {
+            ctx->gene_count = (size_t)ctx->transcripts[t].gene + 1;
+        }
+    }
+    return 0;
+}
+#endif /* !OFFTARGET_LIBRARY */
+
+/*
+ * Builds the seed index for serve and library callers, whose guides are
+ * not known up front: seeds are sized for guides of `window_len` bases.
+ */
+int prepare_seed_index_for_window(SearchContext *ctx, int window_len) {
+    int seed_len = window_len / (ctx->options.max_mismatches + 1);
+    if (seed_len > MAX_KMER_LEN) {
+        seed_len = MAX_KMER_LEN;
+    }
+    if (seed_len == 0) {
+        fprintf(stderr, "Warning: %d-base guides are too short to split into %d seeds; "
+                "using the packed engine\n", window_len, ctx->options.max_mismatches + 1);
+        return 0;
+    }
+    return prepare_seed_index(ctx, seed_len);
+}
+
+/* Library API (offtarget.h). */
+struct ot_reference {
+    SearchContext ctx;
+};
+
+_Static_assert(OT_MAX_MISMATCHES == MAX_MISMATCHES, "offtarget.h must match the engine");
+_Static_assert(OT_MAX_GUIDE_LENGTH == MAX_GUIDE_LEN, "offtarget.h must match the engine");
+
+OT_EXPORT int ot_api_version(void) {
+    return OT_API_VERSION;
+}
+
+OT_EXPORT void ot_options_init(ot_options *options) {
+    memset(options, 0, sizeof(*options));
+    options->engine = OT_ENGINE_PACKED;
+    options->max_mismatches = MAX_MISMATCHES;
+    options->window_length = DEFAULT_INDEX_WINDOW;
+    for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
+        options->max_hits[mm] = OT_NO_CAP;
+    }
+}
+
+OT_EXPORT ot_reference *ot_reference_open(const char *path, const ot_options *options) {
+    ot_options defaults;
+    if (!options) {
+        ot_options_init(&defaults);
+        options = &defaults;
+    }
+    if (options->engine < OT_ENGINE_PACKED || options->engine > OT_ENGINE_GPU ||
+        options->max_mismatches < 0 || options->max_mismatches > MAX_MISMATCHES ||
+        options->window_length < 1 || options->window_length > MAX_GUIDE_LEN) {
+        fprintf(stderr, "Error: invalid ot_options\n");
+        return NULL;
+    }
+    if (access(path, R_OK) != 0) {
+        fprintf(stderr, "Error: unable to open reference file '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    ot_reference *ref = (ot_reference *)xmalloc(sizeof(ot_reference));
+    memset(ref, 0, sizeof(*ref));
+    SearchContext *ctx = &ref->ctx;
+    search_options_init(&ctx->options);
+    ctx->options.engine = (SearchEngine)options->engine;
+#ifndef OFFTARGET_GPU
+    if (ctx->options.engine == ENGINE_GPU) {
+        fprintf(stderr, "Warning: this build has no GPU backend (experimental; 'make GPU=cuda' or "
+                "'make GPU=hip'); using the packed engine\n");
+        ctx->options.engine = ENGINE_PACKED;
+    }
+#endif
+    ctx->options.max_mismatches = options->max_mismatches;
+    for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
+        ctx->options.caps.max[mm] = options->max_hits[mm];
+        if (options->max_hits[mm] != OT_NO_CAP) {
+            ctx->options.caps.active = true;
+        }
+    }
+    if (validate_search_options(&ctx->options) != 0 ||
+        load_search_context(ctx, path, options->window_length) != 0) {
+        free(ref);
+        return NULL;
+    }
+    if (options->threads > 0) {
+        ctx->threads = options->threads;
+    }
+    if (ctx->options.engine == ENGINE_INDEX && prepare_seed_index_for_window(ctx, options->window_length) != 0) {
+        ot_reference_close(ref);
+        return NULL;
+    }
+    return ref;
+}
+
+OT_EXPORT void ot_reference_close(ot_reference *ref) {
+    if (!ref) {
+        return;
+    }
+    free_search_context(&ref->ctx);
+    free(ref);
+}
+
+OT_EXPORT size_t ot_reference_transcript_count(const ot_reference *ref) {
+    return ref->ctx.transcript_count;
+}
+
+OT_EXPORT const char *ot_reference_transcript_id(const ot_reference *ref, size_t index) {
+    return index < ref->ctx.transcript_count ? ref->ctx.transcripts[index].transcript_id : NULL;
+}
+
+OT_EXPORT const char *ot_reference_gene_symbol(const ot_reference *ref, size_t index) {
+    if (index >= ref->ctx.transcript_count) {
+        return NULL;
+    }
+    const char *gene = ref->ctx.transcripts[index].gene_symbol;
+    return gene ? gene : "Unknown";
+}
+
+OT_EXPORT int ot_reference_locate(const ot_reference *ref, uint64_t position, size_t *transcript, uint64_t *offset) {
+    const SearchContext *ctx = &ref->ctx;
+    size_t length = ctx->options.engine == ENGINE_BYTE ? ctx->reference.length : ctx->packed.length;
+    if (ctx->transcript_count == 0 || position >= length) {
+        return -1;
+    }
+    size_t t_idx = find_transcript(ctx->transcripts, ctx->transcript_count, (size_t)position);
+    *transcript = t_idx;
+    *offset = position - ctx->transcripts[t_idx].start;
+    return 0;
+}
+
+/* Searches `guides` for ot_search and ot_search_windows, filling the caller's arrays. */
+static void search_library_guides(const SearchContext *ctx, const Guide *guides, size_t n_guides,
+                                  uint64_t *counts, ot_hits *hits,
+                                  int32_t *disqualified_mm, uint64_t *disqualified_pos) {
+    GuideResult *results = (GuideResult *)xmalloc((n_guides ? n_guides : 1) * sizeof(GuideResult));
+    memset(results, 0, (n_guides ? n_guides : 1) * sizeof(GuideResult));
+    if (n_guides > 0) {
+        if (ctx->threads > 0) {
+            omp_set_num_threads(ctx->threads);
+        }
+        run_search(ctx, guides, (int)n_guides, results, NULL);
+    }
+
+    size_t total_hits = 0;
+    for (size_t i = 0; i < n_guides; ++i) {
+        const GuideResult *res = &results[i];
+        for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
+            counts[i * (MAX_MISMATCHES + 1) + (size_t)mm] = mm <= ctx->options.max_mismatches ? res->counts[mm] : 0;
+        }
+        if (disqualified_mm) {
+            disqualified_mm[i] = res->disqualified ? res->disqualified_mm : -1;
+        }
+        if (disqualified_pos) {
+            disqualified_pos[i] = res->disqualified ? (uint64_t)res->disqualified_pos : 0;
+        }
+        total_hits += res->mm0_count;
+    }
+
+    if (hits) {
+        hits->offsets = (uint64_t *)xmalloc((n_guides + 1) * sizeof(uint64_t));
+        hits->transcripts = (uint64_t *)xmalloc((total_hits ? total_hits : 1) * sizeof(uint64_t));
+        size_t next = 0;
+        for (size_t i = 0; i < n_guides; ++i) {
+            hits->offsets[i] = next;
+            for (size_t h = 0; h < results[i].mm0_count; ++h) {
+                hits->transcripts[next++] = results[i].mm0_transcripts[h];
+            }
+        }
+        hits->offsets[n_guides] = next;
+    }
+
+    free_results(results, n_guides);
+}
+
+OT_EXPORT int ot_search(const ot_reference *ref,
+                        const char *sequences, size_t stride, const int32_t *lengths, size_t n_guides,
+                        uint64_t *counts, ot_hits *hits,
+                        int32_t *disqualified_mm, uint64_t *disqualified_pos) {
+    if (hits) {
+        hits->offsets = NULL;
+        hits->transcripts = NULL;
+    }
+    if (n_guides > INT_MAX) {
+        fprintf(stderr, "Error: too many guides in one search (%zu)\n", n_guides);
+        return -1;
+    }
+
+    Guide *guides = (Guide *)xmalloc((n_guides ? n_guides : 1) * sizeof(Guide));
+    for (size_t i = 0; i < n_guides; ++i) {
+        int len = lengths[i];
+        if (len <= 0 || len > MAX_GUIDE_LEN || (size_t)len > stride) {
+            fprintf(stderr, "Error: guide %zu has unsupported length %d (1-%d)\n", i, len, MAX_GUIDE_LEN);
+            free(guides);
+            return -1;
+        }
+        const char *src = sequences + i * stride;
+        guides[i].gene = 0;
+        for (int k = 0; k < len; ++k) {
+            guides[i].sequence[k] = normalize_base(src[k]);
+        }
+        guides[i].sequence[len] = '\0';
+        guides[i].length = len;
+    }
+
+    search_library_guides(&ref->ctx, guides, n_guides, counts, hits, disqualified_mm, disqualified_pos);
+    free(guides);
+    return 0;
+}
+
+OT_EXPORT int ot_index_build(const char *reference_path, const char *index_path, int window_length, int kmer_length) {
+    if (window_length < 1 || window_length > MAX_GUIDE_LEN || kmer_length < 0 || kmer_length > MAX_KMER_LEN) {
+        fprintf(stderr, "Error: invalid index window (%d) or k-mer length (%d)\n", window_length, kmer_length);
+        return -1;
+    }
+    if (access(reference_path, R_OK) != 0) {
+        fprintf(stderr, "Error: unable to open reference file '%s': %s\n", reference_path, strerror(errno));
+        return -1;
+    }
+    return build_index_image(reference_path, index_path, window_length, kmer_length);
+}
+
+OT_EXPORT void ot_hits_free(ot_hits *hits) {
+    if (!hits) {
+        return;
+    }
+    free(hits->offsets);
+    free(hits->transcripts);
+    hits->offsets = NULL;
+    hits->transcripts = NULL;
+}
+
+/*
+ * A guide table keeps the records in the reference loader's layout (bases
+ * normalised to ACGTN) and each window's start in it, so encodings,
+ * sequences and searches read the bases in place.
+ */
+struct ot_guides {
+    Buffer sequence;
+    TranscriptInfo *records;
+    size_t record_count;
+    StringPool names;
+    uint64_t *record_windows;       /* record_count + 1 offsets into `windows` */
+    size_t *windows;                /* start of each window (5' context included) */
+    size_t window_count;
+    uint8_t *skipped;
+    int guide_length;
+    int context_5p;
+    int context_3p;
+};
+
+OT_EXPORT ot_guides *ot_guides_open(const char *fasta_path, int guide_length, int context_5p, int context_3p) {
+    if (guide_length < 1 || guide_length > MAX_GUIDE_LEN || context_5p < 0 || context_5p > MAX_GUIDE_LEN
+        || context_3p < 0 || context_3p > MAX_GUIDE_LEN) {
+        fprintf(stderr, "Error: invalid guide length (%d) or context (%d, %d)\n", guide_length, context_5p, context_3p);
+        return NULL;
+    }
+    if (access(fasta_path, R_OK) != 0) {
+        fprintf(stderr, "Error: unable to open target file '%s': %s\n", fasta_path, strerror(errno));
+        return NULL;
+    }
+
+    ot_guides *table = (ot_guides *)xmalloc(sizeof(ot_guides));
+    memset(table, 0, sizeof(*table));
+    table->guide_length = guide_length;
+    table->context_5p = context_5p;
+    table->context_3p = context_3p;
+    string_pool_init(&table->names);
+    table->sequence = load_reference_sequence(fasta_path, &table->names, true, select_simd_level(),
+                                              &table->records, &table->record_count);
+
+    size_t window_len = (size_t)(context_5p + guide_length + context_3p);
+    table->record_windows = (uint64_t *)xmalloc((table->record_count + 1) * sizeof(uint64_t));
+    table->skipped = (uint8_t *)xmalloc(table->record_count + 1);
+    table->record_windows[0] = 0;
+    for (size_t r = 0; r < table->record_count; ++r) {
+        const TranscriptInfo *record = &table->records[r];
+        size_t windows = 0;
+        table->skipped[r] = 0;
+        if (record->length >= window_len) {
+            /* Targets cover [context_5p, length - context_3p) of the record. */
+            const char *targets = table->sequence.data + record->start + context_5p;
+            if (memchr(targets, 'N', record->length - (size_t)context_5p - (size_t)context_3p)) {
+                table->skipped[r] = 1;
+            } else {
+                windows = record->length - window_len + 1;
+            }
+        }
+        table->record_windows[r + 1] = table->record_windows[r] + windows;
+    }
+    table->window_count = (size_t)table->record_windows[table->record_count];
+    table->windows = (size_t *)xmalloc((table->window_count ? table->window_count : 1) * sizeof(size_t));
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t r = 0; r < table->record_count; ++r) {
+        for (uint64_t w = table->record_windows[r]; w < table->record_windows[r + 1]; ++w) {
+            table->windows[w] = table->records[r].start + (size_t)(w - table->record_windows[r]);
+        }
+    }
+    return table;
+}
+
+OT_EXPORT void ot_guides_close(ot_guides *guides) {
+    if (!guides) {
+        return;
+    }
+    free(guides->sequence.data);
+    free(guides->records);
+    string_pool_free(&guides->names);
+    free(guides->record_windows);
+    free(guides->windows);
+    free(guides->skipped);
+    free(guides);
+}
+
+OT_EXPORT size_t ot_guides_count(const ot_guides *guides) {
+    return guides->window_count;
+}
+
+OT_EXPORT size_t ot_guides_record_count(const ot_guides *guides) {
+    return guides->record_count;
+}
+
+OT_EXPORT const char *ot_guides_record_id(const ot_guides *guides, size_t record) {
+    return record < guides->record_count ? guides->records[record].transcript_id : NULL;
+}
+
+OT_EXPORT const uint64_t *ot_guides_record_offsets(const ot_guides *guides) {
+    return guides->record_windows;
+}
+
+OT_EXPORT int ot_guides_record_skipped(const ot_guides *guides, size_t record) {
+    return record < guides->record_count ? guides->skipped[record] : 0;
+}
+
+static inline int base_token(char base) {
+    switch (base) {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return -1;
+    }
+}
+
+OT_EXPORT int ot_guides_encode(const ot_guides *guides, size_t first, size_t count, float *inputs) {
+    if (first > guides->window_count || count > guides->window_count - first) {
+        fprintf(stderr, "Error: windows %zu..%zu are outside the guide table (%zu)\n",
+                first, first + count, guides->window_count);
+        return -1;
+    }
+    size_t window_len = (size_t)(guides->context_5p + guides->guide_length + guides->context_3p);
+    size_t row = 2 * window_len * 4;
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < count; ++i) {
+        const char *window = guides->sequence.data + guides->windows[first + i];
+        float *target = inputs + i * row;
+        float *guide = target + window_len * 4;
+        memset(target, 0, row * sizeof(float));
+        for (size_t k = 0; k < window_len; ++k) {
+            int token = base_token(window[k]);
+            if (token >= 0) {
+                target[k * 4 + (size_t)token] = 1.0f;
+            }
+        }
+        for (int k = guides->context_5p; k < guides->context_5p + guides->guide_length; ++k) {
+            guide[(size_t)k * 4 + (size_t)(3 - base_token(window[k]))] = 1.0f;
+        }
+    }
+    return 0;
+}
+
+OT_EXPORT int ot_guides_sequences(const ot_guides *guides, size_t first, size_t count,
+                                  char *targets, char *spacers, size_t stride) {
+    static const char complement[4] = {'T', 'G', 'C', 'A'};
+    size_t length = (size_t)guides->guide_length;
+    if (first > guides->window_count || count > guides->window_count - first || stride < length) {
+        fprintf(stderr, "Error: windows %zu..%zu are outside the guide table (%zu) or stride %zu < %zu\n",
+                first, first + count, guides->window_count, stride, length);
+        return -1;
+    }
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < count; ++i) {
+        const char *target = guides->sequence.data + guides->windows[first + i] + guides->context_5p;
+        if (targets) {
+            memcpy(targets + i * stride, target, length);
+            memset(targets + i * stride + length, 0, stride - length);
+        }
+        if (spacers) {
+            char *spacer = spacers + i * stride;
+            for (size_t k = 0; k < length; ++k) {
+                spacer[k] = complement[base_token(target[length - 1 - k])];
+            }
+            memset(spacer + length, 0, stride - length);
+        }
+    }
+    return 0;
+}
+
+OT_EXPORT int ot_search_windows(const ot_reference *ref, const ot_guides *guides, const uint64_t *windows,
+                                size_t n_windows, uint64_t *counts, ot_hits *hits,
+                                int32_t *disqualified_mm, uint64_t *disqualified_pos) {
+    if (hits) {
+        hits->offsets = NULL;
+        hits->transcripts = NULL;
+    }
+    if (n_windows > INT_MAX) {
+        fprintf(stderr, "Error: too many guides in one search (%zu)\n", n_windows);
+        return -1;
+    }
+    for (size_t i = 0; i < n_windows; ++i) {
+        if (windows[i] >= guides->window_count) {
+            fprintf(stderr, "Error: window %llu is outside the guide table (%zu)\n",
+                    (unsigned long long)windows[i], guides->window_count);
+            return -1;
+        }
+    }
+
+    Guide *batch = (Guide *)xmalloc((n_windows ? n_windows : 1) * sizeof(Guide));
+    for (size_t i = 0; i < n_windows; ++i) {
+        const char *target = guides->sequence.data + guides->windows[windows[i]] + guides->context_5p;
+        memcpy(batch[i].sequence, target, (size_t)guides->guide_length);
+        batch[i].sequence[guides->guide_length] = '\0';
+        batch[i].length = guides->guide_length;
+        batch[i].gene = 0;
+    }
+    search_library_guides(&ref->ctx, batch, n_windows, counts, hits, disqualified_mm, disqualified_pos);
+    free(batch);
+    return 0;
+}
+
+#ifndef OFFTARGET_LIBRARY
+
+#define DEFAULT_CHECKPOINT_GROUP 4096   /* guides per --checkpoint group */
+
+void print_usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options] <guides.csv|-> <reference.fasta|reference.otidx> <output.csv>\n"
+            "       %s serve [options] [--window-length N] [--socket PATH] [--max-request-bytes SIZE]\n"
+            "             <reference>\n"
+            "       %s index build [--window-length N] [--kmer K] <reference.fasta> <reference.otidx>\n"
+            "       %s merge [--hits-out PATH] [--output-format F] <reference> <output> <partial>...\n"
+            "       %s screen [options] [--candidates PATH|-] [--generate N] [--output PATH] <reference>\n"
+            "\n"
+            "  --engine packed       2-bit packed reference, bit-parallel mismatch counting (default)\n"
+            "  --engine byte         one byte per base, per-position SIMD compare\n"
+            "  --engine index        pigeonhole seed lookup in a k-mer index, then verify\n"
+            "  --engine gpu          experimental: packed scan on a CUDA/HIP device (builds with\n"
+            "                        make GPU=cuda|hip; TIGER_OFFTARGET_GPU_DEVICE picks the\n"
+            "                        device, default 0); other builds, and devices that fail to\n"
+            "                        open, warn and use --engine packed\n"
+            "  --max-mismatches K    report MM0..MMK (0-%d, default %d); higher columns are left empty\n"
+            "                        and scans stop counting a window once it is past K\n"
+            "  --guide-length N      require every guide to be N bases (1-%d); the reference is\n"
+            "                        prepared for N and kernels specialised for it\n"
+            "  --position-weights W1,W2,...\n"
+            "                        add Mismatch_Positions (per guide position, windows with\n"
+            "                        1..K mismatches that mismatch there) and OffTarget_Score\n"
+            "                        (sum over those windows of the product of the weights of\n"
+            "                        their mismatched positions; unlisted positions weigh 1;\n"
+            "                        printed with 17 significant digits so it round-trips)\n"
+            "  --collapse-isoforms   scan each window shared by several transcripts of a gene once\n"
+            "                        and expand its hits to every copy (same results; guides of\n"
+            "                        the prepared length, not with --max-mmK or --position-weights)\n"
+            "  --max-mmK N           retire a guide once it has more than N hits with K mismatches\n"
+            "                        (packed and index engines; adds a Status column)\n"
+            "  --hits-out PATH       also write every hit with at most --hits-max-mm mismatches\n"
+            "                        (default 0) as Guide,Gene,Sequence,Transcript_Index,\n"
+            "                        Transcript,Transcript_Gene,Offset,Mismatches rows\n"
+            "  --reference-shard I/N search only windows in the I-th of N transcript-aligned\n"
+            "                        slices of the reference (0-based; not with --max-mmK)\n"
+            "  --guide-shard I/N     search only the I-th of N slices of the guide rows\n"
+            "  --partial             write a binary partial for 'merge' instead of a CSV;\n"
+            "                        --hits-max-mm then records hit details in it\n"
+            "  --output-format csv|columnar\n"
+            "                        columnar writes fixed-width columns plus a string heap\n"
+            "                        (see ColumnarHeader in search.c) for mmap readers\n"
+            "  --cache-dir DIR       reuse results of sequences searched before against the same\n"
+            "                        reference and options (DIR/<key>.otcache, created on demand)\n"
+            "  --cache-from OLD      also carry over results cached in DIR against OLD, an earlier\n"
+            "                        release of the reference: only transcripts added, removed or\n"
+            "                        changed (by ID and sequence) are scanned to update them\n"
+            "  --window-length N     guides file '-': guide length the reference is prepared\n"
+            "                        for before any guide arrives (default %d)\n"
+            "  --memory-budget SIZE  never load the whole reference: scan it in slices that fit\n"
+            "                        in about SIZE (e.g. 32G; default unit M), overlapping by\n"
+            "                        guide length - 1, reading the next slice while the current\n"
+            "                        one is searched; same results, for uncompressed FASTA\n"
+            "                        references larger than RAM (not with --max-mmK,\n"
+            "                        --collapse-isoforms, --cache-dir or --engine gpu)\n"
+            "  --checkpoint PATH     search the guides in groups and append each finished group to\n"
+            "                        PATH; rerunning the same command after an interruption\n"
+            "                        skips the groups already there (guides file only, not with\n"
+            "                        --position-weights; delete PATH once the results are kept)\n"
+            "  --checkpoint-group N  guides per checkpointed group (default %d)\n"
+            "  --stats PATH          write per-phase wall/CPU seconds, work counters (windows,\n"
+            "                        seed candidates, --memory-budget slices, batches of '-'\n"
+            "                        guides), hits per mismatch level, per-thread busy time\n"
+            "                        and peak RSS as JSON\n"
+            "                        ('-' prints it as one line on stderr)\n"
+            "\n"
+            "The reference may be a FASTA file or an index image written by 'index build';\n"
+            "images are memory-mapped read-only instead of being re-parsed.  '--kmer K'\n"
+            "stores a K-mer seed index in the image for '--engine index'; it is used when\n"
+            "K <= guide length / (max mismatches + 1), otherwise one is built in memory.\n"
+            "\n"
+            "'serve' loads the reference once and answers framed requests on stdin/stdout,\n"
+            "or on a Unix socket with one thread per connection:\n"
+            "  SEARCH <bytes>\\n<guides csv>  ->  OK <bytes> <milliseconds>\\n<results csv>\n"
+            "  PING -> PONG, QUIT closes the stream; failures answer ERR <message>.\n"
+            "A SEARCH over --max-request-bytes (default 1G; K/M/G suffixes, default unit M)\n"
+            "answers 'ERR request too large' and closes the stream.\n"
+            "\n"
+            "'merge' reduces the partials of every guide x reference shard of one screen\n"
+            "into the results.csv (and --hits-out table) an unsharded run would write.\n"
+            "\n"
+            "A guides file of '-' reads Gene,Sequence rows from stdin as they are written\n"
+            "and searches them in batches while more arrive; rows are written in input\n"
+            "order and flushed after each batch.\n"
+            "\n"
+            "'screen' writes the candidates with no window within --max-mismatches (default 2\n"
+            "there) anywhere in the reference, one per line, rejecting each at its first hit\n"
+            "(--engine index, the default there, or packed).  Candidates are --guide-length\n"
+            "(default %d) bases, read from --candidates (first field per line, default stdin)\n"
+            "or, with --generate N, drawn from --seed S (default 42) until N distinct ones\n"
+            "survive: --gc-min/--gc-max percent (40/60), --max-homopolymer (3) and\n"
+            "--max-dinucleotide (3) bound them; --limit caps the candidates screened\n"
+            "(default 100 x N when generating).\n",
+            prog, prog, prog, prog, prog, MAX_MISMATCHES, MAX_MISMATCHES, MAX_GUIDE_LEN, DEFAULT_INDEX_WINDOW,
+            DEFAULT_CHECKPOINT_GROUP, DEFAULT_INDEX_WINDOW);
+}
+
+/* A SIZE option: bytes, or with a K, M (the default) or G suffix; at least `min_kib` K. */
+int parse_size_option(const char *name, const char *value, size_t min_kib, size_t *out) {
+    char *endptr = NULL;
+    unsigned long long parsed = strtoull(value, &endptr, 10);
+    int shift = 20;
+    if (endptr != value && *endptr && !endptr[1]) {
+        switch (*endptr) {
+            case 'K': case 'k': shift = 10; ++endptr; break;
+            case 'M': case 'm': shift = 20; ++endptr; break;
+            case 'G': case 'g': shift = 30; ++endptr; break;
+            default: break;
+        }
+    }
+    if (endptr == value || *endptr || value[0] == '-' || parsed > (SIZE_MAX >> shift)
+        || ((size_t)parsed << shift) < (min_kib << 10)) {
+        fprintf(stderr, "Error: %s expects a size of at least %zuK (e.g. 512M, 32G; default unit M)\n",
+                name, min_kib);
+        return -1;
+    }
+    *out = (size_t)parsed << shift;
+    return 0;
+}
+
+int parse_int_option(const char *name, const char *value, int min, int max, int *out) {
+    char *endptr = NULL;
+    long parsed = strtol(value, &endptr, 10);
+    if (endptr == value || *endptr || parsed < min || parsed > max) {
+        fprintf(stderr, "Error: %s must be between %d and %d\n", name, min, max);
+        return -1;
+    }
+    *out = (int)parsed;
+    return 0;
+}
+
+static int index_main(int argc, char *argv[], const char *prog) {
+    if (argc < 2 || strcmp(argv[1], "build") != 0) {
+        print_usage(prog);
+        return EXIT_FAILURE;
+    }
+
+    int window_len = DEFAULT_INDEX_WINDOW;
+    int kmer_len = 0;
+    static const struct option long_options[] = {
+        {"window-length", required_argument, NULL, 'w'},
+        {"kmer", required_argument, NULL, 'k'},
+        {NULL, 0, NULL, 0}
+    };
+
+    optind = 2;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'w':
+                if (parse_int_option("--window-length", optarg, 1, MAX_GUIDE_LEN, &window_len) != 0) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'k':
+                if (parse_int_option("--kmer", optarg, 1, MAX_KMER_LEN, &kmer_len) != 0) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                print_usage(prog);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind < 2) {
+        print_usage(prog);
+        return EXIT_FAILURE;
+    }
+    return build_index_image(argv[optind], argv[optind + 1], window_len, kmer_len) == 0
+        ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int parse_engine(const char *name, SearchEngine *engine_out) {
+    if (strcmp(name, "packed") == 0) {
+        *engine_out = ENGINE_PACKED;
+        return 0;
+    }
+    if (strcmp(name, "byte") == 0) {
+        *engine_out = ENGINE_BYTE;
+        return 0;
+    }
+    if (strcmp(name, "index") == 0) {
+        *engine_out = ENGINE_INDEX;
+        return 0;
+    }
+    if (strcmp(name, "gpu") == 0) {
+#ifdef OFFTARGET_GPU
+        *engine_out = ENGINE_GPU;
+#else
+        fprintf(stderr, "Warning: this build has no GPU backend (experimental; 'make GPU=cuda' or "
+                "'make GPU=hip'); using the packed engine\n");
+        *engine_out = ENGINE_PACKED;
+#endif
+        return 0;
+    }
+    fprintf(stderr, "Error: unknown engine '%s' (expected 'packed', 'byte', 'index' or 'gpu')\n", name);
+    return -1;
+}
+
+/*
+ * --position-weights W1,W2,...: the weight of a mismatch at each guide
+ * position, 5' first; positions past the list weigh 1.
+ */
+static int parse_position_weights(const char *arg, SearchOptions *options) {
+    const char *cursor = arg;
+    for (int k = 0; *cursor; ++k) {
+        char *end = NULL;
+        errno = 0;
+        double weight = strtod(cursor, &end);
+        if (k == MAX_GUIDE_LEN || end == cursor || errno != 0 || !isfinite(weight) || weight < 0.0
+            || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "Error: --position-weights expects up to %d non-negative numbers separated "
+                    "by commas, got '%s'\n", MAX_GUIDE_LEN, arg);
+            return -1;
+        }
+        options->position_weights[k] = weight;
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    options->mismatch_profile = true;
+    return 0;
+}
+
+/* Returns 1 if `opt` is a search option (parsed into `options`), 0 if not, -1 on error. */
+int parse_search_option(int opt, const char *arg, SearchOptions *options) {
+    if (opt == 'e') {
+        return parse_engine(arg, &options->engine) == 0 ? 1 : -1;
+    }
+    if (opt == 'm') {
+        return parse_int_option("--max-mismatches", arg, 0, MAX_MISMATCHES, &options->max_mismatches) == 0
+            ? 1 : -1;
+    }
+    if (opt == 'g') {
+        return parse_int_option("--guide-length", arg, 1, MAX_GUIDE_LEN, &options->guide_length) == 0 ? 1 : -1;
+    }
+    if (opt == 'W') {
+        return parse_position_weights(arg, options) == 0 ? 1 : -1;
+    }
+    if (opt == 'I') {
+        options->collapse_isoforms = true;
+        return 1;
+    }
+    if (opt >= OPT_MAX_MM && opt <= OPT_MAX_MM + MAX_MISMATCHES) {
+        char name[16];
+        int cap = 0;
+        snprintf(name, sizeof(name), "--max-mm%d", opt - OPT_MAX_MM);
+        if (parse_int_option(name, arg, 0, INT_MAX, &cap) != 0) {
+            return -1;
+        }
+        options->caps.max[opt - OPT_MAX_MM] = (uint64_t)cap;
+        options->caps.active = true;
+        return 1;
+    }
+    return 0;
+}
 
-        if (!current) {
+static void write_results_header(FILE *out, const SearchOptions *options) {
+    fprintf(out, "Gene,Sequence,MM0,MM1,MM2,MM3,MM4,MM5,MM0_Transcripts,MM0_Genes%s%s\n",
+            options->caps.active ? ",Status" : "",
+            options->mismatch_profile ? ",Mismatch_Positions,OffTarget_Score" : "");
+}
+
+/*
+ * MM0_Genes lists each gene once, in order of first hit.  Genes are
+ * deduplicated by index with `gene_stamp`, which holds the `stamp` (a
+ * distinct non-zero value per row) of the last row that listed each gene,
+ * so no per-row clearing is needed.
+ */
+static void write_result_row(FILE *out, const SearchContext *ctx, const StringPool *guide_genes,
+                             const Guide *guide, const GuideResult *res, uint32_t stamp, uint32_t *gene_stamp) {
+    const SearchOptions *options = &ctx->options;
+    const TranscriptInfo *transcripts = ctx->transcripts;
+    size_t transcript_count = ctx->transcript_count;
+
+    fprintf(out, "%s,%s", string_pool_get(guide_genes, guide->gene), guide->sequence);
+    for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
+        if (mm <= options->max_mismatches) {
+            fprintf(out, ",%llu", (unsigned long long)res->counts[mm]);
+        } else {
+            fputc(',', out);
+        }
+    }
+
+    fputc(',', out);
+    size_t printed = 0;
+    for (size_t idx = 0; idx < res->mm0_count; ++idx) {
+        size_t t_idx = res->mm0_transcripts[idx];
+        if (t_idx >= transcript_count) {
+            continue;
+        }
+        if (printed++ > 0) {
+            fputc('|', out);
+        }
+        fputs(transcripts[t_idx].transcript_id, out);
+    }
+
+    fputc(',', out);
+    printed = 0;
+    for (size_t idx = 0; idx < res->mm0_count; ++idx) {
+        size_t t_idx = res->mm0_transcripts[idx];
+        if (t_idx >= transcript_count || gene_stamp[transcripts[t_idx].gene] == stamp) {
             continue;
         }
+        gene_stamp[transcripts[t_idx].gene] = stamp;
+        if (printed++ > 0) {
+            fputc('|', out);
+        }
+        fputs(transcripts[t_idx].gene_symbol ? transcripts[t_idx].gene_symbol : "Unknown", out);
+    }
+
+    if (options->caps.active) {
+        fputc(',', out);
+        if (res->disqualified) {
+            size_t t_idx = find_transcript(transcripts, transcript_count, res->disqualified_pos);
+            fprintf(out, "disqualified at %s:%zu (MM%d > %llu)",
+                    transcripts[t_idx].transcript_id,
+                    res->disqualified_pos - transcripts[t_idx].start,
+                    res->disqualified_mm,
+                    (unsigned long long)options->caps.max[res->disqualified_mm]);
+        }
+    }
+
+    if (options->mismatch_profile) {
+        fputc(',', out);
+        for (int k = 0; k < res->profile_length; ++k) {
+            fprintf(out, k ? "|%llu" : "%llu", (unsigned long long)res->mismatch_positions[k]);
+        }
+        fprintf(out, ",%.17g", res->offtarget_score);     /* round-trips: scores rank guides */
+    }
+
+    fputc('\n', out);
+}
+
+void write_results(FILE *out, const SearchContext *ctx, const StringPool *guide_genes,
+                   const Guide *guides, int n_guides, const GuideResult *results) {
+    size_t genes = ctx->gene_count ? ctx->gene_count : 1;
+    uint32_t *gene_stamp = (uint32_t *)xmalloc(genes * sizeof(uint32_t));
+    memset(gene_stamp, 0, genes * sizeof(uint32_t));
+
+    write_results_header(out, &ctx->options);
+    for (int i = 0; i < n_guides; ++i) {
+        write_result_row(out, ctx, guide_genes, &guides[i], &results[i], (uint32_t)i + 1, gene_stamp);
+    }
+    free(gene_stamp);
+}
+
+/*
+ * --hits-out: one row per recorded window, guides in input order and hits in
+ * reference order.  Guide is the 0-based input row; Offset is 0-based within
+ * the transcript.
+ */
+#define HIT_DETAILS_HEADER "Guide,Gene,Sequence,Transcript_Index,Transcript,Transcript_Gene,Offset,Mismatches\n"
+
+static void write_hit_rows(FILE *out, const SearchContext *ctx, const StringPool *guide_genes,
+                           const Guide *guide, const GuideResult *res, size_t row) {
+    const TranscriptInfo *transcripts = ctx->transcripts;
+    size_t transcript_count = ctx->transcript_count;
+
+    for (size_t h = 0; h < res->detail_count; ++h) {
+        size_t pos = (size_t)(res->details[h] >> DETAIL_MM_BITS);
+        int mismatches = (int)(res->details[h] & ((1u << DETAIL_MM_BITS) - 1));
+        size_t t_idx = find_transcript(transcripts, transcript_count, pos);
+        fprintf(out, "%zu,%s,%s,%zu,%s,%s,%zu,%d\n",
+                row, string_pool_get(guide_genes, guide->gene), guide->sequence, t_idx,
+                transcripts[t_idx].transcript_id,
+                transcripts[t_idx].gene_symbol ? transcripts[t_idx].gene_symbol : "Unknown",
+                pos - transcripts[t_idx].start, mismatches);
+    }
+}
+
+static void result_stream_init(ResultStream *stream, size_t count) {
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->ready, NULL);
+    stream->done = (bool *)xmalloc((count ? count : 1) * sizeof(bool));
+    memset(stream->done, 0, (count ? count : 1) * sizeof(bool));
+    stream->count = count;
+}
+
+static void result_stream_free(ResultStream *stream) {
+    pthread_cond_destroy(&stream->ready);
+    pthread_mutex_destroy(&stream->lock);
+    free(stream->done);
+    stream->done = NULL;
+}
+
+/* Blocks until guide `next` is complete; returns the end of the completed run from it. */
+static size_t result_stream_wait(ResultStream *stream, size_t next) {
+    pthread_mutex_lock(&stream->lock);
+    while (!stream->done[next]) {
+        pthread_cond_wait(&stream->ready, &stream->lock);
+    }
+    size_t end = next;
+    while (end < stream->count && stream->done[end]) {
+        ++end;
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return end;
+}
+
+/*
+ * --output-format columnar: the results as fixed-width columns plus a
+ * string heap, readable in place with mmap
+ * (tiger_guides.offtarget.columnar).  A ColumnarHeader is followed by
+ * these sections, each starting at a multiple of INDEX_ALIGN bytes;
+ * integers are host-endian, like index images.
+ *
+ *   counts            uint64 [MAX_MISMATCHES + 1][guide_count], one column per
+ *                     level; levels above max_mismatches hold 0
+ *   disqualified_mm   int32 [guide_count], -1 unless a cap retired the guide
+ *   disqualified_pos  uint64 [guide_count], reference position of that window
+ *   guide_strings     uint64 [guide_count][2], heap offsets of Gene and Sequence
+ *   transcripts       ColumnarTranscript [transcript_count]
+ *   mm0_offsets       uint64 [guide_count + 1]; guide i hit transcripts
+ *                     mm0_transcripts[mm0_offsets[i] .. mm0_offsets[i + 1])
+ *   strings           NUL-terminated guide and transcript names
+ *   mm0_transcripts   uint64 [mm0_transcript_count], in reference order per guide
+ *
+ * Names are written before the search starts and the columns as guides
+ * finish; file_size stays 0 until the last guide is written, so readers
+ * can tell an interrupted file from a complete one.
+ */
+#define COLUMNAR_MAGIC "TGROTRES"
+#define COLUMNAR_VERSION 1
+
+typedef struct {
+    uint64_t start;
+    uint64_t length;
+    uint64_t id_offset;
+    uint64_t gene_offset;
+} ColumnarTranscript;
+
+static int parse_output_format(const char *name, OutputFormat *format_out) {
+    if (strcmp(name, "csv") == 0) {
+        *format_out = OUTPUT_CSV;
+        return 0;
+    }
+    if (strcmp(name, "columnar") == 0) {
+        *format_out = OUTPUT_COLUMNAR;
+        return 0;
+    }
+    fprintf(stderr, "Error: unknown output format '%s' (expected 'csv' or 'columnar')\n", name);
+    return -1;
+}
+
+/*
+ * --stats PATH: wall and CPU seconds per phase plus the work counters of
+ * the run, written as one JSON object ('-' prints it as a line on
+ * stderr).  Phases are laps: run_stats_lap ends the current phase and
+ * starts the named one, and a name seen before adds to its totals (the
+ * streamed mode alternates between waiting for guides and searching).
+ */
+static double cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void run_stats_init(RunStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->current = -1;
+    stats->start_wall = omp_get_wtime();
+    stats->start_cpu = cpu_seconds();
+}
+
+/* Starts counting the context's searches; call once the thread count is set. */
+void run_stats_attach(RunStats *stats, SearchContext *ctx) {
+    stats->counters.threads = omp_get_max_threads();
+    stats->counters.busy = (double *)xmalloc((size_t)stats->counters.threads * sizeof(double));
+    memset(stats->counters.busy, 0, (size_t)stats->counters.threads * sizeof(double));
+    ctx->counters = &stats->counters;
+}
+
+void run_stats_free(RunStats *stats) {
+    if (stats) {
+        free(stats->counters.busy);
+        stats->counters.busy = NULL;
+    }
+}
+
+/* Ends the current phase and starts `name` (NULL just ends it); NULL `stats` is a no-op. */
+void run_stats_lap(RunStats *stats, const char *name) {
+    if (!stats) {
+        return;
+    }
+    double wall = omp_get_wtime();
+    double cpu = cpu_seconds();
+    if (stats->current >= 0) {
+        stats->phases[stats->current].wall += wall - stats->lap_wall;
+        stats->phases[stats->current].cpu += cpu - stats->lap_cpu;
+    }
+    stats->current = -1;
+    if (!name) {
+        return;
+    }
+    for (int p = 0; p < stats->phase_count; ++p) {
+        if (strcmp(stats->phases[p].name, name) == 0) {
+            stats->current = p;
+        }
+    }
+    if (stats->current < 0 && stats->phase_count < STATS_MAX_PHASES) {
+        stats->current = stats->phase_count++;
+        stats->phases[stats->current].name = name;
+    }
+    stats->lap_wall = wall;
+    stats->lap_cpu = cpu;
+}
+
+/* Adds a finished batch's per-level hit totals and disqualifications. */
+void run_stats_count_results(RunStats *stats, const GuideResult *results, size_t count) {
+    if (!stats) {
+        return;
+    }
+    stats->rows += count;
+    for (size_t i = 0; i < count; ++i) {
+        for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
+            stats->hits[mm] += results[i].counts[mm];
+        }
+        stats->disqualified += results[i].disqualified;
+    }
+}
+
+/* Writes the stats of a finished run to `path` and frees them; NULL `stats` is a no-op. */
+int run_stats_finish(RunStats *stats, const SearchContext *ctx, const char *path) {
+    static const char *const engine_names[] = {"packed", "byte", "index", "gpu"};
+    if (!stats) {
+        return 0;
+    }
+    run_stats_lap(stats, NULL);
+
+    FILE *out = strcmp(path, "-") == 0 ? stderr : fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: unable to open stats file '%s': %s\n", path, strerror(errno));
+        run_stats_free(stats);
+        return -1;
+    }
+    const PackedReference *packed = &ctx->packed;
+    uint64_t packed_bytes = packed->lo ? (uint64_t)packed->words * 3 * sizeof(uint64_t) : 0;
+    uint64_t valid_bytes = packed->valid ? (uint64_t)packed->words * sizeof(uint64_t) : 0;
+    uint64_t kmer_bytes = ctx->kmers.k
+        ? (((uint64_t)1 << (2 * ctx->kmers.k)) + 1 + ctx->kmers.position_count) * sizeof(uint32_t) : 0;
+    size_t bases = packed->lo ? packed->length : ctx->reference.length;
+    size_t byte_bytes = ctx->reference.data ? ctx->reference.length : 0;
+
+    double busy_max = 0.0;
+    double busy_total = 0.0;
+    for (int t = 0; t < stats->counters.threads; ++t) {
+        busy_total += stats->counters.busy[t];
+        if (stats->counters.busy[t] > busy_max) {
+            busy_max = stats->counters.busy[t];
+        }
+    }
+    double busy_mean = stats->counters.threads ? busy_total / stats->counters.threads : 0.0;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(out, "{\"version\":1,\"engine\":\"%s\",\"simd\":\"%s\",\"threads\":%d,\"max_mismatches\":%d,"
+            "\"numa\":\"%s\",\"numa_nodes\":%d,",
+            engine_names[ctx->options.engine], simd_level_names[ctx->simd], stats->counters.threads,
+            ctx->options.max_mismatches, numa_mode_names[ctx->numa.mode], ctx->numa.mode ? ctx->numa.node_count : 1);
+    fprintf(out, "\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f,\"phases\":{",
+            omp_get_wtime() - stats->start_wall, cpu_seconds() - stats->start_cpu);
+    for (int p = 0; p < stats->phase_count; ++p) {
+        fprintf(out, "%s\"%s\":{\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f}", p ? "," : "",
+                stats->phases[p].name, stats->phases[p].wall, stats->phases[p].cpu);
+    }
+    fprintf(out, "},\"reference\":{\"transcripts\":%zu,\"searched_transcripts\":%zu,\"bases\":%zu,"
+            "\"from_index\":%s,\"packed_bytes\":%llu,\"valid_bytes\":%llu,\"byte_bytes\":%zu,\"kmer_bytes\":%llu},",
+            ctx->transcript_count, ctx->shard_end - ctx->shard_begin, bases, ctx->from_index ? "true" : "false",
+            (unsigned long long)packed_bytes, (unsigned long long)valid_bytes, byte_bytes,
+            (unsigned long long)kmer_bytes);
+    fprintf(out, "\"guides\":{\"rows\":%llu,\"searched\":%llu,\"cached\":%llu,\"updated\":%llu,"
+            "\"repeated\":%llu,\"checkpointed\":%llu,\"disqualified\":%llu},",
+            (unsigned long long)stats->rows, (unsigned long long)stats->searched,
+            (unsigned long long)stats->cached, (unsigned long long)stats->updated,
+            (unsigned long long)stats->repeated, (unsigned long long)stats->checkpointed,
+            (unsigned long long)stats->disqualified);
+    fprintf(out, "\"work\":{\"guides\":%llu,\"windows\":%llu,\"seed_candidates\":%llu,\"reference_slices\":%llu,"
+            "\"guide_batches\":%llu},\"hits\":[",
+            (unsigned long long)stats->counters.guides, (unsigned long long)stats->counters.windows, (unsigned long long)stats->counters.seed_candidates,
+            (unsigned long long)stats->counters.reference_slices,
+            (unsigned long long)stats->counters.guide_batches);
+    for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
+        if (mm <= ctx->options.max_mismatches) {
+            fprintf(out, "%s%llu", mm ? "," : "", (unsigned long long)stats->hits[mm]);
+        } else {
+            fprintf(out, "%snull", mm ? "," : "");
+        }
+    }
+    fprintf(out, "],\"thread_busy_seconds\":[");
+    for (int t = 0; t < stats->counters.threads; ++t) {
+        fprintf(out, "%s%.6f", t ? "," : "", stats->counters.busy[t]);
+    }
+    fprintf(out, "],\"load_imbalance\":%.4f,\"peak_rss_kb\":%ld}\n",
+            busy_mean > 0.0 ? busy_max / busy_mean : 1.0, usage.ru_maxrss);
+    run_stats_free(stats);
+
+    if (out == stderr) {
+        return 0;
+    }
+    int failed = ferror(out);
+    if (fclose(out) != 0 || failed) {
+        fprintf(stderr, "Error: failed to write stats file '%s'\n", path);
+        return -1;
+    }
+    return 0;
+}
 
-        for (ssize_t i = 0; i < linelen; ++i) {
-            char c = line[i];
-            if (c == '\n' || c == '\r') {
+static uint64_t heap_add(Buffer *heap, const char *s) {
+    size_t len = strlen(s) + 1;
+    uint64_t offset = heap->length;
+    buffer_reserve(heap, len);
+    memcpy(heap->data + heap->length, s, len);
+    heap->length += len;
+    return offset;
+}
+
+bool pwrite_all(int fd, const void *data, size_t size, uint64_t offset) {
+    const char *bytes = (const char *)data;
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, (off_t)offset);
+        if (written <= 0) {
+            if (written < 0 && errno == EINTR) {
                 continue;
             }
-            buffer_append_char(&buffer, normalize_base(c));
+            return false;
+        }
+        bytes += written;
+        size -= (size_t)written;
+        offset += (uint64_t)written;
+    }
+    return true;
+}
+
+static uint64_t *sink_scratch(ResultSink *sink, size_t count) {
+    if (sink->scratch_capacity < count) {
+        free(sink->scratch);
+        sink->scratch = (uint64_t *)xmalloc(count * sizeof(uint64_t));
+        sink->scratch_capacity = count;
+    }
+    return sink->scratch;
+}
+
+/* Lays out the columnar file and writes everything known before the search: header and names. */
+static int columnar_open(ResultSink *sink) {
+    const SearchContext *ctx = sink->ctx;
+    size_t n = sink->n_guides;
+    ColumnarHeader *h = &sink->header;
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, COLUMNAR_MAGIC, sizeof(h->magic));
+    h->version = COLUMNAR_VERSION;
+    h->byte_order = INDEX_BYTE_ORDER;
+    h->max_mismatches = ctx->options.max_mismatches;
+    h->caps_active = ctx->options.caps.active;
+    memcpy(h->caps, ctx->options.caps.max, sizeof(h->caps));
+    h->guide_count = n;
+    h->transcript_count = ctx->transcript_count;
+
+    Buffer heap;
+    buffer_init(&heap, 64 * 1024);
+    uint64_t *guide_strings = (uint64_t *)xmalloc((2 * n + 1) * sizeof(uint64_t));
+    uint64_t *gene_offsets = (uint64_t *)xmalloc((sink->guide_genes->interned.count + 1) * sizeof(uint64_t));
+    for (size_t g = 0; g < sink->guide_genes->interned.count; ++g) {
+        gene_offsets[g] = heap_add(&heap, string_pool_get(sink->guide_genes, (uint32_t)g));
+    }
+    for (size_t i = 0; i < n; ++i) {
+        guide_strings[2 * i] = gene_offsets[sink->guides[i].gene];
+        guide_strings[2 * i + 1] = heap_add(&heap, sink->guides[i].sequence);
+    }
+    free(gene_offsets);
+
+    uint64_t *symbol_offsets = (uint64_t *)xmalloc((ctx->gene_count + 1) * sizeof(uint64_t));
+    for (size_t g = 0; g < ctx->gene_count; ++g) {
+        symbol_offsets[g] = UINT64_MAX;
+    }
+    ColumnarTranscript *records = (ColumnarTranscript *)xmalloc((ctx->transcript_count + 1) * sizeof(ColumnarTranscript));
+    for (size_t t = 0; t < ctx->transcript_count; ++t) {
+        const TranscriptInfo *info = &ctx->transcripts[t];
+        if (symbol_offsets[info->gene] == UINT64_MAX) {
+            symbol_offsets[info->gene] = heap_add(&heap, info->gene_symbol ? info->gene_symbol : "Unknown");
+        }
+        records[t].start = info->start;
+        records[t].length = info->length;
+        records[t].id_offset = heap_add(&heap, info->transcript_id);
+        records[t].gene_offset = symbol_offsets[info->gene];
+    }
+    free(symbol_offsets);
+
+    uint64_t offset = sizeof(ColumnarHeader);
+    h->counts_offset = align_offset(offset);
+    offset = h->counts_offset + (MAX_MISMATCHES + 1) * n * sizeof(uint64_t);
+    h->disqualified_mm_offset = align_offset(offset);
+    offset = h->disqualified_mm_offset + n * sizeof(int32_t);
+    h->disqualified_pos_offset = align_offset(offset);
+    offset = h->disqualified_pos_offset + n * sizeof(uint64_t);
+    h->guide_strings_offset = align_offset(offset);
+    offset = h->guide_strings_offset + 2 * n * sizeof(uint64_t);
+    h->transcripts_offset = align_offset(offset);
+    offset = h->transcripts_offset + ctx->transcript_count * sizeof(ColumnarTranscript);
+    h->mm0_offsets_offset = align_offset(offset);
+    offset = h->mm0_offsets_offset + (n + 1) * sizeof(uint64_t);
+    h->strings_offset = align_offset(offset);
+    h->strings_size = heap.length;
+    h->mm0_transcripts_offset = align_offset(h->strings_offset + heap.length);
+
+    bool ok = pwrite_all(sink->fd, h, sizeof(*h), 0)
+        && pwrite_all(sink->fd, guide_strings, 2 * n * sizeof(uint64_t), h->guide_strings_offset)
+        && pwrite_all(sink->fd, records, ctx->transcript_count * sizeof(ColumnarTranscript), h->transcripts_offset)
+        && pwrite_all(sink->fd, heap.data, heap.length, h->strings_offset)
+        && ftruncate(sink->fd, (off_t)h->mm0_transcripts_offset) == 0;
+    free(guide_strings);
+    free(records);
+    free(heap.data);
+    return ok ? 0 : -1;
+}
+
+/* Writes the columns of guides [begin, end) and appends their MM0 transcripts. */
+static bool columnar_write(ResultSink *sink, size_t begin, size_t end) {
+    const ColumnarHeader *h = &sink->header;
+    const GuideResult *results = sink->results;
+    size_t count = end - begin;
+    uint64_t *values = sink_scratch(sink, count);
+    bool ok = true;
+
+    for (int mm = 0; mm <= MAX_MISMATCHES && ok; ++mm) {
+        for (size_t i = 0; i < count; ++i) {
+            values[i] = mm <= h->max_mismatches ? results[begin + i].counts[mm] : 0;
+        }
+        ok = pwrite_all(sink->fd, values, count * sizeof(uint64_t),
+                        h->counts_offset + ((uint64_t)mm * h->guide_count + begin) * sizeof(uint64_t));
+    }
+
+    int32_t *levels = (int32_t *)values;
+    for (size_t i = 0; i < count && ok; ++i) {
+        levels[i] = results[begin + i].disqualified ? results[begin + i].disqualified_mm : -1;
+    }
+    ok = ok && pwrite_all(sink->fd, levels, count * sizeof(int32_t),
+                          h->disqualified_mm_offset + begin * sizeof(int32_t));
+    for (size_t i = 0; i < count && ok; ++i) {
+        values[i] = results[begin + i].disqualified ? results[begin + i].disqualified_pos : 0;
+    }
+    ok = ok && pwrite_all(sink->fd, values, count * sizeof(uint64_t),
+                          h->disqualified_pos_offset + begin * sizeof(uint64_t));
+
+    uint64_t hits = 0;
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = sink->header.mm0_transcript_count + hits;
+        hits += results[begin + i].mm0_count;
+    }
+    ok = ok && pwrite_all(sink->fd, values, count * sizeof(uint64_t),
+                          h->mm0_offsets_offset + begin * sizeof(uint64_t));
+
+    uint64_t *transcripts = sink_scratch(sink, hits > 0 ? hits : 1);
+    size_t k = 0;
+    for (size_t i = begin; i < end; ++i) {
+        for (size_t j = 0; j < results[i].mm0_count; ++j) {
+            transcripts[k++] = results[i].mm0_transcripts[j];
+        }
+    }
+    ok = ok && pwrite_all(sink->fd, transcripts, hits * sizeof(uint64_t),
+                          h->mm0_transcripts_offset + h->mm0_transcript_count * sizeof(uint64_t));
+    sink->header.mm0_transcript_count += hits;
+    return ok;
+}
+
+static int columnar_close(ResultSink *sink) {
+    ColumnarHeader *h = &sink->header;
+    uint64_t total = h->mm0_transcript_count;
+    h->file_size = h->mm0_transcripts_offset + total * sizeof(uint64_t);
+    bool ok = !sink->failed
+        && pwrite_all(sink->fd, &total, sizeof(total), h->mm0_offsets_offset + h->guide_count * sizeof(uint64_t))
+        && ftruncate(sink->fd, (off_t)h->file_size) == 0
+        && pwrite_all(sink->fd, h, sizeof(*h), 0);
+    if (close(sink->fd) != 0) {
+        ok = false;
+    }
+    return ok ? 0 : -1;
+}
+
+int result_sink_open(ResultSink *sink, const char *path, const char *hits_path) {
+    sink->path = path;
+    if (sink->format == OUTPUT_COLUMNAR) {
+        sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (sink->fd < 0) {
+            fprintf(stderr, "Error: unable to open output file '%s': %s\n", path, strerror(errno));
+            return -1;
+        }
+        if (columnar_open(sink) != 0) {
+            fprintf(stderr, "Error: failed to write output file '%s': %s\n", path, strerror(errno));
+            close(sink->fd);
+            return -1;
+        }
+    } else {
+        sink->out = fopen(path, "w");
+        if (!sink->out) {
+            fprintf(stderr, "Error: unable to open output file '%s': %s\n", path, strerror(errno));
+            return -1;
+        }
+        write_results_header(sink->out, &sink->ctx->options);
+        size_t genes = sink->ctx->gene_count ? sink->ctx->gene_count : 1;
+        sink->gene_stamp = (uint32_t *)xmalloc(genes * sizeof(uint32_t));
+        memset(sink->gene_stamp, 0, genes * sizeof(uint32_t));
+    }
+
+    if (hits_path) {
+        sink->hits = fopen(hits_path, "w");
+        if (!sink->hits) {
+            fprintf(stderr, "Error: unable to open hits file '%s': %s\n", hits_path, strerror(errno));
+            if (sink->format == OUTPUT_COLUMNAR) {
+                close(sink->fd);
+            } else {
+                fclose(sink->out);
+                free(sink->gene_stamp);
+            }
+            return -1;
+        }
+        fputs(HIT_DETAILS_HEADER, sink->hits);
+    }
+    return 0;
+}
+
+/*
+ * Drains the stream: writes each run of finished guides as soon as it is
+ * complete and frees its hit lists, so only unwritten guides hold them.
+ */
+static void *result_writer_thread(void *arg) {
+    ResultSink *sink = (ResultSink *)arg;
+    for (size_t next = 0; next < sink->n_guides; ) {
+        size_t end = result_stream_wait(sink->stream, next);
+        if (sink->format == OUTPUT_COLUMNAR) {
+            if (!sink->failed && !columnar_write(sink, next, end)) {
+                sink->failed = true;
+            }
+        } else {
+            for (size_t i = next; i < end; ++i) {
+                write_result_row(sink->out, sink->ctx, sink->guide_genes, &sink->guides[i],
+                                 &sink->results[i], (uint32_t)(sink->first_row + i) + 1, sink->gene_stamp);
+            }
+        }
+        for (size_t i = next; i < end; ++i) {
+            GuideResult *res = &sink->results[i];
+            if (sink->hits) {
+                write_hit_rows(sink->hits, sink->ctx, sink->guide_genes, &sink->guides[i], res,
+                               sink->first_row + i);
+            }
+            free(res->mm0_transcripts);
+            res->mm0_transcripts = NULL;
+            free(res->details);
+            res->details = NULL;
+            free(res->mismatch_positions);
+            res->mismatch_positions = NULL;
+        }
+        next = end;
+    }
+    return NULL;
+}
+
+int result_sink_close(ResultSink *sink) {
+    int status = 0;
+    if (sink->format == OUTPUT_COLUMNAR) {
+        if (columnar_close(sink) != 0) {
+            status = -1;
+        }
+    } else if (sink->out) {
+        int failed = ferror(sink->out);
+        if (fclose(sink->out) != 0 || failed) {
+            status = -1;
+        }
+    }
+    if (status != 0) {
+        fprintf(stderr, "Error: failed to write output file '%s'\n", sink->path);
+    }
+    if (sink->hits) {
+        int failed = ferror(sink->hits);
+        if (fclose(sink->hits) != 0 || failed) {
+            fprintf(stderr, "Error: failed to write hits file\n");
+            status = -1;
+        }
+    }
+    free(sink->gene_stamp);
+    free(sink->scratch);
+    return status;
+}
+
+/*
+ * Searches `guides` into the sink's current batch (sink->results), writing
+ * results on a separate thread while groups finish (inline afterwards if
+ * no thread can be started).  `guides` NULL writes results that are
+ * already complete, as merge does.
+ */
+void search_into_sink(ResultSink *sink, const SearchContext *ctx, const Guide *guides, int n_guides) {
+    ResultStream stream;
+    result_stream_init(&stream, sink->n_guides);
+    sink->stream = &stream;
+    if (!guides) {
+        result_stream_complete(&stream, 0, sink->n_guides);
+    }
+
+    pthread_t writer;
+    bool threaded = guides && pthread_create(&writer, NULL, result_writer_thread, sink) == 0;
+    if (guides) {
+        run_search(ctx, guides, n_guides, sink->results, &stream);
+    }
+    run_stats_lap(sink->stats, "output");
+    if (threaded) {
+        pthread_join(writer, NULL);
+    } else {
+        result_writer_thread(sink);
+    }
+
+    result_stream_free(&stream);
+    sink->stream = NULL;
+}
+
+/*
+ * Sharded runs.  --reference-shard I/N searches only windows starting in
+ * the I-th of N transcript-aligned slices of the reference (balanced by
+ * length); --guide-shard I/N searches only the I-th of N contiguous slices
+ * of the guide rows.  With --partial the per-guide results go to a binary
+ * partial file instead of a CSV, and `merge` reduces the N x M partials of a
+ * screen into the results one unsharded run would have written: counts are
+ * summed, and MM0 transcripts and hit details are concatenated in shard
+ * order, which is reference order.
+ *
+ * A partial is a PartialHeader, then per guide a PartialGuide followed by
+ * its gene name, sequence, mm0_count transcript indices and detail_count
+ * hit-detail records (uint64 each).  Integers are host-endian, like index
+ * images.  Every partial records a digest of the reference layout, so merge
+ * refuses shards computed against different references.
+ */
+#define PARTIAL_MAGIC "TGROTPRT"
+#define PARTIAL_VERSION 1
+#define PARTIAL_MAX_NAME (1u << 20)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t max_mismatches;
+    int32_t detail_mismatches;      /* -1 = no hit details recorded */
+    uint32_t reference_shard;
+    uint32_t reference_shards;
+    uint32_t guide_shard;
+    uint32_t guide_shards;
+    uint32_t caps_active;
+    uint32_t reserved;
+    uint64_t caps[MAX_MISMATCHES + 1];
+    uint64_t reference_digest;
+    uint64_t transcript_count;
+    uint64_t total_guides;          /* rows in the unsharded guides file */
+    uint64_t guide_begin;           /* first row of this guide shard */
+    uint64_t guide_count;
+} PartialHeader;
+
+typedef struct {
+    uint32_t index;
+    uint32_t count;
+} ShardSpec;
+
+static int parse_shard_option(const char *name, const char *value, ShardSpec *out) {
+    char *endptr = NULL;
+    unsigned long index = strtoul(value, &endptr, 10);
+    if (endptr == value || *endptr != '/') {
+        fprintf(stderr, "Error: %s expects I/N (shard I of N, 0-based)\n", name);
+        return -1;
+    }
+    const char *count_str = endptr + 1;
+    unsigned long count = strtoul(count_str, &endptr, 10);
+    if (endptr == count_str || *endptr || count == 0 || count > UINT32_MAX || index >= count) {
+        fprintf(stderr, "Error: %s expects I/N with 0 <= I < N\n", name);
+        return -1;
+    }
+    out->index = (uint32_t)index;
+    out->count = (uint32_t)count;
+    return 0;
+}
+
+uint64_t fnv1a_bytes(uint64_t h, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* FNV-1a over transcript offsets, lengths, IDs and gene symbols. */
+uint64_t reference_digest(const TranscriptInfo *transcripts, size_t transcript_count) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t t = 0; t < transcript_count; ++t) {
+        uint64_t extent[2] = {transcripts[t].start, transcripts[t].length};
+        const char *gene = transcripts[t].gene_symbol ? transcripts[t].gene_symbol : "";
+        h = fnv1a_bytes(h, extent, sizeof(extent));
+        h = fnv1a_bytes(h, transcripts[t].transcript_id, strlen(transcripts[t].transcript_id) + 1);
+        h = fnv1a_bytes(h, gene, strlen(gene) + 1);
+    }
+    return h;
+}
+
+/* First transcript starting at or after `pos` (transcript_count if none). */
+static size_t first_transcript_from(const TranscriptInfo *transcripts, size_t transcript_count, size_t pos) {
+    size_t lo = 0;
+    size_t hi = transcript_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (transcripts[mid].start < pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
+    return lo;
+}
+
+static void select_reference_shard(SearchContext *ctx, ShardSpec shard) {
+    const TranscriptInfo *last = &ctx->transcripts[ctx->transcript_count - 1];
+    uint64_t total = last->start + last->length;
+    ctx->shard_begin = first_transcript_from(ctx->transcripts, ctx->transcript_count,
+                                             (size_t)(total * shard.index / shard.count));
+    ctx->shard_end = shard.index + 1 == shard.count
+        ? ctx->transcript_count
+        : first_transcript_from(ctx->transcripts, ctx->transcript_count,
+                                (size_t)(total * (shard.index + 1) / shard.count));
+}
+
+/* Writes one guide's PartialGuide record and its trailing data. */
+void write_partial_guide(FILE *out, const char *gene, const Guide *guide, const GuideResult *res) {
+    PartialGuide record;
+    memset(&record, 0, sizeof(record));
+    memcpy(record.counts, res->counts, sizeof(record.counts));
+    record.mm0_count = res->mm0_count;
+    record.detail_count = res->detail_count;
+    record.disqualified_mm = res->disqualified ? res->disqualified_mm : -1;
+    record.disqualified_pos = res->disqualified ? res->disqualified_pos : 0;
+    record.gene_length = (uint32_t)strlen(gene);
+    record.sequence_length = (uint32_t)guide->length;
+    fwrite(&record, sizeof(record), 1, out);
+    fwrite(gene, 1, record.gene_length, out);
+    fwrite(guide->sequence, 1, record.sequence_length, out);
+    for (size_t h = 0; h < res->mm0_count; ++h) {
+        uint64_t transcript = res->mm0_transcripts[h];
+        fwrite(&transcript, sizeof(transcript), 1, out);
+    }
+    if (res->detail_count > 0) {
+        fwrite(res->details, sizeof(uint64_t), res->detail_count, out);
+    }
+}
+
+static int write_partial(const char *path, const PartialHeader *header,
+                         const StringPool *guide_genes, const Guide *guides, const GuideResult *results) {
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "Error: unable to open partial file '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    fwrite(header, sizeof(*header), 1, out);
+    for (size_t i = 0; i < header->guide_count; ++i) {
+        write_partial_guide(out, string_pool_get(guide_genes, guides[i].gene), &guides[i], &results[i]);
+    }
+    int failed = ferror(out);
+    if (fclose(out) != 0 || failed) {
+        fprintf(stderr, "Error: failed to write partial file '%s'\n", path);
+        return -1;
+    }
+    return 0;
+}
 
-    free(line);
-    fclose(fp);
+typedef struct {
+    const char *path;
+    FILE *fp;
+    PartialHeader header;
+} PartialFile;
 
-    if (transcript_count == 0 || !current) {
-        fprintf(stderr, "Error: reference '%s' contains no sequence records\n", filename);
-        free(buffer.data);
-        free_transcript_info(transcripts, transcript_count);
-        exit(EXIT_FAILURE);
+static int compare_partials(const void *a, const void *b) {
+    const PartialHeader *x = &((const PartialFile *)a)->header;
+    const PartialHeader *y = &((const PartialFile *)b)->header;
+    if (x->guide_shard != y->guide_shard) {
+        return x->guide_shard < y->guide_shard ? -1 : 1;
     }
+    if (x->reference_shard != y->reference_shard) {
+        return x->reference_shard < y->reference_shard ? -1 : 1;
+    }
+    return 0;
+}
 
-    current->length = buffer.length - current->start;
-
-    if (buffer.length == 0) {
-        fprintf(stderr, "Error: reference '%s' contains no sequence data\n", filename);
-        free(buffer.data);
-        free_transcript_info(transcripts, transcript_count);
-        exit(EXIT_FAILURE);
+static int open_partial(PartialFile *file) {
+    file->fp = fopen(file->path, "rb");
+    if (!file->fp) {
+        fprintf(stderr, "Error: unable to open partial file '%s': %s\n", file->path, strerror(errno));
+        return -1;
     }
+    const PartialHeader *h = &file->header;
+    if (fread(&file->header, sizeof(file->header), 1, file->fp) != 1
+        || memcmp(h->magic, PARTIAL_MAGIC, sizeof(h->magic)) != 0
+        || h->version != PARTIAL_VERSION
+        || h->byte_order != INDEX_BYTE_ORDER) {
+        fprintf(stderr, "Error: '%s' is not a compatible partial file\n", file->path);
+        return -1;
+    }
+    if (h->reference_shards == 0 || h->reference_shard >= h->reference_shards
+        || h->guide_shards == 0 || h->guide_shard >= h->guide_shards
+        || h->max_mismatches < 0 || h->max_mismatches > MAX_MISMATCHES
+        || h->detail_mismatches > h->max_mismatches
+        || h->total_guides > INT_MAX
+        || h->guide_begin != h->total_guides * h->guide_shard / h->guide_shards
+        || h->guide_begin + h->guide_count != h->total_guides * (h->guide_shard + 1) / h->guide_shards) {
+        fprintf(stderr, "Error: partial file '%s' has a corrupt header\n", file->path);
+        return -1;
+    }
+    return 0;
+}
 
-    append_sentinel(&buffer);  // padding to allow vector loads at the end
-    *transcripts_out = transcripts;
-    *transcript_count_out = transcript_count;
-    return buffer;
+/* Same screen: everything but the shard position must agree. */
+static bool partials_compatible(const PartialHeader *a, const PartialHeader *b) {
+    return a->max_mismatches == b->max_mismatches
+        && a->detail_mismatches == b->detail_mismatches
+        && a->reference_shards == b->reference_shards
+        && a->guide_shards == b->guide_shards
+        && a->caps_active == b->caps_active
+        && memcmp(a->caps, b->caps, sizeof(a->caps)) == 0
+        && a->reference_digest == b->reference_digest
+        && a->transcript_count == b->transcript_count
+        && a->total_guides == b->total_guides;
 }
 
-static inline uint32_t mask_for_length(int length) {
-    if (length >= 32) {
-        return 0xFFFFFFFFu;
-    }
-    return (1u << length) - 1u;
+int read_exact(FILE *fp, void *data, size_t size) {
+    return size == 0 || fread(data, 1, size, fp) == size ? 0 : -1;
 }
 
-static void process_group_avx2(
-    const char *ref_seq,
-    const unsigned char *valid_pos,
-    size_t search_limit,
-    const Guide *guides,
-    size_t group_start,
-    size_t group_size,
-    GuideResult *results,
-    const TranscriptInfo *transcripts,
-    size_t transcript_count
-) {
-    __m256i query_vec[GROUP_SIZE];
-    uint32_t query_masks[GROUP_SIZE];
-    int query_lengths[GROUP_SIZE];
+/*
+ * Folds one partial into the merged arrays.  Reference shard 0 of a guide
+ * shard defines its guides; later shards must carry the same sequences.
+ */
+static int merge_partial(PartialFile *file, StringPool *genes, Guide *guides, GuideResult *results,
+                         char **name_buf, size_t *name_cap) {
+    const PartialHeader *h = &file->header;
+    for (size_t i = 0; i < h->guide_count; ++i) {
+        size_t row = (size_t)h->guide_begin + i;
+        Guide *guide = &guides[row];
+        GuideResult *res = &results[row];
+        PartialGuide record;
+        if (read_exact(file->fp, &record, sizeof(record)) != 0
+            || record.gene_length > PARTIAL_MAX_NAME
+            || record.sequence_length > MAX_GUIDE_LEN
+            || record.mm0_count > h->transcript_count) {
+            fprintf(stderr, "Error: partial file '%s' is truncated or corrupt\n", file->path);
+            return -1;
+        }
+        if (*name_cap < (size_t)record.gene_length + 1) {
+            *name_cap = (size_t)record.gene_length + 1;
+            free(*name_buf);
+            *name_buf = (char *)xmalloc(*name_cap);
+        }
+        char sequence[MAX_GUIDE_LEN + 1];
+        if (read_exact(file->fp, *name_buf, record.gene_length) != 0
+            || read_exact(file->fp, sequence, record.sequence_length) != 0) {
+            fprintf(stderr, "Error: partial file '%s' is truncated\n", file->path);
+            return -1;
+        }
+        (*name_buf)[record.gene_length] = '\0';
+        sequence[record.sequence_length] = '\0';
 
-    char padded[GROUP_SIZE][PAD_WIDTH];
-    memset(padded, SENTINEL_CHAR, sizeof(padded));
+        if (h->reference_shard == 0) {
+            memcpy(guide->sequence, sequence, record.sequence_length + 1);
+            guide->length = (int)record.sequence_length;
+            guide->gene = string_pool_intern(genes, *name_buf);
+            res->disqualified = record.disqualified_mm >= 0;
+            res->disqualified_mm = record.disqualified_mm;
+            res->disqualified_pos = (size_t)record.disqualified_pos;
+        } else if (strcmp(guide->sequence, sequence) != 0
+                   || strcmp(string_pool_get(genes, guide->gene), *name_buf) != 0) {
+            fprintf(stderr, "Error: partial file '%s' was computed from different guides (row %zu)\n",
+                    file->path, row);
+            return -1;
+        }
 
-    for (size_t j = 0; j < group_size; ++j) {
-        const Guide *g = &guides[group_start + j];
-        memcpy(padded[j], g->sequence, (size_t)g->length);
-        query_vec[j] = _mm256_loadu_si256((const __m256i *)padded[j]);
-        query_masks[j] = mask_for_length(g->length);
-        query_lengths[j] = g->length;
+        for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
+            res->counts[mm] += record.counts[mm];
+        }
+        if (record.mm0_count > 0) {
+            res->mm0_transcripts = (size_t *)realloc(res->mm0_transcripts,
+                                                     (res->mm0_count + record.mm0_count) * sizeof(size_t));
+            if (!res->mm0_transcripts) {
+                fprintf(stderr, "Error: out of memory while merging '%s'\n", file->path);
+                exit(EXIT_FAILURE);
+            }
+            for (uint64_t k = 0; k < record.mm0_count; ++k) {
+                uint64_t transcript;
+                if (read_exact(file->fp, &transcript, sizeof(transcript)) != 0) {
+                    fprintf(stderr, "Error: partial file '%s' is truncated\n", file->path);
+                    return -1;
+                }
+                res->mm0_transcripts[res->mm0_count++] = (size_t)transcript;
+            }
+        }
+        if (record.detail_count > 0) {
+            res->details = (uint64_t *)realloc(res->details,
+                                               (res->detail_count + record.detail_count) * sizeof(uint64_t));
+            if (!res->details) {
+                fprintf(stderr, "Error: out of memory while merging '%s'\n", file->path);
+                exit(EXIT_FAILURE);
+            }
+            if (read_exact(file->fp, res->details + res->detail_count,
+                           (size_t)record.detail_count * sizeof(uint64_t)) != 0) {
+                fprintf(stderr, "Error: partial file '%s' is truncated\n", file->path);
+                return -1;
+            }
+            res->detail_count += (size_t)record.detail_count;
+        }
     }
+    return 0;
+}
 
-    uint64_t local_counts[GROUP_SIZE][MAX_MISMATCHES + 1] = {{0}};
-    HitList mm0_hits[GROUP_SIZE];
-    for (size_t j = 0; j < group_size; ++j) {
-        hitlist_init(&mm0_hits[j]);
+/* Names and layout only: merge never touches the sequence. */
+static int load_reference_names(SearchContext *ctx, const char *reference_file) {
+    ctx->from_index = is_index_image(reference_file);
+    if (ctx->from_index) {
+        if (load_index_image(reference_file, DEFAULT_INDEX_WINDOW, &ctx->packed, &ctx->transcripts,
+                             &ctx->transcript_count, NULL) != 0) {
+            return -1;
+        }
+    } else {
+        string_pool_init(&ctx->names);
+        load_reference_sequence(reference_file, &ctx->names, false, SIMD_SCALAR,
+                                &ctx->transcripts, &ctx->transcript_count);
+    }
+    for (size_t t = 0; t < ctx->transcript_count; ++t) {
+        if (ctx->transcripts[t].gene >= ctx->gene_count) {
+            ctx->gene_count = (size_t)ctx->transcripts[t].gene + 1;
+        }
     }
+    return 0;
+}
 
-    size_t transcript_idx = 0;
-    size_t next_boundary = (transcript_count > 1) ? transcripts[1].start : search_limit;
+static int merge_main(int argc, char *argv[], const char *prog) {
+    static const struct option long_options[] = {
+        {"hits-out", required_argument, NULL, 'o'},
+        {"output-format", required_argument, NULL, 'F'},
+        {NULL, 0, NULL, 0}
+    };
 
-    for (size_t pos = 0; pos < search_limit; ++pos) {
-        while (transcript_idx + 1 < transcript_count && pos >= next_boundary) {
-            ++transcript_idx;
-            next_boundary = (transcript_idx + 1 < transcript_count)
-                ? transcripts[transcript_idx + 1].start
-                : search_limit;
+    const char *hits_file = NULL;
+    OutputFormat output_format = OUTPUT_CSV;
+    optind = 1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        if (opt == 'o') {
+            hits_file = optarg;
+        } else if (opt == 'F') {
+            if (parse_output_format(optarg, &output_format) != 0) {
+                return EXIT_FAILURE;
+            }
+        } else {
+            print_usage(prog);
+            return EXIT_FAILURE;
         }
+    }
+    if (argc - optind < 3) {
+        print_usage(prog);
+        return EXIT_FAILURE;
+    }
 
-        if (!valid_pos[pos]) {
-            continue;
+    const char *reference_file = argv[optind];
+    const char *output_file = argv[optind + 1];
+    size_t n_files = (size_t)(argc - optind - 2);
+    PartialFile *files = (PartialFile *)xmalloc(n_files * sizeof(PartialFile));
+    memset(files, 0, n_files * sizeof(PartialFile));
+
+    SearchContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    search_options_init(&ctx.options);
+    StringPool genes;
+    string_pool_init(&genes);
+    Guide *guides = NULL;
+    GuideResult *results = NULL;
+    size_t n_guides = 0;
+    char *name_buf = NULL;
+    size_t name_cap = 0;
+    int status = EXIT_FAILURE;
+    bool loaded = false;
+
+    for (size_t f = 0; f < n_files; ++f) {
+        files[f].path = argv[optind + 2 + f];
+        if (open_partial(&files[f]) != 0) {
+            goto done;
         }
+        if (f > 0 && !partials_compatible(&files[0].header, &files[f].header)) {
+            fprintf(stderr, "Error: '%s' and '%s' belong to different sharded searches\n",
+                    files[0].path, files[f].path);
+            goto done;
+        }
+    }
 
-        const TranscriptInfo *tinfo = &transcripts[transcript_idx];
-        if (pos < tinfo->start) {
-            continue;
+    qsort(files, n_files, sizeof(PartialFile), compare_partials);
+    const PartialHeader *first = &files[0].header;
+    for (size_t f = 1; f < n_files; ++f) {
+        if (compare_partials(&files[f - 1], &files[f]) == 0) {
+            fprintf(stderr, "Error: '%s' and '%s' are the same shard\n", files[f - 1].path, files[f].path);
+            goto done;
         }
-        size_t transcript_end = tinfo->start + tinfo->length;
-        if (pos >= transcript_end) {
-            continue;
+    }
+    size_t expected = (size_t)first->guide_shards * first->reference_shards;
+    for (size_t k = 0; k < expected; ++k) {
+        uint32_t guide_shard = (uint32_t)(k / first->reference_shards);
+        uint32_t reference_shard = (uint32_t)(k % first->reference_shards);
+        if (k >= n_files || files[k].header.guide_shard != guide_shard
+            || files[k].header.reference_shard != reference_shard) {
+            fprintf(stderr, "Error: missing partial for --guide-shard %u/%u --reference-shard %u/%u\n",
+                    guide_shard, first->guide_shards, reference_shard, first->reference_shards);
+            goto done;
         }
+    }
+    if (hits_file && first->detail_mismatches < 0) {
+        fprintf(stderr, "Error: --hits-out needs partials searched with --hits-max-mm\n");
+        goto done;
+    }
 
-        __m256i ref_vec = _mm256_loadu_si256((const __m256i *)(ref_seq + pos));
+    if (load_reference_names(&ctx, reference_file) != 0) {
+        goto done;
+    }
+    loaded = true;
+    if (ctx.transcript_count != first->transcript_count
+        || reference_digest(ctx.transcripts, ctx.transcript_count) != first->reference_digest) {
+        fprintf(stderr, "Error: partials were not searched against '%s'\n", reference_file);
+        goto done;
+    }
+    ctx.options.max_mismatches = first->max_mismatches;
+    ctx.options.caps.active = first->caps_active != 0;
+    memcpy(ctx.options.caps.max, first->caps, sizeof(ctx.options.caps.max));
 
-        for (size_t j = 0; j < group_size; ++j) {
-            if (pos + (size_t)query_lengths[j] > transcript_end) {
-                continue;
-            }
+    n_guides = (size_t)first->total_guides;
+    guides = (Guide *)xmalloc((n_guides ? n_guides : 1) * sizeof(Guide));
+    results = (GuideResult *)xmalloc((n_guides ? n_guides : 1) * sizeof(GuideResult));
+    memset(guides, 0, (n_guides ? n_guides : 1) * sizeof(Guide));
+    memset(results, 0, (n_guides ? n_guides : 1) * sizeof(GuideResult));
+    for (size_t f = 0; f < n_files; ++f) {
+        if (merge_partial(&files[f], &genes, guides, results, &name_buf, &name_cap) != 0) {
+            goto done;
+        }
+    }
 
-            __m256i cmp = _mm256_cmpeq_epi8(ref_vec, query_vec[j]);
-            uint32_t eq_mask = (uint32_t)_mm256_movemask_epi8(cmp);
-            eq_mask &= query_masks[j];
+    ResultSink sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.format = output_format;
+    sink.ctx = &ctx;
+    sink.guide_genes = &genes;
+    sink.guides = guides;
+    sink.results = results;
+    sink.n_guides = n_guides;
+    if (result_sink_open(&sink, output_file, hits_file) != 0) {
+        goto done;
+    }
+    search_into_sink(&sink, &ctx, NULL, 0);
+    if (result_sink_close(&sink) != 0) {
+        goto done;
+    }
+    status = EXIT_SUCCESS;
+    fprintf(stderr, "merge: %zu partials, %zu guides\n", n_files, n_guides);
 
-            int matches = __builtin_popcount(eq_mask);
-            int mismatches = query_lengths[j] - matches;
+done:
+    for (size_t f = 0; f < n_files; ++f) {
+        if (files[f].fp) {
+            fclose(files[f].fp);
+        }
+    }
+    free(files);
+    free(name_buf);
+    free(guides);
+    if (results) {
+        free_results(results, n_guides);
+    }
+    string_pool_free(&genes);
+    if (loaded) {
+        free_search_context(&ctx);
+    }
+    return status;
+}
 
-            if (mismatches <= MAX_MISMATCHES) {
-                local_counts[j][mismatches]++;
-                if (mismatches == 0) {
-                    hitlist_add(&mm0_hits[j], transcript_idx);
-                }
+/*
+ * Whether any window of `ref` is within max_mismatches of `guide` (which
+ * has no N): the seed lookups of search_guide_seeded, stopping at the first
+ * window that verifies.  Used by 'screen', which only needs existence.
+ */
+static bool seeded_window_exists(const PackedReference *ref, const KmerIndex *kmers, const Guide *guide,
+                                 int max_mismatches) {
+    GuideBits bits;
+    guide_bits(guide, &bits);
+    int parts = max_mismatches + 1;
+    for (int s = 0; s < parts; ++s) {
+        int start = s * guide->length / parts;
+        uint32_t code = 0;
+        for (int k = 0; k < kmers->k; ++k) {
+            code = (code << 2) | (uint32_t)(((bits.lo >> (start + k)) & 1) | (((bits.hi >> (start + k)) & 1) << 1));
+        }
+        const uint32_t *pos = kmers->positions + kmers->offsets[code];
+        const uint32_t *end = kmers->positions + kmers->offsets[code + 1];
+        for (; pos < end; ++pos) {
+            if (*pos < (uint32_t)start) {
+                continue;
+            }
+            size_t window = (size_t)*pos - (size_t)start;
+            if (window < ref->length && bit_is_set(ref->valid_len[guide->length], window)
+                && __builtin_popcountll(packed_window_diff(ref, window, &bits)) <= max_mismatches) {
+                return true;
             }
         }
     }
+    return false;
+}
 
-    for (size_t j = 0; j < group_size; ++j) {
-        GuideResult *res = &results[group_start + j];
-        for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
-            res->counts[mm] = local_counts[j][mm];
+/*
+ * Sets hit[i] for the guides with a window within max_mismatches ('screen'):
+ * through the seed index when it covers them, otherwise by a packed scan
+ * that retires each guide at its first such window (caps of 0).
+ */
+void screen_candidates(const SearchContext *ctx, const Guide *guides, int n_guides, bool *hit) {
+    int max_mismatches = ctx->options.max_mismatches;
+    int seed_len = seed_length_for(guides, n_guides, max_mismatches);
+    if (ctx->options.engine == ENGINE_INDEX && ctx->kmers.k > 0 && ctx->kmers.k <= seed_len) {
+        PackedReference packed = ctx->packed;
+        uint64_t *owned[MAX_GUIDE_LEN + 1] = {0};
+        prepare_validity(ctx, guides, n_guides, &packed, owned);
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (int i = 0; i < n_guides; ++i) {
+            hit[i] = seeded_window_exists(&packed, &ctx->kmers, &guides[i], max_mismatches);
         }
-
-        if (mm0_hits[j].count > 0) {
-            res->mm0_transcripts = (size_t *)xmalloc(mm0_hits[j].count * sizeof(size_t));
-            memcpy(res->mm0_transcripts, mm0_hits[j].data, mm0_hits[j].count * sizeof(size_t));
-            res->mm0_count = mm0_hits[j].count;
-        } else {
-            res->mm0_transcripts = NULL;
-            res->mm0_count = 0;
+        for (int len = 0; len <= MAX_GUIDE_LEN; ++len) {
+            free(owned[len]);
         }
+        return;
+    }
 
-        hitlist_free(&mm0_hits[j]);
+    SearchContext capped = *ctx;
+    capped.options.engine = ENGINE_PACKED;
+    capped.options.caps.active = true;
+    for (int mm = 0; mm <= max_mismatches; ++mm) {
+        capped.options.caps.max[mm] = 0;
+    }
+    GuideResult *results = (GuideResult *)xmalloc((size_t)n_guides * sizeof(GuideResult));
+    memset(results, 0, (size_t)n_guides * sizeof(GuideResult));
+    run_search(&capped, guides, n_guides, results, NULL);
+    for (int i = 0; i < n_guides; ++i) {
+        hit[i] = results[i].disqualified;
     }
+    free_results(results, (size_t)n_guides);
 }
 
-static void process_group_scalar(
-    const char *ref_seq,
-    const unsigned char *valid_pos,
-    size_t search_limit,
-    const Guide *guides,
-    size_t group_start,
-    size_t group_size,
-    GuideResult *results,
-    const TranscriptInfo *transcripts,
-    size_t transcript_count
-) {
-    uint64_t local_counts[GROUP_SIZE][MAX_MISMATCHES + 1] = {{0}};
-    HitList mm0_hits[GROUP_SIZE];
-    for (size_t j = 0; j < group_size; ++j) {
-        hitlist_init(&mm0_hits[j]);
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "index") == 0) {
+        return index_main(argc - 1, argv + 1, argv[0]);
+    }
+    if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+        return serve_main(argc - 1, argv + 1, argv[0]);
+    }
+    if (argc > 1 && strcmp(argv[1], "merge") == 0) {
+        return merge_main(argc - 1, argv + 1, argv[0]);
+    }
+    if (argc > 1 && strcmp(argv[1], "screen") == 0) {
+        return screen_main(argc - 1, argv + 1, argv[0]);
     }
 
-    size_t transcript_idx = 0;
-    size_t next_boundary = (transcript_count > 1) ? transcripts[1].start : search_limit;
+    SearchContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    search_options_init(&ctx.options);
 
-    for (size_t pos = 0; pos < search_limit; ++pos) {
-        while (transcript_idx + 1 < transcript_count && pos >= next_boundary) {
-            ++transcript_idx;
-            next_boundary = (transcript_idx + 1 < transcript_count)
-                ? transcripts[transcript_idx + 1].start
-                : search_limit;
-        }
+    static const struct option long_options[] = {
+        SEARCH_LONG_OPTIONS,
+        {"hits-out", required_argument, NULL, 'o'},
+        {"hits-max-mm", required_argument, NULL, 'H'},
+        {"reference-shard", required_argument, NULL, 'R'},
+        {"guide-shard", required_argument, NULL, 'G'},
+        {"partial", no_argument, NULL, 'P'},
+        {"output-format", required_argument, NULL, 'F'},
+        {"window-length", required_argument, NULL, 'w'},
+        {"cache-dir", required_argument, NULL, 'C'},
+        {"cache-from", required_argument, NULL, 'c'},
+        {"stats", required_argument, NULL, 'S'},
+        {"memory-budget", required_argument, NULL, 'B'},
+        {"checkpoint", required_argument, NULL, 'K'},
+        {"checkpoint-group", required_argument, NULL, 'k'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
 
-        if (!valid_pos[pos]) {
+    const char *hits_file = NULL;
+    const char *cache_dir = NULL;
+    const char *cache_from = NULL;
+    const char *stats_file = NULL;
+    const char *checkpoint_file = NULL;
+    int checkpoint_group = DEFAULT_CHECKPOINT_GROUP;
+    int window_len = DEFAULT_INDEX_WINDOW;
+    int hits_max_mm = 0;
+    bool hits_max_mm_set = false;
+    size_t memory_budget = 0;
+    ShardSpec reference_shard = {0, 1};
+    ShardSpec guide_shard = {0, 1};
+    bool partial = false;
+    OutputFormat output_format = OUTPUT_CSV;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        if (opt == 'h') {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (opt == 'o') {
+            hits_file = optarg;
             continue;
         }
-
-        const TranscriptInfo *tinfo = &transcripts[transcript_idx];
-        if (pos < tinfo->start) {
+        if (opt == 'C') {
+            cache_dir = optarg;
             continue;
         }
-        size_t transcript_end = tinfo->start + tinfo->length;
-        if (pos >= transcript_end) {
+        if (opt == 'c') {
+            cache_from = optarg;
             continue;
         }
-
-        for (size_t j = 0; j < group_size; ++j) {
-            const Guide *g = &guides[group_start + j];
-            if (pos + (size_t)g->length > transcript_end) {
-                continue;
+        if (opt == 'S') {
+            stats_file = optarg;
+            continue;
+        }
+        if (opt == 'K') {
+            checkpoint_file = optarg;
+            continue;
+        }
+        if (opt == 'k') {
+            if (parse_int_option("--checkpoint-group", optarg, 1, INT_MAX, &checkpoint_group) != 0) {
+                return EXIT_FAILURE;
             }
-
-            int mismatches = 0;
-            for (int k = 0; k < g->length; ++k) {
-                if (ref_seq[pos + k] != g->sequence[k]) {
-                    mismatches++;
-                    if (mismatches > MAX_MISMATCHES) {
-                        break;
-                    }
-                }
+            continue;
+        }
+        if (opt == 'H') {
+            if (parse_int_option("--hits-max-mm", optarg, 0, MAX_MISMATCHES, &hits_max_mm) != 0) {
+                return EXIT_FAILURE;
             }
-            if (mismatches <= MAX_MISMATCHES) {
-                local_counts[j][mismatches]++;
-                if (mismatches == 0) {
-                    hitlist_add(&mm0_hits[j], transcript_idx);
-                }
+            hits_max_mm_set = true;
+            continue;
+        }
+        if (opt == 'R' || opt == 'G') {
+            if (parse_shard_option(opt == 'R' ? "--reference-shard" : "--guide-shard", optarg,
+                                   opt == 'R' ? &reference_shard : &guide_shard) != 0) {
+                return EXIT_FAILURE;
             }
+            continue;
         }
-    }
-
-    for (size_t j = 0; j < group_size; ++j) {
-        GuideResult *res = &results[group_start + j];
-        for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
-            res->counts[mm] = local_counts[j][mm];
+        if (opt == 'P') {
+            partial = true;
+            continue;
         }
-
-        if (mm0_hits[j].count > 0) {
-            res->mm0_transcripts = (size_t *)xmalloc(mm0_hits[j].count * sizeof(size_t));
-            memcpy(res->mm0_transcripts, mm0_hits[j].data, mm0_hits[j].count * sizeof(size_t));
-            res->mm0_count = mm0_hits[j].count;
-        } else {
-            res->mm0_transcripts = NULL;
-            res->mm0_count = 0;
+        if (opt == 'F') {
+            if (parse_output_format(optarg, &output_format) != 0) {
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if (opt == 'w') {
+            if (parse_int_option("--window-length", optarg, 1, MAX_GUIDE_LEN, &window_len) != 0) {
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if (opt == 'B') {
+            if (parse_size_option("--memory-budget", optarg, 64, &memory_budget) != 0) {
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        int handled = parse_search_option(opt, optarg, &ctx.options);
+        if (handled <= 0) {
+            if (handled == 0) {
+                print_usage(argv[0]);
+            }
+            return EXIT_FAILURE;
         }
-
-        hitlist_free(&mm0_hits[j]);
     }
-}
+    if (partial && output_format != OUTPUT_CSV) {
+        fprintf(stderr, "Error: --partial writes its own format; pass --output-format to 'merge'\n");
+        return EXIT_FAILURE;
+    }
+    if (partial && hits_file) {
+        fprintf(stderr, "Error: --partial records hit details for 'merge --hits-out'; drop --hits-out\n");
+        return EXIT_FAILURE;
+    }
+    if (ctx.options.mismatch_profile && (partial || reference_shard.count > 1 || output_format != OUTPUT_CSV
+                                         || cache_dir)) {
+        fprintf(stderr, "Error: --position-weights profiles are only written to CSV results of unsharded, "
+                "uncached runs\n");
+        return EXIT_FAILURE;
+    }
+    if (ctx.options.mismatch_profile && checkpoint_file) {
+        fprintf(stderr, "Error: --checkpoint does not record --position-weights profiles\n");
+        return EXIT_FAILURE;
+    }
+    if (hits_file || (partial && hits_max_mm_set)) {
+        ctx.options.detail_mismatches = hits_max_mm;
+    }
+    if (validate_search_options(&ctx.options) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (ctx.options.guide_length > 0) {
+        window_len = ctx.options.guide_length;
+    }
+    if (cache_from && !cache_dir) {
+        fprintf(stderr, "Error: --cache-from updates the results in --cache-dir; give both\n");
+        return EXIT_FAILURE;
+    }
+    if (cache_from && (ctx.options.caps.active || ctx.options.detail_mismatches >= 0 || reference_shard.count > 1)) {
+        fprintf(stderr, "Error: --cache-from only updates uncapped counts of whole-reference runs without "
+                "hit details (not with --max-mmK, --hits-out, --hits-max-mm or --reference-shard)\n");
+        return EXIT_FAILURE;
+    }
+    if (ctx.options.caps.active && reference_shard.count > 1) {
+        fprintf(stderr, "Error: --max-mmK needs the whole reference; it cannot be combined with --reference-shard\n");
+        return EXIT_FAILURE;
+    }
+    if (ctx.options.collapse_isoforms && reference_shard.count > 1) {
+        fprintf(stderr, "Error: --collapse-isoforms merges windows across a gene's transcripts; "
+                "it cannot be combined with --reference-shard\n");
+        return EXIT_FAILURE;
+    }
+    if (memory_budget && (ctx.options.caps.active || ctx.options.collapse_isoforms || cache_dir
+                          || ctx.options.engine == ENGINE_GPU)) {
+        fprintf(stderr, "Error: --memory-budget scans the reference slice by slice; it cannot be combined "
+                "with --max-mmK, --collapse-isoforms, --cache-dir or --engine gpu\n");
+        return EXIT_FAILURE;
+    }
 
-int main(int argc, char *argv[]) {
-    if (argc < 4) {
-        fprintf(stderr, "Usage: %s <guides.csv> <reference.fasta> <output.csv>\n", argv[0]);
+    if (argc - optind < 3) {
+        print_usage(argv[0]);
         return EXIT_FAILURE;
     }
 
-    const char *guides_file = argv[1];
-    const char *reference_file = argv[2];
-    const char *output_file = argv[3];
+    const char *guides_file = argv[optind];
+    const char *reference_file = argv[optind + 1];
+    const char *output_file = argv[optind + 2];
+    RunStats stats;
+    RunStats *stats_ptr = NULL;
+    if (stats_file) {
+        run_stats_init(&stats);
+        stats_ptr = &stats;
+    }
+    if (strcmp(guides_file, "-") == 0) {
+        if (checkpoint_file) {
+            fprintf(stderr, "Error: --checkpoint needs a guides file to resume; streamed guides are not replayed\n");
+            return EXIT_FAILURE;
+        }
+        if (memory_budget) {
+            fprintf(stderr, "Error: --memory-budget needs a guides file; streamed guides search a loaded reference\n");
+            return EXIT_FAILURE;
+        }
+        return stream_main(&ctx, reference_file, output_file, hits_file, cache_dir, cache_from, output_format,
+                           partial || reference_shard.count > 1 || guide_shard.count > 1, window_len,
+                           stats_ptr, stats_file);
+    }
 
+    run_stats_lap(stats_ptr, "guides");
     Guide *guides = NULL;
     int max_guide_len = 0;
-    int n_guides = load_guides(guides_file, &guides, &max_guide_len);
+    StringPool genes;
+    string_pool_init(&genes);
+    int n_guides = load_guides(guides_file, &genes, ctx.options.guide_length, &guides, &max_guide_len);
     if (n_guides <= 0) {
+        string_pool_free(&genes);
         return EXIT_FAILURE;
     }
 
-    TranscriptInfo *transcripts = NULL;
-    size_t transcript_count = 0;
-    Buffer reference = load_reference_sequence(reference_file, &transcripts, &transcript_count);
     if (max_guide_len > MAX_GUIDE_LEN) {
         max_guide_len = MAX_GUIDE_LEN;
     }
-    unsigned char *valid_positions = compute_valid_positions(reference.data, reference.length, max_guide_len);
 
-    size_t search_limit = 0;
-    if (reference.length >= PAD_WIDTH) {
-        search_limit = reference.length - (PAD_WIDTH - 1);
+    run_stats_lap(stats_ptr, "reference");
+    if ((memory_budget ? open_streamed_reference(&ctx, reference_file, memory_budget)
+                       : load_search_context(&ctx, reference_file, max_guide_len)) != 0) {
+        free_search_context(&ctx);
+        free(guides);
+        string_pool_free(&genes);
+        return EXIT_FAILURE;
     }
-
-    GuideResult *results = (GuideResult *)xmalloc((size_t)n_guides * sizeof(GuideResult));
-    memset(results, 0, (size_t)n_guides * sizeof(GuideResult));
-
-    int requested_threads = parse_thread_override();
-    if (requested_threads > 0) {
-        omp_set_num_threads(requested_threads);
+    if (stats_ptr) {
+        run_stats_attach(stats_ptr, &ctx);
     }
-
-    size_t total_groups = (n_guides + GROUP_SIZE - 1) / GROUP_SIZE;
-
-    bool use_avx2 = true;
-#if defined(__GNUC__) && defined(__x86_64__)
-    if (!__builtin_cpu_supports("avx2")) {
-        fprintf(stderr, "Warning: CPU does not support AVX2, falling back to scalar implementation\n");
-        use_avx2 = false;
+    if (reference_shard.count > 1) {
+        select_reference_shard(&ctx, reference_shard);
+        fprintf(stderr, "Reference shard %u/%u: transcripts %zu-%zu of %zu\n",
+                reference_shard.index, reference_shard.count,
+                ctx.shard_begin, ctx.shard_end, ctx.transcript_count);
     }
-#endif
 
-#pragma omp parallel for schedule(dynamic)
-    for (size_t group_idx = 0; group_idx < total_groups; ++group_idx) {
-        size_t start = group_idx * GROUP_SIZE;
-        size_t remaining = (size_t)n_guides - start;
-        size_t group_size = remaining < GROUP_SIZE ? remaining : GROUP_SIZE;
-
-        if (use_avx2) {
-            process_group_avx2(reference.data, valid_positions, search_limit,
-                               guides, start, group_size, results,
-                               transcripts, transcript_count);
-        } else {
-            process_group_scalar(reference.data, valid_positions, search_limit,
-                                 guides, start, group_size, results,
-                                 transcripts, transcript_count);
+    /* A guide shard searches its slice of the rows; row numbers stay global. */
+    int total_guides = n_guides;
+    size_t guide_begin = (size_t)((uint64_t)total_guides * guide_shard.index / guide_shard.count);
+    size_t guide_end = (size_t)((uint64_t)total_guides * (guide_shard.index + 1) / guide_shard.count);
+    Guide *shard_guides = guides + guide_begin;
+    n_guides = (int)(guide_end - guide_begin);
+
+    if (ctx.options.engine == ENGINE_INDEX && !ctx.streamed) {
+        run_stats_lap(stats_ptr, "seed_index");
+        int seed_len = seed_length_for(shard_guides, n_guides, ctx.options.max_mismatches);
+        if (seed_len == 0) {
+            fprintf(stderr, "Warning: guides too short to split into %d seeds; using the packed engine\n",
+                    ctx.options.max_mismatches + 1);
+        } else if (prepare_seed_index(&ctx, seed_len) != 0) {
+            run_stats_free(stats_ptr);
+            free_search_context(&ctx);
+            free(guides);
+            string_pool_free(&genes);
+            return EXIT_FAILURE;
         }
     }
-
-    FILE *out = fopen(output_file, "w");
-    if (!out) {
-        fprintf(stderr, "Error: unable to open output file '%s': %s\n", output_file, strerror(errno));
-        free(valid_positions);
-        free(reference.data);
-        free(guides);
-        free_results(results, (size_t)n_guides);
-        free_transcript_info(transcripts, transcript_count);
-        return EXIT_FAILURE;
+    if (ctx.options.collapse_isoforms) {
+        run_stats_lap(stats_ptr, "collapse");
+        if (collapse_isoforms(&ctx) != 0) {
+            run_stats_free(stats_ptr);
+            free_search_context(&ctx);
+            free(guides);
+            string_pool_free(&genes);
+            return EXIT_FAILURE;
+        }
     }
 
-    fprintf(out, "Gene,Sequence,MM0,MM1,MM2,MM3,MM4,MM5,MM0_Transcripts,MM0_Genes\n");
-    for (int i = 0; i < n_guides; ++i) {
-        GuideResult *res = &results[i];
-        fprintf(out, "%s,%s", guides[i].gene, guides[i].sequence);
-        for (int mm = 0; mm <= MAX_MISMATCHES; ++mm) {
-            fprintf(out, ",%llu", (unsigned long long)res->counts[mm]);
-        }
+    GuideResult *results = (GuideResult *)xmalloc(((size_t)n_guides + 1) * sizeof(GuideResult));
+    memset(results, 0, ((size_t)n_guides + 1) * sizeof(GuideResult));
 
-        fputc(',', out);
-        if (res->mm0_count > 0) {
-            size_t printed = 0;
-            for (size_t idx = 0; idx < res->mm0_count; ++idx) {
-                size_t t_idx = res->mm0_transcripts[idx];
-                if (t_idx >= transcript_count) {
-                    continue;
-                }
-                if (printed > 0) {
-                    fputc('|', out);
-                }
-                fputs(transcripts[t_idx].transcript_id, out);
-                ++printed;
+    /*
+     * Repeated and cached sequences are resolved before the scan; the
+     * writer thread then only overlaps the search when neither applies.
+     */
+    ResultCache cache;
+    ResultCache *cache_ptr = open_run_cache(&cache, cache_dir, cache_from, &ctx, max_guide_len);
+    size_t searched = 0;
+    size_t checkpointed = 0;
+    run_stats_lap(stats_ptr, "search");
+    bool resolved;
+    if (checkpoint_file) {
+        if (search_checkpointed(&ctx, cache_ptr, checkpoint_file, (size_t)checkpoint_group, &genes, shard_guides,
+                                n_guides, guide_begin, results, &searched, &checkpointed) != 0) {
+            if (cache_ptr) {
+                close_run_cache(cache_ptr);
             }
+            run_stats_free(stats_ptr);
+            free(guides);
+            string_pool_free(&genes);
+            free_results(results, (size_t)n_guides);
+            free_search_context(&ctx);
+            return EXIT_FAILURE;
         }
+        resolved = true;
+    } else {
+        resolved = search_distinct(&ctx, cache_ptr, shard_guides, n_guides, results, &searched);
+    }
+    if (stats_ptr) {
+        stats_ptr->searched = searched;
+        stats_ptr->cached = cache_ptr ? cache_ptr->hits : 0;
+        stats_ptr->updated = cache_ptr ? cache_ptr->updated : 0;
+        stats_ptr->checkpointed = checkpointed;
+        stats_ptr->repeated = (uint64_t)n_guides - stats_ptr->searched - stats_ptr->cached - stats_ptr->updated -
+                              stats_ptr->checkpointed;
+    }
+    if (cache_ptr) {
+        close_run_cache(cache_ptr);
+    }
 
-        fputc(',', out);
-        if (res->mm0_count > 0) {
-            const char **gene_list = (const char **)xmalloc(res->mm0_count * sizeof(char *));
-            size_t gene_count = 0;
-            for (size_t idx = 0; idx < res->mm0_count; ++idx) {
-                size_t t_idx = res->mm0_transcripts[idx];
-                if (t_idx >= transcript_count) {
-                    continue;
-                }
-                const char *gene = transcripts[t_idx].gene_symbol ? transcripts[t_idx].gene_symbol : "Unknown";
-                bool seen = false;
-                for (size_t g = 0; g < gene_count; ++g) {
-                    if (strcmp(gene_list[g], gene) == 0) {
-                        seen = true;
-                        break;
-                    }
-                }
-                if (!seen) {
-                    gene_list[gene_count++] = gene;
-                }
-            }
-            for (size_t g = 0; g < gene_count; ++g) {
-                if (g > 0) {
-                    fputc('|', out);
-                }
-                fputs(gene_list[g], out);
-            }
-            free((void *)gene_list);
+    if (partial) {
+        if (!resolved) {
+            run_search(&ctx, shard_guides, n_guides, results, NULL);
+        }
+        run_stats_lap(stats_ptr, "output");
+        run_stats_count_results(stats_ptr, results, (size_t)n_guides);
+        PartialHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, PARTIAL_MAGIC, sizeof(header.magic));
+        header.version = PARTIAL_VERSION;
+        header.byte_order = INDEX_BYTE_ORDER;
+        header.max_mismatches = ctx.options.max_mismatches;
+        header.detail_mismatches = ctx.options.detail_mismatches;
+        header.reference_shard = reference_shard.index;
+        header.reference_shards = reference_shard.count;
+        header.guide_shard = guide_shard.index;
+        header.guide_shards = guide_shard.count;
+        header.caps_active = ctx.options.caps.active;
+        memcpy(header.caps, ctx.options.caps.max, sizeof(header.caps));
+        header.reference_digest = reference_digest(ctx.transcripts, ctx.transcript_count);
+        header.transcript_count = ctx.transcript_count;
+        header.total_guides = (uint64_t)total_guides;
+        header.guide_begin = guide_begin;
+        header.guide_count = (uint64_t)n_guides;
+        int status = write_partial(output_file, &header, &genes, shard_guides, results) == 0
+            ? EXIT_SUCCESS : EXIT_FAILURE;
+        if (run_stats_finish(stats_ptr, &ctx, stats_file) != 0) {
+            status = EXIT_FAILURE;
         }
+        free(guides);
+        string_pool_free(&genes);
+        free_results(results, (size_t)n_guides);
+        free_search_context(&ctx);
+        return status;
+    }
 
-        fputc('\n', out);
+    ResultSink sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.format = output_format;
+    sink.ctx = &ctx;
+    sink.guide_genes = &genes;
+    sink.guides = shard_guides;
+    sink.results = results;
+    sink.n_guides = (size_t)n_guides;
+    sink.first_row = guide_begin;
+    sink.stats = stats_ptr;
+    int status = EXIT_FAILURE;
+    if (result_sink_open(&sink, output_file, hits_file) == 0) {
+        search_into_sink(&sink, &ctx, resolved ? NULL : shard_guides, n_guides);
+        status = result_sink_close(&sink) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    run_stats_count_results(stats_ptr, results, (size_t)n_guides);
+    if (run_stats_finish(stats_ptr, &ctx, stats_file) != 0) {
+        status = EXIT_FAILURE;
     }
 
-    fclose(out);
-    free(valid_positions);
-    free(reference.data);
     free(guides);
+    string_pool_free(&genes);
     free_results(results, (size_t)n_guides);
-    free_transcript_info(transcripts, transcript_count);
-    return EXIT_SUCCESS;
+    free_search_context(&ctx);
+    return status;
 }
+
+#endif /* !OFFTARGET_LIBRARY */
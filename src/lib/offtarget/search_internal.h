@@ -0,0 +1,500 @@
+/*
+ * Internal interface of the off-target search, shared by search.c (reference
+ * loading, the scan engines and the one-shot search) and the subcommands
+ * built into the binary next to it: the result cache (cache.c),
+ * checkpoints (checkpoint.c), serve (serve.c), guides streamed on stdin
+ * (stream.c) and screen (screen.c).  Library builds (-DOFFTARGET_LIBRARY)
+ * compile search.c alone and only see the first half; their API is
+ * offtarget.h.
+ */
+#ifndef OFFTARGET_SEARCH_INTERNAL_H
+#define OFFTARGET_SEARCH_INTERNAL_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* sched_setaffinity, sched_getcpu */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#ifdef OFFTARGET_GPU
+#include "gpu.h"
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+static inline void omp_set_num_threads(int n) { (void)n; }
+static inline int omp_get_max_threads(void) { return 1; }
+static inline int omp_get_thread_num(void) { return 0; }
+static inline int omp_get_num_threads(void) { return 1; }
+static inline double omp_get_wtime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+#endif
+
+#define MAX_GUIDE_LEN 64
+#define MAX_MISMATCHES 5
+#define INDEX_BYTE_ORDER 0x01020304u    /* byte_order of every binary file written */
+#define DEFAULT_INDEX_WINDOW 23
+
+/* `gene` indexes the StringPool the guides were read into. */
+typedef struct {
+    char sequence[MAX_GUIDE_LEN + 1];
+    int length;
+    uint32_t gene;
+} Guide;
+
+typedef struct {
+    uint64_t counts[MAX_MISMATCHES + 1];
+    size_t *mm0_transcripts;
+    size_t mm0_count;
+    uint64_t *details;
+    size_t detail_count;
+    bool disqualified;
+    int disqualified_mm;
+    size_t disqualified_pos;
+    uint64_t *mismatch_positions;   /* --position-weights: per guide position, off-target windows */
+    int profile_length;             /*   mismatched there (NULL otherwise) */
+    double offtarget_score;
+} GuideResult;
+
+/*
+ * Per-level hit limits (--max-mmK).  A guide whose MMk count exceeds
+ * max[k] is retired from the scan; its counts then cover the reference up
+ * to and including the window that disqualified it.
+ */
+typedef struct {
+    uint64_t max[MAX_MISMATCHES + 1];
+    bool active;
+} CountCaps;
+
+/* `gene` is the index of `gene_symbol` among the reference's distinct symbols. */
+typedef struct {
+    size_t start;
+    size_t length;
+    char *transcript_id;
+    char *gene_symbol;
+    uint32_t gene;
+} TranscriptInfo;
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+typedef struct {
+    uint64_t *lo;
+    uint64_t *hi;
+    uint64_t *nmask;
+    uint64_t *valid;
+    size_t data_words;
+    size_t words;
+    size_t length;
+    void *mapping;
+    size_t mapping_size;
+    bool valid_mapped;
+    const uint64_t *valid_len[MAX_GUIDE_LEN + 1];
+} PackedReference;
+
+typedef enum {
+    ENGINE_PACKED,
+    ENGINE_BYTE,
+    ENGINE_INDEX,
+    ENGINE_GPU
+} SearchEngine;
+
+/* Kernel families, in increasing order of preference. */
+typedef enum {
+    SIMD_SCALAR,
+    SIMD_VEC128,    /* generic 128-bit vectors: NEON on aarch64, SSE2 on x86 */
+    SIMD_AVX2,
+    SIMD_AVX512
+} SimdLevel;
+
+typedef struct {
+    char **strings;
+    size_t count;
+    size_t capacity;
+    size_t *slots;
+    size_t slot_count;
+} StringTable;
+
+/* Interned gene symbols and copied transcript IDs, in blocks that never move. */
+typedef struct {
+    StringTable interned;
+    char **blocks;
+    size_t block_count;
+    size_t block_used;
+} StringPool;
+
+/*
+ * Lets a writer consume results while the search runs.  Engines mark guides
+ * complete as their groups finish, in any order; result_stream_wait hands
+ * the writer the next run of completed guides in input order (see
+ * result_writer_thread).
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    bool *done;
+    size_t count;
+} ResultStream;
+
+/*
+ * Work done by searches for --stats (NULL everywhere else): guides and
+ * windows scanned (packed and byte engines), seed-list entries the index
+ * engine verified, reference slices of --memory-budget scans, batches of
+ * guides streamed on stdin, and busy seconds per OpenMP thread.
+ */
+typedef struct {
+    uint64_t guides;
+    uint64_t windows;
+    uint64_t seed_candidates;
+    uint64_t reference_slices;
+    uint64_t guide_batches;
+    double *busy;
+    int threads;
+} SearchCounters;
+
+/* k-mer position index of the seed engine (see build_kmer_index). */
+typedef struct {
+    int k;
+    uint32_t *offsets;
+    uint32_t *positions;
+    uint64_t position_count;
+    bool mapped;
+} KmerIndex;
+
+/* TIGER_OFFTARGET_NUMA placement of the reference arrays (see search.c). */
+typedef enum {
+    NUMA_OFF,
+    NUMA_INTERLEAVE,
+    NUMA_REPLICATE
+} NumaMode;
+
+#define MAX_NUMA_NODES 64
+
+/* One node's copy of the reference arrays, each in its own node-bound mapping. */
+typedef struct {
+    void *mapping;                  /* lo, hi, nmask, valid, byte sequence */
+    size_t mapping_size;
+    void *kmer_mapping;             /* k-mer offsets and positions */
+    size_t kmer_mapping_size;
+    const uint64_t *lo;
+    const uint64_t *hi;
+    const uint64_t *nmask;
+    const uint64_t *valid;
+    const char *bytes;
+    const uint32_t *kmer_offsets;
+    const uint32_t *kmer_positions;
+} NumaReplica;
+
+typedef struct {
+    NumaMode mode;
+    int node_count;                 /* nodes with CPUs this process may run on */
+    int node_ids[MAX_NUMA_NODES];
+    short *cpu_node;                /* CPU number -> index into node_ids, -1 if unusable */
+    int cpu_limit;
+    NumaReplica *replicas;          /* node_count copies in replicate mode */
+    const uint32_t *placed_kmers;   /* offsets of the k-mer index last placed */
+#ifdef __linux__
+    cpu_set_t cpus[MAX_NUMA_NODES];
+#endif
+} NumaLayout;
+
+/* A guide as bit-planes (bit k = base k), as the seed engine and profiles compare it. */
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t n;
+    uint64_t length_mask;
+} GuideBits;
+
+/* Options shared by one-shot searches and serve. */
+typedef struct {
+    SearchEngine engine;
+    int max_mismatches;
+    int guide_length;       /* every guide must have this length, 0 = any */
+    CountCaps caps;
+    int detail_mismatches;  /* record hit details up to this level, -1 = none */
+    bool mismatch_profile;  /* --position-weights given */
+    double position_weights[MAX_GUIDE_LEN];
+    bool collapse_isoforms; /* scan each gene's distinct windows once (see CollapsedReference) */
+} SearchOptions;
+
+/*
+ * A loaded reference and everything derived from it.  Once loaded it is only
+ * read, so serve shares one context between concurrent requests.  The
+ * stored validity bitmap is computed for `window_len`; each search adds
+ * private bitmaps for its other guide lengths (see prepare_validity).  The
+ * byte engine keeps only that bitmap of `packed` next to the byte sequence.
+ * Searches only start windows in transcripts [shard_begin, shard_end): all
+ * of them unless --reference-shard picked a slice, or only in the
+ * `selected` transcripts (sorted by start) when a cache delta set them.
+ * With --collapse-isoforms, `collapsed` scans window_len-base guides.
+ */
+typedef struct {
+    SearchOptions options;
+    TranscriptInfo *transcripts;
+    size_t transcript_count;
+    size_t gene_count;              /* distinct gene symbols (TranscriptInfo.gene < gene_count) */
+    StringPool names;               /* transcript names when loaded from FASTA */
+    size_t shard_begin;
+    size_t shard_end;
+    const TranscriptInfo *selected; /* NULL = the shard */
+    size_t selected_count;
+    bool from_index;
+    PackedReference packed;
+    KmerIndex kmers;
+    Buffer reference;               /* byte engine only */
+    int window_len;
+    int threads;
+    SimdLevel simd;
+    NumaLayout numa;                /* TIGER_OFFTARGET_NUMA placement and replicas */
+#ifdef OFFTARGET_GPU
+    OtGpuReference *gpu;            /* device copy of the planes, --engine gpu only */
+#endif
+    SearchCounters *counters;       /* --stats; NULL in serve and the library */
+    struct CollapsedReference *collapsed; /* --collapse-isoforms */
+    struct StreamedReference *streamed;   /* --memory-budget; no sequence is loaded */
+} SearchContext;
+
+/* 2-bit code (A=0 C=1 G=2 T=3) of the base at `pos`; *is_n marks an N. */
+static inline unsigned packed_base(const PackedReference *ref, size_t pos, bool *is_n) {
+    size_t word = pos / 64;
+    unsigned bit = (unsigned)(pos % 64);
+    *is_n = (ref->nmask[word] >> bit) & 1;
+    return (unsigned)(((ref->lo[word] >> bit) & 1) | (((ref->hi[word] >> bit) & 1) << 1));
+}
+
+/* search.c */
+void *xmalloc(size_t size);
+void buffer_init(Buffer *buf, size_t initial_capacity);
+void string_table_init(StringTable *table);
+void string_table_free(StringTable *table);
+size_t string_table_find(const StringTable *table, const char *s);
+size_t string_table_intern(StringTable *table, char *s);
+void string_pool_init(StringPool *pool);
+void string_pool_free(StringPool *pool);
+const char *string_pool_get(const StringPool *pool, uint32_t idx);
+void free_results(GuideResult *results, size_t count);
+void pack_word(const char *sequence, size_t length, size_t word, uint64_t planes[3]);
+void guide_bits(const Guide *guide, GuideBits *bits);
+int compare_size(const void *a, const void *b);
+void search_options_init(SearchOptions *options);
+int validate_search_options(const SearchOptions *options);
+int load_search_context(SearchContext *ctx, const char *reference_file, int window_len);
+int prepare_seed_index(SearchContext *ctx, int seed_len);
+void free_search_context(SearchContext *ctx);
+void run_search(const SearchContext *ctx, const Guide *guides, int n_guides, GuideResult *results,
+                ResultStream *stream);
+int prepare_seed_index_for_window(SearchContext *ctx, int window_len);
+
+#ifndef OFFTARGET_LIBRARY
+
+#define OPT_MAX_MM 256  /* getopt codes for --max-mm0 .. --max-mm5 */
+
+#define SEARCH_LONG_OPTIONS \
+    {"engine", required_argument, NULL, 'e'}, \
+    {"max-mismatches", required_argument, NULL, 'm'}, \
+    {"guide-length", required_argument, NULL, 'g'}, \
+    {"position-weights", required_argument, NULL, 'W'}, \
+    {"collapse-isoforms", no_argument, NULL, 'I'}, \
+    {"max-mm0", required_argument, NULL, OPT_MAX_MM + 0}, \
+    {"max-mm1", required_argument, NULL, OPT_MAX_MM + 1}, \
+    {"max-mm2", required_argument, NULL, OPT_MAX_MM + 2}, \
+    {"max-mm3", required_argument, NULL, OPT_MAX_MM + 3}, \
+    {"max-mm4", required_argument, NULL, OPT_MAX_MM + 4}, \
+    {"max-mm5", required_argument, NULL, OPT_MAX_MM + 5}
+
+/* Header of an --output-format columnar file (see columnar_open). */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t max_mismatches;
+    uint32_t caps_active;
+    uint64_t caps[MAX_MISMATCHES + 1];
+    uint64_t guide_count;
+    uint64_t transcript_count;
+    uint64_t counts_offset;
+    uint64_t disqualified_mm_offset;
+    uint64_t disqualified_pos_offset;
+    uint64_t guide_strings_offset;
+    uint64_t transcripts_offset;
+    uint64_t mm0_offsets_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t mm0_transcripts_offset;
+    uint64_t mm0_transcript_count;
+    uint64_t file_size;
+} ColumnarHeader;
+
+typedef enum {
+    OUTPUT_CSV,
+    OUTPUT_COLUMNAR
+} OutputFormat;
+
+/* --stats record of one run (see run_stats_finish). */
+#define STATS_MAX_PHASES 8
+
+typedef struct {
+    const char *name;
+    double wall;
+    double cpu;
+} StatsPhase;
+
+typedef struct {
+    StatsPhase phases[STATS_MAX_PHASES];
+    int phase_count;
+    int current;                    /* phase being timed, -1 = none */
+    double lap_wall;
+    double lap_cpu;
+    double start_wall;
+    double start_cpu;
+    SearchCounters counters;
+    uint64_t rows;
+    uint64_t searched;
+    uint64_t cached;
+    uint64_t updated;
+    uint64_t repeated;
+    uint64_t checkpointed;
+    uint64_t hits[MAX_MISMATCHES + 1];
+    uint64_t disqualified;
+} RunStats;
+
+/*
+ * Destination of a one-shot search's results (and --hits-out rows),
+ * written incrementally by result_writer_thread.
+ */
+typedef struct {
+    OutputFormat format;
+    const SearchContext *ctx;
+    const StringPool *guide_genes;
+    const Guide *guides;
+    GuideResult *results;
+    size_t n_guides;
+    size_t first_row;               /* input row of guides[0] (guide shards) */
+    const char *path;
+    FILE *out;                      /* CSV */
+    FILE *hits;                     /* --hits-out, optional */
+    uint32_t *gene_stamp;
+    int fd;                         /* columnar */
+    ColumnarHeader header;
+    uint64_t *scratch;
+    size_t scratch_capacity;
+    ResultStream *stream;
+    RunStats *stats;                /* --stats, optional */
+    bool failed;
+} ResultSink;
+
+/* One guide's record in a --partial file or checkpoint (see write_partial_guide). */
+typedef struct {
+    uint64_t counts[MAX_MISMATCHES + 1];
+    uint64_t mm0_count;
+    uint64_t detail_count;
+    uint64_t disqualified_pos;
+    int32_t disqualified_mm;        /* -1 unless a cap retired the guide */
+    uint32_t gene_length;
+    uint32_t sequence_length;
+    uint32_t reserved;
+} PartialGuide;
+
+/* Results of earlier runs kept under --cache-dir (cache.c). */
+typedef struct {
+    int fd;
+    char *path;
+    void *mapping;
+    size_t mapping_size;
+    size_t size;                    /* end of the last complete record read at open */
+    StringTable sequences;          /* sequence -> records[] index */
+    const struct CacheRecord **records;
+    Buffer pending;                 /* records to append at close */
+    size_t hits;
+    struct CacheDelta *delta;       /* --cache-from: cache of an earlier reference release */
+    size_t updated;                 /* results carried over through `delta` */
+} ResultCache;
+
+/* search.c */
+void buffer_reserve(Buffer *buf, size_t additional);
+char *xstrdup(const char *s);
+int parse_guide_line(char *line, StringPool *genes, int required_length, Guide *guide);
+int read_guides(FILE *fp, const char *filename, StringPool *genes, int required_length,
+                Guide **guides_out, int *max_len_out);
+int collapse_isoforms(SearchContext *ctx);
+void print_usage(const char *prog);
+int parse_size_option(const char *name, const char *value, size_t min_kib, size_t *out);
+int parse_int_option(const char *name, const char *value, int min, int max, int *out);
+int parse_search_option(int opt, const char *arg, SearchOptions *options);
+void write_results(FILE *out, const SearchContext *ctx, const StringPool *guide_genes,
+                   const Guide *guides, int n_guides, const GuideResult *results);
+void run_stats_attach(RunStats *stats, SearchContext *ctx);
+void run_stats_free(RunStats *stats);
+void run_stats_lap(RunStats *stats, const char *name);
+void run_stats_count_results(RunStats *stats, const GuideResult *results, size_t count);
+int run_stats_finish(RunStats *stats, const SearchContext *ctx, const char *path);
+bool pwrite_all(int fd, const void *data, size_t size, uint64_t offset);
+int result_sink_open(ResultSink *sink, const char *path, const char *hits_path);
+int result_sink_close(ResultSink *sink);
+void search_into_sink(ResultSink *sink, const SearchContext *ctx, const Guide *guides, int n_guides);
+uint64_t fnv1a_bytes(uint64_t h, const void *data, size_t size);
+uint64_t reference_digest(const TranscriptInfo *transcripts, size_t transcript_count);
+void write_partial_guide(FILE *out, const char *gene, const Guide *guide, const GuideResult *res);
+int read_exact(FILE *fp, void *data, size_t size);
+void screen_candidates(const SearchContext *ctx, const Guide *guides, int n_guides, bool *hit);
+
+/* cache.c */
+uint64_t cache_options_digest(const SearchContext *ctx);
+ResultCache *open_run_cache(ResultCache *cache, const char *dir, const char *previous_file,
+                            const SearchContext *ctx, int window_len);
+void close_run_cache(ResultCache *cache);
+bool search_distinct(const SearchContext *ctx, ResultCache *cache, const Guide *guides, int n_guides,
+                     GuideResult *results, size_t *searched);
+
+/* checkpoint.c */
+int search_checkpointed(const SearchContext *ctx, ResultCache *cache, const char *path, size_t group_size,
+                        const StringPool *genes, const Guide *guides, int n_guides, size_t first_row,
+                        GuideResult *results, size_t *searched, size_t *restored_guides);
+
+/* serve.c */
+int serve_main(int argc, char *argv[], const char *prog);
+
+/* stream.c */
+int stream_main(SearchContext *ctx, const char *reference_file, const char *output_file,
+                const char *hits_file, const char *cache_dir, const char *cache_from, OutputFormat output_format,
+                bool sharded, int window_len, RunStats *stats, const char *stats_file);
+
+/* screen.c */
+int screen_main(int argc, char *argv[], const char *prog);
+
+#endif /* !OFFTARGET_LIBRARY */
+
+#endif /* OFFTARGET_SEARCH_INTERNAL_H */
@@ -0,0 +1,285 @@
+/*
+ * serve: framed request/response loop over a pair of streams.  Every
+ * request parses its own guides and results, so any number of streams can
+ * run against one context at once.
+ */
+#include "search_internal.h"
+
+#define DEFAULT_SERVE_MAX_REQUEST ((size_t)1 << 30)    /* --max-request-bytes */
+
+static unsigned long serve_request_counter = 0;
+static const char *serve_socket_path = NULL;
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1e3 + (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void serve_search_request(const SearchContext *ctx, char *payload, size_t length, FILE *out) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long request_id = __atomic_add_fetch(&serve_request_counter, 1, __ATOMIC_RELAXED);
+
+    FILE *in = length > 0 ? fmemopen(payload, length, "r") : NULL;
+    if (!in) {
+        fprintf(out, "ERR empty request\n");
+        return;
+    }
+    Guide *guides = NULL;
+    int max_guide_len = 0;
+    StringPool genes;
+    string_pool_init(&genes);
+    int n_guides = read_guides(in, "<request>", &genes, ctx->options.guide_length, &guides, &max_guide_len);
+    fclose(in);
+    if (n_guides <= 0) {
+        fprintf(out, "ERR no usable guides in request\n");
+        string_pool_free(&genes);
+        return;
+    }
+
+    GuideResult *results = (GuideResult *)xmalloc((size_t)n_guides * sizeof(GuideResult));
+    memset(results, 0, (size_t)n_guides * sizeof(GuideResult));
+    run_search(ctx, guides, n_guides, results, NULL);
+
+    char *body = NULL;
+    size_t body_length = 0;
+    FILE *mem = open_memstream(&body, &body_length);
+    if (!mem) {
+        fprintf(out, "ERR unable to buffer results: %s\n", strerror(errno));
+    } else {
+        write_results(mem, ctx, &genes, guides, n_guides, results);
+        fclose(mem);
+        double ms = elapsed_ms(&start);
+        fprintf(out, "OK %zu %.3f\n", body_length, ms);
+        fwrite(body, 1, body_length, out);
+        fprintf(stderr, "serve: request %lu: %d guides in %.3f ms\n", request_id, n_guides, ms);
+    }
+
+    free(body);
+    free_results(results, (size_t)n_guides);
+    free(guides);
+    string_pool_free(&genes);
+}
+
+/*
+ * Answers requests from `in` until QUIT or EOF.  A SEARCH header over
+ * `max_request` bytes is refused before anything is allocated for it; the
+ * stream is then closed, since its payload cannot be skipped safely.
+ */
+static void serve_stream(const SearchContext *ctx, size_t max_request, FILE *in, FILE *out) {
+    char *line = NULL;
+    size_t linecap = 0;
+    char *payload = NULL;
+    size_t payload_cap = 0;
+
+    fputs("READY\n", out);
+    fflush(out);
+    while (getline(&line, &linecap, in) > 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strcmp(line, "QUIT") == 0) {
+            break;
+        }
+        if (strcmp(line, "PING") == 0) {
+            fputs("PONG\n", out);
+        } else if (strncmp(line, "SEARCH ", 7) == 0) {
+            char *endptr = NULL;
+            unsigned long long length = strtoull(line + 7, &endptr, 10);
+            if (endptr == line + 7 || *endptr) {
+                fputs("ERR malformed SEARCH header\n", out);
+                break;
+            }
+            if (length > max_request) {
+                fputs("ERR request too large\n", out);
+                break;
+            }
+            if (length + 1 > payload_cap) {
+                payload_cap = (size_t)length + 1;
+                free(payload);
+                payload = (char *)xmalloc(payload_cap);
+            }
+            if (fread(payload, 1, (size_t)length, in) != (size_t)length) {
+                break;
+            }
+            payload[length] = '\0';
+            serve_search_request(ctx, payload, (size_t)length, out);
+        } else {
+            fprintf(out, "ERR unknown command '%s'\n", line);
+        }
+        if (fflush(out) != 0) {
+            break;
+        }
+    }
+    free(payload);
+    free(line);
+}
+
+typedef struct {
+    const SearchContext *ctx;
+    size_t max_request;
+    int fd;
+} ServeConnection;
+
+static void *serve_connection_thread(void *arg) {
+    ServeConnection *conn = (ServeConnection *)arg;
+    if (conn->ctx->threads > 0) {
+        omp_set_num_threads(conn->ctx->threads);
+    }
+    int out_fd = dup(conn->fd);
+    FILE *in = fdopen(conn->fd, "r");
+    FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+    if (in && out) {
+        serve_stream(conn->ctx, conn->max_request, in, out);
+    }
+    if (in) {
+        fclose(in);
+    } else {
+        close(conn->fd);
+    }
+    if (out) {
+        fclose(out);
+    } else if (out_fd >= 0) {
+        close(out_fd);
+    }
+    free(conn);
+    return NULL;
+}
+
+static void serve_remove_socket(int sig) {
+    if (serve_socket_path) {
+        unlink(serve_socket_path);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static int serve_socket(const SearchContext *ctx, size_t max_request, const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path '%s' is too long\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        fprintf(stderr, "Error: unable to listen on '%s': %s\n", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    serve_socket_path = path;
+    signal(SIGINT, serve_remove_socket);
+    signal(SIGTERM, serve_remove_socket);
+    fprintf(stderr, "serve: listening on %s\n", path);
+
+    for (;;) {
+        int client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            fprintf(stderr, "Error: accept failed: %s\n", strerror(errno));
+            break;
+        }
+        ServeConnection *conn = (ServeConnection *)xmalloc(sizeof(ServeConnection));
+        conn->ctx = ctx;
+        conn->max_request = max_request;
+        conn->fd = client;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection_thread, conn) != 0) {
+            fprintf(stderr, "Error: unable to start connection thread\n");
+            close(client);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    close(fd);
+    unlink(path);
+    serve_socket_path = NULL;
+    return -1;
+}
+
+int serve_main(int argc, char *argv[], const char *prog) {
+    SearchContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    search_options_init(&ctx.options);
+    int window_len = DEFAULT_INDEX_WINDOW;
+    const char *socket_path = NULL;
+    size_t max_request = DEFAULT_SERVE_MAX_REQUEST;
+
+    static const struct option long_options[] = {
+        SEARCH_LONG_OPTIONS,
+        {"window-length", required_argument, NULL, 'w'},
+        {"socket", required_argument, NULL, 's'},
+        {"max-request-bytes", required_argument, NULL, 'M'},
+        {NULL, 0, NULL, 0}
+    };
+
+    optind = 1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        if (opt == 'w') {
+            if (parse_int_option("--window-length", optarg, 1, MAX_GUIDE_LEN, &window_len) != 0) {
+                return EXIT_FAILURE;
+            }
+        } else if (opt == 's') {
+            socket_path = optarg;
+        } else if (opt == 'M') {
+            if (parse_size_option("--max-request-bytes", optarg, 1, &max_request) != 0) {
+                return EXIT_FAILURE;
+            }
+        } else {
+            int handled = parse_search_option(opt, optarg, &ctx.options);
+            if (handled <= 0) {
+                if (handled == 0) {
+                    print_usage(prog);
+                }
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    if (argc - optind < 1) {
+        print_usage(prog);
+        return EXIT_FAILURE;
+    }
+    if (validate_search_options(&ctx.options) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (ctx.options.guide_length > 0) {
+        window_len = ctx.options.guide_length;
+    }
+
+    if (load_search_context(&ctx, argv[optind], window_len) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (ctx.options.engine == ENGINE_INDEX && prepare_seed_index_for_window(&ctx, window_len) != 0) {
+        free_search_context(&ctx);
+        return EXIT_FAILURE;
+    }
+    if (ctx.options.collapse_isoforms && collapse_isoforms(&ctx) != 0) {
+        free_search_context(&ctx);
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "serve: loaded %zu transcripts\n", ctx.transcript_count);
+
+    signal(SIGPIPE, SIG_IGN);
+    int status = EXIT_SUCCESS;
+    if (socket_path) {
+        status = serve_socket(&ctx, max_request, socket_path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else {
+        serve_stream(&ctx, max_request, stdin, stdout);
+    }
+    free_search_context(&ctx);
+    return status;
+}
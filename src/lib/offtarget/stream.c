@@ -0,0 +1,214 @@
+/*
+ * '-' as the guides file: rows stream in on stdin, for producers that emit
+ * guides over time (the workflow pipes in TIGER's predictions gene by
+ * gene).  A reader thread queues lines as they arrive; the search takes
+ * whatever has queued (at least one row, at most STREAM_MAX_BATCH),
+ * searches it while more arrive and writes its rows in input order, so
+ * batches grow while the producer outpaces the search.
+ */
+#include "search_internal.h"
+
+#define STREAM_MAX_BATCH 4096
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    FILE *in;
+    char **lines;
+    size_t count;
+    size_t capacity;
+    bool eof;
+} LineQueue;
+
+static void *line_reader_thread(void *arg) {
+    LineQueue *queue = (LineQueue *)arg;
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    bool header = true;
+    while ((linelen = getline(&line, &linecap, queue->in)) != -1) {
+        if (header || linelen <= 1) {
+            header = false;
+            continue;
+        }
+        char *copy = xstrdup(line);
+        pthread_mutex_lock(&queue->lock);
+        if (queue->count == queue->capacity) {
+            queue->capacity = queue->capacity ? queue->capacity * 2 : 1024;
+            queue->lines = (char **)realloc(queue->lines, queue->capacity * sizeof(char *));
+            if (!queue->lines) {
+                fprintf(stderr, "Error: realloc failed while queueing guides\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        queue->lines[queue->count++] = copy;
+        pthread_cond_signal(&queue->ready);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    free(line);
+
+    pthread_mutex_lock(&queue->lock);
+    queue->eof = true;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+/* Waits for queued lines and moves up to `max` of them to `out`; 0 once the input is exhausted. */
+static size_t line_queue_take(LineQueue *queue, char **out, size_t max) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->eof) {
+        pthread_cond_wait(&queue->ready, &queue->lock);
+    }
+    size_t taken = queue->count < max ? queue->count : max;
+    memcpy(out, queue->lines, taken * sizeof(char *));
+    memmove(queue->lines, queue->lines + taken, (queue->count - taken) * sizeof(char *));
+    queue->count -= taken;
+    pthread_mutex_unlock(&queue->lock);
+    return taken;
+}
+
+static int search_guide_stream(const SearchContext *ctx, FILE *in, StringPool *genes, ResultCache *cache,
+                               ResultSink *sink) {
+    LineQueue queue;
+    memset(&queue, 0, sizeof(queue));
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.ready, NULL);
+    queue.in = in;
+
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, line_reader_thread, &queue) != 0) {
+        fprintf(stderr, "Error: unable to start the guide reader thread\n");
+        pthread_cond_destroy(&queue.ready);
+        pthread_mutex_destroy(&queue.lock);
+        return -1;
+    }
+
+    char **lines = (char **)xmalloc(STREAM_MAX_BATCH * sizeof(char *));
+    Guide *guides = (Guide *)xmalloc(STREAM_MAX_BATCH * sizeof(Guide));
+    GuideResult *results = (GuideResult *)xmalloc(STREAM_MAX_BATCH * sizeof(GuideResult));
+    int status = 0;
+    for (;;) {
+        run_stats_lap(sink->stats, "guides");
+        size_t taken = line_queue_take(&queue, lines, STREAM_MAX_BATCH);
+        if (taken == 0) {
+            break;
+        }
+        int n_guides = 0;
+        for (size_t k = 0; k < taken; ++k) {
+            int parsed = status == 0 ? parse_guide_line(lines[k], genes, ctx->options.guide_length, &guides[n_guides]) : 0;
+            if (parsed < 0) {
+                status = -1;  // keep draining so the producer is not blocked on a full pipe
+            } else {
+                n_guides += parsed;
+            }
+            free(lines[k]);
+        }
+        if (status != 0 || n_guides == 0) {
+            continue;
+        }
+
+        memset(results, 0, (size_t)n_guides * sizeof(GuideResult));
+        sink->guides = guides;
+        sink->results = results;
+        sink->n_guides = (size_t)n_guides;
+        size_t batch_searched = 0;
+        run_stats_lap(sink->stats, "search");
+        bool resolved = search_distinct(ctx, cache, guides, n_guides, results, &batch_searched);
+        if (sink->stats) {
+            sink->stats->searched += batch_searched;
+        }
+        search_into_sink(sink, ctx, resolved ? NULL : guides, n_guides);
+        run_stats_count_results(sink->stats, results, (size_t)n_guides);
+        sink->first_row += (size_t)n_guides;
+        if (ctx->counters) {
+            ctx->counters->guide_batches++;
+        }
+        if (sink->out) {
+            fflush(sink->out);
+        }
+    }
+
+    pthread_join(reader, NULL);
+    free(queue.lines);
+    pthread_cond_destroy(&queue.ready);
+    pthread_mutex_destroy(&queue.lock);
+    free(lines);
+    free(guides);
+    free(results);
+
+    if (status == 0 && sink->first_row == 0) {
+        fprintf(stderr, "Error: no guides found in '<stdin>'\n");
+        status = -1;
+    }
+    return status;
+}
+
+/* Main search over guides streamed on stdin (guides file '-'). */
+int stream_main(SearchContext *ctx, const char *reference_file, const char *output_file,
+                const char *hits_file, const char *cache_dir, const char *cache_from,
+                OutputFormat output_format,
+                bool sharded, int window_len, RunStats *stats, const char *stats_file) {
+    if (sharded) {
+        fprintf(stderr, "Error: streamed guides cannot be sharded or written as a partial\n");
+        return EXIT_FAILURE;
+    }
+    if (output_format != OUTPUT_CSV) {
+        fprintf(stderr, "Error: --output-format columnar needs the guide count up front; "
+                "streamed guides are written as CSV\n");
+        return EXIT_FAILURE;
+    }
+
+    run_stats_lap(stats, "reference");
+    if (load_search_context(ctx, reference_file, window_len) != 0) {
+        run_stats_free(stats);
+        return EXIT_FAILURE;
+    }
+    if (stats) {
+        run_stats_attach(stats, ctx);
+    }
+    run_stats_lap(stats, "seed_index");
+    if (ctx->options.engine == ENGINE_INDEX && prepare_seed_index_for_window(ctx, window_len) != 0) {
+        run_stats_free(stats);
+        free_search_context(ctx);
+        return EXIT_FAILURE;
+    }
+    if (ctx->options.collapse_isoforms && collapse_isoforms(ctx) != 0) {
+        run_stats_free(stats);
+        free_search_context(ctx);
+        return EXIT_FAILURE;
+    }
+
+    StringPool genes;
+    string_pool_init(&genes);
+    ResultSink sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.format = OUTPUT_CSV;
+    sink.ctx = ctx;
+    sink.guide_genes = &genes;
+    sink.stats = stats;
+    ResultCache cache;
+    ResultCache *cache_ptr = open_run_cache(&cache, cache_dir, cache_from, ctx, window_len);
+    int status = EXIT_FAILURE;
+    if (result_sink_open(&sink, output_file, hits_file) == 0) {
+        int streamed = search_guide_stream(ctx, stdin, &genes, cache_ptr, &sink);
+        status = result_sink_close(&sink) == 0 && streamed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (cache_ptr) {
+        if (stats) {
+            stats->cached = cache_ptr->hits;
+            stats->updated = cache_ptr->updated;
+        }
+        close_run_cache(cache_ptr);
+    }
+    if (stats) {
+        stats->repeated = stats->rows - stats->searched - stats->cached - stats->updated;
+    }
+    if (run_stats_finish(stats, ctx, stats_file) != 0) {
+        status = EXIT_FAILURE;
+    }
+
+    string_pool_free(&genes);
+    free_search_context(ctx);
+    return status;
+}
@@ -1,6 +1,13 @@
 import csv
+import ctypes
+import gzip
+import json
 import os
+import random
+import re
+import struct
 import subprocess
+import zlib
 from pathlib import Path
 import tempfile
 
@@ -39,13 +46,36 @@ def _brute_counts(sequence: str, transcripts) -> list[int]:
     return counts
 
 
-def test_offtarget_binary_multi_thread(tmp_path: Path):
+def _build_if_stale(target: str) -> Path:
     repo_root = Path(__file__).resolve().parents[2]
-    binary_path = repo_root / "bin" / "offtarget_search"
+    built = repo_root / target
+    source_dir = repo_root / "src" / "lib" / "offtarget"
+    sources = [*source_dir.glob("*.c"), *source_dir.glob("*.h"), source_dir / "gpu.cu"]
+
+    # Build only when the output is missing or older than its sources
+    if not built.exists() or built.stat().st_mtime < max(src.stat().st_mtime for src in sources):
+        subprocess.run(["make", target], cwd=repo_root, check=True, capture_output=True)
+    return built
+
+
+def _ensure_binary() -> Path:
+    return _build_if_stale("bin/offtarget_search")
+
+
+def _run_search(binary_path: Path, guides_path: Path, fasta_path: Path,
+                output_path: Path, *extra_args: str) -> list[dict]:
+    subprocess.run(
+        [str(binary_path), *extra_args, str(guides_path), str(fasta_path), str(output_path)],
+        check=True,
+        capture_output=True,
+        text=True,
+    )
+    with output_path.open("r", encoding="utf-8") as fh:
+        return list(csv.DictReader(fh))
+
 
-    # Ensure the binary is built
-    if not binary_path.exists():
-        subprocess.run(["make", "bin/offtarget_search"], cwd=repo_root, check=True)
+def test_offtarget_binary_multi_thread(tmp_path: Path):
+    binary_path = _ensure_binary()
 
     fasta_contents = (
         ">tx1\n"
@@ -103,3 +133,1097 @@ def test_offtarget_binary_multi_thread(tmp_path: Path):
             int(row["MM5"]),
         ]
         assert observed == counts, f"Mismatches for {row['Gene']} differ"
+
+
+def _write_random_case(tmp_path: Path):
+    rng = random.Random(13)
+
+    # Transcripts longer than one 256-base packed block, with N runs and
+    # soft-masked bases, so word and transcript boundaries are exercised.
+    transcripts = []
+    for length in (70, 300, 523, 64, 1000):
+        seq = "".join(rng.choice("ACGT") for _ in range(length))
+        transcripts.append(seq)
+    transcripts[2] = transcripts[2][:100] + "NNNNN" + transcripts[2][105:]
+    transcripts[4] = transcripts[4][:500] + transcripts[1][:200] + transcripts[4][700:]
+
+    fasta_lines = []
+    for idx, seq in enumerate(transcripts):
+        fasta_lines.append(f">tx{idx}|g{idx}|-|-|Gene{idx}-201|Gene{idx}|{len(seq)}|")
+        body = seq.lower() if idx == 3 else seq
+        fasta_lines.extend(body[i:i + 60] for i in range(0, len(body), 60))
+    fasta_path = tmp_path / "reference.fa"
+    _write_file(fasta_path, "\n".join(fasta_lines) + "\n")
+
+    guides = []
+    for idx in range(9):
+        source = transcripts[rng.randrange(len(transcripts))].replace("N", "A")
+        start = rng.randrange(len(source) - 23)
+        window = list(source[start:start + 23])
+        for _ in range(idx % 4):
+            window[rng.randrange(23)] = rng.choice("ACGT")
+        guides.append("".join(window))
+    guides.append(transcripts[1][:23])
+    guides_path = tmp_path / "guides.csv"
+    _write_file(
+        guides_path,
+        "Gene,Sequence\n" + "".join(f"Guide{i},{seq}\n" for i, seq in enumerate(guides)),
+    )
+    return fasta_path, guides_path, [seq.upper() for seq in transcripts]
+
+
+def test_offtarget_engines_agree(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, reference = _write_random_case(tmp_path)
+
+    packed_rows = _run_search(binary_path, guides_path, fasta_path,
+                              tmp_path / "packed.csv", "--engine", "packed")
+    byte_rows = _run_search(binary_path, guides_path, fasta_path,
+                            tmp_path / "byte.csv", "--engine", "byte")
+    assert packed_rows == byte_rows
+
+    for row in packed_rows:
+        observed = [int(row[f"MM{mm}"]) for mm in range(6)]
+        assert observed == _brute_counts(row["Sequence"], reference), row["Gene"]
+    assert packed_rows[-1]["MM0_Transcripts"] == "tx1|tx4"
+
+    # The experimental GPU engine falls back to the packed scan when this
+    # build has no backend (or the device fails to open)
+    run = subprocess.run(
+        [str(binary_path), "--engine", "gpu", str(guides_path), str(fasta_path), str(tmp_path / "gpu.csv")],
+        check=True, capture_output=True, text=True,
+    )
+    assert (tmp_path / "gpu.csv").read_text() == (tmp_path / "packed.csv").read_text()
+    assert not run.stderr or "using the packed engine" in run.stderr
+
+
+def test_offtarget_mixed_lengths_use_own_windows(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, _, reference = _write_random_case(tmp_path)
+
+    # Guides ending at a transcript's last base only fit windows a longer
+    # guide in the same batch could not use.
+    guides = [reference[0][-18:], reference[1][-20:], reference[4][-23:], reference[4][:28]]
+    guides_path = tmp_path / "mixed.csv"
+    _write_file(guides_path, "Gene,Sequence\n" + "".join(f"Guide{i},{seq}\n" for i, seq in enumerate(guides)))
+
+    for engine in ("packed", "byte", "index"):
+        rows = _run_search(binary_path, guides_path, fasta_path, tmp_path / f"{engine}.csv",
+                           "--engine", engine, "--max-mismatches", "5")
+        for row in rows:
+            observed = [int(row[f"MM{mm}"]) for mm in range(6)]
+            assert observed == _brute_counts(row["Sequence"], reference), (engine, row["Gene"])
+            assert int(row["MM0"]) >= 1, (engine, row["Gene"])
+
+
+def test_offtarget_mm0_genes_listed_once(tmp_path: Path):
+    binary_path = _ensure_binary()
+    site = "ACGTTGCAAGGCTTACGATCGAT"
+    genes = ["GeneA", "GeneB", "GeneA", "GeneC", "GeneB"]
+    fasta_path = tmp_path / "reference.fa"
+    _write_file(fasta_path, "".join(
+        f">tx{i}|g|-|-|{gene}-20{i}|{gene}|46|\nTTTTTTTTTTT{site}GGGGGGGGGGGG\n" for i, gene in enumerate(genes)
+    ))
+    long_name = "L" * 300
+    guides_path = tmp_path / "guides.csv"
+    _write_file(guides_path, f"Gene,Sequence\n{long_name},{site}\nShort,{site}\n")
+
+    rows = _run_search(binary_path, guides_path, fasta_path, tmp_path / "out.csv")
+    assert [row["Gene"] for row in rows] == [long_name, "Short"]
+    for row in rows:
+        assert row["MM0"] == "5"
+        assert row["MM0_Transcripts"] == "tx0|tx1|tx2|tx3|tx4"
+        assert row["MM0_Genes"] == "GeneA|GeneB|GeneC"
+
+
+def test_offtarget_simd_levels_agree(tmp_path: Path, monkeypatch):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, _ = _write_random_case(tmp_path)
+    expected = _run_search(binary_path, guides_path, fasta_path, tmp_path / "default.csv")
+
+    # Levels above what the CPU supports fall back, so this runs anywhere.
+    for level in ("scalar", "vec128", "avx2", "avx512"):
+        monkeypatch.setenv("TIGER_OFFTARGET_SIMD", level)
+        for engine in ("packed", "byte"):
+            rows = _run_search(binary_path, guides_path, fasta_path,
+                               tmp_path / f"{level}_{engine}.csv", "--engine", engine)
+            assert rows == expected, (level, engine)
+
+
+def test_offtarget_mismatch_limit_and_long_guides(tmp_path: Path, monkeypatch):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, reference = _write_random_case(tmp_path)
+
+    # 23-nt guides run the fixed-length kernels; 40- and 64-nt guides need
+    # two-vector compares and share groups with shorter ones.
+    rng = random.Random(5)
+    long_guides = []
+    for length in (40, 64, 33, 64):
+        start = rng.randrange(len(reference[4]) - length)
+        window = list(reference[4][start:start + length])
+        for _ in range(len(long_guides)):
+            window[rng.randrange(length)] = rng.choice("ACGT")
+        long_guides.append("".join(window))
+    mixed_path = tmp_path / "mixed.csv"
+    _write_file(mixed_path, guides_path.read_text(encoding="utf-8")
+                + "".join(f"Long{i},{seq}\n" for i, seq in enumerate(long_guides)))
+
+    for level in ("scalar", "vec128", "avx2", "avx512"):
+        monkeypatch.setenv("TIGER_OFFTARGET_SIMD", level)
+        for engine in ("packed", "byte", "index"):
+            for limit in (0, 2, 5):
+                rows = _run_search(binary_path, mixed_path, fasta_path, tmp_path / "out.csv",
+                                   "--engine", engine, "--max-mismatches", str(limit))
+                for row in rows:
+                    expected = _brute_counts(row["Sequence"], reference)
+                    observed = [row[f"MM{mm}"] for mm in range(6)]
+                    assert observed == [str(expected[mm]) if mm <= limit else "" for mm in range(6)], \
+                        (level, engine, limit, row["Gene"])
+
+    monkeypatch.delenv("TIGER_OFFTARGET_SIMD")
+    expected = _run_search(binary_path, guides_path, fasta_path, tmp_path / "default.csv")
+    fixed = _run_search(binary_path, guides_path, fasta_path, tmp_path / "fixed.csv", "--guide-length", "23")
+    assert fixed == expected
+    rejected = subprocess.run(
+        [str(binary_path), "--guide-length", "23", str(mixed_path), str(fasta_path), str(tmp_path / "bad.csv")],
+        capture_output=True,
+        text=True,
+    )
+    assert rejected.returncode != 0
+    assert "--guide-length is 23" in rejected.stderr
+
+
+def _brute_profile(sequence: str, transcripts, weights, max_mismatch: int = 5):
+    positions = [0] * len(sequence)
+    score = 0.0
+    for ref in transcripts:
+        for pos in range(0, len(ref) - len(sequence) + 1):
+            mismatched = [k for k, (a, b) in enumerate(zip(sequence, ref[pos:pos + len(sequence)])) if a != b]
+            if 1 <= len(mismatched) <= max_mismatch:
+                activity = 1.0
+                for k in mismatched:
+                    positions[k] += 1
+                    activity *= weights[k] if k < len(weights) else 1.0
+                score += activity
+    return positions, score
+
+
+def test_offtarget_position_weights_profile_mismatches(tmp_path: Path, monkeypatch):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, reference = _write_random_case(tmp_path)
+    weights = [0.05 * k for k in range(20)]
+    weight_arg = ",".join(f"{w:g}" for w in weights)
+    expected = _run_search(binary_path, guides_path, fasta_path, tmp_path / "plain.csv")
+
+    for level in ("scalar", "vec128", "avx2", "avx512"):
+        monkeypatch.setenv("TIGER_OFFTARGET_SIMD", level)
+        for engine in ("packed", "byte", "index"):
+            rows = _run_search(binary_path, guides_path, fasta_path, tmp_path / "profile.csv",
+                               "--engine", engine, "--position-weights", weight_arg)
+            for row, plain in zip(rows, expected):
+                positions, score = _brute_profile(row["Sequence"], reference, weights)
+                assert [int(n) for n in row["Mismatch_Positions"].split("|")] == positions, (level, engine)
+                assert abs(float(row["OffTarget_Score"]) - score) <= 1e-12 * max(1.0, score), (level, engine)
+                assert {key: row[key] for key in plain} == plain
+
+    rejected = subprocess.run(
+        [str(binary_path), "--position-weights", "1,x", str(guides_path), str(fasta_path), str(tmp_path / "bad.csv")],
+        capture_output=True,
+        text=True,
+    )
+    assert rejected.returncode != 0
+
+
+def test_offtarget_fasta_layout_does_not_change_results(tmp_path: Path, monkeypatch):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, reference = _write_random_case(tmp_path)
+    expected = _run_search(binary_path, guides_path, fasta_path, tmp_path / "default.csv")
+
+    # CRLF line ends, blank lines and uneven line widths, so vector loads
+    # straddle line breaks and the loader's pieces cut through lines.
+    headers = [line for line in fasta_path.read_text(encoding="utf-8").splitlines()
+               if line.startswith(">")]
+    rng = random.Random(5)
+    parts = []
+    for header, seq in zip(headers, reference):
+        parts.append(header + "\r\n")
+        pos = 0
+        while pos < len(seq):
+            width = rng.choice((1, 7, 31, 33, 64, 200))
+            body = seq[pos:pos + width]
+            parts.append((body.lower() if rng.random() < 0.3 else body) + rng.choice(("\n", "\r\n", "\n\n")))
+            pos += width
+    reflowed_path = tmp_path / "reflowed.fa"
+    reflowed_path.write_bytes("".join(parts).encode("utf-8"))
+
+    for level in ("scalar", "vec128", "avx2", "avx512"):
+        monkeypatch.setenv("TIGER_OFFTARGET_SIMD", level)
+        for engine in ("packed", "byte"):
+            rows = _run_search(binary_path, guides_path, reflowed_path,
+                               tmp_path / f"reflowed_{level}_{engine}.csv", "--engine", engine)
+            assert rows == expected, (level, engine)
+
+
+def _write_bgzf(path: Path, data: bytes, block: int = 4096) -> None:
+    # bgzip layout: gzip members with a "BC" extra field giving the member
+    # size, then the empty end-of-file member.
+    out = bytearray()
+    for start in list(range(0, len(data), block)) + [len(data)]:
+        chunk = data[start:start + block]
+        compressor = zlib.compressobj(6, zlib.DEFLATED, -15)
+        deflated = compressor.compress(chunk) + compressor.flush()
+        header = struct.pack("<BBBBIBBHBBHH", 31, 139, 8, 4, 0, 0, 255, 6, 66, 67, 2,
+                             len(deflated) + 25)
+        out += header + deflated + struct.pack("<II", zlib.crc32(chunk), len(chunk))
+        if not chunk:
+            break
+    path.write_bytes(bytes(out))
+
+
+def test_offtarget_compressed_reference_matches_plain(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, _ = _write_random_case(tmp_path)
+    expected = _run_search(binary_path, guides_path, fasta_path, tmp_path / "plain.csv")
+
+    data = fasta_path.read_bytes()
+    gzip_path = tmp_path / "reference.fa.gz"
+    gzip_path.write_bytes(gzip.compress(data[:1000]) + gzip.compress(data[1000:]))
+    bgzf_path = tmp_path / "reference.fa.bgz"
+    _write_bgzf(bgzf_path, data)
+    for path in (gzip_path, bgzf_path):
+        for engine in ("packed", "byte"):
+            rows = _run_search(binary_path, guides_path, path,
+                               tmp_path / f"{path.suffix}_{engine}.csv", "--engine", engine)
+            assert rows == expected, (path.name, engine)
+
+    truncated_path = tmp_path / "truncated.fa.gz"
+    truncated_path.write_bytes(gzip.compress(data)[:-40])
+    result = subprocess.run(
+        [str(binary_path), str(guides_path), str(truncated_path), str(tmp_path / "bad.csv")],
+        capture_output=True,
+        text=True,
+    )
+    assert result.returncode != 0
+    assert "not valid gzip data" in result.stderr
+
+
+def test_offtarget_index_image_matches_fasta(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, _ = _write_random_case(tmp_path)
+    expected = _run_search(binary_path, guides_path, fasta_path, tmp_path / "fasta.csv")
+
+    # Window 23 matches the guides (mapped bitmap); 20 forces a recompute.
+    for window in ("23", "20"):
+        index_path = tmp_path / f"reference_{window}.otidx"
+        subprocess.run(
+            [str(binary_path), "index", "build", "--window-length", window,
+             str(fasta_path), str(index_path)],
+            check=True,
+            capture_output=True,
+        )
+        for engine in ("packed", "byte"):
+            rows = _run_search(binary_path, guides_path, index_path,
+                               tmp_path / f"index_{window}_{engine}.csv", "--engine", engine)
+            assert rows == expected, (window, engine)
+
+
+def test_offtarget_seed_engine_matches_scan(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, _ = _write_random_case(tmp_path)
+    expected = _run_search(binary_path, guides_path, fasta_path, tmp_path / "packed.csv")
+
+    rows = _run_search(binary_path, guides_path, fasta_path,
+                       tmp_path / "seed.csv", "--engine", "index")
+    assert rows == expected
+
+    # A stored 3-mer index serves K=2 (7-base seeds) as well as K=5.
+    index_path = tmp_path / "reference.otidx"
+    subprocess.run(
+        [str(binary_path), "index", "build", "--kmer", "3", str(fasta_path), str(index_path)],
+        check=True,
+        capture_output=True,
+    )
+    for reference in (fasta_path, index_path):
+        limited = _run_search(binary_path, guides_path, reference,
+                              tmp_path / "seed_k2.csv", "--engine", "index", "--max-mismatches", "2")
+        for got, want in zip(limited, expected):
+            assert [got[f"MM{mm}"] for mm in range(3)] == [want[f"MM{mm}"] for mm in range(3)]
+            assert [got[f"MM{mm}"] for mm in range(3, 6)] == ["", "", ""]
+            assert got["MM0_Transcripts"] == want["MM0_Transcripts"]
+
+
+def _brute_disqualification(sequence: str, transcripts, caps: dict):
+    counts = [0] * 6
+    length = len(sequence)
+    for t_idx, ref in enumerate(transcripts):
+        for pos in range(0, len(ref) - length + 1):
+            mismatches = sum(1 for a, b in zip(sequence, ref[pos:pos + length]) if a != b)
+            if mismatches > 5:
+                continue
+            counts[mismatches] += 1
+            cap = caps.get(mismatches)
+            if cap is not None and counts[mismatches] > cap:
+                return counts, f"disqualified at tx{t_idx}:{pos} (MM{mismatches} > {cap})"
+    return counts, ""
+
+
+def test_offtarget_caps_retire_guides(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, reference = _write_random_case(tmp_path)
+    caps = {0: 0, 3: 0}
+    args = ("--max-mm0", "0", "--max-mm3", "0")
+
+    packed = _run_search(binary_path, guides_path, fasta_path, tmp_path / "packed.csv", *args)
+    seeded = _run_search(binary_path, guides_path, fasta_path, tmp_path / "seed.csv",
+                         "--engine", "index", *args)
+    assert packed == seeded
+
+    statuses = []
+    for row in packed:
+        counts, status = _brute_disqualification(row["Sequence"], reference, caps)
+        assert [int(row[f"MM{mm}"]) for mm in range(6)] == counts, row["Gene"]
+        assert row["Status"] == status, row["Gene"]
+        statuses.append(status)
+    assert any(statuses) and not all(statuses)
+
+
+def test_offtarget_hit_details_list_every_window(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, reference = _write_random_case(tmp_path)
+    guides = [row["Sequence"] for row in csv.DictReader(guides_path.open(encoding="utf-8"))]
+
+    expected = []
+    for g_idx, sequence in enumerate(guides):
+        for t_idx, ref in enumerate(reference):
+            for pos in range(0, len(ref) - len(sequence) + 1):
+                mismatches = sum(1 for a, b in zip(sequence, ref[pos:pos + len(sequence)]) if a != b)
+                if mismatches <= 2:
+                    expected.append((g_idx, f"tx{t_idx}", f"Gene{t_idx}", pos, mismatches))
+
+    for engine in ("packed", "byte", "index"):
+        hits_path = tmp_path / f"hits_{engine}.csv"
+        rows = _run_search(binary_path, guides_path, fasta_path, tmp_path / f"{engine}.csv",
+                           "--engine", engine, "--hits-out", str(hits_path), "--hits-max-mm", "2")
+        with hits_path.open("r", encoding="utf-8") as fh:
+            hits = [
+                (int(h["Guide"]), h["Transcript"], h["Transcript_Gene"], int(h["Offset"]), int(h["Mismatches"]))
+                for h in csv.DictReader(fh)
+            ]
+        assert hits == expected, engine
+        assert sum(int(row["MM0"]) + int(row["MM1"]) + int(row["MM2"]) for row in rows) == len(hits)
+
+
+def test_offtarget_shards_merge_to_one_shot(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, _ = _write_random_case(tmp_path)
+    one_shot = tmp_path / "one_shot.csv"
+    one_shot_hits = tmp_path / "one_shot_hits.csv"
+    _run_search(binary_path, guides_path, fasta_path, one_shot,
+                "--hits-out", str(one_shot_hits), "--hits-max-mm", "2")
+
+    partials = []
+    for guide_shard in range(3):
+        for reference_shard in range(4):
+            partial = tmp_path / f"part_{guide_shard}_{reference_shard}.otp"
+            subprocess.run(
+                [str(binary_path), "--partial", "--hits-max-mm", "2",
+                 "--guide-shard", f"{guide_shard}/3", "--reference-shard", f"{reference_shard}/4",
+                 str(guides_path), str(fasta_path), str(partial)],
+                check=True, capture_output=True,
+            )
+            partials.append(str(partial))
+
+    merged = tmp_path / "merged.csv"
+    merged_hits = tmp_path / "merged_hits.csv"
+    subprocess.run(
+        [str(binary_path), "merge", "--hits-out", str(merged_hits), str(fasta_path), str(merged),
+         *reversed(partials)],
+        check=True, capture_output=True,
+    )
+    assert merged.read_text() == one_shot.read_text()
+    assert merged_hits.read_text() == one_shot_hits.read_text()
+
+    incomplete = subprocess.run(
+        [str(binary_path), "merge", str(fasta_path), str(merged), *partials[1:]],
+        capture_output=True, text=True,
+    )
+    assert incomplete.returncode != 0
+    assert "missing partial" in incomplete.stderr
+
+
+def test_offtarget_streamed_guides_match_one_shot(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, _ = _write_random_case(tmp_path)
+    one_shot = tmp_path / "one_shot.csv"
+    one_shot_hits = tmp_path / "one_shot_hits.csv"
+    _run_search(binary_path, guides_path, fasta_path, one_shot,
+                "--hits-out", str(one_shot_hits), "--hits-max-mm", "1")
+
+    streamed = tmp_path / "streamed.csv"
+    streamed_hits = tmp_path / "streamed_hits.csv"
+    process = subprocess.Popen(
+        [str(binary_path), "--hits-out", str(streamed_hits), "--hits-max-mm", "1",
+         "-", str(fasta_path), str(streamed)],
+        stdin=subprocess.PIPE, stderr=subprocess.PIPE,
+    )
+    # Trickle rows in (some split mid-line) so the search sees several batches
+    payload = guides_path.read_bytes()
+    for start in range(0, len(payload), 97):
+        process.stdin.write(payload[start:start + 97])
+        process.stdin.flush()
+    process.stdin.close()
+    stderr = process.stderr.read().decode()
+    assert process.wait() == 0, stderr
+    assert stderr == ""
+    assert streamed.read_text() == one_shot.read_text()
+    assert streamed_hits.read_text() == one_shot_hits.read_text()
+
+    # Batches are counted in the --stats work counters
+    stats_path = tmp_path / "stats.json"
+    subprocess.run(
+        [str(binary_path), "--stats", str(stats_path), "-", str(fasta_path), str(tmp_path / "stats.csv")],
+        input=guides_path.read_bytes(), check=True, capture_output=True,
+    )
+    assert json.loads(stats_path.read_text())["work"]["guide_batches"] >= 1
+
+
+def test_offtarget_cache_and_repeats_match_one_shot(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, _ = _write_random_case(tmp_path)
+    one_shot = tmp_path / "one_shot.csv"
+    one_shot_hits = tmp_path / "one_shot_hits.csv"
+    _run_search(binary_path, guides_path, fasta_path, one_shot,
+                "--hits-out", str(one_shot_hits), "--hits-max-mm", "1")
+
+    # Every row twice: the second copy must come from the first's result
+    rows = guides_path.read_text().splitlines(keepends=True)
+    doubled = tmp_path / "doubled.csv"
+    doubled.write_text("".join(rows + rows[1:]))
+    expected = tmp_path / "expected.csv"
+    expected_hits = tmp_path / "expected_hits.csv"
+    subprocess.run(
+        [str(binary_path), "--hits-out", str(expected_hits), "--hits-max-mm", "1",
+         str(doubled), str(fasta_path), str(expected)],
+        check=True, capture_output=True,
+    )
+    lines = expected.read_text().splitlines(keepends=True)
+    assert "".join(lines[:len(rows)]) == one_shot.read_text()
+    assert lines[len(rows):] == lines[1:len(rows)]
+
+    cache_dir = tmp_path / "cache"
+    stats_path = tmp_path / "stats.json"
+    distinct = len(rows) - 1
+    for attempt in range(2):
+        output = tmp_path / f"cached_{attempt}.csv"
+        hits = tmp_path / f"cached_hits_{attempt}.csv"
+        run = subprocess.run(
+            [str(binary_path), "--cache-dir", str(cache_dir), "--hits-out", str(hits), "--hits-max-mm", "1",
+             "--stats", str(stats_path), str(doubled), str(fasta_path), str(output)],
+            check=True, capture_output=True, text=True,
+        )
+        assert output.read_text() == expected.read_text()
+        assert hits.read_text() == expected_hits.read_text()
+        assert run.stderr == ""
+        guides = json.loads(stats_path.read_text())["guides"]
+        searched = distinct if attempt == 0 else 0
+        assert (guides["searched"], guides["cached"], guides["repeated"]) == (searched, distinct - searched, distinct)
+
+    # Other options must not reuse these results
+    subprocess.run(
+        [str(binary_path), "--cache-dir", str(cache_dir), "--max-mismatches", "3",
+         "--stats", str(stats_path), str(guides_path), str(fasta_path), str(tmp_path / "other.csv")],
+        check=True, capture_output=True, text=True,
+    )
+    assert json.loads(stats_path.read_text())["guides"]["cached"] == 0
+    assert len(list(cache_dir.glob("*.otcache"))) == 2
+
+
+def test_offtarget_reference_slices_match_single_task(tmp_path: Path, monkeypatch):
+    binary_path = _ensure_binary()
+    rng = random.Random(25)
+
+    # ~400 kb over uneven transcripts, with guide copies (some mutated)
+    # planted throughout, so a few guides are scanned as many slice tasks
+    guides = ["".join(rng.choice("ACGT") for _ in range(23)) for _ in range(6)]
+    transcripts = []
+    for idx in range(40):
+        parts = []
+        for _ in range(rng.randrange(2, 30)):
+            parts.append("".join(rng.choice("ACGT") for _ in range(rng.randrange(50, 900))))
+            window = list(rng.choice(guides))
+            for _ in range(rng.randrange(0, 4)):
+                window[rng.randrange(23)] = rng.choice("ACGT")
+            parts.append("".join(window))
+        transcripts.append("".join(parts))
+    fasta_path = tmp_path / "large.fa"
+    _write_file(fasta_path, "".join(f">tx{idx}|g{idx}|-|-|T{idx}-201|Gene{idx % 7}|\n{seq}\n"
+                                    for idx, seq in enumerate(transcripts)))
+    guides_path = tmp_path / "guides.csv"
+    _write_file(guides_path, "Gene,Sequence\n" + "".join(f"G{i},{seq}\n" for i, seq in enumerate(guides)))
+    # Enough extra guides that one thread gets whole-reference tasks only
+    padded_path = tmp_path / "padded.csv"
+    padding = ["".join(rng.choice("ACGT") for _ in range(23)) for _ in range(250)]
+    _write_file(padded_path, guides_path.read_text() + "".join(f"P{i},{seq}\n" for i, seq in enumerate(padding)))
+
+    for engine in ("packed", "byte"):
+        runs = {}
+        for threads, path in (("1", padded_path), ("8", guides_path)):
+            monkeypatch.setenv("TIGER_OFFTARGET_THREADS", threads)
+            output = tmp_path / f"{engine}_{threads}.csv"
+            hits = tmp_path / f"{engine}_{threads}_hits.csv"
+            rows = _run_search(binary_path, path, fasta_path, output,
+                               "--engine", engine, "--hits-out", str(hits), "--hits-max-mm", "2")
+            with hits.open() as fh:
+                hit_rows = [row for row in csv.DictReader(fh) if int(row["Guide"]) < len(guides)]
+            runs[threads] = (rows[:len(guides)], hit_rows)
+        assert runs["1"] == runs["8"], engine
+        assert any(int(row["MM0"]) > 1 for row in runs["8"][0])
+
+
+def test_offtarget_memory_budget_streams_to_same_results(tmp_path: Path):
+    binary_path = _ensure_binary()
+    rng = random.Random(29)
+
+    # Transcripts far longer than a 64K budget's slices, with planted copies
+    # of mixed-length guides, so windows straddle slice boundaries
+    guides = ["".join(rng.choice("ACGT") for _ in range(length)) for length in (23, 23, 23, 20, 28)]
+    transcripts = []
+    for _ in range(8):
+        parts = []
+        for _ in range(rng.randrange(2, 16)):
+            parts.append("".join(rng.choice("ACGT") for _ in range(rng.randrange(20, 4000))))
+            window = list(rng.choice(guides))
+            for _ in range(rng.randrange(0, 3)):
+                window[rng.randrange(len(window))] = rng.choice("ACGT")
+            parts.append("".join(window))
+        transcripts.append("".join(parts))
+    # A last transcript shorter than one byte-engine vector, two mismatches
+    # from a guide, ends the final slice
+    window = list(guides[0])
+    for pos in (3, 10):
+        window[pos] = "A" if window[pos] != "A" else "C"
+    transcripts.append("".join(window))
+    fasta_path = tmp_path / "large.fa"
+    _write_file(fasta_path, "".join(f">tx{idx}|g{idx}|-|-|T{idx}-201|Gene{idx % 5}|\n{seq}\n"
+                                    for idx, seq in enumerate(transcripts)))
+    guides_path = tmp_path / "guides.csv"
+    _write_file(guides_path, "Gene,Sequence\n" + "".join(f"G{i},{seq}\n" for i, seq in enumerate(guides)))
+
+    parsed = _load_transcripts(fasta_path)
+    expected = [_brute_counts(seq, parsed) for seq in guides]
+    for engine in ("packed", "byte", "index"):
+        runs = []
+        for budget in ((), ("--memory-budget", "64K")):
+            hits = tmp_path / f"{engine}_{len(budget)}_hits.csv"
+            rows = _run_search(binary_path, guides_path, fasta_path, tmp_path / f"{engine}_{len(budget)}.csv",
+                               "--engine", engine, "--hits-out", str(hits), "--hits-max-mm", "2", *budget)
+            runs.append((rows, hits.read_text()))
+        assert runs[0] == runs[1], engine
+        assert [[int(row[f"MM{mm}"]) for mm in range(6)] for row in runs[1][0]] == expected
+        assert f",{len(transcripts) - 1},tx{len(transcripts) - 1}," in runs[1][1], engine
+
+    # Slices are counted in the --stats work counters, not reported on stderr
+    stats_path = tmp_path / "stats.json"
+    run = subprocess.run(
+        [str(binary_path), "--memory-budget", "64K", "--stats", str(stats_path),
+         str(guides_path), str(fasta_path), str(tmp_path / "stats.csv")],
+        check=True, capture_output=True, text=True,
+    )
+    assert run.stderr == ""
+    assert json.loads(stats_path.read_text())["work"]["reference_slices"] > 1
+
+
+def test_offtarget_checkpoint_resumes_interrupted_run(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, _ = _write_random_case(tmp_path)
+    expected = _run_search(binary_path, guides_path, fasta_path, tmp_path / "expected.csv")
+
+    def run(output: Path):
+        stats_path = output.with_suffix(".json")
+        result = subprocess.run(
+            [str(binary_path), "--checkpoint", str(checkpoint), "--checkpoint-group", "2",
+             "--stats", str(stats_path), str(guides_path), str(fasta_path), str(output)],
+            check=True, capture_output=True, text=True,
+        )
+        with output.open("r", encoding="utf-8") as fh:
+            return result.stderr, list(csv.DictReader(fh)), json.loads(stats_path.read_text())["guides"]
+
+    checkpoint = tmp_path / "search.otckpt"
+    stderr, rows, guides = run(tmp_path / "first.csv")
+    assert "5/5 groups done" in stderr
+    assert rows == expected
+    assert guides["checkpointed"] == 0
+
+    # Killed while appending the fourth group: the cut block is dropped
+    # and only the groups missing from the file are searched again
+    data = checkpoint.read_bytes()
+    ends = [i for i in range(len(data)) if data.startswith(b"ENDBLOCK", i)]
+    checkpoint.write_bytes(data[:ends[2] + 8 + 20])
+    stderr, rows, guides = run(tmp_path / "resumed.csv")
+    assert "resumed 3 of 5 groups" in stderr
+    assert rows == expected
+    assert guides["checkpointed"] == 6
+    assert checkpoint.read_bytes() == data
+
+    # A checkpoint of other options is not reused
+    again = subprocess.run(
+        [str(binary_path), "--checkpoint", str(checkpoint), "--max-mismatches", "2",
+         str(guides_path), str(fasta_path), str(tmp_path / "other.csv")],
+        check=True, capture_output=True, text=True,
+    )
+    assert "starting over" in again.stderr
+
+
+def test_offtarget_cache_from_previous_release(tmp_path: Path):
+    binary_path = _ensure_binary()
+    old_fasta, guides_path, transcripts = _write_random_case(tmp_path)
+    rows = guides_path.read_text().splitlines(keepends=True)
+    guides_path.write_text("".join(rows) + f"Removed,{transcripts[3][10:33]}\n")
+
+    # Next release: tx3 dropped, tx2 edited, tx4 renamed to another gene,
+    # a new transcript (carrying copies of guide windows) listed first
+    changed = transcripts[2][:200] + "ACGTA" + transcripts[2][205:]
+    added = transcripts[1][50:120] + transcripts[4][300:400] + transcripts[0]
+    records = [("txNew|gN|-|-|New-201|New|", added)]
+    records += [(f"tx{idx}|g{idx}|-|-|Gene{idx}-201|Gene{idx}|", seq) for idx, seq in enumerate(transcripts[:2])]
+    records += [("tx2|g2|-|-|Gene2-201|Gene2|", changed), ("tx4|g4|-|-|Moved-201|Moved|", transcripts[4])]
+    new_fasta = tmp_path / "release2.fa"
+    _write_file(new_fasta, "".join(f">{name}\n{seq}\n" for name, seq in records))
+
+    for engine in ("packed", "byte", "index"):
+        cache_dir = tmp_path / f"cache_{engine}"
+        expected = tmp_path / f"expected_{engine}.csv"
+        _run_search(binary_path, guides_path, new_fasta, expected, "--engine", engine)
+        _run_search(binary_path, guides_path, old_fasta, tmp_path / "old.csv",
+                    "--engine", engine, "--cache-dir", str(cache_dir))
+        output = tmp_path / f"updated_{engine}.csv"
+        stats_path = tmp_path / f"updated_{engine}.json"
+        run = subprocess.run(
+            [str(binary_path), "--engine", engine, "--cache-dir", str(cache_dir), "--cache-from", str(old_fasta),
+             "--stats", str(stats_path), str(guides_path), str(new_fasta), str(output)],
+            check=True, capture_output=True, text=True,
+        )
+        assert output.read_text() == expected.read_text(), engine
+        assert "3 transcripts kept, 1 changed, 1 removed, 1 added" in run.stderr
+        guides = json.loads(stats_path.read_text())["guides"]
+        assert (guides["searched"], guides["cached"], guides["updated"]) == (0, 0, len(rows))
+
+        # The updated results are now cached for the new release itself
+        subprocess.run(
+            [str(binary_path), "--engine", engine, "--cache-dir", str(cache_dir),
+             "--stats", str(stats_path), str(guides_path), str(new_fasta), str(output)],
+            check=True, capture_output=True, text=True,
+        )
+        assert output.read_text() == expected.read_text(), engine
+        guides = json.loads(stats_path.read_text())["guides"]
+        assert (guides["cached"], guides["updated"]) == (len(rows), 0)
+
+    rejected = subprocess.run(
+        [str(binary_path), "--cache-from", str(old_fasta), str(guides_path), str(new_fasta), str(output)],
+        capture_output=True, text=True,
+    )
+    assert rejected.returncode != 0
+
+
+def test_offtarget_collapsed_isoforms_match_full_scan(tmp_path: Path):
+    binary_path = _ensure_binary()
+    rng = random.Random(29)
+
+    # Genes whose isoforms are exon subsets, so most windows repeat within
+    # a gene; one exon carries an N run and gene 2 shares an exon with gene 0
+    records = []
+    exon_sets = []
+    for gene in range(3):
+        exons = ["".join(rng.choice("ACGT") for _ in range(rng.randrange(40, 160))) for _ in range(5)]
+        exon_sets.append(exons)
+    exon_sets[1][2] = exon_sets[1][2][:20] + "NNN" + exon_sets[1][2][23:]
+    exon_sets[2][4] = exon_sets[0][1]
+    for gene, exons in enumerate(exon_sets):
+        for iso, keep in enumerate(((0, 1, 2, 3, 4), (0, 2, 3, 4), (0, 1, 3), (1, 2, 3, 4))):
+            records.append((f"tx{gene}.{iso}|g{gene}|-|-|Gene{gene}-20{iso}|Gene{gene}|",
+                            "".join(exons[e] for e in keep)))
+    fasta_path = tmp_path / "isoforms.fa"
+    _write_file(fasta_path, "".join(f">{name}\n{seq}\n" for name, seq in records))
+
+    guides = []
+    for idx in range(24):
+        source = records[rng.randrange(len(records))][1].replace("N", "G")
+        start = rng.randrange(len(source) - 23)
+        window = list(source[start:start + 23])
+        for _ in range(idx % 4):
+            window[rng.randrange(23)] = rng.choice("ACGT")
+        guides.append("".join(window))
+    guides_path = tmp_path / "guides.csv"
+    _write_file(guides_path, "Gene,Sequence\n" + "".join(f"Guide{i},{seq}\n" for i, seq in enumerate(guides)))
+
+    for engine in ("packed", "byte", "index"):
+        outputs = []
+        for extra in ((), ("--collapse-isoforms",)):
+            output = tmp_path / f"{engine}{len(extra)}.csv"
+            hits_path = tmp_path / f"hits_{engine}{len(extra)}.csv"
+            run = subprocess.run(
+                [str(binary_path), "--engine", engine, "--hits-out", str(hits_path), "--hits-max-mm", "3",
+                 *extra, str(guides_path), str(fasta_path), str(output)],
+                check=True, capture_output=True, text=True,
+            )
+            outputs.append((output.read_text(), hits_path.read_text()))
+        assert outputs[0] == outputs[1], engine
+        assert "Collapsed isoforms:" in run.stderr
+
+    rejected = subprocess.run(
+        [str(binary_path), "--collapse-isoforms", "--max-mm0", "1", str(guides_path), str(fasta_path),
+         str(tmp_path / "rejected.csv")],
+        capture_output=True, text=True,
+    )
+    assert rejected.returncode != 0
+
+
+def test_offtarget_screen_keeps_candidates_without_hits(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, _, reference = _write_random_case(tmp_path)
+    rng = random.Random(31)
+
+    def has_hit(sequence: str, max_mismatch: int = 2) -> bool:
+        return sum(_brute_counts(sequence, reference)[:max_mismatch + 1]) > 0
+
+    # Near copies of reference windows (some rejected) mixed with random draws
+    candidates = []
+    for idx in range(120):
+        if idx % 3 == 0:
+            source = reference[rng.randrange(len(reference))].replace("N", "C")
+            start = rng.randrange(len(source) - 23)
+            window = list(source[start:start + 23])
+            for _ in range(idx % 5):
+                window[rng.randrange(23)] = rng.choice("ACGT")
+            candidates.append("".join(window))
+        else:
+            candidates.append("".join(rng.choice("ACGT") for _ in range(23)))
+    candidates_path = tmp_path / "candidates.txt"
+    _write_file(candidates_path, "# candidates\n" + "".join(f"{seq}\t# GC\n" for seq in candidates) + "ACGT\n")
+    expected = [seq for seq in candidates if not has_hit(seq)]
+    assert 0 < len(expected) < len(candidates)
+
+    for engine in ("index", "packed"):
+        run = subprocess.run(
+            [str(binary_path), "screen", "--engine", engine, "--candidates", str(candidates_path), str(fasta_path)],
+            check=True, capture_output=True, text=True,
+        )
+        assert run.stdout.split() == expected, engine
+        assert f"{len(expected)} survivors, 1 skipped" in run.stderr
+
+    # Generated candidates: distinct, within the constraints, reproducible
+    generated = []
+    for _ in range(2):
+        run = subprocess.run(
+            [str(binary_path), "screen", "--generate", "50", "--seed", "7", "--max-mismatches", "1",
+             "--gc-min", "45", "--gc-max", "55", str(fasta_path)],
+            check=True, capture_output=True, text=True,
+        )
+        generated.append(run.stdout.split())
+    assert generated[0] == generated[1]
+    assert len(set(generated[0])) == 50
+    # A small request draws about twice the survivors it still needs
+    assert int(re.search(r"Screened (\d+) candidates", run.stderr).group(1)) <= 200
+    for seq in generated[0]:
+        assert 45 <= 100 * (seq.count("G") + seq.count("C")) / 23 <= 55
+        assert not any(base * 4 in seq for base in "ACGT")
+        assert not any((a + b) * 4 in seq for a in "ACGT" for b in "ACGT")
+        assert not has_hit(seq, 1)
+
+
+def test_offtarget_stats_account_for_results(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, _ = _write_random_case(tmp_path)
+    for engine in ("packed", "byte", "index"):
+        stats_path = tmp_path / f"stats_{engine}.json"
+        rows = _run_search(binary_path, guides_path, fasta_path, tmp_path / f"{engine}.csv",
+                           "--engine", engine, "--max-mismatches", "3", "--stats", str(stats_path))
+        stats = json.loads(stats_path.read_text())
+        assert stats["engine"] == engine
+        assert stats["guides"]["rows"] == len(rows)
+        assert stats["hits"][:4] == [sum(int(row[f"MM{mm}"]) for row in rows) for mm in range(4)]
+        assert stats["hits"][4:] == [None, None]
+        assert {"guides", "reference", "search", "output"} <= set(stats["phases"])
+        assert stats["peak_rss_kb"] > 0 and len(stats["thread_busy_seconds"]) == stats["threads"]
+        work = stats["work"]["seed_candidates" if engine == "index" else "windows"]
+        assert work > 0
+
+
+def _read_columnar(path: Path):
+    data = path.read_bytes()
+    fields = struct.unpack_from("<8sIIiI6Q13Q", data)
+    magic, version, _, max_mm, _ = fields[:5]
+    (guide_count, transcript_count, counts_off, _, _, strings_off_table, transcripts_off,
+     mm0_offsets_off, strings_off, _, mm0_off, _, file_size) = fields[11:]
+    assert magic == b"TGROTRES" and version == 1 and file_size == len(data)
+
+    def string(offset):
+        start = strings_off + offset
+        return data[start:data.index(b"\0", start)].decode()
+
+    transcript_ids = [
+        string(struct.unpack_from("<4Q", data, transcripts_off + 32 * t)[2]) for t in range(transcript_count)
+    ]
+    rows = []
+    for i in range(guide_count):
+        gene, sequence = struct.unpack_from("<2Q", data, strings_off_table + 16 * i)
+        counts = [struct.unpack_from("<Q", data, counts_off + 8 * (mm * guide_count + i))[0] for mm in range(6)]
+        begin, end = struct.unpack_from("<2Q", data, mm0_offsets_off + 8 * i)
+        hits = struct.unpack_from(f"<{end - begin}Q", data, mm0_off + 8 * begin)
+        rows.append({
+            "Gene": string(gene),
+            "Sequence": string(sequence),
+            **{f"MM{mm}": str(counts[mm]) if mm <= max_mm else "" for mm in range(6)},
+            "MM0_Transcripts": "|".join(transcript_ids[t] for t in hits),
+        })
+    return rows
+
+
+def test_offtarget_columnar_output_matches_csv(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, _ = _write_random_case(tmp_path)
+
+    for engine in ("packed", "byte", "index"):
+        csv_rows = _run_search(binary_path, guides_path, fasta_path, tmp_path / f"{engine}.csv",
+                               "--engine", engine, "--max-mismatches", "3")
+        columnar_path = tmp_path / f"{engine}.otres"
+        subprocess.run(
+            [str(binary_path), "--engine", engine, "--max-mismatches", "3", "--output-format", "columnar",
+             str(guides_path), str(fasta_path), str(columnar_path)],
+            check=True, capture_output=True,
+        )
+        for row in csv_rows:
+            del row["MM0_Genes"]
+        assert _read_columnar(columnar_path) == csv_rows, engine
+
+
+def _serve_request(process, payload: str):
+    data = payload.encode("utf-8")
+    process.stdin.write(b"SEARCH %d\n" % len(data) + data)
+    process.stdin.flush()
+    header = process.stdout.readline().decode("utf-8").split()
+    if header[0] != "OK":
+        return header, None
+    return header, process.stdout.read(int(header[1])).decode("utf-8")
+
+
+def test_offtarget_serve_matches_one_shot(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, guides_path, _ = _write_random_case(tmp_path)
+    expected_path = tmp_path / "expected.csv"
+    _run_search(binary_path, guides_path, fasta_path, expected_path)
+    expected = expected_path.read_text(encoding="utf-8")
+
+    process = subprocess.Popen(
+        [str(binary_path), "serve", str(fasta_path)],
+        stdin=subprocess.PIPE,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.DEVNULL,
+    )
+    try:
+        assert process.stdout.readline() == b"READY\n"
+        guides_csv = guides_path.read_text(encoding="utf-8")
+        for _ in range(2):
+            header, body = _serve_request(process, guides_csv)
+            assert body == expected
+            assert float(header[2]) >= 0.0
+
+        # Shorter guides get their own validity windows.
+        header, body = _serve_request(process, "Gene,Sequence\nShort,ACGTACGTACGTACGTACG\n")
+        assert body.splitlines()[1].startswith("Short,ACGTACGTACGTACGTACG,")
+
+        header, body = _serve_request(process, "Gene,Sequence\n")
+        assert header[0] == "ERR" and body is None
+
+        process.stdin.write(b"PING\n")
+        process.stdin.flush()
+        assert process.stdout.readline() == b"PONG\n"
+    finally:
+        process.stdin.write(b"QUIT\n")
+        process.stdin.close()
+        assert process.wait(timeout=10) == 0
+
+
+def test_offtarget_serve_rejects_oversized_request(tmp_path: Path):
+    binary_path = _ensure_binary()
+    fasta_path, _, _ = _write_random_case(tmp_path)
+
+    # A length that wraps when one is added, and one over the server's cap,
+    # are refused before any payload buffer is allocated
+    for length, extra in ((2 ** 64 - 1, []), (4096, ["--max-request-bytes", "1K"])):
+        process = subprocess.Popen(
+            [str(binary_path), "serve", *extra, str(fasta_path)],
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL,
+        )
+        assert process.stdout.readline() == b"READY\n"
+        process.stdin.write(f"SEARCH {length}\n".encode())
+        process.stdin.flush()
+        assert process.stdout.readline() == b"ERR request too large\n"
+        assert process.stdout.readline() == b""
+        process.stdin.close()
+        assert process.wait(timeout=10) == 0
+
+
+def _ensure_library() -> Path:
+    return _build_if_stale("bin/libofftarget.so")
+
+
+class _OtOptions(ctypes.Structure):
+    _fields_ = [
+        ("engine", ctypes.c_int),
+        ("max_mismatches", ctypes.c_int),
+        ("window_length", ctypes.c_int),
+        ("threads", ctypes.c_int),
+        ("max_hits", ctypes.c_uint64 * 6),
+    ]
+
+
+class _OtHits(ctypes.Structure):
+    _fields_ = [
+        ("offsets", ctypes.POINTER(ctypes.c_uint64)),
+        ("transcripts", ctypes.POINTER(ctypes.c_uint64)),
+    ]
+
+
+def test_offtarget_library_matches_binary(tmp_path: Path):
+    binary_path = _ensure_binary()
+    lib = ctypes.CDLL(str(_ensure_library()))
+    lib.ot_reference_open.restype = ctypes.c_void_p
+    lib.ot_reference_open.argtypes = [ctypes.c_char_p, ctypes.POINTER(_OtOptions)]
+    lib.ot_reference_transcript_id.restype = ctypes.c_char_p
+    lib.ot_reference_transcript_id.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+    lib.ot_search.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_void_p,
+                              ctypes.c_size_t, ctypes.c_void_p, ctypes.POINTER(_OtHits),
+                              ctypes.c_void_p, ctypes.c_void_p]
+    lib.ot_reference_close.argtypes = [ctypes.c_void_p]
+    lib.ot_hits_free.argtypes = [ctypes.POINTER(_OtHits)]
+    assert lib.ot_api_version() == 2
+
+    fasta_path, guides_path, _ = _write_random_case(tmp_path)
+    expected = _run_search(binary_path, guides_path, fasta_path, tmp_path / "expected.csv")
+    sequences = [row["Sequence"] for row in expected]
+
+    for engine in (0, 2):
+        options = _OtOptions()
+        lib.ot_options_init(ctypes.byref(options))
+        options.engine = engine
+        handle = lib.ot_reference_open(str(fasta_path).encode(), ctypes.byref(options))
+        assert handle
+
+        stride = 32
+        buffer = b"".join(seq.encode().ljust(stride, b"\0") for seq in sequences)
+        lengths = (ctypes.c_int32 * len(sequences))(*[len(seq) for seq in sequences])
+        counts = (ctypes.c_uint64 * (6 * len(sequences)))()
+        hits = _OtHits()
+        assert lib.ot_search(handle, buffer, stride, lengths, len(sequences), counts,
+                             ctypes.byref(hits), None, None) == 0
+
+        for i, row in enumerate(expected):
+            assert [counts[i * 6 + mm] for mm in range(6)] == [int(row[f"MM{mm}"]) for mm in range(6)]
+            ids = [lib.ot_reference_transcript_id(handle, hits.transcripts[h]).decode()
+                   for h in range(hits.offsets[i], hits.offsets[i + 1])]
+            assert "|".join(ids) == row["MM0_Transcripts"]
+
+        lib.ot_hits_free(ctypes.byref(hits))
+        lib.ot_reference_close(handle)
+
+
+def _tiger_inputs(window: str, context_5p: int = 3, guide_length: int = 23) -> list[float]:
+    # TIGER's process_data: target one-hot, then the complemented guide one-hot
+    # behind context_5p empty rows
+    tokens = {"A": 0, "C": 1, "G": 2, "T": 3}
+    complement = {"A": "T", "C": "G", "G": "C", "T": "A"}
+    target = [0.0] * (len(window) * 4)
+    guide = [0.0] * (len(window) * 4)
+    for k, base in enumerate(window):
+        if base in tokens:
+            target[k * 4 + tokens[base]] = 1.0
+        if context_5p <= k < context_5p + guide_length:
+            guide[k * 4 + tokens[complement[base]]] = 1.0
+    return target + guide
+
+
+def test_offtarget_library_guide_table_matches_tiger_layout(tmp_path: Path):
+    lib = ctypes.CDLL(str(_ensure_library()))
+    lib.ot_guides_open.restype = ctypes.c_void_p
+    lib.ot_guides_open.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+    for name in ("ot_guides_count", "ot_guides_record_count"):
+        getattr(lib, name).restype = ctypes.c_size_t
+        getattr(lib, name).argtypes = [ctypes.c_void_p]
+    lib.ot_guides_record_id.restype = ctypes.c_char_p
+    lib.ot_guides_record_id.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+    lib.ot_guides_record_offsets.restype = ctypes.POINTER(ctypes.c_uint64)
+    lib.ot_guides_record_offsets.argtypes = [ctypes.c_void_p]
+    lib.ot_guides_record_skipped.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+    lib.ot_guides_encode.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_void_p]
+    lib.ot_guides_sequences.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t,
+                                        ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t]
+    lib.ot_guides_close.argtypes = [ctypes.c_void_p]
+    lib.ot_reference_open.restype = ctypes.c_void_p
+    lib.ot_reference_open.argtypes = [ctypes.c_char_p, ctypes.POINTER(_OtOptions)]
+    lib.ot_search.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_void_p,
+                              ctypes.c_size_t, ctypes.c_void_p, ctypes.POINTER(_OtHits),
+                              ctypes.c_void_p, ctypes.c_void_p]
+    lib.ot_search_windows.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t,
+                                      ctypes.c_void_p, ctypes.POINTER(_OtHits), ctypes.c_void_p, ctypes.c_void_p]
+    lib.ot_reference_close.argtypes = [ctypes.c_void_p]
+    lib.ot_hits_free.argtypes = [ctypes.POINTER(_OtHits)]
+
+    rng = random.Random(28)
+    records = [
+        ("GeneA_1", "".join(rng.choice("ACGT") for _ in range(60))),
+        ("GeneB_1", "ACGT" * 5),                                          # shorter than a window
+        ("GeneC_1", "".join(rng.choice("ACGT") for _ in range(20)) + "N" + "ACGTACGTAC"),
+        ("GeneD_1", "nN" + "".join(rng.choice("acgt") for _ in range(40))),  # N only in 5' context
+    ]
+    targets_fasta = tmp_path / "targets.fa"
+    _write_file(targets_fasta, "".join(f">{name}\n{seq}\n" for name, seq in records))
+
+    table = lib.ot_guides_open(str(targets_fasta).encode(), 23, 3, 0)
+    assert table
+    assert lib.ot_guides_record_count(table) == 4
+    assert [lib.ot_guides_record_id(table, r).decode() for r in range(4)] == [name for name, _ in records]
+    assert [lib.ot_guides_record_skipped(table, r) for r in range(4)] == [0, 0, 1, 0]
+    offsets = lib.ot_guides_record_offsets(table)
+    assert [offsets[r] for r in range(5)] == [0, 35, 35, 35, 52]
+
+    windows = [records[r][1].upper()[i:i + 26] for r in (0, 3) for i in range(len(records[r][1]) - 25)]
+    count = lib.ot_guides_count(table)
+    assert count == len(windows)
+    inputs = (ctypes.c_float * (count * 208))()
+    assert lib.ot_guides_encode(table, 0, count, inputs) == 0
+    for w, window in enumerate(windows):
+        assert list(inputs[w * 208:(w + 1) * 208]) == _tiger_inputs(window)
+
+    stride = 24
+    targets = ctypes.create_string_buffer(count * stride)
+    spacers = ctypes.create_string_buffer(count * stride)
+    assert lib.ot_guides_sequences(table, 0, count, targets, spacers, stride) == 0
+    reverse_complement = str.maketrans("ACGT", "TGCA")
+    for w, window in enumerate(windows):
+        assert targets.raw[w * stride:w * stride + 23].decode() == window[3:]
+        assert spacers.raw[w * stride:w * stride + 23].decode() == window[3:].translate(reverse_complement)[::-1]
+
+    # Searching windows by id matches searching their target sequences
+    fasta_path, _, _ = _write_random_case(tmp_path)
+    options = _OtOptions()
+    lib.ot_options_init(ctypes.byref(options))
+    reference = lib.ot_reference_open(str(fasta_path).encode(), ctypes.byref(options))
+    assert reference
+    ids = (ctypes.c_uint64 * count)(*range(count))
+    by_id = (ctypes.c_uint64 * (6 * count))()
+    by_sequence = (ctypes.c_uint64 * (6 * count))()
+    lengths = (ctypes.c_int32 * count)(*([23] * count))
+    id_hits, sequence_hits = _OtHits(), _OtHits()
+    assert lib.ot_search_windows(reference, table, ids, count, by_id, ctypes.byref(id_hits), None, None) == 0
+    assert lib.ot_search(reference, targets.raw, stride, lengths, count, by_sequence,
+                         ctypes.byref(sequence_hits), None, None) == 0
+    assert list(by_id) == list(by_sequence)
+    assert [id_hits.offsets[i] for i in range(count + 1)] == [sequence_hits.offsets[i] for i in range(count + 1)]
+
+    lib.ot_hits_free(ctypes.byref(id_hits))
+    lib.ot_hits_free(ctypes.byref(sequence_hits))
+    lib.ot_reference_close(reference)
+    lib.ot_guides_close(table)
@@ -83,10 +83,13 @@ def run(targets: Path,
 @click.option("--destination", type=click.Path(file_okay=False, path_type=Path),
               default=Path("references"), show_default=True,
               help="Directory where downloaded references are cached.")
-def fetch_reference(species: str, destination: Path) -> None:
+@click.option("--keep-compressed", is_flag=True,
+              help="Keep a .gz download compressed; offtarget_search reads gzip/BGZF references directly.")
+def fetch_reference(species: str, destination: Path, keep_compressed: bool) -> None:
     """Download and cache the transcriptome bundle for an organism."""
     species_option = SpeciesOption(species)
-    ensure_reference(species_option, cache_dir=destination)
+    path = ensure_reference(species_option, cache_dir=destination, keep_compressed=keep_compressed)
+    click.echo(f"Reference for '{species}' ready at {path}")
 
 
 @main.command()
@@ -79,6 +79,11 @@ def load_config(config_path: Optional[Path], species: SpeciesOption) -> Dict[str
     offtarget.setdefault("binary_path", "bin/offtarget_search")
     offtarget.setdefault("reference_dir", "references")
     offtarget.setdefault("chunk_size", 1200)
+    offtarget.setdefault("reference_shards", 1)
+    offtarget.setdefault("guide_shards", 1)
+    offtarget.setdefault("stream_with_tiger", False)
+    offtarget.setdefault("cache_dir", None)
+    offtarget.setdefault("stats", True)
 
     # reference path will be resolved by download.references when necessary
     offtarget.setdefault("reference_transcriptome", species.metadata["reference_filename"])
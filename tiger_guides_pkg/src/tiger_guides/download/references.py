@@ -27,10 +27,14 @@ def ensure_reference(
     cache_dir: Path,
     prefer_smoke: bool = True,
     skip_checksum: bool = False,
+    keep_compressed: bool = False,
 ) -> Path:
     """Ensure the transcriptome for ``species`` exists under ``cache_dir``.
 
-    Returns the path to the transcriptome FASTA.
+    Returns the path to the transcriptome FASTA.  With ``keep_compressed`` a
+    ``.gz`` download is kept as ``<filename>.gz`` (offtarget_search reads
+    gzip / BGZF references directly) instead of being inflated to disk; the
+    published checksums cover the inflated file, so it is not verified.
     """
     cache_dir = Path(cache_dir)
     cache_dir.mkdir(parents=True, exist_ok=True)
@@ -50,6 +54,9 @@ def ensure_reference(
                 return destination
         else:
             return destination
+    compressed_destination = destination.with_name(destination.name + ".gz")
+    if keep_compressed and compressed_destination.exists():
+        return compressed_destination
 
     # Special-case smoke dataset for mouse
     if prefer_smoke and species.name == "mouse":
@@ -67,6 +74,10 @@ def ensure_reference(
     download_path = destination.with_suffix(destination.suffix + ".download")
     _download_stream(url, download_path)
 
+    if keep_compressed and url.endswith(".gz"):
+        download_path.rename(compressed_destination)
+        return compressed_destination
+
     if download_path.suffix.endswith(".gz"):
         _gunzip(download_path, destination)
     else:
@@ -64,11 +64,22 @@ def apply_filters(guides: pd.DataFrame, config: Dict, logger=None) -> Tuple[pd.D
         logger.info(f"STEP 4.3: Select Top {top_n} Guides per Gene")
         logger.info("=" * 60)
 
+    # Optionally penalise guides by their weighted off-target activity
+    # (OffTarget_Score, present when offtarget.position_weights is set)
+    score_weight = filtering.get("offtarget_score_weight", 0.0)
+    if score_weight and "OffTarget_Score" in filtered.columns:
+        filtered = filtered.assign(
+            _rank_score=filtered["Score"] - score_weight * filtered["OffTarget_Score"].fillna(0.0)
+        )
+    else:
+        filtered = filtered.assign(_rank_score=filtered["Score"])
+
     ranked = (
         filtered
-        .sort_values(["Gene", "Score"], ascending=[True, False])
+        .sort_values(["Gene", "_rank_score"], ascending=[True, False])
         .groupby("Gene")
         .head(top_n)
+        .drop(columns="_rank_score")
         .reset_index(drop=True)
     )
     stats["final"] = len(ranked)
@@ -84,7 +95,8 @@ def apply_filters(guides: pd.DataFrame, config: Dict, logger=None) -> Tuple[pd.D
         preferred.append("Sequence")
     if "Target" in ranked.columns and "Target" not in preferred:
         preferred.append("Target")
-    for extra in ["Score", "MM0", "MM1", "MM2", "MM3", "MM4", "MM5", "MM0_Transcripts", "MM0_Genes"]:
+    for extra in ["Score", "MM0", "MM1", "MM2", "MM3", "MM4", "MM5", "MM0_Transcripts", "MM0_Genes",
+                  "Mismatch_Positions", "OffTarget_Score"]:
         if extra in ranked.columns and extra not in preferred:
             preferred.append(extra)
     ordered = preferred + [col for col in ranked.columns if col not in preferred]
@@ -0,0 +1,158 @@
+"""
+Reader for `offtarget_search --output-format columnar` result files
+
+The file is a fixed header followed by 64-byte aligned column sections and
+a string heap (layout documented at ColumnarHeader in search.c).  Columns
+are memory-mapped as numpy arrays, so counts can be used without parsing;
+`results_frame` builds the same table the CSV output holds.
+"""
+from pathlib import Path
+
+import numpy as np
+import pandas as pd
+
+MAGIC = b"TGROTRES"
+VERSION = 1
+BYTE_ORDER = 0x01020304
+MAX_MISMATCHES = 5
+
+_HEADER = np.dtype([
+    ("magic", "S8"),
+    ("version", "<u4"),
+    ("byte_order", "<u4"),
+    ("max_mismatches", "<i4"),
+    ("caps_active", "<u4"),
+    ("caps", "<u8", (MAX_MISMATCHES + 1,)),
+    ("guide_count", "<u8"),
+    ("transcript_count", "<u8"),
+    ("counts_offset", "<u8"),
+    ("disqualified_mm_offset", "<u8"),
+    ("disqualified_pos_offset", "<u8"),
+    ("guide_strings_offset", "<u8"),
+    ("transcripts_offset", "<u8"),
+    ("mm0_offsets_offset", "<u8"),
+    ("strings_offset", "<u8"),
+    ("strings_size", "<u8"),
+    ("mm0_transcripts_offset", "<u8"),
+    ("mm0_transcript_count", "<u8"),
+    ("file_size", "<u8"),
+])
+
+_TRANSCRIPT = np.dtype([
+    ("start", "<u8"),
+    ("length", "<u8"),
+    ("id_offset", "<u8"),
+    ("gene_offset", "<u8"),
+])
+
+
+def read_results(path):
+    """
+    Map a columnar result file
+
+    Args:
+        path: File written with --output-format columnar
+
+    Returns:
+        dict: counts (n x 6 uint64), disqualified_mm (int32, -1 when kept),
+        disqualified_pos, mm0_offsets (n + 1), mm0_transcripts, transcripts
+        (start, length, id_offset, gene_offset records), strings (uint8 heap),
+        guide_strings (n x 2 heap offsets of Gene and Sequence),
+        max_mismatches and caps ({level: cap} when caps were active)
+    """
+    path = Path(path)
+    data = np.memmap(path, dtype=np.uint8, mode="r")
+    if len(data) < _HEADER.itemsize:
+        raise ValueError(f"{path} is not a columnar result file")
+    header = data[:_HEADER.itemsize].view(_HEADER)[0]
+    if header["magic"] != MAGIC or header["version"] != VERSION or header["byte_order"] != BYTE_ORDER:
+        raise ValueError(f"{path} is not a compatible columnar result file")
+    if header["file_size"] != len(data):
+        raise ValueError(f"{path} is incomplete (the search did not finish)")
+
+    n = int(header["guide_count"])
+
+    def column(offset, dtype, count):
+        dtype = np.dtype(dtype)
+        start = int(offset)
+        return data[start:start + count * dtype.itemsize].view(dtype)
+
+    caps = {}
+    if header["caps_active"]:
+        caps = {mm: int(cap) for mm, cap in enumerate(header["caps"]) if cap != 2**64 - 1}
+
+    return {
+        "counts": column(header["counts_offset"], "<u8", (MAX_MISMATCHES + 1) * n)
+        .reshape(MAX_MISMATCHES + 1, n).T,
+        "disqualified_mm": column(header["disqualified_mm_offset"], "<i4", n),
+        "disqualified_pos": column(header["disqualified_pos_offset"], "<u8", n),
+        "guide_strings": column(header["guide_strings_offset"], "<u8", 2 * n).reshape(n, 2),
+        "transcripts": column(header["transcripts_offset"], _TRANSCRIPT, int(header["transcript_count"])),
+        "mm0_offsets": column(header["mm0_offsets_offset"], "<u8", n + 1),
+        "mm0_transcripts": column(header["mm0_transcripts_offset"], "<u8",
+                                  int(header["mm0_transcript_count"])),
+        "strings": column(header["strings_offset"], "u1", int(header["strings_size"])),
+        "max_mismatches": int(header["max_mismatches"]),
+        "caps": caps,
+    }
+
+
+def _heap_strings(heap, offsets):
+    raw = heap.tobytes()
+    return np.array([raw[o:raw.index(b"\0", o)].decode() for o in offsets.tolist()], dtype=object)
+
+
+def results_frame(path):
+    """
+    Load a columnar result file as the table the CSV output holds
+
+    Args:
+        path: File written with --output-format columnar
+
+    Returns:
+        pd.DataFrame: Gene, Sequence, MM0..MM5 (NaN above max_mismatches),
+        MM0_Transcripts, MM0_Genes and, with caps, Status
+    """
+    found = read_results(path)
+    heap = found["strings"]
+    transcripts = found["transcripts"]
+    transcript_ids = _heap_strings(heap, transcripts["id_offset"])
+    transcript_genes = _heap_strings(heap, transcripts["gene_offset"])
+
+    frame = pd.DataFrame({
+        "Gene": _heap_strings(heap, found["guide_strings"][:, 0]),
+        "Sequence": _heap_strings(heap, found["guide_strings"][:, 1]),
+    })
+    for mm in range(MAX_MISMATCHES + 1):
+        if mm <= found["max_mismatches"]:
+            frame[f"MM{mm}"] = found["counts"][:, mm].astype(np.int64)
+        else:
+            frame[f"MM{mm}"] = np.nan
+
+    offsets = found["mm0_offsets"]
+    hits = found["mm0_transcripts"].astype(np.intp)
+    hit_ids = transcript_ids[hits]
+    hit_genes = transcript_genes[hits]
+    transcripts_col = []
+    genes_col = []
+    for i in range(len(frame)):
+        start, end = int(offsets[i]), int(offsets[i + 1])
+        transcripts_col.append("|".join(hit_ids[start:end]))
+        genes_col.append("|".join(dict.fromkeys(hit_genes[start:end])))
+    frame["MM0_Transcripts"] = transcripts_col
+    frame["MM0_Genes"] = genes_col
+
+    if found["caps"]:
+        starts = transcripts["start"]
+        status = []
+        for level, pos in zip(found["disqualified_mm"].tolist(), found["disqualified_pos"].tolist()):
+            if level < 0:
+                status.append("")
+                continue
+            t_idx = int(np.searchsorted(starts, pos, side="right")) - 1
+            status.append(
+                f"disqualified at {transcript_ids[t_idx]}:{pos - int(starts[t_idx])} "
+                f"(MM{level} > {found['caps'][level]})"
+            )
+        frame["Status"] = status
+    return frame
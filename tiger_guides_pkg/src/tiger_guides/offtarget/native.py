@@ -0,0 +1,317 @@
+"""
+ctypes binding for libofftarget.so (in-process off-target search)
+
+Guide sequences are handed to the library as one fixed-width byte buffer and
+results come back as numpy arrays, so no CSV is written, parsed or merged.
+A GuideTable enumerates a target FASTA's guide windows and one-hot encodes them
+for TIGER in C; the searcher then passes window ids instead of sequences.
+"""
+import ctypes
+from pathlib import Path
+
+import numpy as np
+
+API_VERSION = 2
+MAX_MISMATCHES = 5
+NO_CAP = 2**64 - 1
+ENGINES = {"packed": 0, "byte": 1, "index": 2, "gpu": 3}
+
+
+class _Options(ctypes.Structure):
+    _fields_ = [
+        ("engine", ctypes.c_int),
+        ("max_mismatches", ctypes.c_int),
+        ("window_length", ctypes.c_int),
+        ("threads", ctypes.c_int),
+        ("max_hits", ctypes.c_uint64 * (MAX_MISMATCHES + 1)),
+    ]
+
+
+class _Hits(ctypes.Structure):
+    _fields_ = [
+        ("offsets", ctypes.POINTER(ctypes.c_uint64)),
+        ("transcripts", ctypes.POINTER(ctypes.c_uint64)),
+    ]
+
+
+def _load_library(library_path):
+    lib = ctypes.CDLL(str(library_path))
+    lib.ot_api_version.restype = ctypes.c_int
+    if lib.ot_api_version() != API_VERSION:
+        raise RuntimeError(f"{library_path} implements API version {lib.ot_api_version()}, expected {API_VERSION}")
+
+    lib.ot_options_init.argtypes = [ctypes.POINTER(_Options)]
+    lib.ot_options_init.restype = None
+    lib.ot_reference_open.argtypes = [ctypes.c_char_p, ctypes.POINTER(_Options)]
+    lib.ot_reference_open.restype = ctypes.c_void_p
+    lib.ot_reference_close.argtypes = [ctypes.c_void_p]
+    lib.ot_reference_close.restype = None
+    lib.ot_reference_transcript_count.argtypes = [ctypes.c_void_p]
+    lib.ot_reference_transcript_count.restype = ctypes.c_size_t
+    lib.ot_reference_transcript_id.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+    lib.ot_reference_transcript_id.restype = ctypes.c_char_p
+    lib.ot_reference_gene_symbol.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+    lib.ot_reference_gene_symbol.restype = ctypes.c_char_p
+    lib.ot_reference_locate.argtypes = [
+        ctypes.c_void_p, ctypes.c_uint64,
+        ctypes.POINTER(ctypes.c_size_t), ctypes.POINTER(ctypes.c_uint64),
+    ]
+    lib.ot_reference_locate.restype = ctypes.c_int
+    lib.ot_search.argtypes = [
+        ctypes.c_void_p,
+        ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_size_t,
+        ctypes.c_void_p, ctypes.POINTER(_Hits),
+        ctypes.c_void_p, ctypes.c_void_p,
+    ]
+    lib.ot_search.restype = ctypes.c_int
+    lib.ot_hits_free.argtypes = [ctypes.POINTER(_Hits)]
+    lib.ot_hits_free.restype = None
+
+    lib.ot_guides_open.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+    lib.ot_guides_open.restype = ctypes.c_void_p
+    lib.ot_guides_close.argtypes = [ctypes.c_void_p]
+    lib.ot_guides_close.restype = None
+    lib.ot_guides_count.argtypes = [ctypes.c_void_p]
+    lib.ot_guides_count.restype = ctypes.c_size_t
+    lib.ot_guides_record_count.argtypes = [ctypes.c_void_p]
+    lib.ot_guides_record_count.restype = ctypes.c_size_t
+    lib.ot_guides_record_id.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+    lib.ot_guides_record_id.restype = ctypes.c_char_p
+    lib.ot_guides_record_offsets.argtypes = [ctypes.c_void_p]
+    lib.ot_guides_record_offsets.restype = ctypes.POINTER(ctypes.c_uint64)
+    lib.ot_guides_record_skipped.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+    lib.ot_guides_record_skipped.restype = ctypes.c_int
+    lib.ot_guides_encode.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_void_p]
+    lib.ot_guides_encode.restype = ctypes.c_int
+    lib.ot_guides_sequences.argtypes = [
+        ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t,
+        ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t,
+    ]
+    lib.ot_guides_sequences.restype = ctypes.c_int
+    lib.ot_search_windows.argtypes = [
+        ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t,
+        ctypes.c_void_p, ctypes.POINTER(_Hits),
+        ctypes.c_void_p, ctypes.c_void_p,
+    ]
+    lib.ot_search_windows.restype = ctypes.c_int
+    return lib
+
+
+def _collect(lib, status, n_guides, counts, hits, disqualified_mm, disqualified_pos):
+    """Copy an ot_search/ot_search_windows result into numpy arrays and free the hits"""
+    if status != 0:
+        raise RuntimeError("libofftarget search failed (see stderr)")
+
+    try:
+        offsets = np.ctypeslib.as_array(hits.offsets, shape=(n_guides + 1,)).copy()
+        total = int(offsets[-1])
+        transcripts = (
+            np.ctypeslib.as_array(hits.transcripts, shape=(total,)).copy()
+            if total else np.zeros(0, dtype=np.uint64)
+        )
+    finally:
+        lib.ot_hits_free(ctypes.byref(hits))
+
+    return {
+        "counts": counts,
+        "mm0_offsets": offsets,
+        "mm0_transcripts": transcripts,
+        "disqualified_mm": disqualified_mm,
+        "disqualified_pos": disqualified_pos,
+    }
+
+
+class GuideTable:
+    """Every guide window of a target FASTA, enumerated by libofftarget.so
+
+    Windows are numbered record by record (window w of record r is
+    record_offsets[r] + position). Records shorter than a window have none, and
+    records with an N in the target span are skipped like TIGER's process_data
+    skips them.
+    """
+
+    def __init__(self, library_path, fasta_path, guide_length=23, context_5p=3, context_3p=0):
+        self._lib = _load_library(Path(library_path))
+        self.guide_length = guide_length
+        self.context_5p = context_5p
+        self.context_3p = context_3p
+        self.window_length = context_5p + guide_length + context_3p
+
+        self._handle = self._lib.ot_guides_open(str(fasta_path).encode(), guide_length, context_5p, context_3p)
+        if not self._handle:
+            raise RuntimeError(f"libofftarget failed to enumerate guides in {fasta_path}")
+
+        records = self._lib.ot_guides_record_count(self._handle)
+        self.count = self._lib.ot_guides_count(self._handle)
+        self.record_ids = [self._lib.ot_guides_record_id(self._handle, r).decode() for r in range(records)]
+        self.record_offsets = np.ctypeslib.as_array(
+            self._lib.ot_guides_record_offsets(self._handle), shape=(records + 1,)
+        ).astype(np.int64)
+        self.skipped = np.array([bool(self._lib.ot_guides_record_skipped(self._handle, r)) for r in range(records)],
+                                dtype=bool)
+
+    def encode(self, first=0, count=None):
+        """TIGER model inputs (float32, count x 2 * window_length * 4) for windows first..first+count"""
+        count = self.count - first if count is None else count
+        inputs = np.empty((count, 2 * self.window_length * 4), dtype=np.float32)
+        if self._lib.ot_guides_encode(self._handle, first, count, inputs.ctypes.data) != 0:
+            raise RuntimeError("libofftarget guide encoding failed (see stderr)")
+        return inputs
+
+    def _sequences(self, first, count, targets):
+        count = self.count - first if count is None else count
+        out = np.zeros(count, dtype=f"S{self.guide_length}")
+        pointers = (out.ctypes.data, None) if targets else (None, out.ctypes.data)
+        if self._lib.ot_guides_sequences(self._handle, first, count, *pointers, self.guide_length) != 0:
+            raise RuntimeError("libofftarget guide sequences failed (see stderr)")
+        return out
+
+    def targets(self, first=0, count=None):
+        """Target sequences (the window minus its context) as a bytes array"""
+        return self._sequences(first, count, targets=True)
+
+    def spacers(self, first=0, count=None):
+        """Spacer sequences (reverse complement of the target) as a bytes array"""
+        return self._sequences(first, count, targets=False)
+
+    def close(self):
+        """Release the table"""
+        if self._handle:
+            self._lib.ot_guides_close(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        try:
+            self.close()
+        except Exception:
+            pass
+
+
+class NativeReference:
+    """A reference loaded into this process through libofftarget.so"""
+
+    def __init__(self, library_path, reference_path, engine="packed", max_mismatches=5,
+                 window_length=23, threads=None, count_caps=None):
+        """
+        Load a reference
+
+        Args:
+            library_path: Path to libofftarget.so
+            reference_path: FASTA file or index image
+            engine: 'packed', 'byte', 'index' or 'gpu' (experimental; packed
+                with a warning in builds without make GPU=cuda|hip)
+            max_mismatches: Highest MMk column computed
+            window_length: Guide length whose valid windows are precomputed
+            threads: Optional OpenMP thread count
+            count_caps: Optional {mismatches: max hits} map (see --max-mmK)
+        """
+        self._lib = _load_library(Path(library_path))
+        self.max_mismatches = max_mismatches
+        self.count_caps = dict(count_caps or {})
+
+        options = _Options()
+        self._lib.ot_options_init(ctypes.byref(options))
+        options.engine = ENGINES[engine or "packed"]
+        options.max_mismatches = max_mismatches
+        options.window_length = window_length
+        options.threads = threads or 0
+        for mismatches, cap in self.count_caps.items():
+            options.max_hits[int(mismatches)] = int(cap)
+
+        self._handle = self._lib.ot_reference_open(str(reference_path).encode(), ctypes.byref(options))
+        if not self._handle:
+            raise RuntimeError(f"libofftarget failed to open {reference_path}")
+
+        count = self._lib.ot_reference_transcript_count(self._handle)
+        self.transcript_ids = np.array(
+            [self._lib.ot_reference_transcript_id(self._handle, i).decode() for i in range(count)],
+            dtype=object,
+        )
+        self.gene_symbols = np.array(
+            [self._lib.ot_reference_gene_symbol(self._handle, i).decode() for i in range(count)],
+            dtype=object,
+        )
+
+    def search(self, sequences):
+        """
+        Search guide sequences
+
+        Args:
+            sequences: Iterable of guide strings (e.g. a DataFrame column)
+
+        Returns:
+            dict: counts (n x 6 uint64), mm0_offsets (n + 1) and
+            mm0_transcripts (transcript indices, guide i owns
+            mm0_transcripts[mm0_offsets[i]:mm0_offsets[i + 1]]),
+            disqualified_mm (int32, -1 when kept) and disqualified_pos
+        """
+        buffer = np.ascontiguousarray(np.asarray(sequences, dtype="S"))
+        n_guides = len(buffer)
+        lengths = np.ascontiguousarray(np.char.str_len(buffer), dtype=np.int32)
+        counts = np.zeros((n_guides, MAX_MISMATCHES + 1), dtype=np.uint64)
+        disqualified_mm = np.full(n_guides, -1, dtype=np.int32)
+        disqualified_pos = np.zeros(n_guides, dtype=np.uint64)
+        hits = _Hits()
+
+        status = self._lib.ot_search(
+            self._handle,
+            buffer.ctypes.data, max(buffer.itemsize, 1), lengths.ctypes.data, n_guides,
+            counts.ctypes.data, ctypes.byref(hits),
+            disqualified_mm.ctypes.data, disqualified_pos.ctypes.data,
+        )
+        return _collect(self._lib, status, n_guides, counts, hits, disqualified_mm, disqualified_pos)
+
+    def search_windows(self, table, windows):
+        """
+        Search guide windows of a GuideTable by id (same result as search())
+
+        Args:
+            table: GuideTable loaded through the same library
+            windows: Window ids (e.g. the index of the predictor's DataFrame)
+        """
+        ids = np.ascontiguousarray(np.asarray(windows, dtype=np.uint64))
+        n_guides = len(ids)
+        counts = np.zeros((n_guides, MAX_MISMATCHES + 1), dtype=np.uint64)
+        disqualified_mm = np.full(n_guides, -1, dtype=np.int32)
+        disqualified_pos = np.zeros(n_guides, dtype=np.uint64)
+        hits = _Hits()
+
+        status = self._lib.ot_search_windows(
+            self._handle, table._handle, ids.ctypes.data, n_guides,
+            counts.ctypes.data, ctypes.byref(hits),
+            disqualified_mm.ctypes.data, disqualified_pos.ctypes.data,
+        )
+        return _collect(self._lib, status, n_guides, counts, hits, disqualified_mm, disqualified_pos)
+
+    def locate(self, position):
+        """Return (transcript_id, offset) of a reference position"""
+        transcript = ctypes.c_size_t()
+        offset = ctypes.c_uint64()
+        if self._lib.ot_reference_locate(self._handle, int(position),
+                                         ctypes.byref(transcript), ctypes.byref(offset)) != 0:
+            raise ValueError(f"Position {position} is outside the reference")
+        return self.transcript_ids[transcript.value], offset.value
+
+    def close(self):
+        """Release the reference"""
+        if self._handle:
+            self._lib.ot_reference_close(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        try:
+            self.close()
+        except Exception:
+            pass
@@ -1,18 +1,230 @@
 """
 Python wrapper for C off-target search
 """
+import hashlib
+import io
+import json
 import os
 import subprocess
+import threading
+import numpy as np
 import pandas as pd
 from pathlib import Path
 import tempfile
 import shutil
 
+from .columnar import results_frame
+
+
+def binary_env(threads=None, numa=None):
+    """Environment for a run of the binary: thread count and NUMA mode overrides"""
+    env = os.environ.copy()
+    if threads:
+        env["TIGER_OFFTARGET_THREADS"] = str(threads)
+    if numa:
+        env["TIGER_OFFTARGET_NUMA"] = str(numa)
+    return env
+
+
+class OffTargetServer:
+    """Resident `offtarget_search serve` process holding one loaded reference
+
+    Requests use the framed stdin/stdout protocol: ``SEARCH <bytes>`` plus a
+    guides CSV, answered by ``OK <bytes> <milliseconds>`` plus the results
+    CSV.  Requests are serialised; use one server per concurrent caller.
+    """
+
+    def __init__(self, binary_path, reference_path, extra_args=(), threads=None,
+                 window_length=23, logger=None, numa=None):
+        self.logger = logger
+        self.last_latency_ms = None
+        self._lock = threading.Lock()
+
+        env = binary_env(threads, numa)
+        cmd = [
+            str(binary_path),
+            "serve",
+            *extra_args,
+            "--window-length", str(window_length),
+            str(reference_path),
+        ]
+        self._stderr = tempfile.TemporaryFile()
+        self._process = subprocess.Popen(
+            cmd,
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            stderr=self._stderr,
+            env=env,
+        )
+        greeting = self._process.stdout.readline()
+        if greeting != b"READY\n":
+            self._process.kill()
+            self._process.wait()
+            stderr = self._stderr_text()
+            self._stderr.close()
+            raise RuntimeError(f"offtarget_search serve failed to load {reference_path}: {stderr}")
+
+    def _stderr_text(self):
+        """Everything the server has written to stderr so far"""
+        self._stderr.seek(0)
+        return self._stderr.read().decode("utf-8", "replace").strip()
+
+    def search_csv(self, guides_csv):
+        """Send a guides CSV and return the results CSV text"""
+        payload = guides_csv.encode("utf-8")
+        with self._lock:
+            try:
+                self._process.stdin.write(b"SEARCH %d\n" % len(payload))
+                self._process.stdin.write(payload)
+                self._process.stdin.flush()
+            except BrokenPipeError:
+                pass  # the server exited; the empty header below reports its stderr
+
+            header = self._process.stdout.readline().decode("utf-8").strip()
+            if not header.startswith("OK "):
+                if not header:
+                    self._process.wait()
+                raise RuntimeError(f"Off-target server error: {header or 'server exited'}: {self._stderr_text()}")
+            _, length, latency = header.split()
+            body = self._process.stdout.read(int(length))
+
+        self.last_latency_ms = float(latency)
+        if self.logger:
+            self.logger.debug(f"Off-target server answered in {latency} ms")
+        return body.decode("utf-8")
+
+    def close(self):
+        """Ask the server to exit and wait for it"""
+        if self._process.poll() is None:
+            try:
+                self._process.stdin.write(b"QUIT\n")
+                self._process.stdin.close()
+            except BrokenPipeError:
+                pass
+            self._process.wait()
+        self._stderr.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+class OffTargetStream:
+    """One `offtarget_search -` run fed guides while they are being produced
+
+    Guides handed to `add` are written to the binary's stdin straight away,
+    so the search of early genes overlaps the scoring of later ones; `finish`
+    closes the input and attaches the results to the guides added.
+    """
+
+    def __init__(self, searcher, hits_path=None, hits_max_mismatches=0, window_length=23):
+        self._searcher = searcher
+        self._frames = []
+        self._search_col = None
+        self._output = tempfile.mktemp(suffix='.csv')
+        self._hits = tempfile.mktemp(suffix='.csv') if hits_path else None
+        self.hits_path = Path(hits_path) if hits_path else None
+        self._stderr = tempfile.TemporaryFile()
+        self._stats = searcher._stats_path("stream")
+
+        env = binary_env(searcher.threads, searcher.numa)
+        cmd = [
+            str(searcher.binary_path),
+            *searcher._engine_args(),
+            *searcher._cache_args(updatable=self._hits is None),
+            *(["--stats", str(self._stats)] if self._stats else []),
+            "--window-length", str(window_length),
+            *(["--hits-out", self._hits, "--hits-max-mm", str(hits_max_mismatches)] if self._hits else []),
+            "-",
+            str(searcher.reference_path),
+            self._output,
+        ]
+        self._process = subprocess.Popen(cmd, stdin=subprocess.PIPE, stderr=self._stderr, env=env)
+        self._process.stdin.write(b"Gene,Sequence\n")
+
+    def add(self, guides_df):
+        """Queue guides (columns: Gene, Sequence or Target, ...) for searching"""
+        if guides_df.empty:
+            return
+        search_col = 'Target' if 'Target' in guides_df.columns else 'Sequence'
+        if self._search_col is None:
+            self._search_col = search_col
+        elif search_col != self._search_col:
+            raise ValueError("every batch of a stream must carry the same sequence column")
+        self._frames.append(guides_df)
+        export_df = guides_df[['Gene', search_col]]
+        self._process.stdin.write(export_df.to_csv(index=False, header=False).encode("utf-8"))
+        self._process.stdin.flush()
+
+    def finish(self, output_path=None):
+        """
+        Wait for the search and attach its results
+
+        Args:
+            output_path: Optional path to save the merged results
+
+        Returns:
+            pd.DataFrame: Results with off-target counts, or None when no
+            guides were added
+        """
+        searcher = self._searcher
+        try:
+            self._process.stdin.close()
+            returncode = self._process.wait()
+            self._stderr.seek(0)
+            stderr = self._stderr.read().decode("utf-8", "replace")
+            if searcher.logger:
+                for line in stderr.split('\n'):
+                    if line.strip():
+                        searcher.logger.debug(line.strip())
+            if not self._frames:
+                return None
+            if returncode != 0:
+                if searcher.logger:
+                    searcher.logger.error(f"Streamed off-target search failed: {stderr}")
+                raise subprocess.CalledProcessError(returncode, self._process.args, stderr=stderr)
+            searcher._log_stats(self._stats)
+
+            guides_df = pd.concat(self._frames, ignore_index=True)
+            results_df = pd.read_csv(self._output)
+            merged = searcher._merge_results(guides_df, results_df, self._search_col)
+
+            if self.hits_path:
+                self.hits_path.parent.mkdir(parents=True, exist_ok=True)
+                shutil.copyfile(self._hits, self.hits_path)
+            if output_path:
+                output_path = Path(output_path)
+                output_path.parent.mkdir(parents=True, exist_ok=True)
+                merged.to_csv(output_path, index=False)
+                if searcher.logger:
+                    searcher.logger.info(f"💾 Saved results to {output_path}")
+            return merged
+        finally:
+            self._cleanup()
+
+    def abort(self):
+        """Stop the search without reading its results"""
+        self._process.kill()
+        self._process.wait()
+        self._cleanup()
+
+    def _cleanup(self):
+        self._stderr.close()
+        Path(self._output).unlink(missing_ok=True)
+        if self._hits:
+            Path(self._hits).unlink(missing_ok=True)
+
 
 class OffTargetSearcher:
     """Wrapper for C off-target search binary"""
     
-    def __init__(self, binary_path, reference_path, logger=None, threads=None):
+    def __init__(self, binary_path, reference_path, logger=None, threads=None,
+                 engine=None, max_mismatches=None, count_caps=None, persistent=False,
+                 library_path=None, output_format="csv", cache_dir=None, stats_dir=None, numa=None,
+                 guide_length=None, position_weights=None, cache_from=None,
+                 collapse_isoforms=False, memory_budget=None, checkpoint_dir=None):
         """
         Initialize off-target searcher
         
@@ -21,11 +233,94 @@ class OffTargetSearcher:
             reference_path: Path to reference transcriptome
             logger: Optional logger
             threads: Optional thread override passed to the binary
+            engine: Optional search engine ('packed', 'byte', 'index', or
+                the experimental 'gpu' for binaries built with make
+                GPU=cuda|hip; other builds warn and use 'packed')
+            max_mismatches: Optional highest mismatch count to report; lower
+                limits also make the scan kernels stop earlier per window
+            count_caps: Optional {mismatches: max hits} map; guides over a cap
+                stop being scanned and get a "disqualified at ..." Status
+            persistent: Keep the reference loaded in an `offtarget_search
+                serve` process across searches instead of one run per chunk
+            library_path: Optional libofftarget.so; searches then run in
+                process and results are attached without CSV round trips
+            output_format: 'csv' or 'columnar'; one-shot runs of the binary
+                then write memory-mapped columns instead of a results CSV
+            cache_dir: Optional directory of per-reference result caches
+                (--cache-dir); runs of the binary only scan sequences not
+                searched before with the same reference and options
+            stats_dir: Optional directory that receives the --stats JSON of
+                every run of the binary (phase timings, work counters, hits
+                per mismatch level, thread balance, peak RSS)
+            numa: Optional NUMA placement of the reference on multi-socket
+                nodes ('interleave' or 'replicate', TIGER_OFFTARGET_NUMA) for
+                runs of the binary; also pins the search threads to their nodes.
+                libofftarget reads the variable from this process's environment
+            guide_length: Optional length every guide has (--guide-length);
+                the binary rejects other lengths and runs kernels specialised
+                for it (23 nt has dedicated ones)
+            position_weights: Optional per-position mismatch weights
+                (--position-weights); results then carry Mismatch_Positions
+                (off-target windows mismatching at each guide position) and
+                OffTarget_Score (sum over off-targets of the product of the
+                weights at their mismatches). CSV runs of the binary only
+            cache_from: Optional earlier release of the reference
+                (--cache-from); results cached in cache_dir against it are
+                carried over by scanning only the transcripts added, removed
+                or changed since. Runs with count caps, hit details or
+                reference shards search those sequences in full instead
+            collapse_isoforms: Scan each window shared by several isoforms
+                of a gene once and expand its hits to every copy
+                (--collapse-isoforms); results are unchanged. Runs of the
+                binary without count caps or position_weights; reference
+                shards and library searches scan every copy
+            memory_budget: Optional size such as "24G" (--memory-budget);
+                one-shot and SLURM runs of the binary then stream the FASTA
+                reference in overlapping slices that fit the budget instead
+                of loading it whole (same results). Not with count caps,
+                collapse_isoforms, cache_dir, persistent, library_path,
+                the GPU engine or a reference index
+            checkpoint_dir: Optional directory of --checkpoint files; one-shot
+                and SLURM runs of the binary append each finished group of
+                guides there, so a preempted or failed run resubmitted with the
+                same guides, reference and options only searches the groups
+                still missing. Files are removed once a run succeeds. Not with
+                position_weights
         """
         self.binary_path = Path(binary_path)
         self.reference_path = Path(reference_path)
         self.logger = logger
         self.threads = threads
+        self.engine = engine
+        self.max_mismatches = max_mismatches
+        self.count_caps = dict(count_caps or {})
+        self.persistent = persistent
+        self.library_path = Path(library_path) if library_path else None
+        # Set by the workflow when guides_df rows are windows of this GuideTable
+        self.guide_table = None
+        self.output_format = output_format or "csv"
+        self.cache_dir = Path(cache_dir) if cache_dir else None
+        self.cache_from = Path(cache_from) if cache_from else None
+        self.stats_dir = Path(stats_dir) if stats_dir else None
+        self.numa = numa
+        self.guide_length = guide_length
+        self.position_weights = list(position_weights) if position_weights else None
+        if self.position_weights and (self.library_path or self.output_format != "csv" or self.cache_dir):
+            raise ValueError("position_weights profiles need CSV runs of the binary without library_path or cache_dir")
+        self.collapse_isoforms = bool(collapse_isoforms)
+        if self.collapse_isoforms and (self.count_caps or self.position_weights):
+            raise ValueError("collapse_isoforms cannot be combined with count_caps or position_weights")
+        self.memory_budget = str(memory_budget) if memory_budget else None
+        if self.memory_budget and (self.count_caps or self.collapse_isoforms or self.cache_dir or self.persistent
+                                   or self.library_path or self.engine == "gpu"):
+            raise ValueError("memory_budget cannot be combined with count_caps, collapse_isoforms, cache_dir, "
+                             "persistent, library_path or the GPU engine")
+        self.checkpoint_dir = Path(checkpoint_dir) if checkpoint_dir else None
+        if self.checkpoint_dir and self.position_weights:
+            raise ValueError("checkpoint_dir cannot be combined with position_weights")
+        self._stats_runs = 0
+        self._server = None
+        self._native = None
         
         # Check if binary exists
         if not self.binary_path.exists():
@@ -35,7 +330,210 @@ class OffTargetSearcher:
         if not self.reference_path.exists():
             raise FileNotFoundError(f"Reference not found: {self.reference_path}")
     
-    def search(self, guides_df, output_path=None, chunk_size=None):
+    def ensure_index(self, index_path, window_length=23):
+        """
+        Build a memory-mapped reference image and search against it
+
+        The image is rebuilt when missing or older than the FASTA, so every
+        chunk (and every concurrent job on the node) maps the same
+        preprocessed reference instead of re-parsing the transcriptome.
+
+        Args:
+            index_path: Destination of the index image
+            window_length: Guide length whose valid windows are precomputed
+
+        Returns:
+            Path: The index image now used as the reference
+        """
+        index_path = Path(index_path)
+        source = self.reference_path
+        if self.memory_budget:
+            if self.logger:
+                self.logger.warning("memory_budget streams the FASTA reference; reference_index ignored")
+            return source
+
+        if not index_path.exists() or index_path.stat().st_mtime < source.stat().st_mtime:
+            if self.logger:
+                self.logger.info(f"Building reference index {index_path}...")
+            index_path.parent.mkdir(parents=True, exist_ok=True)
+            cmd = [
+                str(self.binary_path),
+                "index", "build",
+                "--window-length", str(window_length),
+                str(source),
+                str(index_path),
+            ]
+            result = subprocess.run(cmd, capture_output=True, text=True, check=True)
+            if self.logger and result.stderr:
+                for line in result.stderr.split('\n'):
+                    if line.strip():
+                        self.logger.debug(line.strip())
+
+        self.reference_path = index_path
+        return index_path
+
+    def close(self):
+        """Stop the resident server, if one was started"""
+        if self._server is not None:
+            self._server.close()
+            self._server = None
+        if self._native is not None:
+            self._native.close()
+            self._native = None
+
+    def _get_native(self):
+        if self._native is None:
+            from .native import NativeReference
+
+            if self.logger:
+                self.logger.info(f"Loading {self.reference_path} into libofftarget...")
+            self._native = NativeReference(
+                self.library_path,
+                self.reference_path,
+                engine=self.engine,
+                max_mismatches=5 if self.max_mismatches is None else self.max_mismatches,
+                threads=self.threads,
+                count_caps=self.count_caps,
+            )
+        return self._native
+
+    def _get_server(self):
+        if self._server is None:
+            if self.logger:
+                self.logger.info(f"Starting off-target server for {self.reference_path}...")
+            self._server = OffTargetServer(
+                self.binary_path,
+                self.reference_path,
+                extra_args=self._engine_args(),
+                threads=self.threads,
+                logger=self.logger,
+                numa=self.numa,
+            )
+        return self._server
+
+    def _engine_args(self, collapsible=True):
+        """Command-line flags selecting the engine, limits, guide length, profile weights and isoform collapse"""
+        args = []
+        if self.engine:
+            args += ["--engine", str(self.engine)]
+        if self.max_mismatches is not None:
+            args += ["--max-mismatches", str(self.max_mismatches)]
+        if self.guide_length is not None:
+            args += ["--guide-length", str(self.guide_length)]
+        if self.position_weights:
+            args += ["--position-weights", ",".join(f"{float(w):g}" for w in self.position_weights)]
+        if self.collapse_isoforms and collapsible:
+            args.append("--collapse-isoforms")
+        for mismatches, cap in sorted(self.count_caps.items()):
+            args += [f"--max-mm{mismatches}", str(cap)]
+        return args
+
+    def _budget_args(self):
+        """--memory-budget for one-shot runs of the binary (serve and streamed guides load the reference)"""
+        return ["--memory-budget", self.memory_budget] if self.memory_budget else []
+
+    def open_stream(self, hits_path=None, hits_max_mismatches=0, window_length=23):
+        """
+        Start a search that takes guides as they are produced
+
+        Args:
+            hits_path: Optional path for the per-hit detail table (see search)
+            hits_max_mismatches: Highest mismatch count written to hits_path
+            window_length: Guide length the reference is prepared for
+
+        Returns:
+            OffTargetStream: feed it with add(), then call finish()
+        """
+        if self.logger:
+            self.logger.info("Streaming guides into the off-target search...")
+        return OffTargetStream(self, hits_path=hits_path, hits_max_mismatches=hits_max_mismatches,
+                               window_length=window_length)
+
+    def screen(self, sequences=None, generate=None, max_mismatches=2, length=23, seed=42,
+               gc_range=(40, 60), max_homopolymer=3, max_dinucleotide=3, limit=None):
+        """
+        Find sequences with no window within max_mismatches in the reference
+
+        Runs `offtarget_search screen`, which rejects each candidate at its
+        first hit instead of counting MM0..MM5, for non-targeting controls.
+
+        Args:
+            sequences: Candidate sequences to screen, or None to generate
+            generate: Number of distinct surviving sequences to generate
+                from `seed`, subject to gc_range (percent), max_homopolymer
+                (longest single-base run) and max_dinucleotide (most copies
+                of a repeated base pair)
+            max_mismatches: A window with at most this many mismatches
+                rejects the candidate
+            length: Candidate length; other sequences are skipped
+            limit: Optional cap on candidates screened (generation defaults
+                to 100 per requested survivor)
+
+        Returns:
+            list: surviving sequences, in input or generation order
+        """
+        if (sequences is None) == (generate is None):
+            raise ValueError("screen takes either sequences or generate")
+        engine = self.engine if self.engine in ("index", "packed") else "index"
+        cmd = [
+            str(self.binary_path), "screen", "--engine", engine,
+            "--max-mismatches", str(max_mismatches), "--guide-length", str(length),
+        ]
+        if generate is not None:
+            cmd += [
+                "--generate", str(generate), "--seed", str(seed),
+                "--gc-min", str(gc_range[0]), "--gc-max", str(gc_range[1]),
+                "--max-homopolymer", str(max_homopolymer), "--max-dinucleotide", str(max_dinucleotide),
+            ]
+        if limit is not None:
+            cmd += ["--limit", str(limit)]
+        cmd.append(str(self.reference_path))
+
+        result = subprocess.run(
+            cmd,
+            input="".join(f"{seq}\n" for seq in sequences) if sequences is not None else None,
+            capture_output=True,
+            text=True,
+            check=True,
+            env=binary_env(self.threads, self.numa),
+        )
+        if self.logger and result.stderr:
+            self.logger.info(result.stderr.strip())
+        return result.stdout.split()
+
+    def _cache_args(self, updatable=True):
+        """Flags pointing one-shot runs at the result cache (and the release it updates, when `updatable`)"""
+        if self.cache_dir is None:
+            return []
+        self.cache_dir.mkdir(parents=True, exist_ok=True)
+        args = ["--cache-dir", str(self.cache_dir)]
+        if self.cache_from and updatable and not self.count_caps:
+            args += ["--cache-from", str(self.cache_from)]
+        return args
+
+    def _stats_path(self, label):
+        """Next --stats destination under stats_dir, or None"""
+        if self.stats_dir is None:
+            return None
+        self.stats_dir.mkdir(parents=True, exist_ok=True)
+        self._stats_runs += 1
+        return self.stats_dir / f"{label}_{self._stats_runs:03d}.json"
+
+    def _log_stats(self, stats_path):
+        """Summarise one run's --stats file in the log"""
+        if stats_path is None or self.logger is None or not Path(stats_path).exists():
+            return
+        stats = json.loads(Path(stats_path).read_text())
+        phases = ", ".join(f"{name} {phase['wall_seconds']:.2f}s" for name, phase in stats["phases"].items())
+        self.logger.info(
+            f"Off-target search took {stats['wall_seconds']:.2f}s ({phases}); "
+            f"searched {stats['guides']['searched']} of {stats['guides']['rows']} guides, "
+            f"peak RSS {stats['peak_rss_kb'] / 1024:.0f} MiB, "
+            f"thread load imbalance {stats['load_imbalance']:.2f}; details in {stats_path}"
+        )
+
+    def search(self, guides_df, output_path=None, chunk_size=None, hits_path=None,
+               hits_max_mismatches=0):
         """
         Search for off-targets
         
@@ -43,12 +541,23 @@ class OffTargetSearcher:
             guides_df: DataFrame with guides (columns: Gene, Sequence, Score, ...)
             output_path: Path to save results
             chunk_size: If specified, process in chunks
+            hits_path: Optional path for the per-hit detail table (--hits-out):
+                one row per window with at most hits_max_mismatches
+                mismatches, with its transcript and offset.  Guide is the
+                row position in guides_df.  Always produced by one-shot runs
+                of the binary, even when persistent or library_path is set.
+            hits_max_mismatches: Highest mismatch count written to hits_path
             
         Returns:
             pd.DataFrame: Results with off-target counts
         """
         if self.logger:
             self.logger.info(f"Searching off-targets for {len(guides_df)} guides...")
+
+        hits_args = None
+        if hits_path:
+            hits_args = ["--hits-max-mm", str(hits_max_mismatches)]
+        hit_tables = []
         
         if chunk_size and len(guides_df) > chunk_size:
             # Process in chunks
@@ -57,13 +566,25 @@ class OffTargetSearcher:
                 chunk = guides_df.iloc[i:i+chunk_size]
                 if self.logger:
                     self.logger.info(f"Processing chunk {i//chunk_size + 1}/{(len(guides_df)-1)//chunk_size + 1}...")
-                result = self._search_chunk(chunk)
+                result, hits = self._search_chunk(chunk, hits_args)
                 results.append(result)
+                if hits is not None:
+                    hits["Guide"] += i
+                    hit_tables.append(hits)
             
             final_result = pd.concat(results, ignore_index=True)
         else:
             # Process all at once
-            final_result = self._search_chunk(guides_df)
+            final_result, hits = self._search_chunk(guides_df, hits_args)
+            if hits is not None:
+                hit_tables.append(hits)
+
+        if hits_path:
+            hits_path = Path(hits_path)
+            hits_path.parent.mkdir(parents=True, exist_ok=True)
+            pd.concat(hit_tables, ignore_index=True).to_csv(hits_path, index=False)
+            if self.logger:
+                self.logger.info(f"💾 Saved hit details to {hits_path}")
         
         # Save results
         if output_path:
@@ -76,39 +597,66 @@ class OffTargetSearcher:
         
         return final_result
     
-    def _search_chunk(self, guides_df):
+    def _search_chunk(self, guides_df, hits_args=None):
         """
         Search a chunk of guides
         
         Args:
             guides_df: DataFrame with guides
+            hits_args: Optional --hits-max-mm flags; the binary then also
+                writes hit details
             
         Returns:
-            pd.DataFrame: Results
+            tuple: (results DataFrame, hit details DataFrame or None)
         """
         # Create temporary input file
         search_col = 'Target' if 'Target' in guides_df.columns else 'Sequence'
         export_df = guides_df[['Gene', search_col]].rename(columns={search_col: 'Sequence'})
 
+        if hits_args is None:
+            if self.library_path:
+                return self._search_native(guides_df, search_col), None
+
+            if self.persistent:
+                results_csv = self._get_server().search_csv(export_df.to_csv(index=False))
+                results_df = pd.read_csv(io.StringIO(results_csv))
+                return self._merge_results(guides_df, results_df, search_col), None
+
         with tempfile.NamedTemporaryFile(mode='w', suffix='.csv', delete=False) as tmp_in:
             export_df.to_csv(tmp_in.name, index=False)
             tmp_input = tmp_in.name
 
+        # Checkpoints are named after the exported guides so a rerun of the
+        # same chunk finds the groups its interrupted run already finished
+        checkpoint_path = None
+        if self.checkpoint_dir is not None:
+            self.checkpoint_dir.mkdir(parents=True, exist_ok=True)
+            digest = hashlib.sha1(Path(tmp_input).read_bytes()).hexdigest()[:16]
+            checkpoint_path = self.checkpoint_dir / f"search_{digest}.otckpt"
+
         # Create temporary output file
-        tmp_output = tempfile.mktemp(suffix='.csv')
+        columnar = self.output_format == "columnar"
+        tmp_output = tempfile.mktemp(suffix='.otres' if columnar else '.csv')
+        tmp_hits = tempfile.mktemp(suffix='.csv') if hits_args is not None else None
+        stats_path = self._stats_path("search")
 
         try:
             # Run C binary
             cmd = [
                 str(self.binary_path),
+                *self._engine_args(),
+                *self._budget_args(),
+                *self._cache_args(updatable=tmp_hits is None),
+                *(["--output-format", "columnar"] if columnar else []),
+                *(["--hits-out", tmp_hits, *hits_args] if tmp_hits else []),
+                *(["--stats", str(stats_path)] if stats_path else []),
+                *(["--checkpoint", str(checkpoint_path)] if checkpoint_path else []),
                 tmp_input,
                 str(self.reference_path),
                 tmp_output
             ]
 
-            env = os.environ.copy()
-            if self.threads:
-                env["TIGER_OFFTARGET_THREADS"] = str(self.threads)
+            env = binary_env(self.threads, self.numa)
 
             result = subprocess.run(
                 cmd,
@@ -123,25 +671,14 @@ class OffTargetSearcher:
                 for line in result.stderr.split('\n'):
                     if line.strip():
                         self.logger.debug(line.strip())
+            self._log_stats(stats_path)
 
             # Read results
-            results_df = pd.read_csv(tmp_output)
-            if search_col == 'Target':
-                results_df = results_df.rename(columns={'Sequence': 'Target'})
-
-            # Merge with original guide data and preserve new metadata columns
-            merged = guides_df.merge(
-                results_df,
-                on=['Gene', search_col],
-                how='left'
-            )
-
-            # Ensure transcript metadata columns survive downstream filtering
-            for col in ("MM0_Transcripts", "MM0_Genes"):
-                if col in merged.columns:
-                    merged[col] = merged[col].fillna("")
-
-            return merged
+            results_df = results_frame(tmp_output) if columnar else pd.read_csv(tmp_output)
+            hits_df = pd.read_csv(tmp_hits) if tmp_hits else None
+            if checkpoint_path:
+                checkpoint_path.unlink(missing_ok=True)
+            return self._merge_results(guides_df, results_df, search_col), hits_df
         
         except subprocess.CalledProcessError as e:
             if self.logger:
@@ -153,82 +690,271 @@ class OffTargetSearcher:
             # Clean up temporary files
             Path(tmp_input).unlink(missing_ok=True)
             Path(tmp_output).unlink(missing_ok=True)
+            if tmp_hits:
+                Path(tmp_hits).unlink(missing_ok=True)
     
-    def search_parallel_slurm(self, guides_df, output_dir, chunk_size=1500, 
-                             slurm_config=None):
+    def _search_native(self, guides_df, search_col):
+        """Search through libofftarget and attach results positionally"""
+        native = self._get_native()
+        if self._table_windows(guides_df, search_col):
+            found = native.search_windows(self.guide_table, guides_df.index.to_numpy())
+        else:
+            found = native.search(guides_df[search_col].to_numpy())
+        counts = found["counts"]
+        offsets = found["mm0_offsets"]
+        hit_ids = native.transcript_ids[found["mm0_transcripts"].astype(np.intp)]
+        hit_genes = native.gene_symbols[found["mm0_transcripts"].astype(np.intp)]
+
+        merged = guides_df.copy()
+        for mm in range(counts.shape[1]):
+            if mm <= native.max_mismatches:
+                merged[f"MM{mm}"] = counts[:, mm].astype(np.int64)
+            else:
+                merged[f"MM{mm}"] = np.nan
+
+        transcripts_col = []
+        genes_col = []
+        for i in range(len(merged)):
+            start, end = int(offsets[i]), int(offsets[i + 1])
+            transcripts_col.append("|".join(hit_ids[start:end]))
+            genes_col.append("|".join(dict.fromkeys(hit_genes[start:end])))
+        merged["MM0_Transcripts"] = transcripts_col
+        merged["MM0_Genes"] = genes_col
+
+        if native.count_caps:
+            status = []
+            for level, pos in zip(found["disqualified_mm"], found["disqualified_pos"]):
+                if level < 0:
+                    status.append("")
+                    continue
+                transcript_id, offset = native.locate(pos)
+                status.append(
+                    f"disqualified at {transcript_id}:{offset} (MM{level} > {native.count_caps[int(level)]})"
+                )
+            merged["Status"] = status
+        return merged
+
+    def _table_windows(self, guides_df, search_col):
+        """Whether guides_df's index holds window ids of self.guide_table"""
+        table = self.guide_table
+        if table is None or guides_df.empty or not pd.api.types.is_integer_dtype(guides_df.index):
+            return False
+        index = guides_df.index.to_numpy()
+        if index.min() < 0 or index.max() >= table.count:
+            return False
+        first, last = int(index.min()), int(index.max())
+        targets = table.targets(first, last - first + 1)[index - first]
+        return bool(np.array_equal(targets, guides_df[search_col].to_numpy(dtype="S")))
+
+    def _merge_results(self, guides_df, results_df, search_col):
+        """Attach binary output to the guide table by row position
+
+        The binary writes one row per guide in input order, skipping rows
+        without a sequence, so results are keyed by the guide rows kept
+        rather than joined on (Gene, sequence), which would multiply
+        repeated guides.
         """
-        Search for off-targets using SLURM array jobs
-        
+        kept = guides_df[search_col].fillna("").astype(str).str.strip().ne("").to_numpy()
+        rows = np.flatnonzero(kept)
+        if len(rows) != len(results_df):
+            raise RuntimeError(
+                f"Off-target search returned {len(results_df)} rows for {len(rows)} guides"
+            )
+
+        merged = guides_df.copy()
+        positions = np.arange(len(merged))
+        for col in results_df.columns.drop(['Gene', 'Sequence']):
+            values = results_df[col].to_numpy()
+            if len(rows) < len(merged):
+                values = pd.Series(values, index=rows).reindex(positions).to_numpy()
+            merged[col] = values
+
+        # Ensure transcript metadata columns survive downstream filtering
+        for col in ("MM0_Transcripts", "MM0_Genes"):
+            if col in merged.columns:
+                merged[col] = merged[col].fillna("")
+
+        return merged
+
+    def search_parallel_slurm(self, guides_df, output_dir, reference_shards=1, guide_shards=1,
+                              slurm_config=None, hits_max_mismatches=None):
+        """
+        Fan the search out as a SLURM array job plus a dependent merge job
+
+        Every array task searches one guide shard against one
+        transcript-aligned reference shard and writes a binary partial; the
+        merge job (`offtarget_search merge`) reduces them into
+        output_dir/results.csv, and output_dir/hits.csv when
+        hits_max_mismatches is set.
+
         Args:
             guides_df: DataFrame with guides
-            output_dir: Output directory for results
-            chunk_size: Guides per SLURM job
-            slurm_config: SLURM configuration dict
-            
+            output_dir: Directory for the guides, partials, scripts and results
+            reference_shards: Slices of the reference (count caps need 1)
+            guide_shards: Slices of the guide rows
+            slurm_config: SLURM settings (account, partition, time, mem,
+                cpus_per_task) applied to the array and merge jobs; with
+                engine='gpu' the array tasks request one GPU each and run
+                on gpu_partition when it is set
+            hits_max_mismatches: Optional highest mismatch count recorded
+                for the hit-detail table
+
         Returns:
-            list: List of SLURM job IDs
+            tuple: (array job ID, merge job ID)
         """
+        from ..slurm import submit_slurm_job
+
+        if self.count_caps and reference_shards > 1:
+            raise ValueError("Count caps need the whole reference; use reference_shards=1")
+
         output_dir = Path(output_dir)
-        output_dir.mkdir(parents=True, exist_ok=True)
-        
-        # Split guides into chunks
-        n_chunks = (len(guides_df) - 1) // chunk_size + 1
-        
+        (output_dir / 'partials').mkdir(parents=True, exist_ok=True)
+        (output_dir / 'logs').mkdir(exist_ok=True)
+
+        search_col = 'Target' if 'Target' in guides_df.columns else 'Sequence'
+        guides_df[['Gene', search_col]].rename(columns={search_col: 'Sequence'}).to_csv(
+            output_dir / 'guides.csv', index=False
+        )
+
+        n_tasks = reference_shards * guide_shards
         if self.logger:
-            self.logger.info(f"Splitting {len(guides_df)} guides into {n_chunks} chunks...")
-        
-        # Save chunks
-        chunk_dir = output_dir / 'chunks'
-        chunk_dir.mkdir(exist_ok=True)
-        
-        for i in range(n_chunks):
-            chunk = guides_df.iloc[i*chunk_size:(i+1)*chunk_size]
-            chunk_file = chunk_dir / f'chunk_{i:04d}.csv'
-            chunk.to_csv(chunk_file, index=False)
-        
-        # Create SLURM script
-        slurm_script = self._create_slurm_script(
-            output_dir, n_chunks, slurm_config
+            self.logger.info(
+                f"Sharding {len(guides_df)} guides into {guide_shards} guide x "
+                f"{reference_shards} reference shards ({n_tasks} array tasks)..."
+            )
+
+        array_script, merge_script = self._create_slurm_scripts(
+            output_dir, reference_shards, guide_shards, hits_max_mismatches
         )
-        
-        # Submit SLURM job
-        from ..slurm import submit_slurm_job
-        
-        job_id = submit_slurm_job(
-            slurm_script,
-            job_name='offtarget',
-            **slurm_config
+
+        slurm_config = slurm_config or {}
+        resources = {
+            'account': slurm_config.get('account'),
+            'partition': slurm_config.get('partition'),
+            'time_limit': slurm_config.get('time'),
+            'mem': slurm_config.get('mem'),
+            'cpus': slurm_config.get('cpus_per_task', 1),
+        }
+        array_resources = resources
+        if self.engine == "gpu" and slurm_config.get('gpu_partition'):
+            array_resources = {**resources, 'partition': slurm_config['gpu_partition']}
+        array_id = submit_slurm_job(array_script, job_name='offtarget', **array_resources)
+        merge_id = submit_slurm_job(
+            merge_script,
+            job_name='offtarget_merge',
+            dependency=f"afterok:{array_id}",
+            **{**resources, 'cpus': 1},
         )
-        
+
         if self.logger:
-            self.logger.info(f"Submitted SLURM array job: {job_id}")
-        
-        return [job_id]
-    
-    def _create_slurm_script(self, output_dir, n_chunks, slurm_config):
-        """Create SLURM array job script"""
-        script_path = output_dir / 'run_offtarget.sh'
-        
-        with open(script_path, 'w') as f:
+            self.logger.info(f"Submitted SLURM array job {array_id} and merge job {merge_id}")
+
+        return array_id, merge_id
+
+    def search_slurm(self, guides_df, output_dir, reference_shards=1, guide_shards=1,
+                     slurm_config=None, output_path=None, hits_path=None,
+                     hits_max_mismatches=0, poll_interval=30):
+        """
+        Run search_parallel_slurm, wait for the merge and attach its results
+
+        Args:
+            guides_df: DataFrame with guides
+            output_dir: Working directory for the sharded run
+            reference_shards: Slices of the reference
+            guide_shards: Slices of the guide rows
+            slurm_config: SLURM settings for the jobs
+            output_path: Optional path to save the merged results
+            hits_path: Optional path for the hit-detail table (see search)
+            hits_max_mismatches: Highest mismatch count written to hits_path
+            poll_interval: Seconds between job status checks
+
+        Returns:
+            pd.DataFrame: Results with off-target counts
+        """
+        from ..slurm import wait_for_jobs
+
+        output_dir = Path(output_dir)
+        job_ids = self.search_parallel_slurm(
+            guides_df, output_dir,
+            reference_shards=reference_shards,
+            guide_shards=guide_shards,
+            slurm_config=slurm_config,
+            hits_max_mismatches=hits_max_mismatches if hits_path else None,
+        )
+        if not wait_for_jobs(job_ids, poll_interval=poll_interval, logger=self.logger):
+            raise RuntimeError(f"Sharded off-target search failed; see {output_dir / 'logs'}")
+
+        search_col = 'Target' if 'Target' in guides_df.columns else 'Sequence'
+        results_df = pd.read_csv(output_dir / 'results.csv')
+        final_result = self._merge_results(guides_df, results_df, search_col)
+
+        if hits_path:
+            hits_path = Path(hits_path)
+            hits_path.parent.mkdir(parents=True, exist_ok=True)
+            shutil.copyfile(output_dir / 'hits.csv', hits_path)
+
+        if output_path:
+            output_path = Path(output_path)
+            output_path.parent.mkdir(parents=True, exist_ok=True)
+            final_result.to_csv(output_path, index=False)
+            if self.logger:
+                self.logger.info(f"💾 Saved results to {output_path}")
+
+        return final_result
+
+    def _create_slurm_scripts(self, output_dir, reference_shards, guide_shards,
+                              hits_max_mismatches=None):
+        """Create the shard array script and the merge script"""
+        array_script = output_dir / 'run_offtarget.sh'
+        merge_script = output_dir / 'merge_offtarget.sh'
+        n_tasks = reference_shards * guide_shards
+        detail_args = "" if hits_max_mismatches is None else f" --hits-max-mm {hits_max_mismatches}"
+        hits_args = "" if hits_max_mismatches is None else f" --hits-out {output_dir}/hits.csv"
+        numa_export = f"export TIGER_OFFTARGET_NUMA={self.numa}\n" if self.numa else ""
+        gpu_request = "#SBATCH --gres=gpu:1\n" if self.engine == "gpu" else ""
+        stats_args = ""
+        if self.stats_dir is not None:
+            self.stats_dir.mkdir(parents=True, exist_ok=True)
+            stats_args = f" --stats {self.stats_dir}/shard_g${{GUIDE_SHARD}}_r${{REFERENCE_SHARD}}.json"
+        # A requeued task resumes from its shard's checkpoint
+        checkpoint_args = ""
+        checkpoint_cleanup = ""
+        if self.checkpoint_dir is not None:
+            self.checkpoint_dir.mkdir(parents=True, exist_ok=True)
+            checkpoint = f"{self.checkpoint_dir}/shard_g${{GUIDE_SHARD}}_r${{REFERENCE_SHARD}}.otckpt"
+            checkpoint_args = f" --checkpoint {checkpoint}"
+            checkpoint_cleanup = f"rm -f {checkpoint}\n"
+
+        with open(array_script, 'w') as f:
             f.write(f"""#!/bin/bash
-#SBATCH --account={slurm_config.get('account', 'sanjana')}
-#SBATCH --partition={slurm_config.get('partition', 'cpu')}
-#SBATCH --time={slurm_config.get('time', '02:00:00')}
-#SBATCH --mem={slurm_config.get('mem', '8G')}
-#SBATCH --cpus-per-task={slurm_config.get('cpus_per_task', 1)}
-#SBATCH --array=0-{n_chunks-1}
+#SBATCH --array=0-{n_tasks - 1}
 #SBATCH --output={output_dir}/logs/offtarget_%a.out
 #SBATCH --error={output_dir}/logs/offtarget_%a.err
+{gpu_request}set -euo pipefail
 
-# Create logs directory
-mkdir -p {output_dir}/logs
+GUIDE_SHARD=$((SLURM_ARRAY_TASK_ID / {reference_shards}))
+REFERENCE_SHARD=$((SLURM_ARRAY_TASK_ID % {reference_shards}))
+export TIGER_OFFTARGET_THREADS=${{SLURM_CPUS_PER_TASK:-1}}
+{numa_export}
+{self.binary_path} {' '.join(self._engine_args(collapsible=reference_shards == 1) + self._budget_args() + self._cache_args(updatable=reference_shards == 1 and not detail_args))}{detail_args}{stats_args}{checkpoint_args} --partial \\
+    --guide-shard $GUIDE_SHARD/{guide_shards} --reference-shard $REFERENCE_SHARD/{reference_shards} \\
+    {output_dir}/guides.csv \\
+    {self.reference_path} \\
+    {output_dir}/partials/part_g${{GUIDE_SHARD}}_r${{REFERENCE_SHARD}}.otp
+{checkpoint_cleanup}""")
+
+        with open(merge_script, 'w') as f:
+            f.write(f"""#!/bin/bash
+#SBATCH --output={output_dir}/logs/merge.out
+#SBATCH --error={output_dir}/logs/merge.err
+set -euo pipefail
 
-# Run off-target search
-{self.binary_path} \\
-    {output_dir}/chunks/chunk_$(printf "%04d" $SLURM_ARRAY_TASK_ID).csv \\
+{self.binary_path} merge{hits_args} \\
     {self.reference_path} \\
-    {output_dir}/results/result_$(printf "%04d" $SLURM_ARRAY_TASK_ID).csv
+    {output_dir}/results.csv \\
+    {output_dir}/partials/part_g*_r*.otp
 """)
-        
-        script_path.chmod(0o755)
-        return script_path
+
+        array_script.chmod(0o755)
+        merge_script.chmod(0o755)
+        return array_script, merge_script
@@ -18,7 +18,7 @@ from ..tiger_core import tiger as tiger_module
 class TIGERPredictor:
     """Wrapper for TIGER Cas13 guide prediction"""
     
-    def __init__(self, model_path, config, logger=None):
+    def __init__(self, model_path, config, logger=None, library_path=None):
         """
         Initialize TIGER predictor
 
@@ -26,12 +26,17 @@ class TIGERPredictor:
             model_path: Path to TIGER model directory
             config: Configuration dictionary
             logger: Optional logger
+            library_path: Optional libofftarget.so; guides are then enumerated
+                and one-hot encoded in C, and the table is kept in
+                self.guide_table so the off-target search can reuse it
         """
         self.model_path = Path(model_path)
         self.config = config
         self.logger = logger
+        self.library_path = Path(library_path) if library_path else None
         self.model = None
         self._is_savedmodel = False
+        self.guide_table = None
 
         # Import TIGER modules
         self._import_tiger()
@@ -86,7 +91,7 @@ class TIGERPredictor:
                 self.logger.error(f"Failed to load TIGER model: {e}")
             raise
     
-    def predict_from_fasta(self, fasta_path, output_path=None, batch_size=500):
+    def predict_from_fasta(self, fasta_path, output_path=None, batch_size=500, on_gene=None):
         """
         Predict guide scores from FASTA file
         
@@ -94,6 +99,8 @@ class TIGERPredictor:
             fasta_path: Path to input FASTA file
             output_path: Path to output CSV file
             batch_size: Batch size for prediction
+            on_gene: Optional callback given each sequence's guides (a
+                DataFrame) as soon as they are scored
             
         Returns:
             pd.DataFrame: Predictions
@@ -103,7 +110,17 @@ class TIGERPredictor:
         
         if self.logger:
             self.logger.info(f"Predicting guides from {fasta_path}...")
-        
+
+        if self.library_path:
+            df = self._predict_native(fasta_path, batch_size, on_gene)
+            if output_path:
+                output_path = Path(output_path)
+                output_path.parent.mkdir(parents=True, exist_ok=True)
+                df.to_csv(output_path, index=False)
+                if self.logger:
+                    self.logger.info(f"💾 Saved {len(df)} guides to {output_path}")
+            return df
+
         # Read FASTA
         records = list(SeqIO.parse(fasta_path, 'fasta'))
         
@@ -117,6 +134,7 @@ class TIGERPredictor:
             if self.logger and (i + 1) % 10 == 0:
                 self.logger.info(f"Processed {i + 1}/{len(records)} sequences...")
             
+            guides = None
             try:
                 # Extract gene name from record ID
                 gene_name = record.id.split('_')[0]
@@ -130,6 +148,10 @@ class TIGERPredictor:
             except Exception as e:
                 if self.logger:
                     self.logger.warning(f"Error processing {record.id}: {e}")
+
+            # Outside the guard: a failing consumer must stop the run
+            if guides and on_gene is not None:
+                on_gene(pd.DataFrame(guides))
         
         # Convert to DataFrame
         df = pd.DataFrame(all_predictions)
@@ -145,29 +167,65 @@ class TIGERPredictor:
         
         return df
     
-    def _generate_guides(self, sequence, gene_name):
+    def _predict_native(self, fasta_path, batch_size, on_gene):
         """
-        Generate all possible guides from a sequence
-        
-        Args:
-            sequence: Nucleotide sequence
-            gene_name: Gene name
-            
-        Returns:
-            list: List of guide dictionaries
+        Score every guide of a FASTA from a libofftarget GuideTable
+
+        Rows come out in window order, so the DataFrame index (and the CSV row
+        number) is the guide's window id in self.guide_table.
         """
-        guide_length = self.config.get('guide_length', 23)
-        context_5p = self.config.get('context_5p', 3)
-        context_3p = self.config.get('context_3p', 0)
-        
-        # Use TIGER's process_data function to get all guides
-        target_seq, guide_seq, model_inputs = tiger_module.process_data(sequence.upper())
+        from ..offtarget.native import GuideTable
 
-        if len(target_seq) == 0:
-            if self.logger:
-                self.logger.warning(f"{gene_name}: sequence shorter than target length - no guides generated")
-            return []
+        if self.guide_table is not None:
+            self.guide_table.close()
+        table = GuideTable(
+            self.library_path, fasta_path,
+            guide_length=self.config.get('guide_length', 23),
+            context_5p=self.config.get('context_5p', 3),
+            context_3p=self.config.get('context_3p', 0),
+        )
+        self.guide_table = table
+
+        if self.logger:
+            self.logger.info(f"Processing {len(table.record_ids)} sequences ({table.count:,} guides)...")
 
+        frames = []
+        for r, record_id in enumerate(table.record_ids):
+            if self.logger and (r + 1) % 10 == 0:
+                self.logger.info(f"Processed {r + 1}/{len(table.record_ids)} sequences...")
+
+            gene_name = record_id.split()[0].split('_')[0]
+            first, end = int(table.record_offsets[r]), int(table.record_offsets[r + 1])
+            if table.skipped[r]:
+                if self.logger:
+                    self.logger.warning(f"Error processing {record_id}: non-ACGT base in the target span")
+                continue
+            if first == end:
+                if self.logger:
+                    self.logger.warning(f"{gene_name}: sequence shorter than target length - no guides generated")
+                continue
+
+            scores = np.concatenate([
+                self._score(table.encode(start, min(batch_size, end - start)))
+                for start in range(first, end, batch_size)
+            ])
+            guides = pd.DataFrame({
+                'Gene': gene_name,
+                'Position': np.arange(end - first),
+                'Sequence': table.spacers(first, end - first).astype(str),
+                'Score': np.round(scores.astype(np.float64), 5),
+                'Target': table.targets(first, end - first).astype(str),
+            }, index=pd.RangeIndex(first, end))
+            frames.append(guides)
+            if on_gene is not None:
+                on_gene(guides)
+
+        if not frames:
+            return pd.DataFrame(columns=['Gene', 'Position', 'Sequence', 'Score', 'Target'])
+        return pd.concat(frames)
+
+    def _score(self, model_inputs):
+        """Calibrated TIGER scores of one batch of model inputs"""
         input_tensor = tf.cast(model_inputs, tf.float32)
 
         # Get predictions from the model
@@ -181,7 +239,7 @@ class TIGERPredictor:
             lfc_estimate = self.model.predict(input_tensor, batch_size=500, verbose=False).reshape(-1)
 
         if lfc_estimate.size == 0:
-            return []
+            return lfc_estimate
 
         # Calibrate and score predictions
         lfc_estimate = tiger_module.calibrate_predictions(
@@ -189,7 +247,34 @@ class TIGERPredictor:
             num_mismatches=np.zeros_like(lfc_estimate),
             params=self.calibration_params
         )
-        scores = tiger_module.score_predictions(lfc_estimate, params=self.scoring_params)
+        return tiger_module.score_predictions(lfc_estimate, params=self.scoring_params)
+
+    def _generate_guides(self, sequence, gene_name):
+        """
+        Generate all possible guides from a sequence
+        
+        Args:
+            sequence: Nucleotide sequence
+            gene_name: Gene name
+            
+        Returns:
+            list: List of guide dictionaries
+        """
+        guide_length = self.config.get('guide_length', 23)
+        context_5p = self.config.get('context_5p', 3)
+        context_3p = self.config.get('context_3p', 0)
+        
+        # Use TIGER's process_data function to get all guides
+        target_seq, guide_seq, model_inputs = tiger_module.process_data(sequence.upper())
+
+        if len(target_seq) == 0:
+            if self.logger:
+                self.logger.warning(f"{gene_name}: sequence shorter than target length - no guides generated")
+            return []
+
+        scores = self._score(model_inputs)
+        if len(scores) == 0:
+            return []
         
         # Build guide list
         guides = []
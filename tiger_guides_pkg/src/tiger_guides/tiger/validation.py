@@ -4,10 +4,17 @@ Analyze MM0 (perfect match) locations for final guides.
 Determines if MM0 matches are in the same gene (different isoforms) or different genes.
 """
 
+import gzip
 import pandas as pd
 import sys
 from collections import defaultdict
 
+def _open_fasta(fasta_file):
+    """Open a FASTA for text reading; gzip / BGZF files (as offtarget_search reads them) are inflated."""
+    with open(fasta_file, 'rb') as fh:
+        compressed = fh.read(2) == b'\x1f\x8b'
+    return gzip.open(fasta_file, 'rt') if compressed else open(fasta_file, 'r')
+
 def load_transcriptome_with_genes(fasta_file):
     """Load transcriptome and extract gene names from headers"""
     transcripts = {}
@@ -17,7 +24,7 @@ def load_transcriptome_with_genes(fasta_file):
     current_seq = []
     
     print(f"Loading reference transcriptome: {fasta_file}")
-    with open(fasta_file, 'r') as f:
+    with _open_fasta(fasta_file) as f:
         for line in f:
             line = line.strip()
             if line.startswith('>'):
@@ -71,18 +78,66 @@ def find_all_matches(target_seq, transcriptome, transcript_to_gene, transcript_n
     
     return matches
 
-def analyze_mm0_locations(guides_csv, transcriptome_file, output_file):
-    """Analyze where MM0 matches are located for each guide"""
+def load_transcript_names(fasta_file):
+    """Map transcript IDs to transcript names using only the FASTA headers"""
+    transcript_to_name = {}
+    if not fasta_file or str(fasta_file).endswith('.otidx'):
+        return transcript_to_name
+    with _open_fasta(fasta_file) as f:
+        for line in f:
+            if line.startswith('>'):
+                parts = line[1:].strip().split('|')
+                if len(parts) > 4:
+                    transcript_to_name[parts[0]] = parts[4]
+    return transcript_to_name
+
+def load_hit_matches(hits_file, transcript_names=None):
+    """
+    Group the MM0 rows of an `offtarget_search --hits-out` table by guide
+
+    Returns:
+        dict: (gene, sequence) -> list of matches shaped like find_all_matches
+    """
+    transcript_names = transcript_names or {}
+    hits_df = pd.read_csv(hits_file)
+    hits_df = hits_df[hits_df['Mismatches'] == 0]
+    print(f"Loaded {len(hits_df)} MM0 hits from {hits_file}")
+
+    grouped = hits_df.groupby(['Gene', 'Sequence', 'Transcript', 'Transcript_Gene'], sort=False).size()
+    matches_by_guide = defaultdict(list)
+    for (gene, sequence, transcript_id, transcript_gene), count in grouped.items():
+        matches_by_guide[(gene, sequence.upper())].append({
+            'transcript': transcript_id,
+            'transcript_name': transcript_names.get(transcript_id, transcript_id.split('.')[0]),
+            'gene': transcript_gene,
+            'occurrences': int(count)
+        })
+    return matches_by_guide
+
+def analyze_mm0_locations(guides_csv, transcriptome_file, output_file, hits_file=None):
+    """
+    Analyze where MM0 matches are located for each guide
+
+    With hits_file (written by `offtarget_search --hits-out`) the matches
+    come from the off-target search itself, looked up by the sequence it
+    searched (Target when present), and the transcriptome is only read for
+    transcript names.  Without it every guide is rescanned in Python.
+    """
     
     # Load data
     guides_df = pd.read_csv(guides_csv)
-    transcriptome, transcript_to_gene, transcript_to_name = load_transcriptome_with_genes(transcriptome_file)
+    if hits_file:
+        transcript_to_name = load_transcript_names(transcriptome_file)
+        matches_by_guide = load_hit_matches(hits_file, transcript_to_name)
+    else:
+        transcriptome, transcript_to_gene, transcript_to_name = load_transcriptome_with_genes(transcriptome_file)
     
     print(f"\nAnalyzing {len(guides_df)} guides...")
     
     # Handle different column name conventions
     seq_col = 'Target Sequence' if 'Target Sequence' in guides_df.columns else 'Sequence'
     score_col = 'Guide Score' if 'Guide Score' in guides_df.columns else 'Score'
+    hit_col = 'Target' if 'Target' in guides_df.columns else seq_col
     
     results = []
     summary_stats = {
@@ -98,7 +153,10 @@ def analyze_mm0_locations(guides_csv, transcriptome_file, output_file):
         guide_score = row[score_col]
         
         # Find all matches
-        matches = find_all_matches(target_seq, transcriptome, transcript_to_gene, transcript_to_name)
+        if hits_file:
+            matches = matches_by_guide.get((expected_gene, row[hit_col].upper()), [])
+        else:
+            matches = find_all_matches(target_seq, transcriptome, transcript_to_gene, transcript_to_name)
         
         # Categorize matches (case-insensitive comparison)
         genes_found = set([m['gene'] for m in matches])
@@ -206,7 +264,7 @@ def analyze_mm0_locations(guides_csv, transcriptome_file, output_file):
     
     return results_df, summary_stats
 
-def validate_final_guides(guides_csv, transcriptome_file, output_file, logger=None):
+def validate_final_guides(guides_csv, transcriptome_file, output_file, logger=None, hits_file=None):
     """
     Validate final guides by analyzing MM0 locations
     
@@ -215,6 +273,8 @@ def validate_final_guides(guides_csv, transcriptome_file, output_file, logger=No
         transcriptome_file: Path to reference transcriptome FASTA
         output_file: Path to save validation results
         logger: Optional logger for output
+        hits_file: Optional `offtarget_search --hits-out` table; used
+            instead of rescanning the transcriptome
         
     Returns:
         tuple: (results_df, summary_stats)
@@ -234,7 +294,7 @@ def validate_final_guides(guides_csv, transcriptome_file, output_file, logger=No
         print("This helps identify if matches are in same gene (OK) or different genes (concerning)")
         print("=" * 70)
     
-    results_df, stats = analyze_mm0_locations(guides_csv, transcriptome_file, output_file)
+    results_df, stats = analyze_mm0_locations(guides_csv, transcriptome_file, output_file, hits_file=hits_file)
     
     if logger:
         logger.info("\n✓ MM0 location analysis complete!")
@@ -15,6 +15,7 @@ from ..models.loader import resolve_model_paths
 from ..offtarget.search import OffTargetSearcher
 from ..tiger.predictor import TIGERPredictor
 from ..tiger.validator import validate_tiger_output
+from ..tiger.validation import validate_final_guides
 from ..logging import setup_logger
 from ..config import dump_yaml
 
@@ -110,14 +111,24 @@ class WorkflowRunner:
             else:
                 fasta_file = self.output_dir / "sequences" / "all_targets.fasta"
 
+            streamed = False
             if not resume_from or resume_from in {"download", "tiger"}:
-                tiger_output = self._step_tiger(fasta_file, skip_validation)
-                if tiger_output is None:
-                    return False
+                if self._stream_offtarget():
+                    outputs = self._step_tiger_offtarget(fasta_file, skip_validation)
+                    if outputs is None:
+                        return False
+                    tiger_output, offtarget_output = outputs
+                    streamed = True
+                else:
+                    tiger_output = self._step_tiger(fasta_file, skip_validation)
+                    if tiger_output is None:
+                        return False
             else:
                 tiger_output = self.output_dir / "tiger" / "guides.csv"
 
-            if not resume_from or resume_from in {"download", "tiger", "offtarget"}:
+            if streamed:
+                pass  # the search already ran alongside TIGER
+            elif not resume_from or resume_from in {"download", "tiger", "offtarget"}:
                 offtarget_output = self._step_offtarget(tiger_output)
                 if offtarget_output is None:
                     return False
@@ -131,6 +142,9 @@ class WorkflowRunner:
             else:
                 final_output = self.output_dir / "final_guides.csv"
 
+            if self.config.get("output", {}).get("validate_mm0_locations", False):
+                self._step_validate(final_output)
+
             self.logger.info("=" * 60)
             self.logger.info("✅ Workflow completed successfully!")
             self.logger.info(f"📄 Final results: {final_output}")
@@ -181,7 +195,7 @@ class WorkflowRunner:
         self._register_resolved_targets(records)
         return fasta_file
 
-    def _step_tiger(self, fasta_file: Path, skip_validation: bool) -> Optional[Path]:
+    def _step_tiger(self, fasta_file: Path, skip_validation: bool, on_gene=None) -> Optional[Path]:
         tiger_dir = self.output_dir / "tiger"
         tiger_dir.mkdir(exist_ok=True)
         guides_csv = tiger_dir / "guides.csv"
@@ -193,12 +207,14 @@ class WorkflowRunner:
             model_path=model_paths["model_path"],
             config=tiger_config,
             logger=self.logger,
+            library_path=self._resolve_library_path(),
         )
 
         guides_df = self.tiger.predict_from_fasta(
             fasta_path=fasta_file,
             output_path=guides_csv,
-            batch_size=tiger_config.get("batch_size", 500)
+            batch_size=tiger_config.get("batch_size", 500),
+            on_gene=on_gene,
         )
 
         if not skip_validation and not validate_tiger_output(guides_csv, logger=self.logger):
@@ -206,19 +222,85 @@ class WorkflowRunner:
 
         return guides_csv
 
+    def _stream_offtarget(self) -> bool:
+        """Whether TIGER's guides are piped into the search while it scores"""
+        offtarget_cfg = self.config.get("offtarget", {})
+        if not offtarget_cfg.get("stream_with_tiger", False):
+            return False
+        if (int(offtarget_cfg.get("reference_shards", 1)) > 1 or int(offtarget_cfg.get("guide_shards", 1)) > 1
+                or offtarget_cfg.get("library_path") or offtarget_cfg.get("persistent_server", False)
+                or offtarget_cfg.get("memory_budget") or offtarget_cfg.get("checkpoint", False)):
+            self.logger.warning(
+                "stream_with_tiger runs one local search; ignored with shards, library_path, persistent_server, "
+                "memory_budget or checkpoint"
+            )
+            return False
+        return True
+
+    def _prefilter_offtarget(self, guides_df: pd.DataFrame) -> pd.DataFrame:
+        min_score = self.config.get("offtarget", {}).get("min_score_for_offtarget", 0.0)
+        if "Score" in guides_df.columns and min_score > 0.0:
+            return guides_df[guides_df["Score"] >= min_score].copy()
+        return guides_df
+
+    def _step_tiger_offtarget(self, fasta_file: Path, skip_validation: bool) -> Optional[tuple]:
+        """TIGER and the off-target search together: each gene's guides are searched as they are scored"""
+        offtarget_dir = self.output_dir / "offtarget"
+        offtarget_dir.mkdir(exist_ok=True)
+        results_csv = offtarget_dir / "results.csv"
+
+        self._build_offtarget_searcher()
+        hits_csv = self._offtarget_hits_path(offtarget_dir)
+        stream = self.offtarget.open_stream(
+            hits_path=hits_csv,
+            window_length=self.config.get("tiger", {}).get("guide_length", 23),
+        )
+        counts = {"scored": 0, "searched": 0}
+
+        def on_gene(gene_df: pd.DataFrame) -> None:
+            counts["scored"] += len(gene_df)
+            gene_df = self._prefilter_offtarget(gene_df)
+            counts["searched"] += len(gene_df)
+            stream.add(gene_df)
+
+        try:
+            guides_csv = self._step_tiger(fasta_file, skip_validation, on_gene=on_gene)
+        except BaseException:
+            stream.abort()
+            raise
+        if guides_csv is None:
+            stream.abort()
+            return None
+        results_df = stream.finish(output_path=results_csv)
+
+        self.logger.info(
+            f"Prefiltering guides for off-target search: "
+            f"{counts['searched']:,} / {counts['scored']:,} streamed"
+        )
+        if results_df is None:
+            self.logger.warning(
+                "No guides passed the off-target prefilter; skipping off-target search."
+            )
+            self._prefilter_offtarget(pd.read_csv(guides_csv)).to_csv(results_csv, index=False)
+        return guides_csv, results_csv
+
     def _step_offtarget(self, tiger_output: Path) -> Optional[Path]:
         offtarget_dir = self.output_dir / "offtarget"
         offtarget_dir.mkdir(exist_ok=True)
         results_csv = offtarget_dir / "results.csv"
 
         guides_df = pd.read_csv(tiger_output)
+        # CSV row i is window i of the predictor's guide table when it kept one
+        guide_table = getattr(self.tiger, "guide_table", None)
+        if guide_table is not None and guide_table.count != len(guides_df):
+            guide_table = None
 
         offtarget_cfg = self.config.get("offtarget", {})
         min_score = offtarget_cfg.get("min_score_for_offtarget", 0.0)
 
         if "Score" in guides_df.columns and min_score > 0.0:
             before = len(guides_df)
-            guides_df = guides_df[guides_df["Score"] >= min_score].copy()
+            guides_df = self._prefilter_offtarget(guides_df)
             self.logger.info(
                 f"Prefiltering guides for off-target search: "
                 f"{len(guides_df):,} / {before:,} with Score >= {min_score}"
@@ -232,6 +314,43 @@ class WorkflowRunner:
             guides_df.to_csv(results_csv, index=False)
             return results_csv
 
+        reference_shards, guide_shards = self._build_offtarget_searcher()
+        self.offtarget.guide_table = guide_table
+        hits_csv = self._offtarget_hits_path(offtarget_dir)
+
+        try:
+            if reference_shards > 1 or guide_shards > 1:
+                # Fan out as a SLURM array of (guide shard x reference shard)
+                # tasks; a dependent job merges their partials.
+                results_df = self.offtarget.search_slurm(
+                    guides_df=guides_df,
+                    output_dir=offtarget_dir / "shards",
+                    reference_shards=reference_shards,
+                    guide_shards=guide_shards,
+                    slurm_config=self.config.get("slurm", {}),
+                    output_path=results_csv,
+                    hits_path=hits_csv,
+                )
+            else:
+                results_df = self.offtarget.search(
+                    guides_df=guides_df,
+                    output_path=results_csv,
+                    chunk_size=offtarget_cfg.get("chunk_size"),
+                    hits_path=hits_csv,
+                )
+        finally:
+            self.offtarget.close()
+
+        return results_csv
+
+    def _offtarget_hits_path(self, offtarget_dir: Path) -> Optional[Path]:
+        # MM0 validation reads the search's own hits instead of rescanning
+        if self.config.get("output", {}).get("validate_mm0_locations", False):
+            return offtarget_dir / "hits.csv"
+        return None
+
+    def _build_offtarget_searcher(self) -> tuple:
+        """Set up self.offtarget from the config; returns (reference_shards, guide_shards)"""
         offtarget_cfg = self.config["offtarget"]
         binary_cfg = Path(offtarget_cfg.get("binary_path", "bin/offtarget_search"))
         candidate_paths = []
@@ -268,33 +387,115 @@ class WorkflowRunner:
         if binary_path is None:
             raise FileNotFoundError(f"Off-target binary not found: {binary_cfg}")
 
-        reference_path = Path(offtarget_cfg["reference_transcriptome"])
-        if not reference_path.is_absolute():
-            candidate = (self.root / reference_path).resolve()
-            if candidate.exists():
-                reference_path = candidate
-            else:
-                reference_dir = Path(offtarget_cfg.get("reference_dir", "references"))
-                if not reference_dir.is_absolute():
-                    reference_dir = (self.root / reference_dir).resolve()
-                reference_path = (reference_dir / reference_path.name).resolve()
-        else:
-            reference_path = reference_path.resolve()
+        reference_path = self._resolve_reference_path()
+
+        max_mismatches = offtarget_cfg.get("max_mismatches")
+        if max_mismatches is not None and max_mismatches < 2:
+            raise ValueError("offtarget.max_mismatches must be at least 2 (filtering uses MM1 and MM2)")
+
+        # Guides over the MM1/MM2 filter thresholds are dropped later anyway,
+        # so let the binary stop scanning them as soon as they cross.
+        reference_shards = int(offtarget_cfg.get("reference_shards", 1))
+        guide_shards = int(offtarget_cfg.get("guide_shards", 1))
+        engine = offtarget_cfg.get("engine")
+        if self.config.get("compute", {}).get("use_gpu", False):
+            engine = "gpu"
+        if engine == "gpu":
+            self.logger.warning("The GPU off-target engine is experimental; builds without it (make GPU=cuda|hip) "
+                                "and devices that fail to open fall back to the packed engine")
+        count_caps = None
+        if offtarget_cfg.get("prune_with_filters", False) and engine == "gpu":
+            self.logger.warning("prune_with_filters is not supported by the GPU engine; ignored")
+        elif offtarget_cfg.get("prune_with_filters", False) and reference_shards > 1:
+            self.logger.warning("prune_with_filters needs the whole reference; ignored with reference_shards > 1")
+        elif offtarget_cfg.get("prune_with_filters", False):
+            filtering_cfg = self.config.get("filtering", {})
+            count_caps = {
+                1: filtering_cfg.get("mm1_threshold", 0),
+                2: filtering_cfg.get("mm2_threshold", 0),
+            }
+
+        library_path = self._resolve_library_path()
+
+        cache_dir = offtarget_cfg.get("cache_dir")
+        if cache_dir:
+            cache_dir = Path(cache_dir)
+            if not cache_dir.is_absolute():
+                cache_dir = (self.root / cache_dir).resolve()
+        cache_from = offtarget_cfg.get("cache_from")
+        if cache_from:
+            cache_from = Path(cache_from)
+            if not cache_from.is_absolute():
+                cache_from = (self.root / cache_from).resolve()
+        stats_dir = self.output_dir / "offtarget" / "stats" if offtarget_cfg.get("stats", True) else None
+        checkpoint_dir = self.output_dir / "offtarget" / "checkpoints" if offtarget_cfg.get("checkpoint", False) else None
 
         self.offtarget = OffTargetSearcher(
             binary_path=binary_path,
             reference_path=reference_path,
             logger=self.logger,
             threads=self.config.get("compute", {}).get("threads"),
+            engine=engine,
+            max_mismatches=max_mismatches,
+            count_caps=count_caps,
+            persistent=offtarget_cfg.get("persistent_server", False),
+            library_path=library_path,
+            output_format=offtarget_cfg.get("output_format", "csv"),
+            cache_dir=cache_dir,
+            stats_dir=stats_dir,
+            numa=self.config.get("compute", {}).get("numa"),
+            guide_length=self.config.get("tiger", {}).get("guide_length"),
+            position_weights=offtarget_cfg.get("position_weights"),
+            cache_from=cache_from,
+            collapse_isoforms=offtarget_cfg.get("collapse_isoforms", False),
+            memory_budget=offtarget_cfg.get("memory_budget"),
+            checkpoint_dir=checkpoint_dir,
         )
 
-        results_df = self.offtarget.search(
-            guides_df=guides_df,
-            output_path=results_csv,
-            chunk_size=offtarget_cfg.get("chunk_size"),
-        )
+        index_cfg = offtarget_cfg.get("reference_index")
+        if index_cfg:
+            index_path = Path(index_cfg)
+            if not index_path.is_absolute():
+                index_path = (self.root / index_path).resolve()
+            self.offtarget.ensure_index(
+                index_path,
+                window_length=self.config.get("tiger", {}).get("guide_length", 23),
+            )
+        return reference_shards, guide_shards
 
-        return results_csv
+    def _resolve_library_path(self) -> Optional[Path]:
+        library_path = self.config.get("offtarget", {}).get("library_path")
+        if not library_path:
+            return None
+        library_path = Path(library_path)
+        if not library_path.is_absolute():
+            library_path = (self.root / library_path).resolve()
+        return library_path
+
+    def _resolve_reference_path(self) -> Path:
+        offtarget_cfg = self.config["offtarget"]
+        reference_path = Path(offtarget_cfg["reference_transcriptome"])
+        if not reference_path.is_absolute():
+            candidate = (self.root / reference_path).resolve()
+            if candidate.exists():
+                return candidate
+            reference_dir = Path(offtarget_cfg.get("reference_dir", "references"))
+            if not reference_dir.is_absolute():
+                reference_dir = (self.root / reference_dir).resolve()
+            return (reference_dir / reference_path.name).resolve()
+        return reference_path.resolve()
+
+    def _step_validate(self, final_output: Path) -> Path:
+        hits_csv = self.output_dir / "offtarget" / "hits.csv"
+        analysis_csv = self.output_dir / "mm0_location_analysis.csv"
+        validate_final_guides(
+            guides_csv=str(final_output),
+            transcriptome_file=str(self._resolve_reference_path()),
+            output_file=str(analysis_csv),
+            logger=self.logger,
+            hits_file=str(hits_csv) if hits_csv.exists() else None,
+        )
+        return analysis_csv
 
     def _step_filter(self, offtarget_output: Path) -> Optional[Path]:
         df = pd.read_csv(offtarget_output)